@@ -0,0 +1,499 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_aio.c
+//  Description    : This is the asynchronous interface of the LionCloud driver.
+//                   Requests are queued to a single driver thread, which runs
+//                   them one at a time against the filesystem and then calls
+//                   each request's completion. The driver thread owns every
+//                   device, file and cache line, and submitting threads pass
+//                   it requests over rings of their own. The request blocks
+//                   belong to the caller, so queueing never allocates. A request can
+//                   carry a deadline and cancellation token; one that expires
+//                   in the queue is completed without running, and one that
+//                   expires while running abandons its reads on the bus.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <lcloud_filesys.h>
+#include <lcloud_trace.h>
+#include <lcloud_lock.h>
+#include <lcloud_stats.h>
+
+// Defines
+#define LC_AIO_RING  256    // Requests a submitting thread can have waiting (a power of two)
+#define LC_AIO_RINGS 64     // Submitting threads with a ring of their own, others share the locked list
+#define LC_AIO_TAKE  16     // Most requests the driver takes from one ring before moving on
+#define LC_AIO_POLLS 64     // Times an idle driver yields, looking for requests, before it sleeps
+
+//
+// Single producer, single consumer request ring of one submitting thread.
+// Each side writes only its own cache line and keeps the last index it saw
+// of the other, so the line it reads only moves when it has run dry. The
+// driver counts requests into the queue profile from the tail it reads.
+typedef struct {
+    lcloud_aio         *slots[LC_AIO_RING];
+    uint64_t            head __attribute__((aligned(64)));  // Next slot the driver takes
+    uint64_t            seen_tail;                          // Tail as the driver last read it
+    uint64_t            counted;                            // Tail as the driver last counted it into the profile
+    uint64_t            tail __attribute__((aligned(64)));  // Next slot the submitter fills
+    uint64_t            seen_head;                          // Head as the submitter last read it
+    int                 owned;                              // 1 while a thread submits through it
+} lcloud_aio_ring;
+
+//
+// Global Variables
+lcloud_lock         aio_lock = LC_LOCK_INITIALIZER("aio queue");        // Protects the shared list and thread state
+pthread_cond_t      aio_work = PTHREAD_COND_INITIALIZER;                // Signals the driver thread of new requests
+pthread_cond_t      aio_idle = PTHREAD_COND_INITIALIZER;                // Signals lcdrain that the driver is idle
+lcloud_queue        aio_queue = LC_QUEUE_INITIALIZER("aio requests");   // Profiles the time requests wait
+lcloud_aio         *aio_head, *aio_tail;                                // Requests from threads without a ring, and completions
+lcloud_aio_ring     aio_rings[LC_AIO_RINGS];                            // Rings of the submitting threads
+int                 aio_nrings;                                         // Rings ever handed out, the driver looks at these
+int                 aio_next;                                           // Ring the driver looks at next (driver thread only)
+pthread_key_t       aio_ring_key;                                       // Hands a thread's ring back when it exits
+pthread_once_t      aio_ring_once = PTHREAD_ONCE_INIT;
+__thread lcloud_aio_ring *aio_ring;                                     // The calling thread's ring, NULL until its first request
+pthread_t           aio_thread;                                         // The driver thread
+int                 aio_running, aio_sleeping;                          // Thread started, and waiting for work
+uint64_t            aio_expired;                                        // Requests completed without running, their token expired
+__thread lcloud_cancel *aio_cancel;                                     // Token governing the calling thread's operations
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_aio_ring_release
+// Description  : Hand the ring of an exiting thread back for reuse; requests
+//                still in it are run as usual
+//
+// Inputs       : ring - the thread's ring
+// Outputs      : none
+
+void lcloud_aio_ring_release( void *ring ) {
+    __atomic_store_n(&((lcloud_aio_ring *)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_aio_ring_key
+// Description  : Create the key that releases rings at thread exit, once
+//
+// Inputs       : none
+// Outputs      : none
+
+void lcloud_aio_ring_key( void ) {
+    pthread_key_create(&aio_ring_key, lcloud_aio_ring_release);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_aio_ring_claim
+// Description  : Give the calling thread a ring of its own, reusing one an
+//                exited thread gave back
+//
+// Inputs       : none
+// Outputs      : the ring, NULL if every ring is owned
+
+lcloud_aio_ring *lcloud_aio_ring_claim( void ) {
+    int i, unowned;
+
+    pthread_once(&aio_ring_once, lcloud_aio_ring_key);
+    for ( i = 0; i < LC_AIO_RINGS; i++ ) {
+        unowned = 0;
+        if ( __atomic_compare_exchange_n(&aio_rings[i].owned, &unowned, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) ) {
+            if ( i >= __atomic_load_n(&aio_nrings, __ATOMIC_RELAXED) ) {
+                __atomic_store_n(&aio_nrings, i + 1, __ATOMIC_RELEASE);    // Rings are claimed lowest first, so this only grows
+            }
+            pthread_setspecific(aio_ring_key, &aio_rings[i]);
+            return( &aio_rings[i] );
+        }
+    }
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_aio_ring_push
+// Description  : Put a request in the calling thread's ring, waiting for the
+//                driver to make room if it is full
+//
+// Inputs       : ring - the thread's ring
+//                aio - the request
+// Outputs      : none
+
+void lcloud_aio_ring_push( lcloud_aio_ring *ring, lcloud_aio *aio ) {
+    uint64_t tail = ring->tail;
+
+    while ( tail - ring->seen_head == LC_AIO_RING ) {                       // Full as of the last look, look again
+        if ( tail - (ring->seen_head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) == LC_AIO_RING ) {
+            sched_yield();
+        }
+    }
+    ring->slots[tail & (LC_AIO_RING - 1)] = aio;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_aio_pending
+// Description  : Check for requests waiting in any ring or the shared list
+//                (driver thread only)
+//
+// Inputs       : none
+// Outputs      : 1 if there are some, 0 if not
+
+int lcloud_aio_pending( void ) {
+    lcloud_aio_ring *ring;
+    int i, n = __atomic_load_n(&aio_nrings, __ATOMIC_ACQUIRE);
+
+    if ( __atomic_load_n(&aio_head, __ATOMIC_ACQUIRE) != NULL ) {
+        return( 1 );
+    }
+    for ( i = 0; i < n; i++ ) {
+        ring = &aio_rings[i];
+        if ( (ring->head != ring->seen_tail) || (ring->head != (ring->seen_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))) ) {
+            return( 1 );
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_aio_take
+// Description  : Take the next request for the driver thread. The rings are
+//                visited in turn, a few requests from each, then the shared
+//                list; requests from one thread run in the order queued.
+//
+// Inputs       : none
+// Outputs      : the request, NULL if there are none
+
+lcloud_aio *lcloud_aio_take( void ) {
+    static int taken;                                                       // Requests taken from the ring at aio_next
+    lcloud_aio_ring *ring;
+    lcloud_aio *aio;
+    int i, n = __atomic_load_n(&aio_nrings, __ATOMIC_ACQUIRE);
+
+    for ( i = 0; i <= n + 1; i++, aio_next = (aio_next + 1) % (n + 1), taken = 0 ) {   // Round once, back to a ring cut short
+        if ( taken == LC_AIO_TAKE ) {
+            continue;
+        }
+        if ( aio_next == n ) {                                              // The shared list comes last in the round
+            if ( __atomic_load_n(&aio_head, __ATOMIC_ACQUIRE) == NULL ) {
+                continue;
+            }
+            LC_LOCK(&aio_lock);
+            if ( (aio = aio_head) != NULL ) {
+                __atomic_store_n(&aio_head, aio->next, __ATOMIC_RELEASE);
+                if ( aio_head == NULL ) {
+                    aio_tail = NULL;
+                }
+            }
+            lcloud_lock_release(&aio_lock);
+            if ( aio != NULL ) {
+                taken++;
+                return( aio );
+            }
+            continue;
+        }
+        ring = &aio_rings[aio_next];
+        if ( (ring->head == ring->seen_tail) && (ring->head == (ring->seen_tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))) ) {
+            continue;
+        }
+        if ( ring->counted != ring->seen_tail ) {                          // Count the requests queued since the last look
+            lcloud_queue_add(&aio_queue, ring->seen_tail - ring->counted);
+            ring->counted = ring->seen_tail;
+        }
+        aio = ring->slots[ring->head & (LC_AIO_RING - 1)];
+        __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+        taken++;
+        return( aio );
+    }
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_aio_execute
+// Description  : Run one request against the filesystem
+//
+// Inputs       : aio - the request
+// Outputs      : the return value of the filesystem call
+
+int lcloud_aio_execute( lcloud_aio *aio ) {
+    if ( (aio->opened != NULL) && (aio->op != LC_AIO_OPEN) ) {
+        aio->fh = aio->opened->result;                      // The open ran first, requests run in order
+    }
+    switch ( aio->op ) {
+    case LC_AIO_OPEN:
+        return( lcopen(aio->path, aio->flags) );
+    case LC_AIO_READ:
+        return( lcread(aio->fh, aio->buf, aio->len) );
+    case LC_AIO_WRITE:
+        return( lcwrite(aio->fh, aio->buf, aio->len) );
+    case LC_AIO_SEEK:
+        return( lcseek(aio->fh, aio->len) );
+    case LC_AIO_FLUSH:
+        return( lcflush(aio->fh) );
+    case LC_AIO_CLOSE:
+        return( lcclose(aio->fh) );
+    case LC_AIO_PROBE:
+        return( lcprobe() );
+    }
+    return( -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_aio_worker
+// Description  : The driver thread, runs the queued requests until lcdrain
+//                stops it. When there are none it cleans the log (in log
+//                mode) and evens out the devices a step at a time until
+//                there is nothing worth doing, and polls the rings for a
+//                while, then sleeps.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
+
+void *lcloud_aio_worker( void *arg ) {
+    static const char *span_names[] = { "aio open", "aio read", "aio write", "aio seek", "aio flush", "aio close", "aio probe" };
+    lcloud_aio *aio;
+    uint64_t start;
+    int idle = 1, polls = 0;
+
+    lcloud_trace_thread("lcloud driver");
+    while ( 1 ) {
+        if ( (aio = lcloud_aio_take()) != NULL ) {
+            lcloud_queue_leave(&aio_queue, aio->queued, __func__);
+            start = lcloud_trace_now();
+            if ( lcexpired(aio->cancel) ) {                 // Dropped, not worth the device time any more
+                aio->result = -1;
+                aio_expired++;
+                lcloud_trace_instant("aio expired", "aio", aio->op);
+            } else {
+                aio_cancel = aio->cancel;
+                aio->result = lcloud_aio_execute(aio);
+                aio_cancel = NULL;
+                lcloud_trace_span(span_names[aio->op], "aio", start, aio->fh);
+            }
+            aio->complete(aio);                             // May queue more requests, or reuse aio
+            idle = 1;
+            polls = 0;
+            continue;
+        }
+        if ( idle > 0 ) {                                   // Idle, clean the log a segment at a time, then rebalance
+            if ( (idle = lcclean(0)) == 0 ) {
+                idle = lcrebalance(0);
+            }
+            continue;
+        }
+        if ( polls++ < LC_AIO_POLLS ) {                     // Give way a while before sleeping, a wakeup costs the lock
+            sched_yield();
+            continue;
+        }
+
+        LC_LOCK(&aio_lock);                                 // Nothing to do, sleep unless a request slipped in
+        __atomic_store_n(&aio_sleeping, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);            // Pairs with the submitter's fence, one of us sees the other
+        if ( !lcloud_aio_pending() ) {
+            if ( !aio_running ) {
+                lcloud_lock_release(&aio_lock);
+                break;
+            }
+            pthread_cond_broadcast(&aio_idle);
+            lcloud_lock_wait(&aio_lock, &aio_work);
+        }
+        __atomic_store_n(&aio_sleeping, 0, __ATOMIC_RELAXED);
+        lcloud_lock_release(&aio_lock);
+    }
+
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsubmit
+// Description  : Queue an operation for the driver thread, starting the thread
+//                on first use. The completion runs on the driver thread once
+//                the result is set; the request must stay valid until then.
+//                A request on a file that is still being opened can name the
+//                open request in opened (which must stay valid too) instead
+//                of a handle, if the same thread queued the open.
+//
+//                Each submitting thread has a ring of its own to the driver,
+//                so threads queueing requests share no lock and no cache line
+//                (completions, and threads past LC_AIO_RINGS, share a locked
+//                list). Even the queue profile is left to the driver, which
+//                counts a ring's requests in from its tail. Requests run in
+//                the order each thread queued them.
+//
+// Inputs       : aio - the request to queue
+// Outputs      : 0 if successful, -1 if failure
+
+int lcsubmit( lcloud_aio *aio ) {
+    int driver;
+
+    if ( (aio == NULL) || (aio->complete == NULL) || (aio->op < LC_AIO_OPEN) || (aio->op > LC_AIO_PROBE) ) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure submitting bad asynchronous request");
+        return( -1 );
+    }
+
+    if ( !__atomic_load_n(&aio_running, __ATOMIC_ACQUIRE) ) {
+        LC_LOCK(&aio_lock);
+        if ( !aio_running ) {
+            if ( pthread_create(&aio_thread, NULL, lcloud_aio_worker, NULL) != 0 ) {
+                lcloud_lock_release(&aio_lock);
+                logMessage(LOG_ERROR_LEVEL, "LC failure starting the driver thread");
+                return( -1 );
+            }
+            __atomic_store_n(&aio_running, 1, __ATOMIC_RELEASE);
+        }
+        lcloud_lock_release(&aio_lock);
+    }
+
+    aio->next = NULL;
+    driver = pthread_equal(pthread_self(), aio_thread);
+    if ( (aio_ring != NULL) || (!driver && ((aio_ring = lcloud_aio_ring_claim()) != NULL)) ) {
+        aio->queued = lcloud_queue_stamp();                 // The driver counts it in when it sees the tail move
+        lcloud_aio_ring_push(aio_ring, aio);                // The driver never waits on its own ring
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if ( !__atomic_load_n(&aio_sleeping, __ATOMIC_RELAXED) ) {
+            return( 0 );
+        }
+        LC_LOCK(&aio_lock);
+    } else {
+        aio->queued = lcloud_queue_enter(&aio_queue);
+        LC_LOCK(&aio_lock);
+        if ( aio_tail == NULL ) {
+            __atomic_store_n(&aio_head, aio, __ATOMIC_RELEASE);
+        } else {
+            aio_tail->next = aio;
+        }
+        aio_tail = aio;
+    }
+    pthread_cond_signal(&aio_work);
+    lcloud_lock_release(&aio_lock);
+
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcdrain
+// Description  : Wait for every queued operation (and any it queues in turn)
+//                to complete, then stop the driver thread
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcdrain( void ) {
+    LC_LOCK(&aio_lock);
+    if ( !aio_running ) {
+        lcloud_lock_release(&aio_lock);
+        return( 0 );
+    }
+    if ( pthread_equal(pthread_self(), aio_thread) ) {      // A completion can not wait for itself
+        lcloud_lock_release(&aio_lock);
+        logMessage(LOG_ERROR_LEVEL, "LC failure draining from the driver thread");
+        return( -1 );
+    }
+    while ( !aio_sleeping ) {                               // Asleep only with every ring and the list empty
+        lcloud_lock_wait(&aio_lock, &aio_idle);
+    }
+    __atomic_store_n(&aio_running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&aio_work);
+    lcloud_lock_release(&aio_lock);
+
+    pthread_join(aio_thread, NULL);
+    if ( aio_expired > 0 ) {
+        logMessage(LOG_OUTPUT_LEVEL, "Asynchronous requests dropped unrun, past their deadline or cancelled [%lu]", (unsigned long)aio_expired);
+        aio_expired = 0;
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcdeadline
+// Description  : Arm a deadline and cancellation token
+//
+// Inputs       : token - the token
+//                usec - microseconds from now the operations must finish in,
+//                       0 for no deadline (they can still be cancelled)
+// Outputs      : none
+
+void lcdeadline( lcloud_cancel *token, uint64_t usec ) {
+    token->deadline = (usec > 0) ? lcloud_stats_clock() + usec * 1000 : 0;
+    __atomic_store_n(&token->cancelled, 0, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lccancel
+// Description  : Cancel the operations a token governs. Queued requests are
+//                dropped, and a running one gives up on its outstanding reads.
+//
+// Inputs       : token - the token
+// Outputs      : none
+
+void lccancel( lcloud_cancel *token ) {
+    __atomic_store_n(&token->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcexpired
+// Description  : Get whether the operations a token governs are abandoned
+//
+// Inputs       : token - the token, NULL for none
+// Outputs      : ECANCELED, ETIMEDOUT if the deadline has passed, 0 if neither
+
+int lcexpired( const lcloud_cancel *token ) {
+    if ( token == NULL ) {
+        return( 0 );
+    }
+    if ( __atomic_load_n(&token->cancelled, __ATOMIC_RELAXED) ) {
+        return( ECANCELED );
+    }
+    if ( (token->deadline != 0) && (lcloud_stats_clock() >= token->deadline) ) {
+        return( ETIMEDOUT );
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsetcancel
+// Description  : Govern the calling thread's following blocking calls by a
+//                token (the driver thread sets each request's own)
+//
+// Inputs       : token - the token, NULL for none
+// Outputs      : the token that governed the thread until now
+
+lcloud_cancel *lcsetcancel( lcloud_cancel *token ) {
+    lcloud_cancel *old = aio_cancel;
+
+    aio_cancel = token;
+    return( old );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcgetcancel
+// Description  : Get the token governing the calling thread's calls
+//
+// Inputs       : none
+// Outputs      : the token, NULL if none
+
+lcloud_cancel *lcgetcancel( void ) {
+    return( aio_cancel );
+}
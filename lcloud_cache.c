@@ -2,7 +2,15 @@
 //
 //  File           : lcloud_cache.c
 //  Description    : This is the cache implementation for the LionCloud
-//                   assignment for CMPSC311.
+//                   assignment for CMPSC311. Lines are replaced by
+//                   GreedyDual-Size-Frequency: a line's priority is the cache's
+//                   inflation value when it was last used plus its use count
+//                   times the measured cost of refetching it from its device,
+//                   the lowest priority line goes first, and the inflation
+//                   value rises to each victim's priority so idle lines age out.
+//                   Lines are found through a chained hash index, on the
+//                   address of the device block they hold, or for a delayed
+//                   block (not yet given an address) on its file and cluster.
 //
 //   Author        : Jonathan Martin
 //   Last Modified : 17 Apr 2020 7:03 PM EDT
@@ -13,16 +21,31 @@
 #include <string.h>
 #include <stdlib.h>
 #include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
 #include <lcloud_cache.h>
+#include <lcloud_trace.h>
+#include <lcloud_mem.h>
+#include <lcloud_stats.h>
+
+// Defines
+#define LC_CACHE_COST_DEFAULT   100000.0                // Refetch cost of a device not measured yet (ns)
+#define LC_CACHE_COST_SHIFT     3                       // Weight of a new cost sample, 1/8
+#define LC_CACHE_NODEV          ((LcDeviceId)-1)        // Device id of a line with no device address
 
 //
 // Cache structure
 typedef struct{
-    char            buffer[256];                        // A buffer for the stored block's data
+    char           *buffer;                             // A buffer for the stored cluster's data, line_size bytes, NULL until needed
     int             entry_time;                         // The time the cache was entered into the block
+    double          priority;                           // Replacement priority (GDSF), -1 for an empty line
+    int             freq;                               // Uses since the block came into the cache
     LcDeviceId      dev_id;                             // Device id of the stored block
     uint16_t        sec;                                // Sector id of the stored block
     uint16_t        blk;                                // Block id of the stored block
+    int             dirty;                              // 1 if the buffer holds data not yet written to a device
+    LcFHandle       fh;                                 // Owning file of an unallocated (delayed) block, -1 otherwise
+    int             fblk;                               // Block index within the owning file of a delayed block
+    int             next;                               // Next line in the same index bucket, -1 at the end
 }lcloud_cache;
 
 //
@@ -30,11 +53,240 @@ typedef struct{
 lcloud_cache*       LRU_cache;                          // A pointer to the cache array
 int                 hits, misses, cache_time;           // Talleys of hits, misses, and the cache_time
 int                 cache_lines;                        // Number of lines in the cache
+int                 line_size;                          // Bytes held by each line, one cluster
+int                 cache_shrunk;                       // Line buffers given back under memory pressure
+double              cache_inflation;                    // GDSF inflation value, the priority of the last victim
+double              device_cost[LC_STATS_DEVICES];      // Moving average of each device's refetch time (ns), 0 if not measured
+double              miss_time;                          // Total refetch time of misses (ns)
+int                *cache_index;                        // Hash index, the first line of each bucket or -1
+int                 cache_index_bits;                   // The index has 2^bits buckets, at least two per line
 
 
 //
 // Functions
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_usecache
+// Description  : Record a use of a line and reprice it, GDSF style. A delayed
+//                block is priced as the dearest device, since losing it means
+//                flushing its whole file.
+//
+// Inputs       : line - the line used
+//                fresh - 1 if a new block just came into the line
+// Outputs      : none
+
+void lcloud_usecache( int line, int fresh ) {
+    double cost = LC_CACHE_COST_DEFAULT;
+    int i;
+
+    if (LRU_cache[line].fh != -1) {
+        for(i = 0; i < LC_STATS_DEVICES; i++) {
+            cost = CMPSC311_MAXVAL(cost, device_cost[i]);
+        }
+    } else if ( (LRU_cache[line].dev_id >= 0) && (LRU_cache[line].dev_id < LC_STATS_DEVICES) &&
+                (device_cost[LRU_cache[line].dev_id] > 0) ) {
+        cost = device_cost[LRU_cache[line].dev_id];
+    }
+
+    LRU_cache[line].freq = (fresh) ? 1 : LRU_cache[line].freq + 1;
+    LRU_cache[line].priority = cache_inflation + LRU_cache[line].freq * cost;
+    LRU_cache[line].entry_time = cache_time;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_emptycache
+// Description  : Mark a line as holding no block, the first choice to reuse
+//
+// Inputs       : line - the line
+// Outputs      : none
+
+void lcloud_emptycache( int line ) {
+    LRU_cache[line].entry_time = -1;
+    LRU_cache[line].priority = -1;
+    LRU_cache[line].freq = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_hashcache
+// Description  : Find the index bucket of a device block address
+//
+// Inputs       : did, sec, blk - the block's address
+// Outputs      : the bucket
+
+unsigned int lcloud_hashcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    uint32_t key = ((uint32_t)did << 28) ^ ((uint32_t)sec << 14) ^ blk;
+
+    return( (uint32_t)(key * 2654435761U) >> (32 - cache_index_bits) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_hashdelayed
+// Description  : Find the index bucket of a delayed block, by its file and
+//                cluster; the top bit keeps these keys apart from device ones
+//
+// Inputs       : fh - file handle owning the block
+//                fblk - block index within the file
+// Outputs      : the bucket
+
+unsigned int lcloud_hashdelayed( LcFHandle fh, int fblk ) {
+    uint32_t key = 0x80000000U ^ ((uint32_t)fh << 20) ^ (uint32_t)fblk;
+
+    return( (uint32_t)(key * 2654435761U) >> (32 - cache_index_bits) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_linkcache
+// Description  : Link a line into the index, or out of it, by its current key:
+//                its device address, or the file and cluster of a delayed
+//                block. A line with neither is not indexed.
+//
+// Inputs       : line - the line
+//                in - 1 to link it in, 0 to unlink it
+// Outputs      : none
+
+void lcloud_linkcache( int line, int in ) {
+    int *link;
+
+    if (LRU_cache[line].dev_id != LC_CACHE_NODEV) {
+        link = &cache_index[lcloud_hashcache(LRU_cache[line].dev_id, LRU_cache[line].sec, LRU_cache[line].blk)];
+    } else if (LRU_cache[line].fh != -1) {
+        link = &cache_index[lcloud_hashdelayed(LRU_cache[line].fh, LRU_cache[line].fblk)];
+    } else {
+        return;
+    }
+
+    if (in) {
+        LRU_cache[line].next = *link;
+        *link = line;
+        return;
+    }
+    while (*link != line) {                             // Unlink from the bucket
+        link = &LRU_cache[*link].next;
+    }
+    *link = LRU_cache[line].next;
+    LRU_cache[line].next = -1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_keycache
+// Description  : Give a line a new device address, moving it in the index. A
+//                line that held a delayed block no longer does. A device id
+//                of -1 leaves the line unindexed (empty).
+//
+// Inputs       : line - the line
+//                did, sec, blk - its new address, did -1 for none
+// Outputs      : none
+
+void lcloud_keycache( int line, LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    lcloud_linkcache(line, 0);
+    LRU_cache[line].dev_id = did;
+    LRU_cache[line].sec = sec;
+    LRU_cache[line].blk = blk;
+    LRU_cache[line].fh = -1;
+    LRU_cache[line].fblk = -1;
+    lcloud_linkcache(line, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_keydelayed
+// Description  : Make a line hold a delayed block, with no device address,
+//                moving it in the index to the block's file and cluster
+//
+// Inputs       : line - the line
+//                fh - file handle owning the block
+//                fblk - block index within the file
+// Outputs      : none
+
+void lcloud_keydelayed( int line, LcFHandle fh, int fblk ) {
+    lcloud_linkcache(line, 0);
+    LRU_cache[line].dev_id = LC_CACHE_NODEV;
+    LRU_cache[line].sec = -1;
+    LRU_cache[line].blk = -1;
+    LRU_cache[line].fh = fh;
+    LRU_cache[line].fblk = fblk;
+    lcloud_linkcache(line, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_findcache
+// Description  : Look a device block up in the index
+//
+// Inputs       : did, sec, blk - the block's address
+//                line - the first line of its bucket
+// Outputs      : the line holding the block, -1 if not cached
+
+int lcloud_findcache( LcDeviceId did, uint16_t sec, uint16_t blk, int line ) {
+    while ( (line != -1) &&
+            ((LRU_cache[line].dev_id != did) || (LRU_cache[line].sec != sec) || (LRU_cache[line].blk != blk)) ) {
+        line = LRU_cache[line].next;
+    }
+    return( line );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_finddelayed
+// Description  : Look a delayed block up in the index
+//
+// Inputs       : fh - file handle owning the block
+//                fblk - block index within the file
+// Outputs      : the line holding the block, -1 if not cached
+
+int lcloud_finddelayed( LcFHandle fh, int fblk ) {
+    int line = cache_index[lcloud_hashdelayed(fh, fblk)];
+
+    while ( (line != -1) && ((LRU_cache[line].fh != fh) || (LRU_cache[line].fblk != fblk)) ) {
+        line = LRU_cache[line].next;
+    }
+    return( line );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_beforecache
+// Description  : Order lines for replacement, lowest priority first and the
+//                least recently used among equals
+//
+// Inputs       : a, b - the lines to compare
+// Outputs      : 1 if line a goes before line b, 0 otherwise
+
+int lcloud_beforecache( int a, int b ) {
+    if (LRU_cache[a].priority != LRU_cache[b].priority) {
+        return( LRU_cache[a].priority < LRU_cache[b].priority );
+    }
+    return( LRU_cache[a].entry_time < LRU_cache[b].entry_time );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_costcache
+// Description  : Record how long a missed block took to fetch from its device,
+//                which prices that device's lines from then on
+//
+// Inputs       : did - the device the block came from
+//                ns - the fetch time in nanoseconds
+// Outputs      : none
+
+void lcloud_costcache( LcDeviceId did, uint64_t ns ) {
+    if ( (did < 0) || (did >= LC_STATS_DEVICES) ) {
+        return;
+    }
+    if (device_cost[did] == 0) {
+        device_cost[did] = ns;
+    } else {
+        device_cost[did] += ((double)ns - device_cost[did]) / (1 << LC_CACHE_COST_SHIFT);
+    }
+    miss_time += ns;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : lcloud_getcache
@@ -46,23 +298,198 @@ int                 cache_lines;                        // Number of lines in th
 // Outputs      : cache block if found (pointer), NULL if not or failure
 
 char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
-    int i;
+    lcloud_cachekey key = { did, sec, blk };
+    char *block;
+    int missed;
+
+    lcloud_getcache_multi(1, &key, &block, &missed);
+    return( block );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_getcache_multi
+// Description  : Search the cache for many blocks at once. The keys go in
+//                groups: every key of a group is hashed and its bucket
+//                prefetched, then the bucket heads are read and their lines
+//                prefetched, and only then are the chains walked, so the
+//                index's cache misses overlap instead of being taken one
+//                after another. Each key counts as a hit or miss as if it had
+//                been looked up alone. The hit buffers are only good until
+//                the next call that puts a block in the cache.
+//
+// Inputs       : n - number of blocks
+//                keys - device address of each block
+//                blocks - set to each block's cache buffer, NULL if missed
+//                missed - set to the index (in keys) of each block missed
+// Outputs      : number of blocks missed
+
+int lcloud_getcache_multi( int n, lcloud_cachekey *keys, char **blocks, int *missed ) {
+    unsigned int bucket[LC_CACHE_MULTI];
+    int head[LC_CACHE_MULTI];
+    int base, count, i, line, nmissed = 0;
+
+    for(base = 0; base < n; base += count) {
+        count = CMPSC311_MINVAL(n - base, LC_CACHE_MULTI);
+        for(i = 0; i < count; i++) {                    // Hash the group, fetching the buckets
+            bucket[i] = lcloud_hashcache(keys[base + i].dev_id, keys[base + i].sec, keys[base + i].blk);
+            __builtin_prefetch(&cache_index[bucket[i]], 0, 3);
+        }
+        for(i = 0; i < count; i++) {                    // Read the bucket heads, fetching their lines
+            if ( (head[i] = cache_index[bucket[i]]) != -1 ) {
+                __builtin_prefetch(&LRU_cache[head[i]], 0, 3);
+            }
+        }
+        for(i = 0; i < count; i++) {                    // Resolve each key
+            cache_time++;                               // Increment cache time
+            line = lcloud_findcache(keys[base + i].dev_id, keys[base + i].sec, keys[base + i].blk, head[i]);
+            if (line == -1) {
+                misses++;                               // Block wasn't retrieved, increment misses
+                LC_STAT_ADD(cache_misses, 1);
+                lcloud_trace_instant("cache miss", "cache", keys[base + i].dev_id);
+                blocks[base + i] = NULL;
+                missed[nmissed++] = base + i;
+                continue;
+            }
+            hits++;                                     // Increment hits
+            LC_STAT_ADD(cache_hits, 1);
+            lcloud_usecache(line, 0);                   // Update the line's time and priority
+            lcloud_trace_instant("cache hit", "cache", keys[base + i].dev_id);
+            blocks[base + i] = LRU_cache[line].buffer;
+            __builtin_prefetch(blocks[base + i], 0, 0); // The caller copies it out next
+        }
+    }
+
+    return( nmissed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_victimcache
+// Description  : Pick the lowest priority line for replacement, and raise the
+//                inflation value to its priority so the lines left age
+//                against the ones to come. A line holding a delayed block
+//                cannot simply be dropped, so the owning file is flushed
+//                first (which allocates and writes all of its delayed blocks
+//                at once).
+//
+// Inputs       : buffered - 1 to only consider lines holding a buffer
+// Outputs      : index of the line to reuse, -1 if failure
+
+int lcloud_victimcache( int buffered ) {
+    int i, victim = -1;
+
+    for(i = 0; i < cache_lines; i++) {                  // Find the lowest priority line
+        if ( (!buffered || (LRU_cache[i].buffer != NULL)) && ((victim == -1) || lcloud_beforecache(i, victim)) ) {
+            victim = i;
+        }
+    }
+    if (victim == -1) {
+        return( -1 );
+    }
+    if (LRU_cache[victim].priority > cache_inflation) { // Age every other line by the victim's worth
+        cache_inflation = LRU_cache[victim].priority;
+    }
+
+    if (LRU_cache[victim].fh != -1) {                   // Delayed block, place the file's dirty range first
+        lcloud_trace_instant("evict delayed", "cache", LRU_cache[victim].fh);
+        if (lcflush(LRU_cache[victim].fh) == -1) {
+            logMessage(LOG_ERROR_LEVEL, "Cache failure flushing file [%d] for eviction", LRU_cache[victim].fh);
+            return( -1 );
+        }
+    }
 
-    cache_time++;                                   // Increment cache time 
+    return( victim );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_claimcache
+// Description  : Pick a line for a new block and make sure it has a buffer.
+//                Buffers are allocated on first use from the memory budget;
+//                when the budget is spent the buffer of the lowest priority
+//                line that has one is taken over instead.
+//
+// Inputs       : none
+// Outputs      : index of the line to use, -1 if failure
 
-                                                    
-    for(i = 0; i < cache_lines; i++) {              // Loop through the cache linearly
-                                                    // If the block identifiers are equal, the block is in cache
-        if (LRU_cache[i].dev_id == did && LRU_cache[i].sec == sec && LRU_cache[i].blk == blk) {
-            hits++;                                 // Increment hits
-            LRU_cache[i].entry_time = cache_time;   // Update the cache's time
-            return( LRU_cache[i].buffer );
+int lcloud_claimcache( void ) {
+    int line, spare;
+
+    if ( (line = lcloud_victimcache(0)) == -1 ) {
+        return( -1 );
+    }
+    if (LRU_cache[line].buffer != NULL) {
+        return( line );
+    }
+
+    if (lcloud_mem_reserve(LC_MEM_CACHE, line_size) == 0) {
+        if ( (LRU_cache[line].buffer = (char *)malloc(line_size)) != NULL ) {
+            return( line );
         }
+        lcloud_mem_release(LC_MEM_CACHE, line_size);
     }
-    misses++;                                       // Block wasn't retrieved, increment misses return null
 
-    /* Return not found */
-    return( NULL );
+    if ( (spare = lcloud_victimcache(1)) == -1 ) {      // No line has a buffer yet, the cache needs one to work at all
+        lcloud_mem_charge(LC_MEM_CACHE, line_size);
+        if ( (LRU_cache[line].buffer = (char *)malloc(line_size)) == NULL ) {
+            lcloud_mem_release(LC_MEM_CACHE, line_size);
+            logMessage(LOG_ERROR_LEVEL, "Cache failure allocating line of [%d] bytes", line_size);
+            return( -1 );
+        }
+        return( line );
+    }
+    LRU_cache[line].buffer = LRU_cache[spare].buffer;   // Take over the buffer, the spare line is now empty
+    LRU_cache[spare].buffer = NULL;
+    lcloud_emptycache(spare);
+    lcloud_keycache(spare, -1, -1, -1);
+    return( line );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_shrinkcache
+// Description  : Memory reclaimer, frees the buffers of clean lines, lowest
+//                priority first. Delayed blocks only live in the cache, so
+//                when only they are left the lowest priority one's file is
+//                flushed, which leaves its lines clean.
+//
+// Inputs       : want - bytes wanted
+// Outputs      : bytes freed
+
+size_t lcloud_shrinkcache( size_t want ) {
+    int i, victim, delayed;
+    size_t freed = 0;
+
+    while (freed < want) {
+        for(i = 0, victim = -1, delayed = -1; i < cache_lines; i++) {
+            if (LRU_cache[i].buffer == NULL) {
+                continue;
+            }
+            if ( (LRU_cache[i].fh == -1) && ((victim == -1) || lcloud_beforecache(i, victim)) ) {
+                victim = i;
+            }
+            if ( (LRU_cache[i].fh != -1) && ((delayed == -1) || lcloud_beforecache(i, delayed)) ) {
+                delayed = i;
+            }
+        }
+        if (victim == -1) {
+            if ( (delayed == -1) || (lcflush(LRU_cache[delayed].fh) == -1) || (LRU_cache[delayed].fh != -1) ) {
+                break;                                  // Nothing left to give back (a block being written is not placed yet)
+            }
+            lcloud_trace_instant("flush for memory", "cache", LRU_cache[delayed].fh);
+            continue;
+        }
+        free(LRU_cache[victim].buffer);
+        lcloud_mem_release(LC_MEM_CACHE, line_size);
+        LRU_cache[victim].buffer = NULL;
+        lcloud_emptycache(victim);
+        lcloud_keycache(victim, -1, -1, -1);
+        freed += line_size;
+        cache_shrunk++;
+    }
+
+    return( freed );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -76,30 +503,218 @@ char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
 // Outputs      : 0 if succesfully inserted, -1 if failure
 
 int lcloud_putcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
-    int i, least_time = cache_time, least_recent;
-    lcloud_cache cache;
+    lcloud_cachekey key = { did, sec, blk };
+
+    return( lcloud_putcache_multi(1, &key, &block) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_putcache_multi
+// Description  : Put many values in the cache, updating blocks already cached
+//                in place. Buckets are prefetched a group ahead, as for
+//                lcloud_getcache_multi.
+//
+// Inputs       : n - number of blocks
+//                keys - device address of each block
+//                blocks - the line_size bytes of each block's data
+// Outputs      : 0 if succesfully inserted, -1 if failure
+
+int lcloud_putcache_multi( int n, lcloud_cachekey *keys, char **blocks ) {
+    unsigned int bucket[LC_CACHE_MULTI];
+    int base, count, i, line;
+
+    for(base = 0; base < n; base += count) {
+        count = CMPSC311_MINVAL(n - base, LC_CACHE_MULTI);
+        for(i = 0; i < count; i++) {
+            bucket[i] = lcloud_hashcache(keys[base + i].dev_id, keys[base + i].sec, keys[base + i].blk);
+            __builtin_prefetch(&cache_index[bucket[i]], 0, 3);
+        }
+        for(i = 0; i < count; i++) {
+            cache_time++;                               // Increment the running time
+                                                        // A claim can flush and re-key lines, so the bucket is read now
+            line = lcloud_findcache(keys[base + i].dev_id, keys[base + i].sec, keys[base + i].blk, cache_index[bucket[i]]);
+            if (line != -1) {
+                lcloud_usecache(line, 0);               // Update the block, it is already in the cache
+            } else {
+                if ( (line = lcloud_claimcache()) == -1 ) {
+                    return( -1 );                       // Could not free a line for the block
+                }
+                lcloud_keycache(line, keys[base + i].dev_id, keys[base + i].sec, keys[base + i].blk);
+                lcloud_usecache(line, 1);               // The cache entry gets current cache time and a priority
+            }
+            LRU_cache[line].dirty = 0;                  // Block was written through, so the line is clean
+            memcpy(LRU_cache[line].buffer, blocks[base + i], line_size);
+        }
+    }
+
+    /* Return successfully */
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_peekcache
+// Description  : Look for a block without updating its use count, priority or
+//                statistics, used by uncached (direct) transfers so they do
+//                not keep a line in the cache that only they touched
+//
+// Inputs       : did - device number of block to find
+//                sec - sector number of block to find
+//                blk - block number of block to find
+// Outputs      : cache block if found (pointer), NULL if not or failure
+
+char * lcloud_peekcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    int line = lcloud_findcache(did, sec, blk, cache_index[lcloud_hashcache(did, sec, blk)]);
+
+    return( (line == -1) ? NULL : LRU_cache[line].buffer );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_invalidcache
+// Description  : Drop a block from the cache (if present), used when the device
+//                copy is written around the cache
+//
+// Inputs       : did - device number of block to drop
+//                sec - sector number of block to drop
+//                blk - block number of block to drop
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_invalidcache( LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    int line = lcloud_findcache(did, sec, blk, cache_index[lcloud_hashcache(did, sec, blk)]);
+
+    if (line != -1) {
+        lcloud_emptycache(line);                        // Line becomes the first choice for replacement
+        lcloud_keycache(line, -1, -1, -1);
+        LRU_cache[line].dirty = 0;
+    }
+
+    /* Return successfully */
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_getdelayed
+// Description  : Search the cache for an unallocated (delayed) block of a file
+//
+// Inputs       : fh - file handle owning the block
+//                fblk - block index within the file
+// Outputs      : cache block if found (pointer), NULL if not or failure
+
+char * lcloud_getdelayed( LcFHandle fh, int fblk ) {
+    int line;
+
+    cache_time++;                                       // Increment cache time
+
+    if ( (line = lcloud_finddelayed(fh, fblk)) == -1 ) {
+        return( NULL );                                 // Block has never been written
+    }
+    hits++;                                             // Delayed blocks are always resident, so only hits count
+    lcloud_usecache(line, 0);
+    return( LRU_cache[line].buffer );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_putdelayed
+// Description  : Put an unallocated dirty block of a file in the cache. The 
+//                block has no device address until the file is flushed.
+//
+// Inputs       : fh - file handle owning the block
+//                fblk - block index within the file
+//                block - the line_size bytes of block data
+// Outputs      : 0 if succesfully inserted, -1 if failure
+
+int lcloud_putdelayed( LcFHandle fh, int fblk, char *block ) {
+    int line, fresh = 0;
 
     cache_time++;                                       // Increment the running time
 
-    for(i = 0; i < cache_lines; i++) {                  // Loop through cache linearly
-        cache = LRU_cache[i];                           // Assign the current cache
-                                                        // If the block identifier matches, we update that block
-        if (cache.dev_id == did && cache.sec == sec && cache.blk == blk) {
-            least_recent = i;                           // We update this block as its already in the cache
-            break;                                      // Break out of the for loop to update the block
-        } else if (cache.entry_time < least_time) {
-            least_time = cache.entry_time;
-            least_recent = i;
+    if ( (line = lcloud_finddelayed(fh, fblk)) == -1 ) {   // Update in place if the block is already buffered
+        if ( (line = lcloud_claimcache()) == -1 ) {
+            return( -1 );                               // Could not free a line for the block
         }
+        lcloud_keydelayed(line, fh, fblk);              // No device address until the block is placed
+        LC_STAT_ADD(dirty, 1);
+        fresh = 1;
+    }
+
+    LRU_cache[line].dirty = 1;                          // Data only lives in the cache
+    lcloud_usecache(line, fresh);
+
+    memcpy(LRU_cache[line].buffer, block, line_size);
+
+    /* Return successfully */
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_peekdelayed
+// Description  : Look for a delayed block without updating its priority or
+//                statistics, used by a flush to write the buffer out. The line
+//                stays delayed until lcloud_placedelayed, after the write.
+//
+// Inputs       : fh - file handle owning the block
+//                fblk - block index within the file
+// Outputs      : the block's buffer (pointer), NULL if not found
+
+char * lcloud_peekdelayed( LcFHandle fh, int fblk ) {
+    int line;
+
+    if ( (line = lcloud_finddelayed(fh, fblk)) == -1 ) {
+        logMessage(LOG_ERROR_LEVEL, "Cache failure finding delayed block [%d:%d], not resident", fh, fblk);
+        return( NULL );
+    }
+    return( LRU_cache[line].buffer );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_placedelayed
+// Description  : Bind a delayed block to its allocated device address, once
+//                its buffer is on the device. The line is then a regular
+//                (clean) cache entry.
+//
+// Inputs       : fh - file handle owning the block
+//                fblk - block index within the file
+//                did, sec, blk - the allocated device address
+// Outputs      : 0 if successful, -1 if not found
+
+int lcloud_placedelayed( LcFHandle fh, int fblk, LcDeviceId did, uint16_t sec, uint16_t blk ) {
+    int line;
+
+    if ( (line = lcloud_finddelayed(fh, fblk)) == -1 ) {
+        logMessage(LOG_ERROR_LEVEL, "Cache failure placing delayed block [%d:%d], not resident", fh, fblk);
+        return( -1 );
     }
-    cache.entry_time = cache_time;                      // The cache entry gets current cache time
-    cache.dev_id = did;                                 // Cache entry gets the parameter device id
-    cache.sec = sec;                                    // Cache entry gets the parameter device id
-    cache.blk = blk;                                    // Cache entry gets the parameter device id
+    lcloud_keycache(line, did, sec, blk);               // Re-key the line by its device address
+    LRU_cache[line].dirty = 0;
+    LC_STAT_ADD(dirty, -1);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_dropdelayed
+// Description  : Discard a delayed block whose data was written to the device 
+//                some other way (e.g. a direct write of the whole block)
+//
+// Inputs       : fh - file handle owning the block
+//                fblk - block index within the file
+// Outputs      : 0 if successful, -1 if failure
 
-    strncpy(cache.buffer, block, 256);                  // Copy the input block's 256 bytes to the cache buffer
+int lcloud_dropdelayed( LcFHandle fh, int fblk ) {
+    int line;
 
-    LRU_cache[least_recent] = cache;                    // Input the cache entry to the cache array
+    if ( (line = lcloud_finddelayed(fh, fblk)) != -1 ) {
+        lcloud_emptycache(line);                        // Line becomes the first choice for replacement
+        lcloud_keycache(line, -1, -1, -1);
+        LRU_cache[line].dirty = 0;
+        LC_STAT_ADD(dirty, -1);
+    }
 
     /* Return successfully */
     return( 0 );
@@ -110,22 +725,42 @@ int lcloud_putcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block ) {
 // Function     : lcloud_initcache
 // Description  : Initialze the cache by setting up metadata a cache elements.
 //
-// Inputs       : maxblocks - the max number number of blocks 
+// Inputs       : maxblocks - the max number number of lines
+//                linesize - bytes held by each line (the cluster size)
 // Outputs      : 0 if successful, -1 if failure
 
-int lcloud_initcache( int maxblocks ) {
+int lcloud_initcache( int maxblocks, int linesize ) {
     int i;
     cache_lines = maxblocks;                // Set the global cache_lines value
+    line_size = linesize;
+    for(cache_index_bits = 1; (1 << cache_index_bits) < 2 * cache_lines; cache_index_bits++);
 
-                                            // Dynamically allocate the cache array
-    LRU_cache = (lcloud_cache *)malloc(sizeof(lcloud_cache) * cache_lines);
+                                            // Dynamically allocate the cache array, buffers come on first use
+    if ( (lcloud_mem_reserve(LC_MEM_CACHE, sizeof(lcloud_cache) * cache_lines) == -1) ||
+         ((LRU_cache = (lcloud_cache *)malloc(sizeof(lcloud_cache) * cache_lines)) == NULL) ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure allocating cache of [%d] lines", cache_lines);
+        return( -1 );
+    }
+    if ( (lcloud_mem_reserve(LC_MEM_CACHE, sizeof(int) << cache_index_bits) == -1) ||
+         ((cache_index = (int *)malloc(sizeof(int) << cache_index_bits)) == NULL) ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure allocating cache index of [%d] buckets", 1 << cache_index_bits);
+        return( -1 );
+    }
+    for(i = 0; i < (1 << cache_index_bits); i++) {
+        cache_index[i] = -1;
+    }
     for(i = 0; i < cache_lines; i++) {      // Loop through the allocated array
-        LRU_cache[i].entry_time = -1;       // Set cache values to default values
+        lcloud_emptycache(i);               // Set cache values to default values
         LRU_cache[i].dev_id = -1;
         LRU_cache[i].sec = -1;
         LRU_cache[i].blk = -1;
-       memset(LRU_cache[i].buffer, 0, 256);
+        LRU_cache[i].dirty = 0;
+        LRU_cache[i].fh = -1;
+        LRU_cache[i].fblk = -1;
+        LRU_cache[i].next = -1;
+        LRU_cache[i].buffer = NULL;
     }
+    lcloud_mem_reclaimer(lcloud_shrinkcache);   // First to give memory back under pressure
 
     /* Return successfully */
     return( 0 );
@@ -140,11 +775,23 @@ int lcloud_initcache( int maxblocks ) {
 // Outputs      : 0 if successful, -1 if failure
 
 int lcloud_closecache( void ) {
+    int i;
 
+    for(i = 0; i < cache_lines; i++) {
+        if (LRU_cache[i].buffer != NULL) {
+            free(LRU_cache[i].buffer);
+            lcloud_mem_release(LC_MEM_CACHE, line_size);
+        }
+    }
     free(LRU_cache);                // Free the cache array from memory, called during shutdown
+    lcloud_mem_release(LC_MEM_CACHE, sizeof(lcloud_cache) * cache_lines);
+    free(cache_index);
+    lcloud_mem_release(LC_MEM_CACHE, sizeof(int) << cache_index_bits);
 
     logMessage(LOG_OUTPUT_LEVEL, "Successfully de-allocated cache");
     logMessage(LOG_OUTPUT_LEVEL, "Hits: [%d] Misses[%d] Ratio: [%.2f]", hits, misses, ((float)hits / (hits + misses)));
+    logMessage(LOG_OUTPUT_LEVEL, "Cache lines shrunk under memory pressure: [%d]", cache_shrunk);
+    logMessage(LOG_OUTPUT_LEVEL, "Cache miss time: [%.1f] ms", miss_time / 1000000);
 
 
     /* Return successfully */
@@ -14,9 +14,20 @@
 // Includes 
 #include <stdint.h>
 #include <lcloud_controller.h>
+#include <lcloud_filesys.h>
 
 // Defines 
 #define LC_CACHE_MAXBLOCKS 64
+#define LC_CACHE_MINLINES 4
+#define LC_CACHE_MULTI 64                           // Keys hashed and prefetched ahead of one resolving pass
+
+//
+// Device address of a cached block, for the multi-key calls
+typedef struct {
+    LcDeviceId  dev_id;
+    uint16_t    sec;
+    uint16_t    blk;
+} lcloud_cachekey;
 
 //
 // Functional Prototypes
@@ -27,7 +38,37 @@ char * lcloud_getcache( LcDeviceId did, uint16_t sec, uint16_t blk );
 int lcloud_putcache( LcDeviceId did, uint16_t sec, uint16_t blk, char *block );
     // Put a value in the cache 
 
-int lcloud_initcache( int maxblocks );
+int lcloud_getcache_multi( int n, lcloud_cachekey *keys, char **blocks, int *missed );
+    // Search the cache for many blocks at once, returning the number missed
+
+int lcloud_putcache_multi( int n, lcloud_cachekey *keys, char **blocks );
+    // Put many values in the cache
+
+char * lcloud_peekcache( LcDeviceId did, uint16_t sec, uint16_t blk );
+    // Look for a block without updating its priority or statistics
+
+int lcloud_invalidcache( LcDeviceId did, uint16_t sec, uint16_t blk );
+    // Drop a block from the cache (if present)
+
+void lcloud_costcache( LcDeviceId did, uint64_t ns );
+    // Record the time a missed block took to fetch, to price the device's lines
+
+char * lcloud_getdelayed( LcFHandle fh, int fblk );
+    // Search the cache for an unallocated (delayed) block of a file
+
+int lcloud_putdelayed( LcFHandle fh, int fblk, char *block );
+    // Put an unallocated dirty block of a file in the cache
+
+char * lcloud_peekdelayed( LcFHandle fh, int fblk );
+    // Look for a delayed block without updating its priority or statistics
+
+int lcloud_placedelayed( LcFHandle fh, int fblk, LcDeviceId did, uint16_t sec, uint16_t blk );
+    // Bind a delayed block to its allocated device address, once it is written
+
+int lcloud_dropdelayed( LcFHandle fh, int fblk );
+    // Discard a delayed block whose data was written elsewhere
+
+int lcloud_initcache( int maxblocks, int linesize );
     // Initialze the cache by setting up metadata a cache elements.
 
 int lcloud_closecache( void );
@@ -0,0 +1,426 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_check.c
+//  Description    : This is the check of the LionCloud driver's file paths that
+//                   the workloads do not reach. Against a running server it
+//                   drives the filesystem interface directly, and checks the
+//                   data, sizes and offsets that come back. The bus is reached
+//                   through a wrapper (linked with --wrap), so a check can
+//                   fail a batch on demand and see what was sent.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+#include <lcloud_support.h>
+#include <lcloud_controller.h>
+#include <lcloud_network.h>
+#include <lcloud_filesys.h>
+#include <lcloud_stats.h>
+
+// Defines
+#define LCLOUD_CHECK_ARGUMENTS "hvl:"
+#define USAGE                                                                   \
+    "USAGE: lcloud_check [-h] [-v] [-l <logfile>]\n"                            \
+    "\n"                                                                        \
+    "where:\n"                                                                  \
+    "    -h - help mode (display this message)\n"                               \
+    "    -v - verbose output\n"                                                 \
+    "    -l - write log messages to the filename <logfile>\n"                   \
+    "\n"                                                                        \
+    "    The LionCloud server must be running on the default port.\n"           \
+    "\n"
+#define LC_CHECK_CLUSTERS   40      // Delayed clusters flushed, fewer than the cache holds
+#define LC_CHECK_BYTES      (LC_CHECK_CLUSTERS * LC_DEVICE_BLOCK_SIZE - 100)   // Ends in a partial cluster
+#define LC_CHECK_WRITE      100     // Bytes per write, so every cluster is delayed
+#define LC_CHECK_OBJECTS    3       // Objects put and got at once
+#define LC_CHECK_IMPORT     (5 * LC_DEVICE_BLOCK_SIZE + 17)   // Bytes imported, over a longer file
+#define LC_CHECK_HEAD       10      // Bytes written at the start of the sparse file
+#define LC_CHECK_SPARSE     5000    // Offset of the bytes written past its hole
+#define LC_CHECK_SPARSE_END 5010    // And its size
+
+//
+// Global Variables
+int     checks, failures;                                   // Checks made, and failed
+int     fail_batches;                                       // Bus batches still to fail
+int     capture;                                            // Non-zero to capture the blocks batches write
+char    captured[LC_CHECK_CLUSTERS * LC_DEVICE_BLOCK_SIZE]; // Blocks written while capturing, in order
+int     captured_blocks;                                    // Number of them
+long    read_frames;                                        // Block reads sent on the bus
+
+// The driver's register unpacking, it has no header of its own
+int extract_lcloud_registers(LCloudRegisterFrame resp, int64_t *B0_4bit, int64_t *B1_4bit, int64_t *C0_8bit,
+                             int64_t *C1_8bit, int64_t *C2_8bit, int64_t *D0_16bit, int64_t *D1_16bit);
+int __real_client_lcloud_bus_batch(LCloudRegisterFrame *regs, void **bufs, int count);
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : __wrap_client_lcloud_bus_batch
+// Description  : Stands in for the driver's bus batch call, failing it while
+//                fail_batches is set, counting the blocks it reads and
+//                capturing the blocks it writes
+//
+// Inputs       : regs, bufs, count - as client_lcloud_bus_batch
+// Outputs      : as client_lcloud_bus_batch, -1 when failed on purpose
+
+int __wrap_client_lcloud_bus_batch(LCloudRegisterFrame *regs, void **bufs, int count) {
+    int64_t b0, b1, c0, c1, c2, d0, d1;
+    int i;
+
+    if (fail_batches > 0) {
+        fail_batches--;
+        logMessage(LOG_INFO_LEVEL, "Check failing a bus batch of [%d] frames", count);
+        return( -1 );
+    }
+    for(i = 0; i < count; i++) {
+        extract_lcloud_registers(regs[i], &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        if ( (c0 == LC_BLOCK_XFER) && (c2 == LC_XFER_READ) ) {
+            read_frames++;
+        }
+        if ( capture && (c0 == LC_BLOCK_XFER) && (c2 == LC_XFER_WRITE) &&
+             (captured_blocks < sizeof(captured) / LC_DEVICE_BLOCK_SIZE) ) {
+            memcpy(&captured[captured_blocks++ * LC_DEVICE_BLOCK_SIZE], bufs[i], LC_DEVICE_BLOCK_SIZE);
+        }
+    }
+    return( __real_client_lcloud_bus_batch(regs, bufs, count) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check
+// Description  : Record the outcome of one check, logging a failure
+//
+// Inputs       : ok - whether the check passed
+//                path - the file checked
+//                what - what was checked
+// Outputs      : ok
+
+int check(int ok, const char *path, const char *what) {
+    checks++;
+    if ( !ok ) {
+        failures++;
+        logMessage(LOG_ERROR_LEVEL, "Check failed on [%s]: %s", path, what);
+    }
+    return( ok );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : fill
+// Description  : Fill a buffer with data that tells files and offsets apart
+//
+// Inputs       : buf - the buffer
+//                len - its length
+//                seed - first byte of the data
+// Outputs      : none
+
+void fill(char *buf, size_t len, int seed) {
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        buf[i] = (char)((seed + i * 7) & 0xff);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : free_clusters
+// Description  : Count the clusters the devices have left unallocated
+//
+// Inputs       : none
+// Outputs      : the count
+
+uint64_t free_clusters(void) {
+    uint64_t total = 0;
+    int i;
+
+    for(i = 0; i < LC_STATS_DEVICES; i++) {
+        total += lcloud_statp->devices[i].free;
+    }
+    return( total );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_flush_failure
+// Description  : Buffer a file's clusters as delayed, fail the flush's batch,
+//                and check that the clusters stay delayed with their data and
+//                their addresses given back, and that the next flush writes
+//                them all.
+//
+// Inputs       : none
+// Outputs      : none
+
+void check_flush_failure(void) {
+    const char *path = "check-flush";
+    char out[LC_CHECK_BYTES], in[LC_CHECK_BYTES];
+    uint64_t before, dirty;
+    LcFHandle fh;
+    int i;
+
+    fill(out, sizeof(out), 3);
+    if ( !check((fh = lcopen(path, 0)) != -1, path, "open") ) {
+        return;
+    }
+    for(i = 0; i < sizeof(out); i += LC_CHECK_WRITE) {
+        check(lcwrite(fh, &out[i], CMPSC311_MINVAL(LC_CHECK_WRITE, sizeof(out) - i)) != -1, path, "write");
+    }
+    before = free_clusters();
+    dirty = lcloud_statp->dirty;
+    check(dirty >= LC_CHECK_CLUSTERS, path, "writes are delayed");
+
+    fail_batches = 1;
+    check(lcflush(fh) == -1, path, "flush fails with its batch");
+    check(fail_batches == 0, path, "flush sends a batch");
+    check(lcloud_statp->dirty == dirty, path, "clusters stay dirty after a failed flush");
+    check(before - free_clusters() < LC_CHECK_CLUSTERS, path, "failed flush gives its clusters back");
+    check((lcseek(fh, 0) == 0) && (lcread(fh, in, sizeof(in)) == sizeof(in)) &&
+          (memcmp(in, out, sizeof(in)) == 0), path, "data kept after a failed flush");
+
+    capture = 1;
+    check(lcflush(fh) == 0, path, "flush after a failure");
+    capture = 0;
+    check(lcloud_statp->dirty == dirty - LC_CHECK_CLUSTERS, path, "flushed clusters are clean");
+    check((captured_blocks == LC_CHECK_CLUSTERS) && (memcmp(captured, out, sizeof(out)) == 0),
+          path, "flush writes every cluster");
+    check((lcseek(fh, 0) == 0) && (lcread(fh, in, sizeof(in)) == sizeof(in)) &&
+          (memcmp(in, out, sizeof(in)) == 0), path, "read back after the flush");
+    check(lcclose(fh) == 0, path, "close");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_objects
+// Description  : Put whole objects and get them back, alone and together, and
+//                check that a put replaces what was there: a shorter object
+//                leaves the file its own length and gives back the clusters
+//                past it.
+//
+// Inputs       : none
+// Outputs      : none
+
+void check_objects(void) {
+    const char *path = "check-object";
+    char out[LC_CHECK_OBJECTS][LC_CHECK_BYTES], in[LC_CHECK_OBJECTS][LC_CHECK_BYTES];
+    const char *paths[LC_CHECK_OBJECTS] = { "check-object", "check-object-1", "check-object-2" };
+    size_t lens[LC_CHECK_OBJECTS] = { 700, LC_CHECK_BYTES, 3 * LC_DEVICE_BLOCK_SIZE };
+    lcloud_object objs[LC_CHECK_OBJECTS];
+    uint64_t before;
+    int i;
+
+    for(i = 0; i < LC_CHECK_OBJECTS; i++) {
+        fill(out[i], sizeof(out[i]), 11 + i);
+    }
+    check(lcput(path, out[0], sizeof(out[0])) == sizeof(out[0]), path, "put");
+    check((lcget(path, in[0], sizeof(in[0])) == sizeof(in[0])) && (memcmp(in[0], out[0], sizeof(in[0])) == 0),
+          path, "get");
+    check(lcget("check-missing", in[0], sizeof(in[0])) == -1, "check-missing", "get of a missing object fails");
+
+    before = free_clusters();
+    check(lcput(path, out[1], 1000) == 1000, path, "shorter put");
+    check(free_clusters() > before, path, "shorter put gives back clusters");
+    memset(in[0], 0xff, sizeof(in[0]));
+    check((lcget(path, in[0], sizeof(in[0])) == 1000) && (memcmp(in[0], out[1], 1000) == 0),
+          path, "shorter put replaces the object");
+
+    for(i = 0; i < LC_CHECK_OBJECTS; i++) {                 // The first shrinks again, the others are new
+        objs[i].path = paths[i];
+        objs[i].buf = out[i];
+        objs[i].len = lens[i];
+    }
+    check(lcputv(objs, LC_CHECK_OBJECTS) == LC_CHECK_OBJECTS, path, "put of many objects");
+    for(i = 0; i < LC_CHECK_OBJECTS; i++) {
+        check(objs[i].result == lens[i], paths[i], "put of many objects, each");
+        objs[i].buf = in[i];
+        objs[i].len = sizeof(in[i]);
+    }
+    check(lcgetv(objs, LC_CHECK_OBJECTS) == LC_CHECK_OBJECTS, path, "get of many objects");
+    for(i = 0; i < LC_CHECK_OBJECTS; i++) {
+        check((objs[i].result == lens[i]) && (memcmp(in[i], out[i], lens[i]) == 0), paths[i], "get of many objects, each");
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : local_file
+// Description  : Make a scratch local file holding some data
+//
+// Inputs       : buf - the data
+//                len - bytes of it
+// Outputs      : descriptor of the file (already unlinked), -1 if failure
+
+int local_file(char *buf, size_t len) {
+    char name[] = "/tmp/lcloud-check.XXXXXX";
+    int fd;
+
+    if ( (fd = mkstemp(name)) == -1 ) {
+        return( -1 );
+    }
+    unlink(name);
+    if ( (len > 0) && (write(fd, buf, len) != len) ) {
+        close(fd);
+        return( -1 );
+    }
+    return( fd );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_import_export
+// Description  : Import a local file over a longer LionCloud file and export
+//                it over a longer local one, and check that both copies come
+//                out the exact length of the original, with its data.
+//
+// Inputs       : none
+// Outputs      : none
+
+void check_import_export(void) {
+    const char *path = "check-import";
+    char longer[LC_CHECK_BYTES], out[LC_CHECK_IMPORT], in[LC_CHECK_BYTES];
+    int src, dst;
+    struct stat st;
+
+    fill(longer, sizeof(longer), 21);
+    fill(out, sizeof(out), 23);
+    if ( !check(((src = local_file(out, sizeof(out))) != -1) && ((dst = local_file(longer, sizeof(longer))) != -1),
+                path, "scratch local files") ) {
+        return;
+    }
+
+    check(lcput(path, longer, sizeof(longer)) == sizeof(longer), path, "put of a longer file");
+    check(lcimport(src, path) == sizeof(out), path, "import");
+    check((lcget(path, in, sizeof(in)) == sizeof(out)) && (memcmp(in, out, sizeof(out)) == 0),
+          path, "import replaces the longer file");
+    check(lcexport(path, dst) == sizeof(out), path, "export");
+    check((fstat(dst, &st) == 0) && (st.st_size == sizeof(out)), path, "export cuts the local file to length");
+    check((pread(dst, in, sizeof(in), 0) == sizeof(out)) && (memcmp(in, out, sizeof(out)) == 0),
+          path, "export round trip");
+    close(src);
+    close(dst);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check_sparse
+// Description  : Write a few bytes at the start of a file and a few far past
+//                them, and check where lcseekdata and lcseekhole land, before
+//                and after the flush, and that the hole reads back as zeros
+//                without a block read on the bus.
+//
+// Inputs       : none
+// Outputs      : none
+
+void check_sparse(void) {
+    const char *path = "check-sparse";
+    char out[LC_CHECK_SPARSE_END], in[LC_CHECK_SPARSE_END], zeros[LC_CHECK_SPARSE_END];
+    int data = (LC_CHECK_SPARSE / LC_DEVICE_BLOCK_SIZE) * LC_DEVICE_BLOCK_SIZE;   // Start of the cluster written last
+    int pass;
+    long reads;
+    LcFHandle fh;
+
+    memset(out, 0, sizeof(out));
+    memset(zeros, 0, sizeof(zeros));
+    fill(&out[LC_CHECK_SPARSE], LC_CHECK_SPARSE_END - LC_CHECK_SPARSE, 31);
+    fill(out, LC_CHECK_HEAD, 37);
+    if ( !check((fh = lcopen(path, 0)) != -1, path, "open") ) {
+        return;
+    }
+    check((lcseek(fh, LC_CHECK_SPARSE) == LC_CHECK_SPARSE) &&
+          (lcwrite(fh, &out[LC_CHECK_SPARSE], LC_CHECK_SPARSE_END - LC_CHECK_SPARSE) != -1), path, "write past a hole");
+    check(lcseekdata(fh, 0) == data, path, "seekdata from the start of a hole finds the written cluster");
+    check(lcseekhole(fh, LC_CHECK_SPARSE - 100) == LC_CHECK_SPARSE_END, path, "seekhole in the last cluster finds the end");
+    check((lcseek(fh, 0) == 0) && (lcwrite(fh, out, LC_CHECK_HEAD) == LC_CHECK_HEAD), path, "write at the start");
+
+    for(pass = 0; pass < 2; pass++) {                       // Delayed, then flushed to the devices
+        check(lcseekhole(fh, 0) == LC_DEVICE_BLOCK_SIZE, path, "seekhole finds the end of the first cluster");
+        check(lcseekdata(fh, LC_DEVICE_BLOCK_SIZE) == data, path, "seekdata skips the hole");
+        check(lcseekdata(fh, 10) == 10, path, "seekdata in data stays put");
+        check(lcseekhole(fh, 2 * LC_DEVICE_BLOCK_SIZE) == 2 * LC_DEVICE_BLOCK_SIZE, path, "seekhole in a hole stays put");
+        check(lcseekhole(fh, LC_CHECK_SPARSE_END) == -1, path, "no hole at the end of the file");
+        check(lcseekdata(fh, LC_CHECK_SPARSE_END) == -1, path, "no data at the end of the file");
+        reads = read_frames;
+        check((lcseek(fh, LC_DEVICE_BLOCK_SIZE) == LC_DEVICE_BLOCK_SIZE) &&
+              (lcread(fh, in, data - LC_DEVICE_BLOCK_SIZE) == data - LC_DEVICE_BLOCK_SIZE) &&
+              (memcmp(in, zeros, data - LC_DEVICE_BLOCK_SIZE) == 0), path, "hole reads as zeros");
+        check(read_frames == reads, path, "hole read without the bus");
+        check((lcseek(fh, 0) == 0) && (lcread(fh, in, sizeof(in)) == sizeof(in)) &&
+              (memcmp(in, out, sizeof(in)) == 0), path, "read of the sparse file");
+        check((pass == 1) || (lcflush(fh) == 0), path, "flush");
+    }
+    check(lcclose(fh) == 0, path, "close");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the driver check
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if every check passed, 1 if not, -1 if failure
+
+int main(int argc, char *argv[]) {
+    int ch, verbose = 0, log_initialized = 0;
+
+    // Process the command line parameters
+    while ( (ch = getopt(argc, argv, LCLOUD_CHECK_ARGUMENTS)) != -1 ) {
+        switch ( ch ) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return( -1 );
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'l': // Set the log filename
+            initializeLogWithFilename(optarg);
+            log_initialized = 1;
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return( -1 );
+        }
+    }
+
+    // Setup the log as needed
+    if ( !log_initialized ) {
+        initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    }
+    LcControllerLLevel = registerLogLevel("LCLOUD_CONTROLLER", 0);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    LcSimulatorLLevel = registerLogLevel("LCLOUD_SIMULATOR", 0);
+    if ( verbose ) {
+        enableLogLevels(LOG_INFO_LEVEL);
+        enableLogLevels(LcControllerLLevel | LcDriverLLevel | LcSimulatorLLevel);
+    }
+
+    // The checks, each on files of its own
+    check_flush_failure();
+    check_objects();
+    check_import_export();
+    check_sparse();
+
+    if (lcshutdown() == -1) {
+        logMessage(LOG_ERROR_LEVEL, "Check failed shutting down the driver");
+        failures++;
+    }
+    printf("lcloud_check: %d checks, %d failed\n", checks, failures);
+    freeLogRegistrations();
+
+    return( (failures > 0) ? 1 : 0 );
+}
@@ -18,17 +18,54 @@
 #include <unistd.h>
 #include <assert.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <netinet/tcp.h>
+#include <time.h>
+#include <poll.h>
 
 // Project Include Files
 #include <lcloud_network.h>
 #include <cmpsc311_log.h>
 #include <lcloud_filesys.h>
+#include <lcloud_trace.h>
+#include <lcloud_mem.h>
+#include <lcloud_stats.h>
 #include <cmpsc311_util.h>
 
+// Defines
+#ifndef IOV_MAX
+#define IOV_MAX 1024                        // Most buffers one writev will take
+#endif
+#define LC_XFER_COPY 2                      // Batch direction marker of a block copy
+#define LC_BUS_MAX_LINGER 200000            // Longest a ready frame is held back to coalesce a send (ns)
+#define LC_BUS_SEND_BUCKETS 8               // Frames per send histogram buckets: 1, 2-3, 4-7, ... 128+
+#define LC_BUS_CANCEL_POLL 1                // Longest wait for a reply between looks at the cancel flag (ms)
+
+//
+// Request abandoned in flight, its reply still to come
+typedef struct {
+    LCloudRegisterFrame reg;                // The request registers
+    uint32_t        tag;                    // Its tag (v2), v1 replies come back in send order
+} LCloudOrphan;
+
 //
 // Global Variables
 LcFHandle       socket_handle = -1;         // Socket handle to connect to, initialized to -1 for setup
-int64_t         b0, b1, c0, c1, c2, d0, d1;                                         // Holders for 7 operation registers
+int             bus_protocol = LCLOUD_PROTO_V1;                                     // Protocol version negotiated at power on
+int             bus_credits = 1;                                                    // Requests the server lets us have in flight (v2)
+uint32_t        bus_tag = 0;                                                        // Next request tag (v2)
+int             bus_features = 0;                                                   // Features the server announced (v2)
+uint64_t        bus_min_rtt = 0;                                                    // Shortest request round trip seen (ns, v2)
+uint64_t        bus_gap = 0;                                                        // Moving average of the time between replies (ns, v2)
+int             bus_coalesce = 1;                                                   // Frames a send waits to gather when the pipeline is deep
+uint64_t        bus_sends = 0, bus_frames = 0;                                      // Sends made and frames they carried
+uint64_t        bus_send_sizes[LC_BUS_SEND_BUCKETS];                                // Frames per send, by power of two
+LCloudOrphan   *bus_orphans;                                                        // Requests abandoned in flight, in send order
+int             bus_norphans, bus_orphan_alloc;                                     // Number of them, and room for them
+uint64_t        bus_dropped, bus_abandoned, bus_discarded;                          // Frames never sent, given up in flight, late replies thrown away
+static int64_t  b0, b1, c0, c1, c2, d0, d1;                                         // Holders for 7 operation registers, the driver has its own
 
 //
 // Functions
@@ -71,26 +108,112 @@ int lcloud_client_extract_registers(LCloudRegisterFrame resp, int64_t *B0_4bit,
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : client_lcloud_bus_request
-// Description  : This the client regstateeration that sends a request to the 
-//                lion client server.   It will:
+// Function     : lcloud_client_clock
+// Description  : Read the monotonic clock, for the transport's timing
 //
-//                1) if INIT make a connection to the server
-//                2) send any request to the server, returning results
-//                3) if CLOSE, will close the connection
+// Inputs       : none
+// Outputs      : the time in nanoseconds
+
+uint64_t lcloud_client_clock( void ) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return( (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
 //
-// Inputs       : reg - the request reqisters for the command
-//                buf - the block to be read/written from (READ/WRITE)
-// Outputs      : the response structure encoded as needed
+// Function     : lcloud_client_count_send
+// Description  : Count one send to the server and the frames it carried
+//
+// Inputs       : frames - number of request frames in the send
+// Outputs      : none
 
-LCloudRegisterFrame client_lcloud_bus_request(LCloudRegisterFrame reg, void *buf) {
-    LCloudRegisterFrame nbo, hbo;
-    // If there isn't an open connection already created
-    // Use a global variable 'socket_handle', set initially equal to '-1'.
+void lcloud_client_count_send( int frames ) {
+    int bucket;
 
-    // IF 'socket_handle' == -1, there is no open connection.
-    // ELSE, there is an open connection.
+    for ( bucket = 0; (bucket < LC_BUS_SEND_BUCKETS - 1) && (frames >> (bucket + 1)); bucket++ );
+    bus_send_sizes[bucket]++;
+    bus_sends++;
+    bus_frames += frames;
+    lcloud_trace_counter("bus send frames", frames);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_count_frame
+// Description  : Count a frame going to (or coming back from) a device in the
+//                live counters
+//
+// Inputs       : reg - the request registers
+//                sending - 1 when the frame is sent, 0 when its reply is in
+// Outputs      : none
+
+void lcloud_client_count_frame( LCloudRegisterFrame reg, int sending ) {
+    int op = (reg >> 48) & 0xff, dev = (reg >> 40) & 0xff, xfer = (reg >> 32) & 0xff;  // C0, C1 and C2
+
+    if ( ((op != LC_BLOCK_XFER) && (op != LC_BLOCK_COPY)) || (dev >= LC_STATS_DEVICES) ) {
+        return;
+    }
+    if ( !sending ) {
+        LC_STAT_ADD(devices[dev].inflight, -1);
+        LC_STAT_ADD(bus_inflight, -1);
+        return;
+    }
+    if ( (op == LC_BLOCK_XFER) && (xfer == LC_XFER_READ) ) {
+        LC_STAT_ADD(devices[dev].reads, 1);
+    } else {
+        LC_STAT_ADD(devices[dev].writes, 1);
+    }
+    LC_STAT_ADD(devices[dev].inflight, 1);
+    LC_STAT_ADD(bus_inflight, 1);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_report
+// Description  : Log the transport statistics and reset them, at power off
+//
+// Inputs       : none
+// Outputs      : none
 
+void lcloud_client_report( void ) {
+    if ( bus_sends > 0 ) {
+        logMessage(LOG_OUTPUT_LEVEL, "Bus sends [%lu] carried [%lu] frames, [%.2f] per send",
+                   (unsigned long)bus_sends, (unsigned long)bus_frames, (double)bus_frames / bus_sends);
+        logMessage(LOG_OUTPUT_LEVEL, "Bus frames per send 1 [%lu] 2+ [%lu] 4+ [%lu] 8+ [%lu] 16+ [%lu] 32+ [%lu] 64+ [%lu] 128+ [%lu]",
+                   (unsigned long)bus_send_sizes[0], (unsigned long)bus_send_sizes[1], (unsigned long)bus_send_sizes[2],
+                   (unsigned long)bus_send_sizes[3], (unsigned long)bus_send_sizes[4], (unsigned long)bus_send_sizes[5],
+                   (unsigned long)bus_send_sizes[6], (unsigned long)bus_send_sizes[7]);
+    }
+    if ( bus_gap > 0 ) {
+        logMessage(LOG_OUTPUT_LEVEL, "Bus shortest round trip [%lu] us, reply gap [%lu] ns, last coalesce target [%d] frames",
+                   (unsigned long)(bus_min_rtt / 1000), (unsigned long)bus_gap, bus_coalesce);
+    }
+    if ( bus_dropped + bus_abandoned > 0 ) {
+        logMessage(LOG_OUTPUT_LEVEL, "Bus frames dropped unsent [%lu], abandoned in flight [%lu], late replies discarded [%lu]",
+                   (unsigned long)bus_dropped, (unsigned long)bus_abandoned, (unsigned long)bus_discarded);
+    }
+    bus_sends = bus_frames = 0;
+    bus_dropped = bus_abandoned = bus_discarded = 0;
+    free(bus_orphans);                                                          // Every reply is in by the power off
+    lcloud_mem_release(LC_MEM_BUFFERS, bus_orphan_alloc * sizeof(LCloudOrphan));
+    bus_orphans = NULL;
+    bus_norphans = bus_orphan_alloc = 0;
+    memset(bus_send_sizes, 0, sizeof(bus_send_sizes));
+    bus_min_rtt = bus_gap = 0;
+    bus_coalesce = 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_connect
+// Description  : Make the connection to the server if there is not one open
+//
+// Inputs       : none
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcloud_client_connect( void ) {
     // IF there isn't an open connection already created, three things need 
     // to be done.
     //    (a) Setup the address
@@ -115,8 +238,329 @@ LCloudRegisterFrame client_lcloud_bus_request(LCloudRegisterFrame reg, void *buf
                                                                 // Step - Create the connection
         if ( connect(socket_handle, (const struct sockaddr *)&client_addr, sizeof(client_addr)) == -1 ) {   // Connect to socket, catch errors
             logMessage(LOG_ERROR_LEVEL, "Error on socket connect [%d]", socket_handle);
+            close(socket_handle);
+            socket_handle = -1;
+            return( -1 );
+        }
+    }
+
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_quickack
+// Description  : Ack the replies about to be read at once, so the server's next
+//                response is not held back behind a delayed ack. The kernel
+//                falls back to delayed acks by itself, so this is done once
+//                per reply or batch, not per read.
+//
+// Inputs       : none
+// Outputs      : none
+
+void lcloud_client_quickack( void ) {
+#ifdef TCP_QUICKACK
+    int one = 1;
+
+    setsockopt(socket_handle, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_read_all
+// Description  : Read exactly len bytes from the socket, retrying short reads
+//
+// Inputs       : buf - place to put the data
+//                len - number of bytes to read
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcloud_client_read_all( void *buf, size_t len ) {
+    ssize_t got;
+    size_t done = 0;
+
+    while ( done < len ) {
+        if ( (got = read(socket_handle, (char *)buf + done, len - done)) <= 0 ) {
+            if ( (got == -1) && (errno == EINTR) ) {
+                continue;
+            }
+            return( -1 );
+        }
+        done += got;
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_writev_all
+// Description  : Write a whole scatter/gather list to the socket, retrying
+//                short writes (the iovec array is consumed in place)
+//
+// Inputs       : iov - the list of buffers to send
+//                iovcnt - number of entries in the list
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcloud_client_writev_all( struct iovec *iov, int iovcnt ) {
+    ssize_t sent;
+    int chunk;
+
+    while ( iovcnt > 0 ) {
+        chunk = (iovcnt > IOV_MAX) ? IOV_MAX : iovcnt;
+        if ( (sent = writev(socket_handle, iov, chunk)) == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return( -1 );
+        }
+        while ( (iovcnt > 0) && (sent >= iov->iov_len) ) {      // Skip the buffers sent in full
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if ( iovcnt > 0 ) {                                     // Advance into a partially sent buffer
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_await
+// Description  : Wait for a reply to start arriving, giving up when the token
+//                governing the requests expires or is cancelled. Replies are
+//                only given up on between frames, so the stream stays in step.
+//
+// Inputs       : token - the token, NULL to wait as long as it takes
+// Outputs      : 0 when a reply is ready, ETIMEDOUT or ECANCELED if given
+//                up on, -1 if failure
+
+int lcloud_client_await( const lcloud_cancel *token ) {
+    struct pollfd pfd;
+    uint64_t now;
+    int why, wait;
+
+    if ( token == NULL ) {
+        return( 0 );
+    }
+    pfd.fd = socket_handle;
+    pfd.events = POLLIN;
+    while ( 1 ) {
+        if ( (why = lcexpired(token)) != 0 ) {
+            return( why );
+        }
+        wait = LC_BUS_CANCEL_POLL;                                              // Cancellation is only seen between polls
+        if ( (token->deadline != 0) && ((now = lcloud_client_clock()) < token->deadline) ) {
+            wait = (int)CMPSC311_MINVAL((uint64_t)wait, (token->deadline - now + 999999) / 1000000);
+        }
+        switch ( poll(&pfd, 1, wait) ) {
+        case -1:
+            if ( errno != EINTR ) {
+                return( -1 );
+            }
+            break;
+        case 0:
+            break;
+        default:
+            return( 0 );
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_orphan
+// Description  : Remember a request given up on in flight, so its reply can be
+//                recognised and thrown away when it comes
+//
+// Inputs       : reg - the request registers
+//                tag - its tag (v2)
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcloud_client_orphan( LCloudRegisterFrame reg, uint32_t tag ) {
+    LCloudOrphan *grown;
+    int alloc;
+
+    if ( bus_norphans == bus_orphan_alloc ) {
+        alloc = CMPSC311_MAXVAL(2 * bus_orphan_alloc, 64);
+        if ( (grown = realloc(bus_orphans, alloc * sizeof(LCloudOrphan))) == NULL ) {
+            logMessage(LOG_ERROR_LEVEL, "Client IO Bus failure allocating room for [%d] abandoned requests", alloc);
+            return( -1 );
+        }
+        lcloud_mem_charge(LC_MEM_BUFFERS, (alloc - bus_orphan_alloc) * sizeof(LCloudOrphan));
+        bus_orphans = grown;
+        bus_orphan_alloc = alloc;
+    }
+    bus_orphans[bus_norphans].reg = reg;
+    bus_orphans[bus_norphans++].tag = tag;
+    bus_abandoned++;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_discard
+// Description  : Throw away the rest of a reply to an abandoned request, its
+//                register frame (and tag) already read
+//
+// Inputs       : i - the request in the abandoned list
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcloud_client_discard( int i ) {
+    char scratch[LC_DEVICE_BLOCK_SIZE];
+    LCloudRegisterFrame reg = bus_orphans[i].reg;
+
+    if ( (((reg >> 48) & 0xff) == LC_BLOCK_XFER) && (((reg >> 32) & 0xff) == LC_XFER_READ) &&
+         (lcloud_client_read_all(scratch, LC_DEVICE_BLOCK_SIZE) == -1) ) {
+        logMessage(LOG_ERROR_LEVEL, "Client IO Bus failure reading late reply from socket [%d]", socket_handle);
+        return( -1 );
+    }
+    lcloud_client_count_frame(reg, 0);
+    bus_discarded++;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_discard_tag
+// Description  : Throw away a v2 reply if it answers an abandoned request
+//
+// Inputs       : tag - the reply's tag
+// Outputs      : 1 if it was thrown away, 0 if it answers no abandoned
+//                request, -1 if failure
+
+int lcloud_client_discard_tag( uint32_t tag ) {
+    int i;
+
+    for ( i = 0; (i < bus_norphans) && (bus_orphans[i].tag != tag); i++ );
+    if ( i == bus_norphans ) {
+        return( 0 );
+    }
+    if ( lcloud_client_discard(i) == -1 ) {
+        return( -1 );
+    }
+    bus_orphans[i] = bus_orphans[--bus_norphans];                              // Order only matters to v1
+    return( 1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_drain
+// Description  : Throw away the replies to abandoned v1 requests, which come
+//                back ahead of any others
+//
+// Inputs       : token - the token of the requests waiting to go out, NULL
+//                        to wait for every late reply
+// Outputs      : 0 if successful test, -1 if failure (or given up on)
+
+int lcloud_client_drain( const lcloud_cancel *token ) {
+    LCloudRegisterFrame nbo;
+    int i, ret = 0;
+
+    for ( i = 0; i < bus_norphans; i++ ) {
+        if ( (lcloud_client_await(token) != 0) || (lcloud_client_read_all(&nbo, sizeof(nbo)) == -1) ||
+             (lcloud_client_discard(i) == -1) ) {
+            ret = -1;
+            break;
+        }
+    }
+    memmove(bus_orphans, &bus_orphans[i], (bus_norphans - i) * sizeof(LCloudOrphan));
+    bus_norphans -= i;
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_tagged_request
+// Description  : Send one request over a v2 connection and wait for its reply
+//
+// Inputs       : reg - the request reqisters for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response registers in host byte order, -1 if failure
+
+LCloudRegisterFrame lcloud_client_tagged_request(LCloudRegisterFrame reg, void *buf) {
+    LCloudRegisterFrame nbo;
+    LCloudTagHeader hdr;
+    struct iovec iov[3];
+    int iovcnt = 0;
+    uint32_t tag = bus_tag++;
+
+    lcloud_client_extract_registers(reg, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+    nbo = htonll64(reg);
+    hdr.tag = htonl(tag);
+    hdr.credits = 0;
+    hdr.flags = 0;
+    iov[iovcnt].iov_base = &nbo;
+    iov[iovcnt++].iov_len = sizeof(nbo);
+    iov[iovcnt].iov_base = &hdr;
+    iov[iovcnt++].iov_len = sizeof(hdr);
+    if ( (c0 == LC_BLOCK_XFER) && (c2 == LC_XFER_WRITE) ) {
+        iov[iovcnt].iov_base = buf;
+        iov[iovcnt++].iov_len = LC_DEVICE_BLOCK_SIZE;
+    }
+    if ( lcloud_client_writev_all(iov, iovcnt) == -1 ) {
+        logMessage(LOG_ERROR_LEVEL, "Client IO Bus [v2] failure writing request to socket [%d]", socket_handle);
+        return( -1 );
+    }
+
+    lcloud_client_quickack();
+    do {                                                                        // Late replies to abandoned requests may come first
+        if ( (lcloud_client_read_all(&nbo, sizeof(nbo)) == -1) || (lcloud_client_read_all(&hdr, sizeof(hdr)) == -1) ) {
+            logMessage(LOG_ERROR_LEVEL, "Client IO Bus [v2] failure reading response from socket [%d]", socket_handle);
+            return( -1 );
+        }
+        if ( (ntohl(hdr.tag) != tag) && (lcloud_client_discard_tag(ntohl(hdr.tag)) != 1) ) {
+            logMessage(LOG_ERROR_LEVEL, "Client IO Bus [v2] response tag [%u] does not match request [%u]", ntohl(hdr.tag), tag);
             return( -1 );
         }
+    } while ( ntohl(hdr.tag) != tag );
+    if ( (c0 == LC_BLOCK_XFER) && (c2 == LC_XFER_READ) && (lcloud_client_read_all(buf, LC_DEVICE_BLOCK_SIZE) == -1) ) {
+        logMessage(LOG_ERROR_LEVEL, "Client IO Bus [v2] read error");
+        return( -1 );
+    }
+
+    if ( c0 == LC_POWER_OFF ) {                                                 // The next connection starts over at v1
+        close(socket_handle);
+        socket_handle = -1;
+        bus_protocol = LCLOUD_PROTO_V1;
+        bus_credits = 1;
+        bus_features = 0;
+        lcloud_client_report();
+    }
+    return( ntohll64(nbo) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_request
+// Description  : This the client regstateeration that sends a request to the 
+//                lion client server.   It will:
+//
+//                1) if INIT make a connection to the server
+//                2) send any request to the server, returning results
+//                3) if CLOSE, will close the connection
+//
+// Inputs       : reg - the request reqisters for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+LCloudRegisterFrame lcloud_client_request(LCloudRegisterFrame reg, void *buf) {
+    LCloudRegisterFrame nbo, hbo;
+    // If there isn't an open connection already created
+    // Use a global variable 'socket_handle', set initially equal to '-1'.
+
+    // IF 'socket_handle' == -1, there is no open connection.
+    // ELSE, there is an open connection.
+    if ( lcloud_client_connect() == -1 ) {
+        return( -1 );
+    }
+    if ( bus_protocol == LCLOUD_PROTO_V2 ) {                                    // Tagged framing once negotiated
+        return( lcloud_client_tagged_request(reg, buf) );
+    }
+    if ( lcloud_client_drain(NULL) == -1 ) {                                    // Replies still owed to abandoned requests come first
+        return( -1 );
     }
     
     lcloud_client_extract_registers(reg, &b0, &b1, &c0, &c1, &c2, &d0, &d1);    // Extract the input register to get opcode registers
@@ -198,6 +642,7 @@ LCloudRegisterFrame client_lcloud_bus_request(LCloudRegisterFrame reg, void *buf
 
         close(socket_handle);   // Close the socket
         socket_handle = -1;     // Set to -1 to avoid calling operations on closed socket
+        lcloud_client_report();
 
         hbo = ntohll64(nbo);
         return(hbo);
@@ -219,9 +664,364 @@ LCloudRegisterFrame client_lcloud_bus_request(LCloudRegisterFrame reg, void *buf
         }
 
         hbo = ntohll64(nbo);    // Convert the return register to host byte order for return
+
+        // A v2 server answers a power on that asks for v2 with the version in
+        // D0, the credits it grants in D1 and its features in C1, stock
+        // servers leave D0 zero.
+        if ( (c0 == LC_POWER_ON) && (d0 >= LCLOUD_PROTO_V2) ) {
+            lcloud_client_extract_registers(hbo, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+            if ( (b0 == 1) && (b1 == 1) && (d0 == LCLOUD_PROTO_V2) && (d1 > 0) ) {
+                bus_protocol = LCLOUD_PROTO_V2;
+                bus_credits = d1;
+                bus_features = c1;
+            }
+        }
         return(hbo);            // Return the register in host byte order
     }
 
     return (0); // Sucessful test
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_request
+// Description  : Send one request to the server, traced as a span named
+//                after the opcode
+//
+// Inputs       : reg - the request reqisters for the command
+//                buf - the block to be read/written from (READ/WRITE)
+// Outputs      : the response structure encoded as needed
+
+LCloudRegisterFrame client_lcloud_bus_request(LCloudRegisterFrame reg, void *buf) {
+    static const char *span_names[LC_MAX_OPERATION + 1] = { "bus power on", "bus probe", "bus init", "bus xfer", "bus power off", "bus other" };
+    uint64_t start = lcloud_trace_now();
+    int op = (reg >> 48) & 0xff;                                                // C0, the opcode
+    int dev = (reg >> 40) & 0xff;                                               // C1, the device
+    LCloudRegisterFrame rsp;
+
+    lcloud_client_count_send(1);                                                // Counted first, a power off reports the totals
+    lcloud_client_count_frame(reg, 1);
+    LC_STAT_ADD(bus_requests, 1);
+    rsp = lcloud_client_request(reg, buf);
+    lcloud_client_count_frame(reg, 0);
+
+    lcloud_trace_span(span_names[(op < LC_MAX_OPERATION) ? op : LC_MAX_OPERATION], "bus", start, dev);
+    return( rsp );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_batch_xfer
+// Description  : Gather every request of a batch (and the data for writes) into
+//                one send, then read back the responses in order
+//
+// Inputs       : regs - the request registers, replaced by the responses
+//                bufs - the block to be read/written for each request
+//                count - number of requests in the batch
+//                nbo - scratch space for count network order registers
+//                iov - scratch space for 2 * count iovecs
+//                token - the token the batch may be given up on by, or NULL
+// Outputs      : 0 if successful test, -1 if failure (or given up on)
+
+int lcloud_client_batch_xfer(LCloudRegisterFrame *regs, void **bufs, int count, LCloudRegisterFrame *nbo, struct iovec *iov,
+                             const lcloud_cancel *token) {
+    int i, j, iovcnt = 0, why;
+
+    if ( lcloud_client_drain(token) == -1 ) {                                   // Replies still owed to abandoned requests come first
+        bus_dropped += count;
+        return( -1 );
+    }
+    if ( lcexpired(token) ) {                                                   // Given up on before it went out
+        bus_dropped += count;
+        return( -1 );
+    }
+
+    for ( i = 0; i < count; i++ ) {                                             // Gather the registers and write data
+        lcloud_client_extract_registers(regs[i], &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        if ( c0 != LC_BLOCK_XFER ) {
+            logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] only carries block transfers [%d]", (int)c0);
+            return( -1 );
+        }
+        nbo[i] = htonll64(regs[i]);                                             // Convert the register to network byte order
+        iov[iovcnt].iov_base = &nbo[i];
+        iov[iovcnt++].iov_len = sizeof(LCloudRegisterFrame);
+        if ( c2 == LC_XFER_WRITE ) {
+            iov[iovcnt].iov_base = bufs[i];
+            iov[iovcnt++].iov_len = LC_DEVICE_BLOCK_SIZE;
+        }
+    }
+    if ( lcloud_client_writev_all(iov, iovcnt) == -1 ) {
+        logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] failure writing [%d] requests to socket [%d]", count, socket_handle);
+        return( -1 );
+    }
+    lcloud_client_count_send(count);
+    for ( i = 0; i < count; i++ ) {
+        lcloud_client_count_frame(regs[i], 1);
+    }
+    lcloud_client_quickack();
+
+    for ( i = 0; i < count; i++ ) {                                             // Responses come back in request order
+        if ( (why = lcloud_client_await(token)) != 0 ) {
+            for ( j = i; (why > 0) && (j < count); j++ ) {                      // The rest are owed, and thrown away when they come
+                why = (lcloud_client_orphan(regs[j], 0) == -1) ? -1 : why;
+            }
+            if ( why == -1 ) {
+                logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] failure waiting for responses on socket [%d]", socket_handle);
+            }
+            return( -1 );
+        }
+        lcloud_client_extract_registers(regs[i], &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        if ( lcloud_client_read_all(&nbo[i], sizeof(LCloudRegisterFrame)) == -1 ) {
+            logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] failure reading register from socket [%d]", socket_handle);
+            return( -1 );
+        }
+        if ( (c2 == LC_XFER_READ) && (lcloud_client_read_all(bufs[i], LC_DEVICE_BLOCK_SIZE) == -1) ) {
+            logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] read error");
+            return( -1 );
+        }
+        lcloud_client_count_frame(regs[i], 0);
+        regs[i] = ntohll64(nbo[i]);                                             // Hand back the response in host byte order
+    }
+
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_client_tagged_batch
+// Description  : Run a batch over a v2 connection. Up to the granted credits of
+//                requests are kept in flight, and each reply is matched to its
+//                request by tag, in whatever order the server finishes them.
+//
+//                Sends adapt to load: while fewer frames are in flight than it
+//                takes to keep the server busy for a round trip, freed credits
+//                are used at once; beyond that, they are gathered until
+//                bus_coalesce frames can go in one send. The target follows
+//                the shortest round trip and the gap between replies, and is
+//                capped so no frame lingers past LC_BUS_MAX_LINGER.
+//
+//                A batch under a token that expires sends nothing more; the
+//                requests in flight are left to the server, and their replies
+//                thrown away as they come in. Until then they still hold
+//                credits.
+//
+// Inputs       : regs - the request registers, replaced by the responses
+//                bufs - the block to be read/written for each request, or the
+//                       source frame of a block copy
+//                count - number of requests in the batch
+//                nbo - scratch space for 2 * count network order registers
+//                iov - scratch space for 3 * count iovecs
+//                hdrs - scratch space for count tag headers
+//                xfer - scratch space for count transfer directions
+//                sent_at - scratch space for count send times
+//                token - the token the batch may be given up on by, or NULL
+// Outputs      : 0 if successful test, -1 if failure (or given up on)
+
+int lcloud_client_tagged_batch(LCloudRegisterFrame *regs, void **bufs, int count, LCloudRegisterFrame *nbo,
+                               struct iovec *iov, LCloudTagHeader *hdrs, int8_t *xfer, uint64_t *sent_at,
+                               const lcloud_cancel *token) {
+    int i, iovcnt, first, sent = 0, done = 0, inflight, room, cover, why;
+    uint64_t now, last = 0;
+    uint32_t base = bus_tag;
+    LCloudRegisterFrame rsp;
+    LCloudTagHeader hdr;
+
+    bus_tag += count;                                                           // Tags base..base+count-1 belong to this batch
+    for ( i = 0; i < count; i++ ) {
+        lcloud_client_extract_registers(regs[i], &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        if ( (c0 == LC_BLOCK_COPY) && (bus_features & LCLOUD_FEATURE_COPY) ) {
+            xfer[i] = LC_XFER_COPY;
+            nbo[count + i] = htonll64(*(LCloudRegisterFrame *)bufs[i]);        // The source frame goes in place of data
+        } else if ( c0 == LC_BLOCK_XFER ) {
+            xfer[i] = (int8_t)c2;
+        } else {
+            logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] only carries block transfers [%d]", (int)c0);
+            return( -1 );
+        }
+        nbo[i] = htonll64(regs[i]);
+        hdrs[i].tag = htonl(base + i);
+        hdrs[i].credits = 0;
+        hdrs[i].flags = 0;
+    }
+
+    bus_min_rtt += bus_min_rtt >> 6;                                            // Let the shortest round trip drift up between batches
+    lcloud_client_quickack();
+    while ( done < count ) {
+        inflight = sent - done;
+        room = CMPSC311_MINVAL(bus_credits - inflight - bus_norphans, count - sent);   // Abandoned requests hold credits too
+        cover = (bus_gap > 0) ? (int)(bus_min_rtt / bus_gap) + 1 : bus_credits;    // Frames that keep the server busy for a round trip
+        if ( (room > 0) && ((inflight <= cover) || (room >= bus_coalesce)) && !lcexpired(token) ) {
+            now = lcloud_client_clock();
+            for ( iovcnt = 0, first = sent; sent < first + room; sent++ ) {     // Top up the credit window in one send
+                sent_at[sent] = now;
+                lcloud_client_count_frame(regs[sent], 1);
+                iov[iovcnt].iov_base = &nbo[sent];
+                iov[iovcnt++].iov_len = sizeof(LCloudRegisterFrame);
+                iov[iovcnt].iov_base = &hdrs[sent];
+                iov[iovcnt++].iov_len = sizeof(LCloudTagHeader);
+                if ( xfer[sent] == LC_XFER_WRITE ) {
+                    iov[iovcnt].iov_base = bufs[sent];
+                    iov[iovcnt++].iov_len = LC_DEVICE_BLOCK_SIZE;
+                } else if ( xfer[sent] == LC_XFER_COPY ) {
+                    iov[iovcnt].iov_base = &nbo[count + sent];
+                    iov[iovcnt++].iov_len = sizeof(LCloudRegisterFrame);
+                }
+            }
+            if ( lcloud_client_writev_all(iov, iovcnt) == -1 ) {
+                logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] failure writing requests to socket [%d]", socket_handle);
+                return( -1 );
+            }
+            lcloud_client_count_send(room);
+            lcloud_trace_counter("bus inflight", sent - done);                 // Pipeline depth after the top up
+        }
+
+        if ( (why = lcloud_client_await(token)) != 0 ) {
+            bus_dropped += count - sent;                                        // Given up on, the rest never go out
+            for ( i = 0; (why > 0) && (i < sent); i++ ) {
+                if ( (xfer[i] != -1) && (lcloud_client_orphan(regs[i], base + i) == -1) ) {
+                    why = -1;
+                }
+            }
+            if ( why == -1 ) {
+                logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] failure waiting for responses on socket [%d]", socket_handle);
+            }
+            lcloud_trace_counter("bus inflight", 0);
+            return( -1 );
+        }
+        if ( (lcloud_client_read_all(&rsp, sizeof(rsp)) == -1) || (lcloud_client_read_all(&hdr, sizeof(hdr)) == -1) ) {
+            logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] failure reading response from socket [%d]", socket_handle);
+            return( -1 );
+        }
+        i = (int)(ntohl(hdr.tag) - base);                                       // Completion order is up to the server
+        if ( (i < 0) || (i >= sent) || (xfer[i] == -1) ) {
+            if ( (why = lcloud_client_discard_tag(ntohl(hdr.tag))) == 1 ) {   // A late reply to an abandoned request
+                continue;
+            }
+            if ( why == 0 ) {
+                logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] unexpected response tag [%u]", ntohl(hdr.tag));
+            }
+            return( -1 );
+        }
+        if ( (xfer[i] == LC_XFER_READ) && (lcloud_client_read_all(bufs[i], LC_DEVICE_BLOCK_SIZE) == -1) ) {
+            logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] read error");
+            return( -1 );
+        }
+        lcloud_client_count_frame(regs[i], 0);
+        regs[i] = ntohll64(rsp);
+        xfer[i] = -1;                                                           // Mark the request complete
+
+        now = lcloud_client_clock();                                            // Retune the coalescing target
+        if ( (bus_min_rtt == 0) || (now - sent_at[i] < bus_min_rtt) ) {
+            bus_min_rtt = now - sent_at[i];
+        }
+        if ( (last != 0) && (sent - done > 1) ) {                               // Only gaps while the server had work queued
+            bus_gap = (bus_gap == 0) ? now - last : bus_gap - (bus_gap >> 3) + ((now - last) >> 3);
+        }
+        LC_STAT_SET(bus_rtt, bus_min_rtt);
+        LC_STAT_SET(bus_gap, bus_gap);
+        if ( bus_gap > 0 ) {
+            cover = (int)(bus_min_rtt / bus_gap) + 1;
+            bus_coalesce = CMPSC311_MINVAL(bus_credits - cover, (int)(LC_BUS_MAX_LINGER / bus_gap));
+            bus_coalesce = CMPSC311_MAXVAL(bus_coalesce, 1);
+        }
+        last = now;
+        done++;
+    }
+    lcloud_trace_counter("bus inflight", 0);
+
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_batch
+// Description  : Send a batch of block transfers to the server back to back in
+//                gathered writes, and then collect the responses. A v1 server
+//                handles the frames one at a time and replies in order, so
+//                this just keeps the link busy instead of paying a round trip
+//                per block; over v2 the replies may come back in any order.
+//                A batch of reads under the calling thread's token (see
+//                lcsetcancel) is given up on when the token expires; the
+//                buffers of requests without a reply are left as they were.
+//
+// Inputs       : regs - the request registers (LC_BLOCK_XFER, or LC_BLOCK_COPY
+//                       when the server has LCLOUD_FEATURE_COPY), replaced by
+//                       the response registers in host byte order
+//                bufs - the block to be read/written for each request, or a
+//                       pointer to the source frame of a copy
+//                count - number of requests in the batch
+// Outputs      : 0 if successful test, -1 if failure
+
+int client_lcloud_bus_batch(LCloudRegisterFrame *regs, void **bufs, int count) {
+    LCloudRegisterFrame *nbo;
+    LCloudTagHeader *hdrs;
+    struct iovec *iov;
+    int8_t *xfer;
+    uint64_t *sent_at;
+    int i, ret = -1;
+    size_t scratch;
+    uint64_t start = lcloud_trace_now();
+    const lcloud_cancel *token = lcgetcancel();
+
+    if ( count <= 0 ) {
+        return( 0 );
+    }
+    for ( i = 0; (token != NULL) && (i < count); i++ ) {                        // Only reads are given up on part way
+        if ( (((regs[i] >> 48) & 0xff) != LC_BLOCK_XFER) || (((regs[i] >> 32) & 0xff) != LC_XFER_READ) ) {
+            token = NULL;
+        }
+    }
+    if ( lcloud_client_connect() == -1 ) {
+        return( -1 );
+    }
+    LC_STAT_ADD(bus_batches, 1);
+    LC_STAT_ADD(bus_frames, count);
+
+    scratch = count * (2 * sizeof(LCloudRegisterFrame) + 3 * sizeof(struct iovec) + sizeof(LCloudTagHeader) + 1 + sizeof(uint64_t));
+    lcloud_mem_charge(LC_MEM_BUFFERS, scratch);                                 // Counted against the budget, never refused
+    nbo = malloc(2 * count * sizeof(LCloudRegisterFrame));                      // Network order registers (and copy sources), kept alive for the writev
+    iov = malloc(count * 3 * sizeof(struct iovec));
+    hdrs = malloc(count * sizeof(LCloudTagHeader));
+    xfer = malloc(count);
+    sent_at = malloc(count * sizeof(uint64_t));
+    if ( (nbo == NULL) || (iov == NULL) || (hdrs == NULL) || (xfer == NULL) || (sent_at == NULL) ) {
+        logMessage(LOG_ERROR_LEVEL, "Client IO Bus [Batch] failure allocating batch of [%d]", count);
+    } else if ( bus_protocol == LCLOUD_PROTO_V2 ) {
+        ret = lcloud_client_tagged_batch(regs, bufs, count, nbo, iov, hdrs, xfer, sent_at, token);
+    } else {
+        ret = lcloud_client_batch_xfer(regs, bufs, count, nbo, iov, token);
+    }
+
+    free(nbo);
+    free(iov);
+    free(hdrs);
+    free(xfer);
+    free(sent_at);
+    lcloud_mem_release(LC_MEM_BUFFERS, scratch);
+    lcloud_trace_span("bus batch", "bus", start, count);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_protocol
+// Description  : Get the protocol version negotiated with the server
+//
+// Inputs       : none
+// Outputs      : LCLOUD_PROTO_V1 or LCLOUD_PROTO_V2
+
+int client_lcloud_bus_protocol(void) {
+    return( bus_protocol );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_features
+// Description  : Get the protocol features the server announced at power on
+//
+// Inputs       : none
+// Outputs      : LCLOUD_FEATURE_* bits, 0 for a v1 server
+
+int client_lcloud_bus_features(void) {
+    return( bus_features );
+}
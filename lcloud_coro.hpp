@@ -0,0 +1,488 @@
+#ifndef LCLOUD_CORO_INCLUDED
+#define LCLOUD_CORO_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_coro.hpp
+//  Description    : This is a header-only C++20 coroutine interface to the
+//                   LionCloud driver. Each operation is an awaitable that
+//                   queues an lcloud_aio request (held in the awaiting
+//                   coroutine's frame, so the fast path never allocates) and
+//                   is resumed on the driver thread when the request is done.
+//
+//                   lcloud::task<int> copy_header( const char *path ) {
+//                       lcloud::file f = co_await lcloud::open(path);
+//                       std::array<std::byte, 256> hdr;
+//                       co_return co_await f.read(hdr);
+//                   }
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <lcloud_filesys.h>
+}
+
+namespace lcloud {
+
+namespace detail {
+
+//
+// Awaitable driver request. The lcloud_aio block lives in the awaiter, which
+// lives in the awaiting coroutine's frame until the coroutine is resumed.
+class operation {
+public:
+    operation( const operation & ) = delete;
+    operation &operator=( const operation & ) = delete;
+
+    bool await_ready( void ) const noexcept { return( false ); }
+
+    bool await_suspend( std::coroutine_handle<> waiter ) noexcept {
+        waiter_ = waiter;
+        aio_.complete = &operation::on_complete;
+        aio_.context = this;
+        if ( lcsubmit(&aio_) == -1 ) {                      // Not queued, carry on with the failure
+            aio_.result = -1;
+            return( false );
+        }
+        return( true );                                     // May already be resumed, do not touch *this
+    }
+
+    int await_resume( void ) const noexcept { return( aio_.result ); }
+
+protected:
+    explicit operation( int op ) noexcept : aio_{} { aio_.op = op; aio_.fh = -1; }
+
+    lcloud_aio aio_;                                        // The request handed to the driver
+
+private:
+    static void on_complete( lcloud_aio *aio ) noexcept {  // Driver thread, the result is set
+        static_cast<operation *>(aio->context)->waiter_.resume();
+    }
+
+    std::coroutine_handle<> waiter_;                        // Coroutine to resume on completion
+};
+
+//
+// Awaitable for an operation on an open file
+class file_operation : public operation {
+public:
+    file_operation( int op, LcFHandle fh, char *buf = nullptr, size_t len = 0 ) noexcept : operation(op) {
+        aio_.fh = fh;
+        aio_.buf = buf;
+        aio_.len = len;
+    }
+};
+
+} // namespace detail
+
+class file;
+
+namespace detail {
+
+//
+// Awaitable open, resumes with the RAII file
+class open_operation : public operation {
+public:
+    open_operation( const char *path, int flags ) noexcept : operation(LC_AIO_OPEN) {
+        aio_.path = path;
+        aio_.flags = flags;
+    }
+
+    file await_resume( void ) const noexcept;
+};
+
+} // namespace detail
+
+//
+// RAII file handle. Moving transfers ownership; destroying an open file queues
+// a close without waiting for it (co_await close() to see the result). Note
+// a path can only be open once: opening it again before it is closed gives
+// an empty file, as lcopen fails.
+class file {
+public:
+    file( void ) noexcept = default;
+    explicit file( LcFHandle fh ) noexcept : fh_(fh) {}
+    file( file &&other ) noexcept : fh_(std::exchange(other.fh_, -1)) {}
+    file( const file & ) = delete;
+    file &operator=( const file & ) = delete;
+    ~file() { reset(); }
+
+    file &operator=( file &&other ) noexcept {
+        if ( this != &other ) {
+            reset();
+            fh_ = std::exchange(other.fh_, -1);
+        }
+        return( *this );
+    }
+
+    explicit operator bool( void ) const noexcept { return( fh_ != -1 ); }
+    LcFHandle handle( void ) const noexcept { return( fh_ ); }
+    LcFHandle release( void ) noexcept { return( std::exchange(fh_, -1) ); }
+
+    // Read into buf at the file position, resumes with the bytes read or -1
+    detail::file_operation read( std::span<std::byte> buf ) const noexcept {
+        return( detail::file_operation(LC_AIO_READ, fh_, reinterpret_cast<char *>(buf.data()), buf.size()) );
+    }
+
+    // Write buf at the file position, resumes with the bytes written or -1
+    detail::file_operation write( std::span<const std::byte> buf ) const noexcept {
+        return( detail::file_operation(LC_AIO_WRITE, fh_, const_cast<char *>(reinterpret_cast<const char *>(buf.data())), buf.size()) );
+    }
+
+    // Move the file position, resumes with the new position or -1
+    detail::file_operation seek( size_t off ) const noexcept {
+        return( detail::file_operation(LC_AIO_SEEK, fh_, nullptr, off) );
+    }
+
+    // Write out delayed blocks, resumes with 0 or -1
+    detail::file_operation flush( void ) const noexcept {
+        return( detail::file_operation(LC_AIO_FLUSH, fh_) );
+    }
+
+    // Close the file (giving up the handle), resumes with 0 or -1
+    detail::file_operation close( void ) noexcept {
+        return( detail::file_operation(LC_AIO_CLOSE, release()) );
+    }
+
+private:
+    //
+    // Close queued by the destructor, frees itself when done
+    struct detached_close {
+        lcloud_aio aio;
+        static void on_complete( lcloud_aio *aio ) noexcept { delete static_cast<detached_close *>(aio->context); }
+    };
+
+    void reset( void ) noexcept {
+        detached_close *dc;
+
+        if ( (fh_ != -1) && ((dc = new (std::nothrow) detached_close{}) != nullptr) ) {
+            dc->aio.op = LC_AIO_CLOSE;                      // Otherwise lcshutdown closes it
+            dc->aio.fh = fh_;
+            dc->aio.complete = &detached_close::on_complete;
+            dc->aio.context = dc;
+            if ( lcsubmit(&dc->aio) == -1 ) {
+                delete dc;
+            }
+        }
+        fh_ = -1;
+    }
+
+    LcFHandle fh_ = -1;                                     // Driver handle, -1 when empty
+};
+
+inline file detail::open_operation::await_resume( void ) const noexcept {
+    return( file(aio_.result) );
+}
+
+// Open a file, resumes with the file (empty on failure)
+inline detail::open_operation open( const char *path, int flags = LC_OPEN_DEFAULT ) noexcept {
+    return( detail::open_operation(path, flags) );
+}
+
+namespace detail {
+
+//
+// Resumes the awaiting coroutine when a task finishes
+struct final_awaiter {
+    bool await_ready( void ) const noexcept { return( false ); }
+
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend( std::coroutine_handle<Promise> done ) noexcept {
+        if ( done.promise().continuation ) {
+            return( done.promise().continuation );
+        }
+        return( std::noop_coroutine() );
+    }
+
+    void await_resume( void ) const noexcept {}
+};
+
+struct task_promise_base {
+    std::coroutine_handle<> continuation;                   // Coroutine awaiting the task
+    std::exception_ptr error;                               // Exception the task ended with
+
+    std::suspend_always initial_suspend( void ) const noexcept { return {}; }
+    final_awaiter final_suspend( void ) const noexcept { return {}; }
+    void unhandled_exception( void ) noexcept { error = std::current_exception(); }
+};
+
+template <typename T>
+struct task_promise : task_promise_base {
+    std::optional<T> value;                                 // Value the task returned
+
+    template <typename U>
+    void return_value( U &&v ) { value.emplace(std::forward<U>(v)); }
+
+    T take( void ) {
+        if ( error ) {
+            std::rethrow_exception(error);
+        }
+        return( std::move(*value) );
+    }
+};
+
+template <>
+struct task_promise<void> : task_promise_base {
+    void return_void( void ) noexcept {}
+
+    void take( void ) {
+        if ( error ) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+} // namespace detail
+
+//
+// Lazily started coroutine, runs when first awaited
+template <typename T = void>
+class [[nodiscard]] task {
+public:
+    struct promise_type : detail::task_promise<T> {
+        task get_return_object( void ) noexcept {
+            return( task(std::coroutine_handle<promise_type>::from_promise(*this)) );
+        }
+    };
+
+    task( task &&other ) noexcept : coro_(std::exchange(other.coro_, nullptr)) {}
+    task( const task & ) = delete;
+    task &operator=( const task & ) = delete;
+    ~task() {
+        if ( coro_ ) {
+            coro_.destroy();
+        }
+    }
+
+    task &operator=( task &&other ) noexcept {
+        if ( this != &other ) {
+            if ( coro_ ) {
+                coro_.destroy();
+            }
+            coro_ = std::exchange(other.coro_, nullptr);
+        }
+        return( *this );
+    }
+
+    auto operator co_await( void ) noexcept {
+        struct awaiter {
+            std::coroutine_handle<promise_type> coro;
+
+            bool await_ready( void ) const noexcept { return( coro.done() ); }
+
+            std::coroutine_handle<> await_suspend( std::coroutine_handle<> waiter ) noexcept {
+                coro.promise().continuation = waiter;
+                return( coro );                             // Start the task in place of the waiter
+            }
+
+            T await_resume( void ) { return( coro.promise().take() ); }
+        };
+        return( awaiter{coro_} );
+    }
+
+private:
+    explicit task( std::coroutine_handle<promise_type> coro ) noexcept : coro_(coro) {}
+
+    std::coroutine_handle<promise_type> coro_;              // The task's frame
+};
+
+namespace detail {
+
+//
+// Count of tasks still running in a when_all, and who to resume after them
+struct join_counter {
+    std::atomic<size_t> remaining;
+    std::coroutine_handle<> waiter;
+};
+
+//
+// Wrapper run for each task of a when_all
+struct join_task {
+    struct promise_type {
+        join_counter *counter;
+
+        join_task get_return_object( void ) noexcept {
+            return( join_task{std::coroutine_handle<promise_type>::from_promise(*this)} );
+        }
+        std::suspend_always initial_suspend( void ) const noexcept { return {}; }
+
+        auto final_suspend( void ) noexcept {
+            struct last_out {
+                bool await_ready( void ) const noexcept { return( false ); }
+                std::coroutine_handle<> await_suspend( std::coroutine_handle<promise_type> done ) noexcept {
+                    join_counter *c = done.promise().counter;
+                    if ( c->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1 ) {
+                        return( c->waiter );
+                    }
+                    return( std::noop_coroutine() );
+                }
+                void await_resume( void ) const noexcept {}
+            };
+            return( last_out{} );
+        }
+
+        void return_void( void ) noexcept {}
+        void unhandled_exception( void ) noexcept {}
+    };
+
+    join_task( join_task &&other ) noexcept : coro(std::exchange(other.coro, nullptr)) {}
+    explicit join_task( std::coroutine_handle<promise_type> c ) noexcept : coro(c) {}
+    ~join_task() {
+        if ( coro ) {
+            coro.destroy();
+        }
+    }
+
+    std::coroutine_handle<promise_type> coro;
+};
+
+inline join_task join_one( task<void> &t ) {
+    try {
+        co_await t;
+    } catch ( ... ) {                                       // Kept in the task, rethrown by when_all
+    }
+}
+
+//
+// Starts every wrapper and suspends until the last one finishes
+struct join_awaiter {
+    join_counter &counter;
+    std::vector<join_task> &joins;
+
+    bool await_ready( void ) const noexcept { return( joins.empty() ); }
+
+    bool await_suspend( std::coroutine_handle<> waiter ) noexcept {
+        counter.waiter = waiter;
+        for ( join_task &j : joins ) {
+            j.coro.promise().counter = &counter;
+            j.coro.resume();                                // Runs to its first driver request
+        }
+        return( counter.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1 );
+    }
+
+    void await_resume( void ) const noexcept {}
+};
+
+//
+// Coroutine sync_wait blocks on
+struct sync_state {
+    std::mutex lock;
+    std::condition_variable cond;
+    bool done = false;
+};
+
+struct sync_task {
+    struct promise_type {
+        sync_state *state;
+
+        sync_task get_return_object( void ) noexcept {
+            return( sync_task{std::coroutine_handle<promise_type>::from_promise(*this)} );
+        }
+        std::suspend_always initial_suspend( void ) const noexcept { return {}; }
+
+        auto final_suspend( void ) noexcept {
+            struct notify {
+                bool await_ready( void ) const noexcept { return( false ); }
+                void await_suspend( std::coroutine_handle<promise_type> done ) noexcept {
+                    sync_state *s = done.promise().state;
+                    std::lock_guard<std::mutex> guard(s->lock);
+                    s->done = true;
+                    s->cond.notify_all();
+                }
+                void await_resume( void ) const noexcept {}
+            };
+            return( notify{} );
+        }
+
+        void return_void( void ) noexcept {}
+        void unhandled_exception( void ) noexcept {}
+    };
+
+    std::coroutine_handle<promise_type> coro;
+};
+
+template <typename T>
+sync_task sync_run( task<T> &t, std::optional<T> &out, std::exception_ptr &error ) {
+    try {
+        out.emplace(co_await t);
+    } catch ( ... ) {
+        error = std::current_exception();
+    }
+}
+
+inline sync_task sync_run( task<void> &t, std::exception_ptr &error ) {
+    try {
+        co_await t;
+    } catch ( ... ) {
+        error = std::current_exception();
+    }
+}
+
+inline void sync_block( sync_task waiter ) {
+    sync_state state;
+
+    waiter.coro.promise().state = &state;
+    waiter.coro.resume();
+    std::unique_lock<std::mutex> guard(state.lock);
+    state.cond.wait(guard, [&state] { return( state.done ); });
+    guard.unlock();
+    waiter.coro.destroy();
+}
+
+} // namespace detail
+
+// Run every task concurrently, completes when all have (rethrowing the first
+// exception in task order)
+inline task<void> when_all( std::vector<task<void>> tasks ) {
+    detail::join_counter counter{tasks.size() + 1, nullptr};
+    std::vector<detail::join_task> joins;
+
+    joins.reserve(tasks.size());
+    for ( task<void> &t : tasks ) {
+        joins.push_back(detail::join_one(t));
+    }
+    co_await detail::join_awaiter{counter, joins};
+    for ( task<void> &t : tasks ) {                         // All done, this only collects errors
+        co_await t;
+    }
+}
+
+// Block the calling thread until a task completes, returning its result
+template <typename T>
+T sync_wait( task<T> t ) {
+    std::optional<T> out;
+    std::exception_ptr error;
+
+    detail::sync_block(detail::sync_run(t, out, error));
+    if ( error ) {
+        std::rethrow_exception(error);
+    }
+    return( std::move(*out) );
+}
+
+inline void sync_wait( task<void> t ) {
+    std::exception_ptr error;
+
+    detail::sync_block(detail::sync_run(t, error));
+    if ( error ) {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace lcloud
+
+#endif
@@ -0,0 +1,242 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_coro_test.cpp
+//  Description    : This is the check of the C++20 coroutine interface to the
+//                   LionCloud driver (lcloud_coro.hpp). Against a running
+//                   server it opens, writes, flushes, seeks, reads back and
+//                   closes files with co_await, one file alone and then
+//                   several at once, and checks the data, that every request
+//                   resumes its coroutine from the driver's completion path,
+//                   that files move but do not copy, and that awaiting a
+//                   request allocates nothing.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <unistd.h>
+
+// Project Includes
+extern "C" {
+#include <cmpsc311_log.h>
+#include <lcloud_support.h>
+}
+#include <lcloud_coro.hpp>
+
+// Defines
+#define LCLOUD_CORO_ARGUMENTS "hvn:l:"
+#define USAGE                                                                   \
+    "USAGE: lcloud_coro_test [-h] [-v] [-n <files>] [-l <logfile>]\n"           \
+    "\n"                                                                        \
+    "where:\n"                                                                  \
+    "    -h - help mode (display this message)\n"                               \
+    "    -v - verbose output\n"                                                 \
+    "    -n - write and read back <files> files at once (default 8)\n"          \
+    "    -l - write log messages to the filename <logfile>\n"                   \
+    "\n"                                                                        \
+    "    The LionCloud server must be running on the default port.\n"           \
+    "\n"
+#define LC_CORO_BYTES       10000   // Bytes written to each file, several clusters and a partial one
+#define LC_CORO_MAX_FILES   64      // Most files run at once
+
+// Files are handles to be moved, never copied
+static_assert(!std::is_copy_constructible_v<lcloud::file> && !std::is_copy_assignable_v<lcloud::file>,
+              "lcloud::file must not be copyable");
+static_assert(std::is_nothrow_move_constructible_v<lcloud::file> && std::is_nothrow_move_assignable_v<lcloud::file>,
+              "lcloud::file must move without throwing");
+static_assert(!std::is_copy_constructible_v<lcloud::task<int>> && std::is_nothrow_move_constructible_v<lcloud::task<int>>,
+              "lcloud::task must be move-only");
+
+//
+// Global Variables
+thread_local long   allocations;                            // Calls to operator new from the calling thread
+std::atomic<int>    checks, failures;                       // Checks made, and failed
+std::thread::id     main_thread;                            // Thread that runs sync_wait
+
+//
+// Allocation counting, every operator new goes through these. Counts are per
+// thread, as other tasks may still be starting on the main thread while a
+// request's completion resumes a file's frame on the driver thread.
+
+void *operator new( std::size_t n ) {
+    void *p;
+
+    allocations++;
+    if ( (p = std::malloc((n > 0) ? n : 1)) == nullptr ) {
+        throw std::bad_alloc();
+    }
+    return( p );
+}
+
+void *operator new( std::size_t n, const std::nothrow_t & ) noexcept {
+    allocations++;
+    return( std::malloc((n > 0) ? n : 1) );
+}
+
+void operator delete( void *p ) noexcept { std::free(p); }
+void operator delete( void *p, std::size_t ) noexcept { std::free(p); }
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : check
+// Description  : Record the outcome of one check, logging a failure
+//
+// Inputs       : ok - whether the check passed
+//                path - the file checked
+//                what - what was checked
+// Outputs      : ok
+
+bool check( bool ok, const char *path, const char *what ) {
+    checks++;
+    if ( !ok ) {
+        failures++;
+        logMessage(LOG_ERROR_LEVEL, "Coroutine check failed on [%s]: %s", path, what);
+    }
+    return( ok );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : round_trip
+// Description  : Write a file, flush it and read it back, by co_await. Once the
+//                file is open every request is awaited with the driver
+//                thread's allocation count held still, as the requests live
+//                in this frame.
+//
+// Inputs       : path - the file to write
+//                seed - first byte of the data, to tell the files apart
+// Outputs      : bytes read back, -1 if failure
+
+lcloud::task<int> round_trip( const char *path, int seed ) {
+    std::array<std::byte, LC_CORO_BYTES> out, in;
+    long before;
+    int got;
+
+    for ( size_t i = 0; i < out.size(); i++ ) {
+        out[i] = static_cast<std::byte>((seed + i * 7) & 0xff);
+    }
+
+    lcloud::file opened = co_await lcloud::open(path);
+    if ( !check(static_cast<bool>(opened), path, "open") ) {
+        co_return( -1 );
+    }
+    check(std::this_thread::get_id() != main_thread, path, "open resumed on the driver thread");
+    lcloud::file f = std::move(opened);                     // The handle moves, the source is left empty
+    check(!opened && (f.handle() != -1), path, "move of an open file");
+
+    before = allocations;                                   // On the driver thread, which resumes every request
+    check(co_await f.write(out) == (int)out.size(), path, "write");
+    check(co_await f.flush() == 0, path, "flush");
+    check(co_await f.seek(0) == 0, path, "seek to the start");
+    got = co_await f.read(in);
+    check((std::this_thread::get_id() != main_thread) && (allocations == before), path, "requests awaited without allocating");
+    check((got == (int)in.size()) && (std::memcmp(in.data(), out.data(), in.size()) == 0), path, "read back");
+    check(co_await f.close() == 0, path, "close");
+    check(!f, path, "close gives up the handle");
+
+    co_return( got );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : round_trip_all
+// Description  : A round trip as a task of a when_all
+//
+// Inputs       : path - the file to write
+//                seed - first byte of the data
+// Outputs      : none
+
+lcloud::task<void> round_trip_all( const char *path, int seed ) {
+    check(co_await round_trip(path, seed) == LC_CORO_BYTES, path, "round trip");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the coroutine check
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if every check passed, 1 if not, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    char paths[LC_CORO_MAX_FILES][32];
+    std::vector<lcloud::task<void>> tasks;
+    int ch, i, nfiles = 8, verbose = 0, log_initialized = 0;
+
+    // Process the command line parameters
+    while ( (ch = getopt(argc, argv, LCLOUD_CORO_ARGUMENTS)) != -1 ) {
+        switch ( ch ) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return( -1 );
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'n': // Files at once
+            nfiles = atoi(optarg);
+            if ( (nfiles < 1) || (nfiles > LC_CORO_MAX_FILES) ) {
+                fprintf(stderr, "Bad file count (%s), must be 1 to %d, aborting.\n", optarg, LC_CORO_MAX_FILES);
+                return( -1 );
+            }
+            break;
+
+        case 'l': // Set the log filename
+            initializeLogWithFilename(optarg);
+            log_initialized = 1;
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return( -1 );
+        }
+    }
+
+    // Setup the log as needed
+    if ( !log_initialized ) {
+        initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    }
+    LcControllerLLevel = registerLogLevel("LCLOUD_CONTROLLER", 0);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    LcSimulatorLLevel = registerLogLevel("LCLOUD_SIMULATOR", 0);
+    if ( verbose ) {
+        enableLogLevels(LOG_INFO_LEVEL);
+        enableLogLevels(LcControllerLLevel | LcDriverLLevel | LcSimulatorLLevel);
+    }
+    main_thread = std::this_thread::get_id();
+
+    // One file alone, its result handed back through sync_wait
+    check(lcloud::sync_wait(round_trip("coro-single", 1)) == LC_CORO_BYTES, "coro-single", "round trip");
+
+    // Then every file at once, their requests interleaved on the driver
+    tasks.reserve(nfiles);
+    for ( i = 0; i < nfiles; i++ ) {
+        snprintf(paths[i], sizeof(paths[i]), "coro-%02d", i);
+        tasks.push_back(round_trip_all(paths[i], i + 2));
+    }
+    lcloud::sync_wait(lcloud::when_all(std::move(tasks)));
+
+    // Stop the driver thread and the devices
+    if ( (lcdrain() == -1) || (lcshutdown() == -1) ) {
+        logMessage(LOG_ERROR_LEVEL, "Coroutine check failed shutting down the driver");
+        failures++;
+    }
+    printf("lcloud_coro_test: %d checks, %d failed\n", checks.load(), failures.load());
+    freeLogRegistrations();
+
+    return( (failures > 0) ? 1 : 0 );
+}
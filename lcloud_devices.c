@@ -0,0 +1,310 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_devices.c
+//  Description    : This is the in-memory emulation of the LionCloud devices.
+//                   It follows the register protocol of the stock server, so
+//                   a driver can not tell the two apart.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmpsc311_log.h>
+#include <lcloud_devices.h>
+#include <lcloud_network.h>
+
+//
+// Device structure
+typedef struct {
+    LcDeviceState   state;          // Uninitialized until the manifest lists it, online after DEVINIT
+    int             present;        // 1 if the manifest lists the device (set last, devices can arrive while serving)
+    int             sectors;        // Number of sectors on the device
+    int             blocks;         // Number of blocks in each sector
+    int             latency;        // Service time of one block transfer (microseconds)
+    int             bandwidth;      // Transfer rate (MB/s), 0 if only the latency counts
+    int             qdepth;         // Transfers the device serves at once
+    char           *data;           // Contents of the device, sectors * blocks * LC_DEVICE_BLOCK_SIZE bytes
+} lcloud_emudev;
+
+//
+// Global Variables
+lcloud_emudev       emu_devices[LC_MAX_DEVICES];                // The devices on the bus
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_pack_registers
+// Description  : Pack the register values into a register frame
+//
+// Inputs       : b0, b1, c0, c1, c2, d0, d1 - the register values
+// Outputs      : the register frame
+
+LCloudRegisterFrame lcloud_pack_registers( int b0, int b1, int c0, int c1, int c2, int d0, int d1 ) {
+    return( ((LCloudRegisterFrame)(b0 & 0xf) << 60) | ((LCloudRegisterFrame)(b1 & 0xf) << 56) |
+            ((LCloudRegisterFrame)(c0 & 0xff) << 48) | ((LCloudRegisterFrame)(c1 & 0xff) << 40) |
+            ((LCloudRegisterFrame)(c2 & 0xff) << 32) | ((LCloudRegisterFrame)(d0 & 0xffff) << 16) |
+            (LCloudRegisterFrame)(d1 & 0xffff) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_unpack_registers
+// Description  : Unpack a register frame into the register values
+//
+// Inputs       : frm - the register frame
+//                pointers - pointers to registers to place the extraction
+// Outputs      : none
+
+void lcloud_unpack_registers( LCloudRegisterFrame frm, int *b0, int *b1, int *c0, int *c1, int *c2, int *d0, int *d1 ) {
+    *b0 = (frm >> 60) & 0xf;
+    *b1 = (frm >> 56) & 0xf;
+    *c0 = (frm >> 48) & 0xff;
+    *c1 = (frm >> 40) & 0xff;
+    *c2 = (frm >> 32) & 0xff;
+    *d0 = (frm >> 16) & 0xffff;
+    *d1 = frm & 0xffff;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devices_load
+// Description  : Create the devices listed in a hardware manifest. Each line is
+//                "<device> <sectors> <blocks> [latency-usec [MBps [qdepth]]]",
+//                lines starting with '#' are comments.
+//
+// Inputs       : manifest - the path of the manifest file
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_devices_load( const char *manifest ) {
+    memset(emu_devices, 0, sizeof(emu_devices));
+    if ( lcloud_devices_attach(manifest) == -1 ) {
+        lcloud_devices_release();
+        return( -1 );
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devices_attach
+// Description  : Add the devices listed in a hardware manifest to the bus, as
+//                if plugged in; a driver finds them at its next probe. Each
+//                device is complete before it shows up as present, so this
+//                can run while drivers are being served. The devices must
+//                not be on the bus already.
+//
+// Inputs       : manifest - the path of the manifest file
+// Outputs      : 0 if successful, -1 if failure (earlier lines stay attached)
+
+int lcloud_devices_attach( const char *manifest ) {
+    char line[256];
+    int dev, sectors, blocks, latency, bandwidth, qdepth, fields, lineno = 0;
+    FILE *fp;
+
+    if ( (fp = fopen(manifest, "r")) == NULL ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure opening hardware manifest [%s]", manifest);
+        return( -1 );
+    }
+
+    while ( fgets(line, sizeof(line), fp) != NULL ) {
+        lineno++;
+        latency = bandwidth = 0;
+        qdepth = 1;
+        if ( (line[0] == '#') ||
+             ((fields = sscanf(line, "%d %d %d %d %d %d", &dev, &sectors, &blocks, &latency, &bandwidth, &qdepth)) <= 0) ) {
+            continue;                                                       // Comment or blank line
+        }
+        if ( (fields < 3) || (dev < 0) || (dev >= LC_MAX_DEVICES) || emu_devices[dev].present ||
+             (sectors <= 0) || (sectors > 0xffff) || (blocks <= 0) || (blocks > 0xffff) || (latency < 0) ||
+             (bandwidth < 0) || (qdepth <= 0) ) {
+            logMessage(LOG_ERROR_LEVEL, "Bad device definition in manifest [%s:%d]", manifest, lineno);
+            fclose(fp);
+            return( -1 );
+        }
+
+        emu_devices[dev].sectors = sectors;
+        emu_devices[dev].blocks = blocks;
+        emu_devices[dev].latency = latency;
+        emu_devices[dev].bandwidth = bandwidth;
+        emu_devices[dev].qdepth = qdepth;
+        if ( (emu_devices[dev].data = calloc((size_t)sectors * blocks, LC_DEVICE_BLOCK_SIZE)) == NULL ) {
+            logMessage(LOG_ERROR_LEVEL, "Failure allocating device [%d] [%d:%d]", dev, sectors, blocks);
+            fclose(fp);
+            return( -1 );
+        }
+        __atomic_store_n(&emu_devices[dev].present, 1, __ATOMIC_RELEASE);
+        logMessage(LOG_INFO_LEVEL, "Created device [%d] [sectors:blocks] [%d:%d] latency %d usec, %d MB/s, depth %d",
+                   dev, sectors, blocks, latency, bandwidth, qdepth);
+    }
+
+    fclose(fp);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devices_execute
+// Description  : Carry out one bus request against the devices. For a block
+//                read buf receives the data (zeroed if the request fails), for
+//                a write it holds the data.
+//
+// Inputs       : req - the request register frame
+//                buf - LC_DEVICE_BLOCK_SIZE buffer for block transfers
+// Outputs      : the response register frame
+
+LCloudRegisterFrame lcloud_devices_execute( LCloudRegisterFrame req, void *buf ) {
+    int b0, b1, c0, c1, c2, d0, d1, id, probe = 0;
+    lcloud_emudev *dev;
+    char *blk;
+
+    lcloud_unpack_registers(req, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+    switch ( c0 ) {
+    case LC_POWER_ON:
+    case LC_POWER_OFF:
+        return( lcloud_pack_registers(1, LC_SUCCESS, c0, 0, 0, 0, 0) );
+
+    case LC_DEVPROBE:
+        for ( id = 0; id < LC_MAX_DEVICES; id++ ) {                         // One bit per device present
+            if ( __atomic_load_n(&emu_devices[id].present, __ATOMIC_ACQUIRE) ) {
+                probe |= (1 << id);
+            }
+        }
+        return( lcloud_pack_registers(1, LC_SUCCESS, c0, 0, 0, probe, 0) );
+
+    case LC_DEVINIT:
+        if ( (c1 >= LC_MAX_DEVICES) || (!__atomic_load_n(&emu_devices[c1].present, __ATOMIC_ACQUIRE)) ) {
+            logMessage(LOG_ERROR_LEVEL, "Init for unknown device [%d], failure.", c1);
+            return( lcloud_pack_registers(1, LC_NO_DEVICE, c0, 0, c1, 0, 0) );
+        }
+        emu_devices[c1].state = LC_DEVICE_ONLINE;
+        return( lcloud_pack_registers(1, LC_SUCCESS, c0, 0, c1, emu_devices[c1].sectors, emu_devices[c1].blocks) );
+
+    case LC_BLOCK_XFER:
+        if ( (c1 >= LC_MAX_DEVICES) || (emu_devices[c1].state != LC_DEVICE_ONLINE) ) {
+            logMessage(LOG_ERROR_LEVEL, "Block transfer for unknown device [%d], failure", c1);
+            b1 = LC_NO_DEVICE;
+        } else if ( (d0 >= emu_devices[c1].sectors) || (d1 >= emu_devices[c1].blocks) ||
+                    ((c2 != LC_XFER_READ) && (c2 != LC_XFER_WRITE)) ) {
+            logMessage(LOG_ERROR_LEVEL, "Block transfer bad sector [%d], failure", d0);
+            b1 = LC_BAD_PARAMS;
+        } else {
+            dev = &emu_devices[c1];
+            blk = &dev->data[((size_t)d0 * dev->blocks + d1) * LC_DEVICE_BLOCK_SIZE];
+            if ( c2 == LC_XFER_READ ) {
+                memcpy(buf, blk, LC_DEVICE_BLOCK_SIZE);
+            } else {
+                memcpy(blk, buf, LC_DEVICE_BLOCK_SIZE);
+            }
+            return( lcloud_pack_registers(1, LC_SUCCESS, c0, c1, c2, d0, d1) );
+        }
+        if ( c2 == LC_XFER_READ ) {
+            memset(buf, 0, LC_DEVICE_BLOCK_SIZE);
+        }
+        return( lcloud_pack_registers(1, b1, c0, c1, c2, d0, d1) );
+
+    default:
+        logMessage(LOG_ERROR_LEVEL, "Failed deconstructing register frame [%lx]", (unsigned long)req);
+        return( (LCloudRegisterFrame)-1 );
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devices_copy
+// Description  : Copy one block from the source address to the destination,
+//                without the data crossing the bus
+//
+// Inputs       : req - the LC_BLOCK_COPY request frame (destination address)
+//                src - the source frame (source address)
+// Outputs      : the response register frame
+
+LCloudRegisterFrame lcloud_devices_copy( LCloudRegisterFrame req, LCloudRegisterFrame src ) {
+    int b0, b1, c0, c1, c2, d0, d1, sc1, sd0, sd1;
+    lcloud_emudev *dst, *from;
+
+    lcloud_unpack_registers(src, &b0, &b1, &c0, &sc1, &c2, &sd0, &sd1);
+    lcloud_unpack_registers(req, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+    if ( (c1 >= LC_MAX_DEVICES) || (emu_devices[c1].state != LC_DEVICE_ONLINE) ||
+         (sc1 >= LC_MAX_DEVICES) || (emu_devices[sc1].state != LC_DEVICE_ONLINE) ) {
+        logMessage(LOG_ERROR_LEVEL, "Block copy for unknown device [%d -> %d], failure", sc1, c1);
+        return( lcloud_pack_registers(1, LC_NO_DEVICE, LC_BLOCK_COPY, c1, 0, d0, d1) );
+    }
+    dst = &emu_devices[c1];
+    from = &emu_devices[sc1];
+    if ( (d0 >= dst->sectors) || (d1 >= dst->blocks) || (sd0 >= from->sectors) || (sd1 >= from->blocks) ) {
+        logMessage(LOG_ERROR_LEVEL, "Block copy bad address [%d/%d/%d -> %d/%d/%d], failure", sc1, sd0, sd1, c1, d0, d1);
+        return( lcloud_pack_registers(1, LC_BAD_PARAMS, LC_BLOCK_COPY, c1, 0, d0, d1) );
+    }
+
+    memmove(&dst->data[((size_t)d0 * dst->blocks + d1) * LC_DEVICE_BLOCK_SIZE],
+            &from->data[((size_t)sd0 * from->blocks + sd1) * LC_DEVICE_BLOCK_SIZE], LC_DEVICE_BLOCK_SIZE);
+    return( lcloud_pack_registers(1, LC_SUCCESS, LC_BLOCK_COPY, c1, 0, d0, d1) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devices_latency
+// Description  : Get the service time of one block transfer on a device
+//
+// Inputs       : dev_id - the device
+// Outputs      : latency in microseconds, 0 for unknown devices
+
+int lcloud_devices_latency( int dev_id ) {
+    if ( (dev_id < 0) || (dev_id >= LC_MAX_DEVICES) ) {
+        return( 0 );
+    }
+    return( emu_devices[dev_id].latency );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devices_bandwidth
+// Description  : Get the transfer rate of a device
+//
+// Inputs       : dev_id - the device
+// Outputs      : bandwidth in MB/s, 0 if not given or the device is unknown
+
+int lcloud_devices_bandwidth( int dev_id ) {
+    if ( (dev_id < 0) || (dev_id >= LC_MAX_DEVICES) ) {
+        return( 0 );
+    }
+    return( emu_devices[dev_id].bandwidth );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devices_qdepth
+// Description  : Get the number of transfers a device serves at once
+//
+// Inputs       : dev_id - the device
+// Outputs      : queue depth, 1 for unknown devices
+
+int lcloud_devices_qdepth( int dev_id ) {
+    if ( (dev_id < 0) || (dev_id >= LC_MAX_DEVICES) || (emu_devices[dev_id].qdepth == 0) ) {
+        return( 1 );
+    }
+    return( emu_devices[dev_id].qdepth );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_devices_release
+// Description  : Free the devices and their contents
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_devices_release( void ) {
+    int id;
+
+    for ( id = 0; id < LC_MAX_DEVICES; id++ ) {
+        free(emu_devices[id].data);
+    }
+    memset(emu_devices, 0, sizeof(emu_devices));
+    return( 0 );
+}
@@ -0,0 +1,53 @@
+#ifndef LCLOUD_DEVICES_INCLUDED
+#define LCLOUD_DEVICES_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_devices.h
+//  Description    : This is the interface of the in-memory emulation of the
+//                   LionCloud devices, as described by a hardware manifest.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdint.h>
+#include <lcloud_controller.h>
+
+// Defines
+#define LC_MAX_DEVICES 16       // Devices addressable on the bus (bits of the probe mask)
+
+//
+// Functional Prototypes
+
+LCloudRegisterFrame lcloud_pack_registers( int b0, int b1, int c0, int c1, int c2, int d0, int d1 );
+    // Pack the register values into a register frame
+
+void lcloud_unpack_registers( LCloudRegisterFrame frm, int *b0, int *b1, int *c0, int *c1, int *c2, int *d0, int *d1 );
+    // Unpack a register frame into the register values
+
+int lcloud_devices_load( const char *manifest );
+    // Create the devices listed in a hardware manifest
+
+int lcloud_devices_attach( const char *manifest );
+    // Add the devices listed in a hardware manifest, while serving
+
+LCloudRegisterFrame lcloud_devices_execute( LCloudRegisterFrame req, void *buf );
+    // Carry out one bus request against the devices, returning the response
+
+LCloudRegisterFrame lcloud_devices_copy( LCloudRegisterFrame req, LCloudRegisterFrame src );
+    // Copy one block between device addresses (LC_BLOCK_COPY), returning the response
+
+int lcloud_devices_latency( int dev_id );
+    // Get the service time of one block transfer on a device (microseconds)
+
+int lcloud_devices_bandwidth( int dev_id );
+    // Get the transfer rate of a device (MB/s), 0 if only its latency counts
+
+int lcloud_devices_qdepth( int dev_id );
+    // Get the number of transfers a device serves at once
+
+int lcloud_devices_release( void );
+    // Free the devices and their contents
+
+#endif
@@ -0,0 +1,574 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_devsrv.c
+//  Description    : This is the in-tree LionCloud device server. It serves the
+//                   emulated devices of a hardware manifest over the bus
+//                   protocol, and speaks protocol v2 (tagged requests with
+//                   out-of-order completion) to drivers that ask for it at
+//                   LC_POWER_ON. Over v2 it also copies blocks between device
+//                   addresses itself (LC_BLOCK_COPY).
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+#include <lcloud_controller.h>
+#include <lcloud_network.h>
+#include <lcloud_devices.h>
+
+// Defines
+#define LCLOUD_DEVSRV_ARGUMENTS "hvca:l:p:"
+#define USAGE                                                                   \
+    "USAGE: lcloud_devsrv [-h] [-v] [-c] [-a <manifest>] [-l <logfile>] [-p <port>] <hardware-manifest>\n" \
+    "\n"                                                                        \
+    "where:\n"                                                                  \
+    "    -h - help mode (display this message)\n"                               \
+    "    -v - verbose output\n"                                                 \
+    "    -c - serve many connections at once (default, one at a time)\n"       \
+    "    -a - plug in the devices of <manifest> when sent SIGUSR1\n"          \
+    "    -l - write log messages to the filename <logfile>\n"                   \
+    "    -p - port number to listen on.\n"                                      \
+    "\n"                                                                        \
+    "    <hardware-manifest> - file containing the simulated hardware definitions\n" \
+    "                          (<device> <sectors> <blocks> [latency-usec] per line)\n" \
+    "\n"
+
+//
+// Request structure, one per v2 block transfer in flight
+typedef struct lcloud_srvreq {
+    LCloudRegisterFrame     frm;                        // Request registers (host byte order)
+    LCloudRegisterFrame     src;                        // Source frame of a block copy (host byte order)
+    uint32_t                tag;                        // Tag to echo in the response
+    char                    data[LC_DEVICE_BLOCK_SIZE]; // Block written, or read back
+    struct lcloud_srvreq   *next;                       // Next request queued for the device
+} lcloud_srvreq;
+
+//
+// Connection structure, the state shared by the reader and device workers
+typedef struct {
+    int                 sock;                           // Socket of the driver
+    int                 credits;                        // Requests the driver may have in flight
+    int                 inflight;                       // Block transfers queued or being served
+    int                 closing;                        // Set when the workers should exit
+    lcloud_srvreq      *head[LC_MAX_DEVICES];           // Per-device queues of block transfers
+    lcloud_srvreq      *tail[LC_MAX_DEVICES];
+    pthread_t           workers[LC_MAX_DEVICES];        // One worker per device serves its queue
+    pthread_mutex_t     lock;                           // Protects the queues and counters
+    pthread_cond_t      work[LC_MAX_DEVICES];           // Signals a device worker of new requests
+    pthread_cond_t      idle;                           // Signals the reader that nothing is in flight
+    pthread_mutex_t     send_lock;                      // Keeps responses whole on the socket
+} lcloud_conn;
+
+//
+// Worker structure, the argument of a device worker thread
+typedef struct {
+    lcloud_conn        *conn;                           // Connection being served
+    int                 dev_id;                         // Device whose queue the worker serves
+} lcloud_worker;
+
+//
+// Global Data
+int verbose;
+int concurrent;                                             // Serve each connection on its own thread
+const char *hotplug;                                        // Manifest of devices plugged in on SIGUSR1, or NULL
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devsrv_read_all
+// Description  : Read exactly len bytes from the socket, retrying short reads
+//
+// Inputs       : sock - the socket
+//                buf - place to put the data
+//                len - number of bytes to read
+// Outputs      : 0 if successful, -1 if failure or the peer closed
+
+int devsrv_read_all( int sock, void *buf, size_t len ) {
+    ssize_t got;
+    size_t done = 0;
+
+    while ( done < len ) {
+        if ( (got = read(sock, (char *)buf + done, len - done)) <= 0 ) {
+            if ( (got == -1) && (errno == EINTR) ) {
+                continue;
+            }
+            return( -1 );
+        }
+        done += got;
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devsrv_send
+// Description  : Send one response (registers, v2 tag header and read data) in
+//                a single gathered write
+//
+// Inputs       : conn - the connection
+//                rsp - response registers (host byte order)
+//                hdr - tag header to send, NULL for v1
+//                data - block read, NULL if none
+// Outputs      : 0 if successful, -1 if failure
+
+int devsrv_send( lcloud_conn *conn, LCloudRegisterFrame rsp, LCloudTagHeader *hdr, char *data ) {
+    LCloudRegisterFrame nbo = htonll64(rsp);
+    struct iovec iov[3], *vp = iov;
+    int iovcnt = 0, ret = 0;
+    ssize_t sent;
+
+    iov[iovcnt].iov_base = &nbo;
+    iov[iovcnt++].iov_len = sizeof(nbo);
+    if ( hdr != NULL ) {
+        iov[iovcnt].iov_base = hdr;
+        iov[iovcnt++].iov_len = LCLOUD_NET_TAG_SIZE;
+    }
+    if ( data != NULL ) {
+        iov[iovcnt].iov_base = data;
+        iov[iovcnt++].iov_len = LC_DEVICE_BLOCK_SIZE;
+    }
+
+    pthread_mutex_lock(&conn->send_lock);
+    while ( iovcnt > 0 ) {
+        if ( (sent = writev(conn->sock, vp, iovcnt)) == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            ret = -1;
+            break;
+        }
+        while ( (iovcnt > 0) && (sent >= vp->iov_len) ) {   // Skip the buffers sent in full
+            sent -= vp->iov_len;
+            vp++;
+            iovcnt--;
+        }
+        if ( iovcnt > 0 ) {                                 // Advance into a partially sent buffer
+            vp->iov_base = (char *)vp->iov_base + sent;
+            vp->iov_len -= sent;
+        }
+    }
+    pthread_mutex_unlock(&conn->send_lock);
+
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devsrv_worker
+// Description  : Serve the queue of one device, completing each transfer as
+//                soon as the device is done with it. Devices never wait on one
+//                another, so a slow device only delays its own replies.
+//
+// Inputs       : arg - the lcloud_worker of the thread
+// Outputs      : NULL
+
+void *devsrv_worker( void *arg ) {
+    lcloud_worker *wrk = (lcloud_worker *)arg;
+    lcloud_conn *conn = wrk->conn;
+    int id = wrk->dev_id, b0, b1, c0, c1, c2, d0, d1, latency;
+    LCloudRegisterFrame rsp;
+    LCloudTagHeader hdr;
+    lcloud_srvreq *req;
+
+    pthread_mutex_lock(&conn->lock);
+    while ( 1 ) {
+        while ( (conn->head[id] == NULL) && (!conn->closing) ) {
+            pthread_cond_wait(&conn->work[id], &conn->lock);
+        }
+        if ( (req = conn->head[id]) == NULL ) {             // Closing and the queue is drained
+            break;
+        }
+        if ( (conn->head[id] = req->next) == NULL ) {
+            conn->tail[id] = NULL;
+        }
+        pthread_mutex_unlock(&conn->lock);
+
+        lcloud_unpack_registers(req->frm, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        latency = lcloud_devices_latency(c1);
+        if ( c0 == LC_BLOCK_COPY ) {                        // A copy reads the source, then writes here
+            latency += lcloud_devices_latency((req->src >> 40) & 0xff);
+        }
+        if ( latency > 0 ) {                                // Model the device's service time
+            usleep(latency);
+        }
+        if ( c0 == LC_BLOCK_COPY ) {
+            rsp = lcloud_devices_copy(req->frm, req->src);
+        } else {
+            rsp = lcloud_devices_execute(req->frm, req->data);
+        }
+        pthread_mutex_lock(&conn->lock);                    // Free the credit before the reply hands it back
+        if ( --conn->inflight == 0 ) {
+            pthread_cond_broadcast(&conn->idle);
+        }
+        pthread_mutex_unlock(&conn->lock);
+
+        hdr.tag = htonl(req->tag);
+        hdr.credits = htons(1);                             // Hand back the credit of the request
+        hdr.flags = 0;
+        devsrv_send(conn, rsp, &hdr, ((c0 == LC_BLOCK_XFER) && (c2 == LC_XFER_READ)) ? req->data : NULL);
+        free(req);
+
+        pthread_mutex_lock(&conn->lock);
+    }
+    pthread_mutex_unlock(&conn->lock);
+
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devsrv_start_workers
+// Description  : Start the device workers once a connection moves to v2
+//
+// Inputs       : conn - the connection
+//                wrks - LC_MAX_DEVICES worker arguments
+// Outputs      : 0 if successful, -1 if failure
+
+int devsrv_start_workers( lcloud_conn *conn, lcloud_worker *wrks ) {
+    int id;
+
+    for ( id = 0; id < LC_MAX_DEVICES; id++ ) {
+        wrks[id].conn = conn;
+        wrks[id].dev_id = id;
+        if ( pthread_create(&conn->workers[id], NULL, devsrv_worker, &wrks[id]) != 0 ) {
+            logMessage(LOG_ERROR_LEVEL, "Failure starting worker for device [%d]", id);
+            return( -1 );
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devsrv_queue
+// Description  : Queue a v2 block transfer on its device, enforcing the
+//                driver's credits
+//
+// Inputs       : conn - the connection
+//                req - the request to queue
+// Outputs      : 0 if successful, -1 if the driver overran its credits
+
+int devsrv_queue( lcloud_conn *conn, lcloud_srvreq *req ) {
+    int b0, b1, c0, c1, c2, d0, d1, id;
+
+    lcloud_unpack_registers(req->frm, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+    id = (c1 < LC_MAX_DEVICES) ? c1 : 0;                    // Unknown devices fail in the emulator
+
+    pthread_mutex_lock(&conn->lock);
+    if ( conn->inflight >= conn->credits ) {
+        pthread_mutex_unlock(&conn->lock);
+        logMessage(LOG_ERROR_LEVEL, "Driver exceeded its [%d] credits, dropping connection", conn->credits);
+        return( -1 );
+    }
+    conn->inflight++;
+    req->next = NULL;
+    if ( conn->tail[id] == NULL ) {
+        conn->head[id] = req;
+    } else {
+        conn->tail[id]->next = req;
+    }
+    conn->tail[id] = req;
+    pthread_cond_signal(&conn->work[id]);
+    pthread_mutex_unlock(&conn->lock);
+
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devsrv_serve
+// Description  : Serve one driver connection until power off or hang up. Block
+//                transfers of a v2 connection are queued to the device workers,
+//                every other request waits for the transfers in flight and is
+//                answered in place.
+//
+// Inputs       : sock - the connected socket
+// Outputs      : 0 if the driver powered off, -1 otherwise
+
+int devsrv_serve( int sock ) {
+    int b0, b1, c0, c1, c2, d0, d1, id, started = 0, proto = LCLOUD_PROTO_V1, ret = -1;
+    lcloud_worker wrks[LC_MAX_DEVICES];
+    LCloudRegisterFrame frm, rsp;
+    LCloudTagHeader hdr;
+    lcloud_srvreq *req;
+    lcloud_conn conn;
+    char data[LC_DEVICE_BLOCK_SIZE];
+
+    memset(&conn, 0, sizeof(conn));
+    conn.sock = sock;
+    conn.credits = 1;
+    pthread_mutex_init(&conn.lock, NULL);
+    pthread_mutex_init(&conn.send_lock, NULL);
+    pthread_cond_init(&conn.idle, NULL);
+    for ( id = 0; id < LC_MAX_DEVICES; id++ ) {
+        pthread_cond_init(&conn.work[id], NULL);
+    }
+
+    while ( devsrv_read_all(sock, &frm, sizeof(frm)) == 0 ) {
+        frm = ntohll64(frm);
+        lcloud_unpack_registers(frm, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        if ( (proto == LCLOUD_PROTO_V2) && (devsrv_read_all(sock, &hdr, sizeof(hdr)) == -1) ) {
+            break;
+        }
+
+        if ( (proto == LCLOUD_PROTO_V2) && ((c0 == LC_BLOCK_XFER) || (c0 == LC_BLOCK_COPY)) ) {
+            if ( (req = malloc(sizeof(lcloud_srvreq))) == NULL ) {
+                logMessage(LOG_ERROR_LEVEL, "Failure allocating request, dropping connection");
+                break;
+            }
+            req->frm = frm;
+            req->tag = ntohl(hdr.tag);
+            req->src = 0;
+            if ( ((c0 == LC_BLOCK_COPY) && (devsrv_read_all(sock, &req->src, sizeof(req->src)) == -1)) ||
+                 ((c0 == LC_BLOCK_XFER) && (c2 == LC_XFER_WRITE) && (devsrv_read_all(sock, req->data, LC_DEVICE_BLOCK_SIZE) == -1)) ) {
+                free(req);
+                break;
+            }
+            req->src = ntohll64(req->src);
+            if ( devsrv_queue(&conn, req) == -1 ) {
+                free(req);
+                break;
+            }
+            continue;
+        }
+
+        if ( (c0 == LC_BLOCK_XFER) && (c2 == LC_XFER_WRITE) && (devsrv_read_all(sock, data, LC_DEVICE_BLOCK_SIZE) == -1) ) {
+            break;
+        }
+        if ( proto == LCLOUD_PROTO_V2 ) {                   // Control requests see every earlier transfer done
+            pthread_mutex_lock(&conn.lock);
+            while ( conn.inflight > 0 ) {
+                pthread_cond_wait(&conn.idle, &conn.lock);
+            }
+            pthread_mutex_unlock(&conn.lock);
+        } else if ( (c0 == LC_BLOCK_XFER) && (lcloud_devices_latency(c1) > 0) ) {
+            usleep(lcloud_devices_latency(c1));
+        }
+
+        rsp = lcloud_devices_execute(frm, data);
+        if ( (c0 == LC_POWER_ON) && (proto == LCLOUD_PROTO_V1) && (d0 >= LCLOUD_PROTO_V2) && (rsp != (LCloudRegisterFrame)-1) ) {
+            conn.credits = CMPSC311_MINVAL(CMPSC311_MAXVAL(d1, 1), LCLOUD_MAX_CREDITS);
+            rsp = lcloud_pack_registers(1, LC_SUCCESS, LC_POWER_ON, LCLOUD_FEATURE_COPY, 0, LCLOUD_PROTO_V2, conn.credits);
+            if ( devsrv_send(&conn, rsp, NULL, NULL) == -1 ) {
+                break;
+            }
+            if ( (!started) && (devsrv_start_workers(&conn, wrks) == -1) ) {
+                break;
+            }
+            started = 1;
+            proto = LCLOUD_PROTO_V2;                        // Everything after the reply is tagged
+            logMessage(LOG_INFO_LEVEL, "Driver negotiated protocol v2 with [%d] credits", conn.credits);
+            continue;
+        }
+
+        if ( proto == LCLOUD_PROTO_V2 ) {
+            hdr.credits = htons(1);
+            hdr.flags = 0;
+        }
+        if ( devsrv_send(&conn, rsp, (proto == LCLOUD_PROTO_V2) ? &hdr : NULL,
+                         ((c0 == LC_BLOCK_XFER) && (c2 == LC_XFER_READ)) ? data : NULL) == -1 ) {
+            break;
+        }
+        if ( c0 == LC_POWER_OFF ) {
+            ret = 0;
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&conn.lock);                         // Let the workers drain their queues and exit
+    conn.closing = 1;
+    for ( id = 0; id < LC_MAX_DEVICES; id++ ) {
+        pthread_cond_broadcast(&conn.work[id]);
+    }
+    pthread_mutex_unlock(&conn.lock);
+    for ( id = 0; started && (id < LC_MAX_DEVICES); id++ ) {
+        pthread_join(conn.workers[id], NULL);
+    }
+
+    pthread_mutex_destroy(&conn.lock);
+    pthread_mutex_destroy(&conn.send_lock);
+    pthread_cond_destroy(&conn.idle);
+    for ( id = 0; id < LC_MAX_DEVICES; id++ ) {
+        pthread_cond_destroy(&conn.work[id]);
+    }
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devsrv_connection
+// Description  : Connection thread, serves one driver and closes its socket.
+//                Connections share the devices; power on and off only change
+//                the state of the connection, so drivers do not disturb each
+//                other (beyond racing on blocks they both use).
+//
+// Inputs       : arg - the socket, as an intptr_t
+// Outputs      : NULL
+
+void *devsrv_connection( void *arg ) {
+    int client = (int)(intptr_t)arg;
+
+    if ( devsrv_serve(client) == 0 ) {
+        logMessage(LOG_OUTPUT_LEVEL, "Driver powered off, connection closed");
+    } else {
+        logMessage(LOG_ERROR_LEVEL, "Driver connection lost");
+    }
+    close(client);
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : devsrv_hotplug
+// Description  : Wait for SIGUSR1 and plug in the devices of the hot-plug
+//                manifest, which drivers then find at their next probe
+//
+// Inputs       : arg - the signals to wait for (SIGUSR1, blocked in every thread)
+// Outputs      : NULL
+
+void *devsrv_hotplug( void *arg ) {
+    int sig;
+
+    if ( (sigwait((sigset_t *)arg, &sig) == 0) && (lcloud_devices_attach(hotplug) == 0) ) {
+        logMessage(LOG_OUTPUT_LEVEL, "Plugged in the devices of [%s]", hotplug);
+    }
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the LionCloud device server
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    int ch, sock, client, one = 1, log_initialized = 0;
+    pthread_t thread;
+    static sigset_t usr1;
+    unsigned short port = LCLOUD_DEFAULT_PORT;
+    struct sockaddr_in addr;
+
+    // Process the command line parameters
+    while ((ch = getopt(argc, argv, LCLOUD_DEVSRV_ARGUMENTS)) != -1) {
+
+        switch (ch) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return (-1);
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'c': // Concurrent connections
+            concurrent = 1;
+            break;
+
+        case 'a': // Hot-plug manifest
+            hotplug = optarg;
+            break;
+
+        case 'l': // Set the log filename
+            initializeLogWithFilename(optarg);
+            log_initialized = 1;
+            break;
+
+        case 'p': // Set the port
+            port = (unsigned short)atoi(optarg);
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return (-1);
+        }
+    }
+
+    // Setup the log as needed
+    if (!log_initialized) {
+        initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    }
+    if (verbose) {
+        enableLogLevels(LOG_INFO_LEVEL);
+    }
+
+    // The manifest should be the next option
+    if (argv[optind] == NULL) {
+        fprintf(stderr, "Missing command line parameters, use -h to see usage, aborting.\n");
+        return (-1);
+    }
+    if (lcloud_devices_load(argv[optind]) == -1) {
+        return (-1);
+    }
+    signal(SIGPIPE, SIG_IGN);                               // A departed driver shows up as a failed write
+    if ( hotplug != NULL ) {                                // Only the hot-plug thread takes SIGUSR1
+        sigemptyset(&usr1);
+        sigaddset(&usr1, SIGUSR1);
+        if ( (pthread_sigmask(SIG_BLOCK, &usr1, NULL) != 0) ||
+             (pthread_create(&thread, NULL, devsrv_hotplug, &usr1) != 0) ) {
+            logMessage(LOG_ERROR_LEVEL, "Failure starting hot-plug thread");
+            return (-1);
+        }
+        pthread_detach(thread);
+    }
+
+    // Setup the listening socket
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ( ((sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) ||
+         (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == -1) ||
+         (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+         (listen(sock, LCLOUD_MAX_BACKLOG) == -1) ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure setting up server socket on port [%d] : %s", port, strerror(errno));
+        return (-1);
+    }
+    logMessage(LOG_OUTPUT_LEVEL, "LionCloud device server listening on port [%d]", port);
+
+    // Serve the drivers, one connection at a time unless asked for more
+    while (1) {
+        if ( (client = accept(sock, NULL, NULL)) == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            logMessage(LOG_ERROR_LEVEL, "Failure accepting connection : %s", strerror(errno));
+            break;
+        }
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if ( !concurrent ) {
+            devsrv_connection((void *)(intptr_t)client);
+        } else if ( pthread_create(&thread, NULL, devsrv_connection, (void *)(intptr_t)client) != 0 ) {
+            logMessage(LOG_ERROR_LEVEL, "Failure starting connection thread, closing connection");
+            close(client);
+        } else {
+            pthread_detach(thread);
+        }
+    }
+
+    close(sock);
+    lcloud_devices_release();
+    return (0);
+}
@@ -11,35 +11,85 @@
 // Include files
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
 
 // Project include files
 #include <lcloud_filesys.h>
 #include <lcloud_controller.h>
 #include <lcloud_cache.h>
 #include <lcloud_network.h>
+#include <lcloud_trace.h>
+#include <lcloud_mem.h>
+#include <lcloud_stats.h>
+#include <lcloud_lock.h>
+
+// Defines
+#define LC_BLOCK_HOLE       -1  // Block map entry that was never written, reads as zeros
+#define LC_BLOCK_DELAYED    -2  // Block map entry whose data is buffered in cache, not yet allocated
+#define LC_BLOCKMAP_CHUNK   64  // Number of entries the block map grows by
+#define LC_FILES_CHUNK      64  // Number of entries the file table grows by
+#define LC_CLUSTER_BUFSIZE  (LC_MAX_CLUSTER_BLOCKS * LC_DEVICE_BLOCK_SIZE)  // Largest cluster, for stack buffers
+#define LC_BUS_BATCH_FRAMES 256 // Most block transfers sent to the server in one batch
+#define LC_LOG_RESERVE      1   // Free log segments kept back for the cleaner
+#define LC_LOG_CLEAN_SHARE  8   // Clean in the background while fewer than 1 in this many segments are free
+#define LC_LOG_CLEAN_LIVE   75  // Background cleaning takes segments at most this percent live
+#define LC_ALLOC_GROUP      64  // Clusters per allocation group, full groups are skipped by the allocator
+#define LC_ALLOC_RESERVE    16  // Clusters a file keeps reserved past its last allocation (in place only)
+#define LC_BALANCE_SLACK    10  // Background rebalancing stops once the devices' fill is within this many percent
+#define LC_BALANCE_STEP     16  // Most clusters one background rebalancing step moves
+#define LC_SEG_FREE         0   // Log segment states
+#define LC_SEG_OPEN         1
+#define LC_SEG_FULL         2
 
 //
 // File system interface implementation
 
 //
-// Block structure
+// Block address structure, one per cluster of a file
 typedef struct {
-    int         next_sector;    // The next block's sector number, for linking puposes
-    int         next_block;     // The next block number, for linking purposes
-    int         next_dev_id;    // The next block's device id, for linking purposes
-    int         used;           // An integer representing whether the block is occupied, can be 0 or 1
-} lcloud_block;
+    int         dev_id;         // The device id of the cluster, or LC_BLOCK_HOLE/LC_BLOCK_DELAYED
+    int         cluster;        // Cluster number on the device
+} lcloud_blkaddr;
+
+//
+// Log segment structure, a run of log_clusters clusters written in order
+typedef struct {
+    int             live;           // Clusters still in a file's block map
+    int             state;          // LC_SEG_FREE, LC_SEG_OPEN or LC_SEG_FULL
+    uint64_t        stamp;          // Log clock when the segment filled, for its age
+} lcloud_segment;
 
 //
 // Device structure
 typedef struct {
-    lcloud_block**  sector_block;   // 2D array for sector, block memory structure
+    uint8_t*        usemap;         // Allocation bitmap, one bit per cluster on the device
+    int            *group_free;     // Free clusters in each allocation group of LC_ALLOC_GROUP clusters
+    int             ngroups;
+    int             nclusters;      // Number of whole clusters that fit on the device
     int             sectors;        // Store number of sectors available for device
     int             blocks;         // Store number of blocks available for device
     int             dev_id;         // An represents device id, -1 if never initialized
+    lcloud_segment *segs;           // Log segments (log mode), a partial tail is unused
+    int             nsegs;
+    int            *owner_fh;       // File holding each cluster (log mode), -1 if dead or unwritten
+    int            *owner_fblk;     // The cluster's index in that file
 } lcloud_device;
 
+//
+// Extent structure, a run of clusters being handed out to a file
+typedef struct {
+    int         dev_id;         // The device id of the run
+    int         cluster;        // First cluster number of the run
+    int         len;            // Number of clusters in the run
+    int         used;           // Number of clusters already assigned to file clusters
+} lcloud_extent;
+
 //
 // File structure
 typedef struct {
@@ -47,19 +97,60 @@ typedef struct {
     char        name[260];      // A character array to hold path, windows 10 uses 260 characters, why can't we
     int         pos;            // The position of the read/write head for the file
     int         size;           // The size of the file
-    int         block;          // Block number of the file's starting block
-    int         sector;         // Sector number of the file's starting block
-    int         dev_id;         // The device id
+    lcloud_blkaddr *blkmap;     // Device address of each cluster of the file, entries past map_blocks are holes
+    int         map_blocks;     // Number of entries in the block map
     int         opened;         // Tracker for whether the file was last opened or closed
+    int         flags;          // Open mode flags (LC_OPEN_*)
+    lcloud_extent reserve;      // Clusters allocated to the file ahead of its writes, len == used when none
 }lcloud_file;
 
+//
+// Bus batch structure, block transfers gathered for one trip to the server
+typedef struct {
+    LCloudRegisterFrame frms[LC_BUS_BATCH_FRAMES];  // Request registers, replaced by the responses
+    void               *bufs[LC_BUS_BATCH_FRAMES];  // Data of each block transfer, or the source frame of a copy
+    LCloudRegisterFrame srcs[LC_BUS_BATCH_FRAMES];  // Source frames of block copies
+    int                 count;                      // Number of transfers in the batch
+    lcloud_cachekey     cached[LC_BUS_BATCH_FRAMES]; // Cached clusters the batch writes, updated once it is sent
+    char               *cached_bufs[LC_BUS_BATCH_FRAMES]; // Data written to each of them
+    int                 ncached;                    // Number of cached clusters written
+} lcloud_busbatch;
+
+//
+// Object plan structure, the cluster transfers of whole objects gathered into
+// bus batches. A partial cluster is staged in the scratch space of its first
+// frame, and a read of one is copied out once its batch is back.
+typedef struct {
+    lcloud_busbatch     batch;                                          // Transfers not yet sent
+    char                scratch[LC_BUS_BATCH_FRAMES * LC_DEVICE_BLOCK_SIZE]; // Staging, a block per frame
+    char               *copy_to[LC_BUS_BATCH_FRAMES];                   // Destination of each staged read
+    int                 copy_from[LC_BUS_BATCH_FRAMES];                 // First frame of the staged read
+    int                 copy_len[LC_BUS_BATCH_FRAMES];                  // Bytes of the staged read wanted
+    int                 copies;                                         // Number of staged reads
+} lcloud_objplan;
+
 //
 // Global variables 
 
 LcFHandle       file_handle = 0;                                                    // Global tracker for file handles, initialized to -1
-lcloud_file     files[0xfff];                                                       // Array to hold files, initialized for 4096 files
+lcloud_file    *files = NULL;                                                       // Array to hold files, grown as files are created
+int             files_alloc = 0;                                                    // Number of entries allocated in the files array
 lcloud_device   devices[16];                                                        // Array to hold device structures
 int64_t         b0, b1, c0, c1, c2, d0, d1;                                         // Holders for 7 operation registers
+int             allocator_calls, allocator_blocks;                                  // Talleys of allocator requests and clusters handed out
+int             allocator_reserved, allocator_reclaimed;                            // Talleys of extents served from file reservations, and reservations taken back
+int             cluster_blocks = 1;                                                 // Device blocks per logical cluster
+int             cluster_size = LC_DEVICE_BLOCK_SIZE;                                // Bytes per logical cluster
+lcloud_file    *map_growing = NULL;                                                 // File whose block map is being grown, not compacted
+int             log_clusters = 0;                                                   // Clusters per log segment, 0 to update data in place
+int             log_dev = -1, log_seg = -1, log_next;                               // The open segment and its next unwritten cluster
+int             log_free, log_total;                                                // Free segments, and all of them
+int             log_depth;                                                          // Operations under way, the cleaner waits for none
+int             log_cleaning;                                                       // Non-zero while the cleaner runs, it may use the reserve
+uint64_t        log_clock;                                                          // Clusters appended, ages the segments
+uint64_t        log_moved;                                                          // Live clusters the cleaner copied forward
+int             log_cleaned;                                                        // Segments the cleaner emptied
+int             balance_moved;                                                      // Clusters the rebalancer moved between devices
 
 //
 // Functions
@@ -131,6 +222,144 @@ int extract_lcloud_registers(LCloudRegisterFrame resp, int64_t *B0_4bit, int64_t
     return( 0 );
 } 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cluster_used
+// Description  : Tests a cluster's bit in the device allocation bitmap
+//
+// Inputs       : dev - A pointer to the device
+//                cluster - the cluster number on the device
+// Outputs      : non-zero if the cluster is allocated, 0 if free
+
+int cluster_used(lcloud_device *dev, int cluster) {
+    return( dev->usemap[cluster / 8] & (1 << (cluster % 8)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : usemap_mark
+// Description  : Marks a cluster allocated or free, keeping the free count of
+//                its allocation group
+//
+// Inputs       : dev - the device
+//                cluster - the cluster number on the device
+//                used - 1 to allocate the cluster, 0 to free it
+// Outputs      : none
+
+void usemap_mark(lcloud_device *dev, int cluster, int used) {
+    if ( !cluster_used(dev, cluster) == !used ) {
+        return;
+    }
+    dev->usemap[cluster / 8] ^= 1 << (cluster % 8);
+    dev->group_free[cluster / LC_ALLOC_GROUP] += (used) ? -1 : 1;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_layout
+// Description  : Divides a new device into log segments, with a map of the
+//                file cluster each device cluster holds for the cleaner. The
+//                clusters past the last whole segment are marked used.
+//
+// Inputs       : dev - the device, its usemap already allocated
+// Outputs      : 0 on successful test, -1 otherwise
+
+int log_layout(lcloud_device *dev) {
+    size_t bytes;
+    int j;
+
+    dev->nsegs = dev->nclusters / log_clusters;
+    bytes = dev->nsegs * sizeof(lcloud_segment) + 2 * (size_t)dev->nclusters * sizeof(int);
+    if ( (lcloud_mem_reserve(LC_MEM_DEVICES, bytes) == -1) ||
+         ((dev->segs = calloc(CMPSC311_MAXVAL(dev->nsegs, 1), sizeof(lcloud_segment))) == NULL) ||
+         ((dev->owner_fh = malloc(dev->nclusters * sizeof(int))) == NULL) ||
+         ((dev->owner_fblk = malloc(dev->nclusters * sizeof(int))) == NULL) ) {
+        logMessage( LOG_ERROR_LEVEL, "LC failure allocating log map of device [%d] (%d clusters)", dev->dev_id, dev->nclusters);
+        return( -1 );
+    }
+    for(j = 0; j < dev->nclusters; j++) {
+        dev->owner_fh[j] = -1;
+        if (j >= dev->nsegs * log_clusters) {
+            usemap_mark(dev, j, 1);
+        }
+    }
+    log_total += dev->nsegs;
+    log_free += dev->nsegs;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : device_probe
+// Description  : Asks the bus which devices are present
+//
+// Inputs       : None
+// Outputs      : mask of the devices present (bit i for device i), -1 if failure
+
+int device_probe(void) {
+    LCloudRegisterFrame frm, rfrm;
+
+    frm = create_lcloud_registers(0, 0, LC_DEVPROBE, 0, 0, 0, 0);
+    if ( (frm == -1) || ((rfrm = client_lcloud_bus_request(frm, NULL)) == -1) ||
+        (extract_lcloud_registers(rfrm, &b0, &b1, &c0, &c1, &c2, &d0, &d1)) ||
+        (b0 != 1) || (b1 != 1) || (c0 != LC_DEVPROBE)) {
+            logMessage( LOG_ERROR_LEVEL, "LC failure probing device");
+            return( -1 );
+    }
+    return( (int)d0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : device_attach
+// Description  : Initializes a device found by a probe and gives its clusters
+//                to the allocator (and its segments to the log)
+//
+// Inputs       : id - the device id
+// Outputs      : 0 on successful test, -1 otherwise
+
+int device_attach(int id) {
+    LCloudRegisterFrame frm, rfrm;
+    lcloud_device dev;
+    size_t bytes;
+    int g;
+                                                                                            // Initialize device
+    frm = create_lcloud_registers(0, 0, LC_DEVINIT, id, 0, 0, 0);
+    if ( (frm == -1) || ((rfrm = client_lcloud_bus_request(frm, NULL)) == -1) ||
+        (extract_lcloud_registers(rfrm, &b0, &b1, &c0, &c1, &c2, &d0, &d1)) ||
+        (b0 != 1) || (b1 != 1) || (c0 != LC_DEVINIT)) {
+            logMessage( LOG_ERROR_LEVEL, "LC failure initializing device");
+            return( -1 );
+    }
+
+    dev.dev_id = id;
+    dev.sectors = d0;
+    dev.blocks = d1;
+    dev.nclusters = (d0 * d1) / cluster_blocks;                                              // Clusters run across sectors, a partial tail is unused
+    dev.ngroups = (dev.nclusters + LC_ALLOC_GROUP - 1) / LC_ALLOC_GROUP;
+    bytes = (dev.nclusters + 7) / 8;
+    if ( (lcloud_mem_reserve(LC_MEM_DEVICES, bytes + dev.ngroups * sizeof(int)) == -1) ||
+        ((dev.usemap = (uint8_t *)calloc(bytes, 1)) == NULL) ||                             // Every cluster starts out unused
+        ((dev.group_free = (int *)malloc(CMPSC311_MAXVAL(dev.ngroups, 1) * sizeof(int))) == NULL) ) {
+            logMessage( LOG_ERROR_LEVEL, "LC failure allocating map of device [%d] (%d clusters)", id, dev.nclusters);
+            return( -1 );
+    }
+    for(g = 0; g < dev.ngroups; g++) {                                                      // The last group may be short
+        dev.group_free[g] = CMPSC311_MINVAL(LC_ALLOC_GROUP, dev.nclusters - g * LC_ALLOC_GROUP);
+    }
+    dev.segs = NULL;
+    dev.nsegs = 0;
+    dev.owner_fh = dev.owner_fblk = NULL;
+    if ( (log_clusters > 0) && (log_layout(&dev) == -1) ) {
+        return( -1 );
+    }
+    devices[id] = dev;
+    LC_STAT_SET(devices[id].clusters, dev.nclusters);
+    LC_STAT_SET(devices[id].free, dev.nsegs * log_clusters + (log_clusters == 0) * dev.nclusters);
+    logMessage(LOG_OUTPUT_LEVEL, "Successfully initialized device [%d] with [sectors:blocks] [%d:%d] (%d clusters)", dev.dev_id, dev.sectors, dev.blocks, dev.nclusters);
+    return( 0 );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : device_power_on
@@ -142,60 +371,41 @@ int extract_lcloud_registers(LCloudRegisterFrame resp, int64_t *B0_4bit, int64_t
 int device_power_on() {
     LCloudRegisterFrame frm, rfrm;
                                                                                             // Power on the devices
-    frm = create_lcloud_registers(0, 0, LC_POWER_ON, 0, 0, 0, 0);
+    frm = create_lcloud_registers(0, 0, LC_POWER_ON, 0, 0, LCLOUD_PROTO_V2, LCLOUD_DEFAULT_CREDITS);   // Ask for protocol v2
     if ( (frm == -1) || ((rfrm = client_lcloud_bus_request(frm, NULL)) == -1) ||
         (extract_lcloud_registers(rfrm, &b0, &b1, &c0, &c1, &c2, &d0, &d1)) ||
         (b0 != 1) || (b1 != 1) || (c0 != LC_POWER_ON) ) {
             logMessage( LOG_ERROR_LEVEL, "LC failure powering on");
             return( -1 );
     }
+    logMessage(LOG_OUTPUT_LEVEL, "LC powered on, bus protocol v%d%s", client_lcloud_bus_protocol(),
+               (client_lcloud_bus_features() & LCLOUD_FEATURE_COPY) ? " with block copy" : "");
 
-                                                                                            // Probe the devices
-    frm = create_lcloud_registers(0, 0, LC_DEVPROBE, 0, 0, 0, 0);
-    if ( (frm == -1) || ((rfrm = client_lcloud_bus_request(frm, NULL)) == -1) ||
-        (extract_lcloud_registers(rfrm, &b0, &b1, &c0, &c1, &c2, &d0, &d1)) ||
-        (b0 != 1) || (b1 != 1) || (c0 != LC_DEVPROBE)) {
-            logMessage( LOG_ERROR_LEVEL, "LC failure probing device");
-            return( -1 );
-    }
+    int id, lines, probe;
 
-    int id, i, j, probe = d0;
-    lcloud_device dev;
+    if ( (probe = device_probe()) == -1 ) {                                                 // Probe the devices
+        return( -1 );
+    }
 
     for(id = 0; id < 16; id++) {                                                            // Check the first 16 bits for devices
-        if(probe & 1) {                                                                     // If the LSB is 1, then there is a device
-                                                                                            // Initialize device
-            frm = create_lcloud_registers(0, 0, LC_DEVINIT, id, 0, 0, 0);
-            if ( (frm == -1) || ((rfrm = client_lcloud_bus_request(frm, NULL)) == -1) ||
-                (extract_lcloud_registers(rfrm, &b0, &b1, &c0, &c1, &c2, &d0, &d1)) ||
-                (b0 != 1) || (b1 != 1) || (c0 != LC_DEVINIT)) {
-                    logMessage( LOG_ERROR_LEVEL, "LC failure initializing device");
-                    return( -1 );
-            }
-
-            dev.dev_id = id;
-            dev.sectors = d0;
-            dev.blocks = d1;
-            dev.sector_block = (lcloud_block **)malloc(d0 * sizeof(lcloud_block*));         // Allocate memory for the d0 sectors
-                                                                                            // Create block structure for device
-            for(i = 0; i < d0; i++) {
-                dev.sector_block[i] = (lcloud_block *)malloc(d1 * sizeof(lcloud_block));    // Allocate memory for d1 blocks in each sector
-                for(j = 0; j < d1; j++) {
-                    dev.sector_block[i][j].next_sector = -1;                                // Let -1 represent no next sector
-                    dev.sector_block[i][j].next_block = -1;                                 // Let -1 represent no next block
-                    dev.sector_block[i][j].next_dev_id = -1;                                // Let -1 represent no next device
-                    dev.sector_block[i][j].used = 0;                                        // Set all blocks to unused
-                }
-            }
-            devices[id] = dev;
-            logMessage(LOG_OUTPUT_LEVEL, "Successfully initialized device [%d] with [sectors:blocks] [%d:%d]", dev.dev_id, dev.sectors, dev.blocks);
-        } else {
-            devices[id].dev_id = -1;                                                        // device id of -1 means device is off
+        devices[id].dev_id = -1;                                                            // device id of -1 means device is off
+        if ( (probe & 1) && (device_attach(id) == -1) ) {                                   // If the LSB is 1, then there is a device
+            return( -1 );
         }
         probe = probe >> 1;                                                                 // Shift probe to probe next device
     }
-    lcloud_initcache(LC_CACHE_MAXBLOCKS);
-    
+    if ( (log_clusters > 0) && (log_total <= LC_LOG_RESERVE) ) {
+        logMessage( LOG_ERROR_LEVEL, "LC failure, only [%d] log segments of [%d] clusters fit the devices", log_total, log_clusters);
+        return( -1 );
+    }
+    lines = CMPSC311_MAXVAL(LC_CACHE_MAXBLOCKS / cluster_blocks, LC_CACHE_MINLINES);
+    if (lcloud_mem_budget() != 0) {                                                                // Under a budget, half of it goes to cache lines
+        lines = CMPSC311_MAXVAL(CMPSC311_MINVAL(lines, (int)(lcloud_mem_budget() / 2 / cluster_size)), LC_CACHE_MINLINES);
+    }
+    if (lcloud_initcache(lines, cluster_size) == -1) {
+        return( -1 );
+    }
+
     return( 0 );                                                                            // Successful test
 }
 
@@ -205,410 +415,2361 @@ int device_power_on() {
 // Description  : Determines if fh is valid and the associated file is open
 //
 // Inputs       : fh - A unique file handle
-//                file - A pointer to the file to be assigned
-// Outputs      : 0 for successful test, -1 otherwise
+// Outputs      : pointer to the file for successful test, NULL otherwise
 
-int validate_fh(LcFHandle fh, lcloud_file *file) {
-    if(fh > file_handle) {
+lcloud_file *validate_fh(LcFHandle fh) {
+    if((fh < 0) || (fh >= file_handle)) {
         logMessage(LOG_ERROR_LEVEL, "LC failure invalid file handle [%d]", fh);
-        return( -1 );                                                       // Invalid file handle
+        return( NULL );                                                     // Invalid file handle
     } else if(files[fh].opened == 0) {
         logMessage(LOG_ERROR_LEVEL, "LC failure file not opened [%d]", fh);
-        return( -1 );                                                       // File at handle is not opened, also invalid
+        return( NULL );                                                     // File at handle is not opened, also invalid
     }
-    *file = files[fh];                                                      // If valid file handle, assign the file
-    return( 0 );                                                            // Successful test
+    return( &files[fh] );                                                   // Successful test
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : allocate_device
-// Description  : Linearly assigns a device, block, and id for use
+// Function     : op_abandoned
+// Description  : Checks the token governing an operation before it starts, so
+//                one already past its deadline (or cancelled) costs nothing
 //
-// Inputs       : *sec - the address of the file's sector
-//                *blk - the address of the file's block
-// Outputs      : 0 for successful test, -1 otherwise
+// Inputs       : op - the operation, for the log
+// Outputs      : -1 if the operation is abandoned, 0 to go ahead
 
-int allocate_block(int *sec,int *blk) {
-    int id, i, j;
-    lcloud_device dev;
-    for(id = 0; id < 16; id++) {
-        dev = devices[id];
-        if (dev.dev_id != -1) {                                     // If the device was initialized
-            for(i = 0; i < dev.sectors; i++) {                      // Loop through the 2D array
-                for(j = 0; j < dev.blocks; j++) {
-                    if(dev.sector_block[i][j].used == 0) { 
-                        *sec = i;
-                        *blk = j;
-                        dev.sector_block[i][j].used = 1;
-                        return( id );                               // Return id of allocated block
-                    }
-                }
-            }
-        }
+int op_abandoned(const char *op) {
+    int why;
+
+    if ( (why = lcexpired(lcgetcancel())) == 0 ) {
+        return( 0 );
     }
-    logMessage( LOG_ERROR_LEVEL, "LC failure allocating block, memory structure full.");
+    logMessage(LOG_OUTPUT_LEVEL, "LC %s abandoned before it started, %s", op, (why == ETIMEDOUT) ? "deadline passed" : "cancelled");
     return( -1 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : get_block
-// Description  : Traverses through a file's block list to find the last block used to write to
+// Function     : log_free_segment
+// Description  : Returns an emptied log segment to the free pool; its clusters
+//                only become free now, dead ones included
 //
-// Inputs       : file - A file passed by value
-//                sec - A pointer to the sector to assign the sector id
-//                blk - A pointer to the block to assign the block id
-// Outputs      : 0 for successful test, -1 otherwise
-
-int get_block(lcloud_file file, int *sec, int *blk) {
-    int next_sec = file.sector, next_blk = file.block, i = 0, curr_sec, curr_blk;
-    lcloud_device next_dev = devices[file.dev_id], curr_dev;
-
-    do {
-        if((next_sec == -1) || (next_blk == -1)) {                                  // The file should have allocated blocks up to file position
-                                                                                    // Thus, should not occur before loop parameter is triggered
-            logMessage( LOG_ERROR_LEVEL, "LC failure fetching block, invalid file position.");
-            return( -1 );
+// Inputs       : dev_id - the device of the segment
+//                seg - the segment number
+// Outputs      : none
+
+void log_free_segment(int dev_id, int seg) {
+    lcloud_device *dev = &devices[dev_id];
+    int j, freed = 0;
+
+    for(j = seg * log_clusters; j < (seg + 1) * log_clusters; j++) {
+        if (cluster_used(dev, j)) {
+            usemap_mark(dev, j, 0);
+            freed++;
         }
-                                                                                    // Standard loop through linked list
-        curr_sec = next_sec;                                                        // Next ids become current
-        curr_blk = next_blk;
-        curr_dev = next_dev;                                          
-        next_dev = devices[curr_dev.sector_block[curr_sec][curr_blk].next_dev_id];  // Get the next device to get the next block from
-        next_sec = curr_dev.sector_block[curr_sec][curr_blk].next_sector;           // Next ids from new current become the new next ids
-        next_blk = curr_dev.sector_block[curr_sec][curr_blk].next_block;
-
-        i += 256;                                                                   // Increment i by block length because we are comparing it to file position
-    } while(i <= file.pos);                                                         // If i > file.pos, we curr_blk holds the file position
-
-    *sec = curr_sec;                                                                // Assign sec and blk to the retrieved ids
-    *blk = curr_blk;
-
-    return( curr_dev.dev_id );
+    }
+    dev->segs[seg].state = LC_SEG_FREE;
+    log_free++;
+    LC_STAT_ADD(devices[dev_id].free, freed);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : add_block
-// Description  : Gets the last block of the file, chooses a new block, and adds the block to the linked list
+// Function     : log_own
+// Description  : Records the file cluster a log cluster now holds
 //
-// Inputs       : file - A file structure passed by value
-// Outputs      : 0 for successful test, -1 otherwise
+// Inputs       : dev_id, cluster - the log cluster
+//                fh, fblk - the file and the cluster's index in it
+// Outputs      : none
+
+void log_own(int dev_id, int cluster, int fh, int fblk) {
+    devices[dev_id].owner_fh[cluster] = fh;
+    devices[dev_id].owner_fblk[cluster] = fblk;
+    devices[dev_id].segs[cluster / log_clusters].live++;
+}
 
-int add_block(lcloud_file file) {
-    int sec, blk, next_sec, next_blk, dev_id, next_dev_id;
-    file.pos--;                                                             // Decrement the file pos so get_block doesn't try to get an unallocated block
-                                                                            // Note that add_block only gets called at file.pos % 256 = 0, so always decrement
-    if ( ((dev_id = get_block(file, &sec, &blk)) == -1) || 
-         ((next_dev_id = allocate_block(&next_sec, &next_blk)) == -1) ) {   // If get_block returns -1, test fails
-        return( -1 );
-    }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_retire
+// Description  : Marks a log cluster dead, its data having been superseded; a
+//                full segment left with nothing live is free again
+//
+// Inputs       : dev_id, cluster - the log cluster
+// Outputs      : none
 
-    devices[dev_id].sector_block[sec][blk].next_sector = next_sec;          // Assign to the retrieved block the id of the next sector
-    devices[dev_id].sector_block[sec][blk].next_block = next_blk;           // Assign to the retrieved block the id of the next block
-    devices[dev_id].sector_block[sec][blk].next_dev_id = next_dev_id;       // Assign to the retrieved block the device id of the next block
+void log_retire(int dev_id, int cluster) {
+    lcloud_segment *seg = &devices[dev_id].segs[cluster / log_clusters];
 
-    logMessage(LOG_OUTPUT_LEVEL, "Allocated block for data [%d/%d/%d]", file.dev_id, next_sec, next_blk);
-    return( 0 );
+    devices[dev_id].owner_fh[cluster] = -1;
+    if ( (--seg->live == 0) && (seg->state == LC_SEG_FULL) ) {
+        log_free_segment(dev_id, cluster / log_clusters);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcopen
-// Description  : Open the file for for reading and writing
+// Function     : log_open_segment
+// Description  : Closes the open log segment and opens a free one, moving on
+//                to the next device each time so appends spread across them.
+//                The last LC_LOG_RESERVE free segments are the cleaner's.
 //
-// Inputs       : path - the path/filename of the file to be read
-// Outputs      : file handle if successful test, -1 if failure
+// Inputs       : none
+// Outputs      : 0 for successful test, -1 otherwise
 
-LcFHandle lcopen( const char *path ) {
-    if(file_handle == 0) {                                                  // First open operation, power on devices
-        if(device_power_on() == -1) {                                       // Start by powering on device
-            return(-1);                                                     // Throw error if device_power_on fails
+int log_open_segment(void) {
+    lcloud_segment *seg;
+    int i, id, j;
+
+    if (log_seg != -1) {
+        seg = &devices[log_dev].segs[log_seg];
+        seg->state = LC_SEG_FULL;
+        seg->stamp = log_clock;
+        log_seg = -1;
+        if (seg->live == 0) {
+            log_free_segment(log_dev, seg - devices[log_dev].segs);
         }
     }
+    if ( (log_free == 0) || ((log_free <= LC_LOG_RESERVE) && !log_cleaning) ) {
+        logMessage( LOG_ERROR_LEVEL, "LC failure allocating block, log full (%d free segments).", log_free);
+        return( -1 );
+    }
 
-    // Check if the file already exists
-    LcFHandle fh;
-    for(fh = 0; fh < file_handle; fh++) {                                   // When no name matches the path, fh = file_handle and is unique
-        if(files[fh].name == path) {                                        // If a file with this path exists, check if it is already opened
-            if(files[fh].opened == 1) {
-                return( -1 );                                               // If the file is already opened, the function fails
-                logMessage( LOG_ERROR_LEVEL, "LC failure opening file, file already opened.");
-            } else {                                                        // Otherwise, open the file
-                files[fh].pos = 0;                                          // Set the read/write head to 0
-                files[fh].opened = 1;                                       // The file is opened
-                return( fh );                                               // Return the file handle       
-            }
+    for(i = 1; i <= 16; i++) {
+        id = (log_dev + i + 16) % 16;
+        if (devices[id].dev_id == -1) {
+            continue;
+        }
+        for(j = 0; (j < devices[id].nsegs) && (devices[id].segs[j].state != LC_SEG_FREE); j++);
+        if (j < devices[id].nsegs) {
+            devices[id].segs[j].state = LC_SEG_OPEN;
+            log_dev = id;
+            log_seg = j;
+            log_next = 0;
+            log_free--;
+            lcloud_trace_instant("open segment", "log", id * 65536 + j);
+            return( 0 );
         }
     }
-
-    lcloud_file file;                                                       // The file does not exist, create it
-
-    file_handle += 1;                                                       // Increment the file_handle tracker to maintain uniqueness
-    file.fh = file_handle;                                                  // Assign the file's handle to the unique file_handle tracker
-    
-    strncpy(file.name, path, 259);                                          // Assign 259 characters of path to file.name
-    file.name[259] = '\0';                                                  // Place null terminator at end of path in case path length > 260
-    
-    file.pos = 0;                                                           // Set the file's read/write head to 0
-    file.size = 0;                                                          // Initialize the file's size to 0
-    
-                                                                            // File device id, block, and sector go unassigned until a write occurs
-
-    file.opened = 1;                                                        // Set the file to opened
-
-    files[fh] = file;                                                       // Add the current file to the files array
-    return(fh);                                                             // Returns the uniquely generated file header
+    return( -1 );                                                           // Not reached, log_free counts the free segments
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcread
-// Description  : Read data from the file 
+// Function     : log_allocate
+// Description  : Hands out the next clusters of the log, a run within the open
+//                segment (opening a new one when it is full)
 //
-// Inputs       : fh - file handle for the file to read from
-//                buf - place to put the data
-//                len - the length of the read
-// Outputs      : number of bytes read, -1 if failure
-
-int lcread( LcFHandle fh, char *buf, size_t len ) {
-    char temp[256], *cache_block;                                           // Temporary buffer to perform reads in 256 byte chunks
-
-    lcloud_file file;
-    if(validate_fh(fh, &file) == -1) {                                      // Validate the file handle and assign the file from handle
-        return( - 1 );
-    }
+// Inputs       : want - the number of clusters requested
+//                *cluster - the address of the run's first cluster
+//                *len - the address of the number of clusters allocated (1 to want)
+// Outputs      : device id of the run for successful test, -1 otherwise
 
-    int i = 0, pos_in_block, sec, blk, dev_id;
+int log_allocate(int want, int *cluster, int *len) {
+    int j, run;
 
-    if (file.size == 0) {                                                   // No data to read
-        return ( 0 );
+    if ( ((log_seg == -1) || (log_next == log_clusters)) && (log_open_segment() == -1) ) {
+        return( -1 );
     }
-    if (file.pos + len > file.size) {                                       // If the length of the read goes over the file sieze
-        len = file.size - file.pos;                                         // Set the length of the read to rest of file
+    run = CMPSC311_MAXVAL(CMPSC311_MINVAL(want, log_clusters - log_next), 1);
+    *cluster = log_seg * log_clusters + log_next;
+    *len = run;
+    for(j = *cluster; j < *cluster + run; j++) {
+        usemap_mark(&devices[log_dev], j, 1);
     }
+    log_next += run;
+    log_clock += run;
+    allocator_blocks += run;
+    LC_STAT_ADD(devices[log_dev].free, -run);
 
-    while(i < len) {                                                        // Loop to read in blocks, i is incremented depending on case
+    return( log_dev );
+}
 
-        pos_in_block = file.pos % 256;                                      // Get the position of the read head in the block
-        if ( (dev_id = get_block(file, &sec, &blk)) == -1 ) {               // Set sec and blk for the read
-            return( -1 );
-        }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_extent
+// Description  : Returns a run of clusters to the allocator
+//
+// Inputs       : dev_id - the device of the run
+//                cluster - first cluster of the run
+//                len - number of clusters in the run
+// Outputs      : none
 
-        if( (cache_block = lcloud_getcache(dev_id, sec, blk)) == NULL ) {   // The block is not in cache
-            memset(temp, 0, 256);
+void release_extent(int dev_id, int cluster, int len) {
+    int j;
 
-            LCloudRegisterFrame frm, rfrm;                                  // Perform a read operation to put data at sec, block into temp
-            frm = create_lcloud_registers(0, 0, LC_BLOCK_XFER, dev_id, LC_XFER_READ, sec, blk);
-            if ( (frm == -1) || ((rfrm = client_lcloud_bus_request(frm, temp)) == -1) ||
-                (extract_lcloud_registers(rfrm, &b0, &b1, &c0, &c1, &c2, &d0, &d1)) ||
-                (b0 != 1) || (b1 != 1) || (c0 != LC_BLOCK_XFER) ) {
-                    logMessage( LOG_ERROR_LEVEL, "LC failure reading blkc [%d,%d,%d]", dev_id, sec, blk);
-                    return( -1 );                                           // Failed read operation
-            }
-            logMessage( LOG_OUTPUT_LEVEL, "LC success reading blkc [%d/%d/%d]", dev_id, sec,blk);  
+    for(j = cluster; j < cluster + len; j++) {
+        usemap_mark(&devices[dev_id], j, 0);
+    }
+    LC_STAT_ADD(devices[dev_id].free, len);
+}
 
-        } else {
-            memcpy(temp, cache_block, 256);
-            logMessage( LOG_OUTPUT_LEVEL, "LC success retrieving blkc from cache [%d/%d/%d]", dev_id, sec,blk);  
-        }
-        
-        if(pos_in_block == 0) {                                             // Case: read from beginning of block
-            if((len - i) < 256) {                                           // Case: read to middle of block
-                memcpy(&buf[i], temp, len - i);                             // Copy first part of temp into buf at i
-                file.pos += len - i;                                        // Increment pos by bytes read
-                i = len;                                                    // Last read command, i now equal to length
-            }
-            else {                                                          // Case: read to end of block
-                memcpy(&buf[i], temp, 256);                                 // Copy next 256 bytes of temp into buf at i
-                file.pos += 256;                                            // Increment pos by bytes written
-                i += 256;                                                   // Increment i by the 256 written bytes
-            }
-        }
-        else {                                                              // Case: read at middle of block
-            if ((len + pos_in_block - i) < 256) {                           // Case: read to middle of block
-                memcpy(&buf[i], &temp[pos_in_block], len - i);              // Copy temp from pos_in_block to the rest of len into buf at i
-                file.pos += len - i;                                        // Increment pos by bytes written
-                i = len;                                                    // Case only happens as single write (first and last), loop won't continue
-            }
-            else {                                                          // Case: read to end of block
-                memcpy(&buf[i], &temp[pos_in_block], 256 - pos_in_block);   // Copy temp from pos_in_block to the end into buf at i
-                file.pos += 256 - pos_in_block;                             // Increment pos by bytes written
-                i += 256 - pos_in_block;                                    // Increment i by how many bytes of buf were written
-            }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : release_reservations
+// Description  : Takes back the unused reservations of every file, for when
+//                the devices have no other free space left
+//
+// Inputs       : none
+// Outputs      : number of clusters released
+
+int release_reservations(void) {
+    lcloud_extent *res;
+    int i, released = 0;
+
+    for(i = 0; i < file_handle; i++) {
+        res = &files[i].reserve;
+        if (res->used < res->len) {
+            release_extent(res->dev_id, res->cluster + res->used, res->len - res->used);
+            released += res->len - res->used;
+            allocator_reclaimed++;
         }
+        res->used = res->len = 0;
     }
-    logMessage(LOG_OUTPUT_LEVEL, "Driver read %d bytes from file %s (at %d)", len, file.name, files[fh].pos);
-
-    files[fh] = file;                                                       // Update the file in the file list
-    return( len );                                                          // returns number of bytes read on sucessful test, if operation passed, file.size this value was changed
+    return( released );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcwrite
-// Description  : write data to the file
+// Function     : allocate_extent
+// Description  : Allocates a run of contiguous clusters on a single device. The
+//                allocator first tries to extend the run at the goal address (the
+//                cluster after the file's current tail), then takes the first free
+//                run long enough for the request, and otherwise the longest run.
+//                The search starts at the goal's allocation group and wraps
+//                around every device, skipping groups with nothing free. When
+//                nothing at all is free the files' reservations are taken back.
 //
-// Inputs       : fh - file handle for the file to write to
-//                buf - pointer to data to write
-//                len - the length of the write
-// Outputs      : number of bytes written if successful test, -1 if failure
-
-int lcwrite( LcFHandle fh, char *buf, size_t len ) {
-    char temp[256];                                                             // Temporary buffer to perform write in 256 byte chunks
+// Inputs       : want - the number of clusters requested
+//                goal_dev, goal_cluster - preferred start of the run, -1 for none
+//                *cluster - the address of the run's first cluster
+//                *len - the address of the number of clusters allocated (1 to want)
+// Outputs      : device id of the run for successful test, -1 otherwise
+
+int allocate_extent(int want, int goal_dev, int goal_cluster, int *cluster, int *len) {
+    int id, j, k, to, run, pass, best_id = -1, best_cluster = 0, best_len = 0, start_dev = 0, start_cluster = 0;
+    lcloud_device dev;
 
-    lcloud_file file;
-    if (validate_fh(fh, &file) == -1) {                                         // Validate the file handle and assign the file from handle
-        return( - 1 );                                                          // Invalid file handle
+    allocator_calls++;
+    if (log_clusters > 0) {                                                 // Log mode, everything goes at the log head
+        return( log_allocate(want, cluster, len) );
     }
 
-    int i = 0, pos_in_block, sec, blk, dev_id;
-
-    if (file.size == 0) {                                                       // File has not been written yet, a block must be allocated
-        if ((file.dev_id = allocate_block(&file.sector, &file.block)) == -1) {  // Allocate block
-            return( -1 );
-        }                     
+    if ( (goal_dev != -1) && (devices[goal_dev].dev_id != -1) && (goal_cluster < devices[goal_dev].nclusters) ) {
+        dev = devices[goal_dev];                                            // Try to continue the file's last extent
+        for(run = 0; (run < want) && (goal_cluster + run < dev.nclusters) && !cluster_used(&dev, goal_cluster + run); run++);
+        if (run > 0) {
+            best_id = goal_dev;
+            best_cluster = goal_cluster;
+            best_len = run;
+        }
+        start_dev = goal_dev;                                               // Otherwise look near it first
+        start_cluster = goal_cluster - goal_cluster % LC_ALLOC_GROUP;
     }
 
-    while (i < len) {                                                           // Loop to write in blocks, i is incremented depending on case
-        pos_in_block = file.pos % 256;                                          // Get the position of the write head in the block
-        if ( (dev_id = get_block(file, &sec, &blk)) == -1 ) {                   // Set sec and blk for the write operation
-            return( -1 );
-        } 
-
-        // Read the block into temp
-        memset(temp, 0, 256);
-        lcseek(fh, file.pos - pos_in_block);                                    // Seek to beginning of block
-        lcread(fh, temp, 256);                                                  // read the current block into temp     
-
-        if(pos_in_block == 0) {                                                 // Case: write at beginning of block
-            if((len - i) < 256) {                                               // Case: write to middle of block
-                memcpy(temp, &buf[i], len - i);                                 // Copy the end of buf to the beginning of temp, leave the rest zero'd
-                file.pos += len - i;                                            // Increment pos by bytes written
-                i = len;                                                        // Last write command, i now equal to length
-            }
-            else {                                                              // Case: write to end of block
-                memcpy(temp, &buf[i], 256);                                     // Copy next 256 bytes of buf into temp
-                file.pos += 256;                                                // Increment pos by bytes written
-                i += 256;                                                       // Increment i by the 256 written bytes                                          
-            }
-        }
-        else {                                                                  // Case: write at middle of block
-            if ((len + pos_in_block - i) < 256) {                               // Case: write to middle of block
-                memcpy(&temp[pos_in_block], &buf[i], len - i);                  // Copy the end of buf into the second part of temp, leave the rest zero'd
-                file.pos += len - i;                                            // Increment pos by bytes written
-                i = len;                                                        // Case only happens as single write (first and last), loop won't continue
+    for(pass = 0; (best_len == 0) && ((pass == 0) || (release_reservations() > 0)); pass++) {
+        for(k = 0; (k <= 16) && (best_len < want); k++) {                  // Nothing after the tail, search every device
+            id = (start_dev + k) % 16;
+            dev = devices[id];
+            if (dev.dev_id == -1) {                                         // Skip devices that were never initialized
+                continue;
             }
-            else {                                                              // Case: write to end of block
-                memcpy(&temp[pos_in_block], &buf[i], 256 - pos_in_block);       // Copy buf to second part of temp
-                file.pos += 256 - pos_in_block;                                 // Increment pos by bytes written
-                i += 256 - pos_in_block;                                        // Increment i by how many bytes of buf were written 
+            j = (k == 0) ? start_cluster : 0;                               // The start device is searched last up to the start
+            to = (k == 16) ? start_cluster : dev.nclusters;
+            while ( (j < to) && (best_len < want) ) {
+                if (dev.group_free[j / LC_ALLOC_GROUP] == 0) {              // Nothing free in this group
+                    j = (j / LC_ALLOC_GROUP + 1) * LC_ALLOC_GROUP;
+                    continue;
+                }
+                for(run = 0; (j + run < dev.nclusters) && (run < want) && !cluster_used(&dev, j + run); run++);
+                if (run > best_len) {                                       // Keep the longest run seen, a full run ends the search
+                    best_id = id;
+                    best_cluster = j;
+                    best_len = run;
+                }
+                j += (run > 0) ? run : 1;
             }
         }
+    }
 
-        LCloudRegisterFrame frm, rfrm;                                          // Perform a write operation to put temp into the file at block, sector
-        frm = create_lcloud_registers(0, 0, LC_BLOCK_XFER, dev_id, LC_XFER_WRITE, sec, blk);
-        if ( (frm == -1) || ((rfrm = client_lcloud_bus_request(frm, temp)) == -1) ||
-             (extract_lcloud_registers(rfrm, &b0, &b1, &c0, &c1, &c2, &d0, &d1)) ||
-             (b0 != 1) || (b1 != 1) || (c0 != LC_BLOCK_XFER) ) {
-                logMessage( LOG_ERROR_LEVEL, "LC failure writing blkc [%d/%d/%d]", dev_id, sec, blk);
-                return( -1 );                                                   // Failed write operation
-        }
-
-        if ( lcloud_putcache(dev_id, sec, blk, temp) == -1) {
-            return( -1 );
-        }
+    if (best_len == 0) {
+        logMessage( LOG_ERROR_LEVEL, "LC failure allocating block, memory structure full.");
+        return( -1 );
+    }
 
-        if (file.pos >= file.size) {                                            // When writing to the end of the file
-            file.size = file.pos;                                               // Update the file size to the write head
-            if (file.pos % 256 == 0) {                                          // If the write was at the end of the file and the end of a block
-                if(add_block(file) == -1) {                                     // We need to allocate a block for the file
-                    return( -1 );                                           
-                } 
-            }
-        }
-        logMessage(LOG_OUTPUT_LEVEL, "LC success writing blkc [%d/%d/%d]", dev_id, sec, blk);
-        files[fh] = file;                                                       // Update the file in the file list within the loop for read and seek calls
+    for(j = 0; j < best_len; j++) {                                         // Mark the run as used
+        usemap_mark(&devices[best_id], best_cluster + j, 1);
     }
+    allocator_blocks += best_len;
+    LC_STAT_ADD(devices[best_id].free, -best_len);
 
-    logMessage(LOG_OUTPUT_LEVEL, "Driver wrote %d bytes to file %s (now %d bytes)", len, file.name, file.size);
-    return( len );                                                              // returns number of bytes written on sucessful test
+    *cluster = best_cluster;
+    *len = best_len;
+    return( best_id );                                                      // Return id of allocated run
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcseek
-// Description  : Seek to a specific place in the file
+// Function     : get_block
+// Description  : Looks up a cluster in the file's block map. Clusters past the
+//                end of the map are holes.
 //
-// Inputs       : fh - the file handle of the file to seek in
-//                off - offset within the file to seek to
-// Outputs      : 0 if successful test, -1 if failure
+// Inputs       : file - A pointer to the file
+//                fblk - index of the cluster within the file
+//                sec - A pointer to the sector to assign the sector id
+//                blk - A pointer to the block to assign the id of the cluster's first block
+// Outputs      : device id, LC_BLOCK_HOLE or LC_BLOCK_DELAYED
 
-int lcseek( LcFHandle fh, size_t off ) {
+int get_block(lcloud_file *file, int fblk, int *sec, int *blk) {
+    int dev_id, first;
 
-    lcloud_file file;
-    if(validate_fh(fh, &file) == -1) {                                      // Validate the file handle and assign the file from handle
-        return( - 1 );                                                      // Invalid file handle
+    if (fblk >= file->map_blocks) {                                             // Never written, so the cluster is a hole
+        return( LC_BLOCK_HOLE );
     }
 
-    if ((off < 0) || (off > file.size)) {                                   // Validity check: 0 < off < sile.size so that new position is within file
-        logMessage(LOG_ERROR_LEVEL, "LC failure seek bounds out of range [%d,%d]", file.size, off);
-        return( -1 );                                                       // Failed seek
+    if ( (dev_id = file->blkmap[fblk].dev_id) >= 0 ) {                          // Clusters number the device blocks linearly across sectors
+        first = file->blkmap[fblk].cluster * cluster_blocks;
+        *sec = first / devices[dev_id].blocks;                                  // Assign sec and blk to the retrieved ids
+        *blk = first % devices[dev_id].blocks;
     }
 
-    file.pos = off;                                                         // Set the file position to the seek offset
-    files[fh] = file;                                                       // Update the file in the file list
-    logMessage(LOG_OUTPUT_LEVEL, "LC successfully seeked file %s to [%d]", file.name, off);
-    return( file.pos );                                                     // Successful seek
+    return( dev_id );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcclose
-// Description  : Close the file
+// Function     : map_block
+// Description  : Gets the block map entry for a block, growing the map with 
+//                holes if the block lies past its end
 //
-// Inputs       : fh - the file handle of the file to close
-// Outputs      : 0 if successful test, -1 if failure
-
-int lcclose( LcFHandle fh ) {
-    lcloud_file file;
-    if(validate_fh(fh, &file) == -1) {                                      // Validate the file handle and assign the file from handle
-        return( - 1 );                                                      // Invalid file handle
-    }
-    if(file.opened == 0) {                                                  // If the file is not opened, it can't be closed
-        logMessage( LOG_ERROR_LEVEL, "LC failure closing file [%d] file not openend", fh);
-        return( -1 );                                                       // Failed close
+// Inputs       : file - A pointer to the file
+//                fblk - index of the block within the file
+// Outputs      : pointer to the map entry for successful test, NULL otherwise
+
+lcloud_blkaddr *map_block(lcloud_file *file, int fblk) {
+    lcloud_blkaddr *grown;
+    int entries;
+
+    if (fblk >= file->map_blocks) {
+        entries = ((fblk / LC_BLOCKMAP_CHUNK) + 1) * LC_BLOCKMAP_CHUNK;         // Grow the map in whole chunks
+        map_growing = file;
+        if (lcloud_mem_reserve(LC_MEM_BLOCKMAP, (entries - file->map_blocks) * sizeof(lcloud_blkaddr)) == -1) {
+            map_growing = NULL;
+            logMessage( LOG_ERROR_LEVEL, "LC failure growing block map for file %s, over memory budget", file->name);
+            return( NULL );
+        }
+        if ( (grown = realloc(file->blkmap, entries * sizeof(lcloud_blkaddr))) == NULL ) {
+            map_growing = NULL;
+            lcloud_mem_release(LC_MEM_BLOCKMAP, (entries - file->map_blocks) * sizeof(lcloud_blkaddr));
+            logMessage( LOG_ERROR_LEVEL, "LC failure growing block map for file %s", file->name);
+            return( NULL );
+        }
+        map_growing = NULL;
+        file->blkmap = grown;
+        for(; file->map_blocks < entries; file->map_blocks++) {                 // New entries are holes until written
+            file->blkmap[file->map_blocks].dev_id = LC_BLOCK_HOLE;
+            file->blkmap[file->map_blocks].cluster = -1;
+        }
     }
-    file.opened = 0;                                                        // File no longer opened, set opened to 0
-    files[fh] = file;                                                       // Update the file in the file list
-    logMessage(LOG_OUTPUT_LEVEL, "Driver successfully closed file %s", file.name);
-    return( 0 );                                                            // Succesful close      
+
+    return( &file->blkmap[fblk] );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : lcshutdown
-// Description  : Shut down the filesystem
+// Function     : compact_blockmaps
+// Description  : Memory reclaimer, trims block maps down to their last written
+//                cluster. Entries past the end of a map are holes, so trimming
+//                trailing holes changes nothing. No caller keeps a map entry
+//                across a reservation, except the map being grown.
 //
-// Inputs       : none
-// Outputs      : 0 if successful test, -1 if failure
+// Inputs       : want - bytes wanted
+// Outputs      : bytes freed
 
-int lcshutdown( void ) {
-    int i;
-    for(i = 0; i < file_handle; i++) {                                      // Loop through all files
-        if(files[i].opened == 1) {                                          // If the file is opened
-            if(lcclose(i) == -1) {
+size_t compact_blockmaps(size_t want) {
+    lcloud_blkaddr *shrunk;
+    size_t freed = 0;
+    int i, entries;
+
+    for(i = 0; (i < file_handle) && (freed < want); i++) {
+        if ( (&files[i] == map_growing) || (files[i].blkmap == NULL) ) {
+            continue;
+        }
+        for(entries = files[i].map_blocks; (entries > 0) && (files[i].blkmap[entries - 1].dev_id == LC_BLOCK_HOLE); entries--);
+        if (entries == files[i].map_blocks) {
+            continue;
+        }
+        if (entries == 0) {
+            free(files[i].blkmap);
+            files[i].blkmap = NULL;
+        } else if ( (shrunk = realloc(files[i].blkmap, entries * sizeof(lcloud_blkaddr))) != NULL ) {
+            files[i].blkmap = shrunk;
+        } else {
+            continue;                                                       // Keep the old map, nothing was freed
+        }
+        lcloud_mem_release(LC_MEM_BLOCKMAP, (files[i].map_blocks - entries) * sizeof(lcloud_blkaddr));
+        freed += (files[i].map_blocks - entries) * sizeof(lcloud_blkaddr);
+        files[i].map_blocks = entries;
+    }
+
+    return( freed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : assign_block
+// Description  : Gives a file cluster the next address of the current extent. When
+//                the extent runs out it is refilled from the file's reservation,
+//                without searching, or else the allocator is asked for want
+//                clusters at once, placed right after the previous file cluster
+//                if possible. In place, LC_ALLOC_RESERVE more are asked for and
+//                whatever comes beyond want is kept as the file's reservation,
+//                so files written side by side do not interleave on the device.
+//
+// Inputs       : file - A pointer to the file
+//                fblk - index of the cluster to assign
+//                want - number of clusters still to be assigned, including this one
+//                ext - the extent being handed out, len == used when empty
+// Outputs      : pointer to the block's map entry for successful test, NULL otherwise
+
+lcloud_blkaddr *assign_block(lcloud_file *file, int fblk, int want, lcloud_extent *ext) {
+    int goal_dev = -1, goal_cluster = -1, extra = (log_clusters == 0) ? LC_ALLOC_RESERVE : 0;
+    lcloud_extent *res = &file->reserve;
+    lcloud_blkaddr *addr;
+
+    if ( (ext->used == ext->len) && (res->used < res->len) ) {                 // Current extent used up, take from the reservation
+        ext->dev_id = res->dev_id;
+        ext->cluster = res->cluster + res->used;
+        ext->len = CMPSC311_MINVAL(want, res->len - res->used);
+        ext->used = 0;
+        res->used += ext->len;
+        allocator_reserved++;
+    } else if (ext->used == ext->len) {                                         // Or ask for the rest of the range
+        if ( (fblk > 0) && (fblk <= file->map_blocks) && (file->blkmap[fblk - 1].dev_id >= 0) ) {
+            goal_dev = file->blkmap[fblk - 1].dev_id;                           // Continue after the previous cluster of the file
+            goal_cluster = file->blkmap[fblk - 1].cluster + 1;
+        }
+        if ( (ext->dev_id = allocate_extent(want + extra, goal_dev, goal_cluster, &ext->cluster, &ext->len)) == -1 ) {
+            return( NULL );
+        }
+        ext->used = 0;
+        if (ext->len > want) {                                                  // Keep what is left over for the file's next writes
+            res->dev_id = ext->dev_id;
+            res->cluster = ext->cluster + want;
+            res->len = ext->len - want;
+            res->used = 0;
+            ext->len = want;
+        }
+        logMessage(LOG_OUTPUT_LEVEL, "Allocated extent for data [%d/%d] (%d clusters)", ext->dev_id, ext->cluster, ext->len);
+    }
+
+    if ( (addr = map_block(file, fblk)) == NULL ) {
+        return( NULL );
+    }
+    addr->dev_id = ext->dev_id;                                                 // Cluster now has a device address
+    addr->cluster = ext->cluster + ext->used;
+    ext->used++;
+    if (log_clusters > 0) {
+        log_own(addr->dev_id, addr->cluster, file - files, fblk);
+    }
+
+    return( addr );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : batch_add_cluster
+// Description  : Adds the device blocks of a cluster to a bus batch
+//
+// Inputs       : batch - the batch to add to (must have room for a cluster)
+//                dev_id, sec, blk - the device address of the cluster's first block
+//                buf - cluster sized buffer to read into or write from
+//                xfer - LC_XFER_READ or LC_XFER_WRITE
+// Outputs      : none
+
+void batch_add_cluster(lcloud_busbatch *batch, int dev_id, int sec, int blk, char *buf, int xfer) {
+    int i, linear = sec * devices[dev_id].blocks + blk;
+
+    for(i = 0; i < cluster_blocks; i++, linear++) {                         // Consecutive blocks wrap onto the next sector
+        batch->frms[batch->count] = create_lcloud_registers(0, 0, LC_BLOCK_XFER, dev_id, xfer,
+                                          linear / devices[dev_id].blocks, linear % devices[dev_id].blocks);
+        batch->bufs[batch->count++] = &buf[i * LC_DEVICE_BLOCK_SIZE];
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : batch_submit
+// Description  : Sends a bus batch to the server and checks every response,
+//                leaving the batch empty. Cached clusters the batch writes
+//                are updated only once it has succeeded, and dropped from the
+//                cache if it fails, as the device may hold either copy.
+//
+// Inputs       : batch - the batch to send
+// Outputs      : 0 for successful test, -1 otherwise
+
+int batch_submit(lcloud_busbatch *batch) {
+    int i, count = batch->count, ncached = batch->ncached, ok;
+
+    batch->count = 0;
+    batch->ncached = 0;
+    ok = (client_lcloud_bus_batch(batch->frms, batch->bufs, count) != -1);
+    for(i = 0; ok && (i < count); i++) {                                    // Every block of the batch must have succeeded
+        if ( (extract_lcloud_registers(batch->frms[i], &b0, &b1, &c0, &c1, &c2, &d0, &d1)) ||
+             (b0 != 1) || (b1 != 1) || ((c0 != LC_BLOCK_XFER) && (c0 != LC_BLOCK_COPY)) ) {
+            ok = 0;
+        }
+    }
+    if ( !ok ) {
+        for(i = 0; i < ncached; i++) {
+            lcloud_invalidcache(batch->cached[i].dev_id, batch->cached[i].sec, batch->cached[i].blk);
+        }
+        return( -1 );
+    }
+    return( lcloud_putcache_multi(ncached, batch->cached, batch->cached_bufs) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : device_xfer_cluster
+// Description  : Transfers the device blocks of a cluster as one batch on the bus
+//
+// Inputs       : dev_id, sec, blk - the device address of the cluster's first block
+//                buf - cluster sized buffer to read into or write from
+//                xfer - LC_XFER_READ or LC_XFER_WRITE
+// Outputs      : 0 for successful test, -1 otherwise
+
+int device_xfer_cluster(int dev_id, int sec, int blk, char *buf, int xfer) {
+    lcloud_busbatch batch;
+
+    batch.count = 0;
+    batch.ncached = 0;
+    batch_add_cluster(&batch, dev_id, sec, blk, buf, xfer);
+    return( batch_submit(&batch) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : relocate_clusters
+// Description  : Moves clusters to a run of clusters on one device. A server
+//                with LCLOUD_FEATURE_COPY copies the blocks itself, in one
+//                batch of copy frames; otherwise the data is read back in one
+//                batch and written out in another.
+//
+// Inputs       : count - number of clusters (at most a batch of them)
+//                src_dev, src_cluster - device address of each cluster
+//                dst_dev, dst_cluster - first cluster of the destination run
+// Outputs      : 0 for successful test, -1 otherwise
+
+int relocate_clusters(int count, int *src_dev, int *src_cluster, int dst_dev, int dst_cluster) {
+    lcloud_busbatch batch;
+    int i, j, src, dst, ret;
+    size_t bytes = (size_t)count * cluster_size;
+    char *data;
+
+    batch.count = 0;
+    batch.ncached = 0;
+    if (client_lcloud_bus_features() & LCLOUD_FEATURE_COPY) {
+        for(i = 0; i < count; i++) {
+            src = src_cluster[i] * cluster_blocks;                          // Linear block numbers, as in get_block
+            dst = (dst_cluster + i) * cluster_blocks;
+            for(j = 0; j < cluster_blocks; j++, src++, dst++) {
+                batch.srcs[batch.count] = create_lcloud_registers(0, 0, LC_BLOCK_COPY, src_dev[i], 0,
+                                              src / devices[src_dev[i]].blocks, src % devices[src_dev[i]].blocks);
+                batch.frms[batch.count] = create_lcloud_registers(0, 0, LC_BLOCK_COPY, dst_dev, 0,
+                                              dst / devices[dst_dev].blocks, dst % devices[dst_dev].blocks);
+                batch.bufs[batch.count] = &batch.srcs[batch.count];
+                batch.count++;
+            }
+        }
+        return( batch_submit(&batch) );
+    }
+
+    lcloud_mem_charge(LC_MEM_BUFFERS, bytes);                               // Staging for the data, never refused
+    if ( (data = malloc(bytes)) == NULL ) {
+        lcloud_mem_release(LC_MEM_BUFFERS, bytes);
+        logMessage( LOG_ERROR_LEVEL, "LC failure allocating [%d] clusters to relocate", count);
+        return( -1 );
+    }
+    for(i = 0; i < count; i++) {
+        src = src_cluster[i] * cluster_blocks;
+        batch_add_cluster(&batch, src_dev[i], src / devices[src_dev[i]].blocks, src % devices[src_dev[i]].blocks,
+                          &data[i * cluster_size], LC_XFER_READ);
+    }
+    if ( (ret = batch_submit(&batch)) == 0 ) {
+        for(i = 0; i < count; i++) {
+            dst = (dst_cluster + i) * cluster_blocks;
+            batch_add_cluster(&batch, dst_dev, dst / devices[dst_dev].blocks, dst % devices[dst_dev].blocks,
+                              &data[i * cluster_size], LC_XFER_WRITE);
+        }
+        ret = batch_submit(&batch);
+    }
+    free(data);
+    lcloud_mem_release(LC_MEM_BUFFERS, bytes);
+
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_move
+// Description  : Copies file clusters forward to the log head, in the order
+//                given, and points the files at the copies. The old clusters
+//                are retired and their cached copies dropped.
+//
+// Inputs       : count - number of clusters (at most a batch of them)
+//                fhs, fblks - the file and index of each cluster
+// Outputs      : 0 for successful test, -1 otherwise
+
+int log_move(int count, int *fhs, int *fblks) {
+    int src_dev[LC_BUS_BATCH_FRAMES], src_cluster[LC_BUS_BATCH_FRAMES];
+    int i, done, dev_id, cluster, len, sec, blk;
+    lcloud_blkaddr *addr;
+
+    for(done = 0; done < count; done += len) {                              // One run per segment the copies land in
+        if ( (dev_id = allocate_extent(count - done, -1, -1, &cluster, &len)) == -1 ) {
+            return( -1 );
+        }
+        for(i = 0; i < len; i++) {
+            src_dev[i] = files[fhs[done + i]].blkmap[fblks[done + i]].dev_id;
+            src_cluster[i] = files[fhs[done + i]].blkmap[fblks[done + i]].cluster;
+        }
+        if ( relocate_clusters(len, src_dev, src_cluster, dev_id, cluster) == -1 ) {
+            return( -1 );                                                   // The run is dead space, reclaimed with its segment
+        }
+        for(i = 0; i < len; i++) {
+            get_block(&files[fhs[done + i]], fblks[done + i], &sec, &blk);
+            lcloud_invalidcache(src_dev[i], sec, blk);
+            log_retire(src_dev[i], src_cluster[i]);
+            addr = &files[fhs[done + i]].blkmap[fblks[done + i]];
+            addr->dev_id = dev_id;
+            addr->cluster = cluster + i;
+            log_own(dev_id, cluster + i, fhs[done + i], fblks[done + i]);
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_victim
+// Description  : Picks the full segment most worth cleaning, by the classic
+//                cost-benefit of free space gained times age over the cost of
+//                reading and rewriting the live data
+//
+// Inputs       : max_live - most live clusters a victim may hold, in percent
+//                *dev_id, *seg - the address of the victim's device and number
+// Outputs      : 0 if a victim was found, -1 otherwise
+
+int log_victim(int max_live, int *dev_id, int *seg) {
+    double u, score, best = -1;
+    lcloud_segment *sg;
+    int id, j;
+
+    for(id = 0; id < 16; id++) {
+        if (devices[id].dev_id == -1) {
+            continue;
+        }
+        for(j = 0; j < devices[id].nsegs; j++) {
+            sg = &devices[id].segs[j];
+            if ( (sg->state != LC_SEG_FULL) || (sg->live == log_clusters) || (sg->live * 100 > max_live * log_clusters) ) {
+                continue;
+            }
+            u = (double)sg->live / log_clusters;
+            if ( (score = (1 - u) * (log_clock - sg->stamp + 1) / (1 + u)) > best ) {
+                best = score;
+                *dev_id = id;
+                *seg = j;
+            }
+        }
+    }
+    return( (best < 0) ? -1 : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_clean_segment
+// Description  : Copies the live clusters of a segment forward to the log
+//                head, a batch at a time, which frees the segment
+//
+// Inputs       : dev_id, seg - the segment to clean
+// Outputs      : 0 for successful test, -1 otherwise
+
+int log_clean_segment(int dev_id, int seg) {
+    int fhs[LC_BUS_BATCH_FRAMES], fblks[LC_BUS_BATCH_FRAMES];
+    int j, count, live = devices[dev_id].segs[seg].live, chunk = LC_BUS_BATCH_FRAMES / cluster_blocks;
+    uint64_t start = lcloud_trace_now();
+
+    log_cleaning++;
+    for(j = seg * log_clusters; j < (seg + 1) * log_clusters; ) {
+        for(count = 0; (j < (seg + 1) * log_clusters) && (count < chunk); j++) {
+            if (devices[dev_id].owner_fh[j] != -1) {
+                fhs[count] = devices[dev_id].owner_fh[j];
+                fblks[count++] = devices[dev_id].owner_fblk[j];
+            }
+        }
+        if ( (count > 0) && (log_move(count, fhs, fblks) == -1) ) {
+            log_cleaning--;
+            logMessage( LOG_ERROR_LEVEL, "LC failure cleaning log segment [%d/%d]", dev_id, seg);
+            return( -1 );
+        }
+        log_moved += count;
+    }
+    log_cleaning--;
+    log_cleaned++;
+
+    logMessage(LOG_OUTPUT_LEVEL, "LC cleaned log segment [%d/%d], [%d] live clusters moved", dev_id, seg, live);
+    lcloud_trace_span("clean segment", "log", start, live);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_enter
+// Description  : Starts a filesystem operation. In log mode, when no other
+//                operation is under way (so no batch holds log clusters not
+//                yet written), the cleaner first makes room for the clusters
+//                the operation may append: its own, and every delayed cluster
+//                in the cache, which it may flush.
+//
+// Inputs       : clusters - clusters the operation itself may write
+// Outputs      : none
+
+void log_enter(int clusters) {
+    int dev_id, seg, need = clusters + (int)lcloud_statp->dirty;
+
+    if ( (log_clusters > 0) && (log_depth == 0) && (log_total > 0) ) {
+        while ( ((log_free - LC_LOG_RESERVE) * log_clusters + ((log_seg != -1) ? log_clusters - log_next : 0) < need) &&
+                (log_victim(100, &dev_id, &seg) == 0) && (log_clean_segment(dev_id, seg) == 0) );
+    }
+    log_depth++;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_leave
+// Description  : Ends a filesystem operation started with log_enter
+//
+// Inputs       : none
+// Outputs      : none
+
+void log_leave(void) {
+    log_depth--;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : device_read_block
+// Description  : Reads a cluster from a device over the bus
+//
+// Inputs       : dev_id, sec, blk - the device address of the cluster's first block
+//                buf - cluster sized buffer to place the data
+// Outputs      : 0 for successful test, -1 otherwise
+
+int device_read_block(int dev_id, int sec, int blk, char *buf) {
+    if ( device_xfer_cluster(dev_id, sec, blk, buf, LC_XFER_READ) == -1 ) {
+        logMessage( (lcexpired(lcgetcancel())) ? LOG_OUTPUT_LEVEL : LOG_ERROR_LEVEL, "LC failure reading blkc [%d,%d,%d]", dev_id, sec, blk);
+        return( -1 );                                                       // Failed read operation
+    }
+    logMessage( LOG_OUTPUT_LEVEL, "LC success reading blkc [%d/%d/%d]", dev_id, sec, blk);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : device_write_block
+// Description  : Writes a cluster to a device over the bus
+//
+// Inputs       : dev_id, sec, blk - the device address of the cluster's first block
+//                buf - cluster sized buffer holding the data
+// Outputs      : 0 for successful test, -1 otherwise
+
+int device_write_block(int dev_id, int sec, int blk, char *buf) {
+    if ( device_xfer_cluster(dev_id, sec, blk, buf, LC_XFER_WRITE) == -1 ) {
+        logMessage( LOG_ERROR_LEVEL, "LC failure writing blkc [%d/%d/%d]", dev_id, sec, blk);
+        return( -1 );                                                       // Failed write operation
+    }
+    logMessage(LOG_OUTPUT_LEVEL, "LC success writing blkc [%d/%d/%d]", dev_id, sec, blk);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_block
+// Description  : Reads a whole file cluster. Holes are zero filled without any
+//                bus traffic, delayed clusters come from their cache buffers and
+//                allocated clusters from cache or the device, and are cached
+//                once fetched.
+//
+// Inputs       : fh - the file handle of the file
+//                file - A pointer to the file
+//                fblk - index of the cluster within the file
+//                buf - cluster sized buffer to place the data
+//                direct - 1 to use a resident copy without promoting it (or
+//                         counting a hit/miss) and not cache a fetched one,
+//                         0 for a normal cache lookup
+// Outputs      : 0 for successful test, -1 otherwise
+
+int read_block(LcFHandle fh, lcloud_file *file, int fblk, char *buf, int direct) {
+    int dev_id, sec, blk;
+    char *cache_block;
+    uint64_t start;
+
+    dev_id = get_block(file, fblk, &sec, &blk);                             // Set sec and blk for the read
+    if (dev_id == LC_BLOCK_HOLE) {                                          // Hole, nothing stored anywhere
+        memset(buf, 0, cluster_size);
+        return( 0 );
+    }
+
+    if (dev_id == LC_BLOCK_DELAYED) {                                       // Delayed block, lives only in the cache
+        if ( (cache_block = lcloud_getdelayed(fh, fblk)) == NULL ) {
+            logMessage( LOG_ERROR_LEVEL, "LC failure delayed block [%d:%d] not in cache", fh, fblk);
+            return( -1 );
+        }
+        memcpy(buf, cache_block, cluster_size);
+        return( 0 );
+    }
+
+    cache_block = (direct) ? lcloud_peekcache(dev_id, sec, blk) : lcloud_getcache(dev_id, sec, blk);
+    if( cache_block == NULL ) {                                             // The block is not in cache
+        memset(buf, 0, cluster_size);
+        start = lcloud_stats_clock();
+        if ( device_read_block(dev_id, sec, blk, buf) == -1 ) {
+            return( -1 );
+        }
+        lcloud_costcache(dev_id, lcloud_stats_clock() - start);             // What this miss cost, for the cache's replacement
+        if ( !direct && (lcloud_putcache(dev_id, sec, blk, buf) == -1) ) {  // Kept, and priced at that cost, unless read around the cache
+            return( -1 );
+        }
+        return( 0 );
+    }
+    memcpy(buf, cache_block, cluster_size);
+    logMessage( LOG_OUTPUT_LEVEL, "LC success retrieving blkc from cache [%d/%d/%d]", dev_id, sec, blk);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_clusters
+// Description  : Reads many allocated clusters. They are looked up in the
+//                cache together, the hits copied out, and the misses fetched
+//                in one batch, so a large read pays for one trip to the
+//                server instead of one per cluster missed. Each miss is
+//                priced at its share of the batch's time and then cached,
+//                so what it cost to fetch decides how long it is kept.
+//
+// Inputs       : keys - device address of each cluster
+//                dst - cluster sized buffer for each cluster's data
+//                n - number of clusters (at most a batch of them)
+// Outputs      : 0 for successful test, -1 otherwise
+
+int read_clusters(lcloud_cachekey *keys, char **dst, int n) {
+    char *blocks[LC_BUS_BATCH_FRAMES];
+    int missed[LC_BUS_BATCH_FRAMES];
+    lcloud_cachekey fetched[LC_BUS_BATCH_FRAMES];
+    lcloud_busbatch batch;
+    int i, nmissed;
+    uint64_t start, ns;
+
+    nmissed = lcloud_getcache_multi(n, keys, blocks, missed);
+    for(i = 0; i < n; i++) {                                                // Hits first, their buffers are only good for now
+        if (blocks[i] != NULL) {
+            memcpy(dst[i], blocks[i], cluster_size);
+            logMessage( LOG_OUTPUT_LEVEL, "LC success retrieving blkc from cache [%d/%d/%d]", keys[i].dev_id, keys[i].sec, keys[i].blk);
+        }
+    }
+    if (nmissed == 0) {
+        return( 0 );
+    }
+
+    batch.count = 0;
+    batch.ncached = 0;
+    for(i = 0; i < nmissed; i++) {
+        batch_add_cluster(&batch, keys[missed[i]].dev_id, keys[missed[i]].sec, keys[missed[i]].blk, dst[missed[i]], LC_XFER_READ);
+    }
+    start = lcloud_stats_clock();
+    if ( batch_submit(&batch) == -1 ) {
+        logMessage( (lcexpired(lcgetcancel())) ? LOG_OUTPUT_LEVEL : LOG_ERROR_LEVEL, "LC failure reading [%d] blkcs", nmissed);
+        return( -1 );
+    }
+    ns = (lcloud_stats_clock() - start) / nmissed;
+    for(i = 0; i < nmissed; i++) {
+        lcloud_costcache(keys[missed[i]].dev_id, ns);                       // What this miss cost, for the cache's replacement
+        fetched[i] = keys[missed[i]];
+        blocks[i] = dst[missed[i]];
+        logMessage( LOG_OUTPUT_LEVEL, "LC success reading blkc [%d/%d/%d]", keys[missed[i]].dev_id, keys[missed[i]].sec, keys[missed[i]].blk);
+    }
+    return( lcloud_putcache_multi(nmissed, fetched, blocks) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : zerocopy_write_block
+// Description  : Adds a whole file cluster to a bus batch that sends it straight
+//                from the caller's buffer. Unallocated clusters are given an
+//                address right away (from one extent covering the rest of the
+//                full clusters in the write). A direct open drops any cached
+//                copy; otherwise a resident copy is updated once the batch has
+//                been sent, and a cluster that is not resident is left to be
+//                cached when next read.
+//                In log mode every cluster is given a new address at the log
+//                head and its old one retired.
+//
+// Inputs       : fh - the file handle of the file
+//                file - A pointer to the file
+//                fblk - index of the cluster within the file
+//                buf - the cluster of data to write, untouched until the batch is sent
+//                remaining - number of full clusters left in the write, including this one
+//                ext - extent used for unallocated clusters across the write
+//                batch - the batch to add to (must have room for a cluster)
+// Outputs      : 0 for successful test, -1 otherwise
+
+int zerocopy_write_block(LcFHandle fh, lcloud_file *file, int fblk, char *buf, int remaining, lcloud_extent *ext, lcloud_busbatch *batch) {
+    int dev_id, sec = 0, blk = 0, want = 0, f, s, b;
+    lcloud_blkaddr *addr;
+
+    if ( ((dev_id = get_block(file, fblk, &sec, &blk)) >= 0) && (log_clusters > 0) ) {
+        lcloud_invalidcache(dev_id, sec, blk);                              // Log mode, the old copy is superseded by one at the log head
+        log_retire(dev_id, file->blkmap[fblk].cluster);
+        file->blkmap[fblk].dev_id = dev_id = LC_BLOCK_HOLE;
+    }
+    if ( dev_id < 0 ) {
+        if (dev_id == LC_BLOCK_DELAYED) {                                   // The buffered data is being replaced
+            lcloud_dropdelayed(fh, fblk);
+        }
+        if (ext->used == ext->len) {                                        // Size the allocation to the unallocated blocks left
+            for(f = fblk; f < fblk + remaining; f++) {
+                if ( (get_block(file, f, &s, &b) < 0) || (log_clusters > 0) ) {
+                    want++;
+                }
+            }
+        }
+        if ( ((addr = assign_block(file, fblk, want, ext)) == NULL) ||
+             ((dev_id = get_block(file, fblk, &sec, &blk)) < 0) ) {
+            return( -1 );
+        }
+    } else if ( (file->flags & LC_OPEN_DIRECT) || (lcloud_peekcache(dev_id, sec, blk) == NULL) ) {
+        lcloud_invalidcache(dev_id, sec, blk);                              // Nothing cached to keep current
+    } else {
+        batch->cached[batch->ncached].dev_id = dev_id;                      // Updated once the batch is on the device
+        batch->cached[batch->ncached].sec = sec;
+        batch->cached[batch->ncached].blk = blk;
+        batch->cached_bufs[batch->ncached++] = buf;
+    }
+
+    batch_add_cluster(batch, dev_id, sec, blk, buf, LC_XFER_WRITE);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsetclustersize
+// Description  : Set the logical cluster size, the unit of allocation, block 
+//                mapping and caching. Must be called before the first open.
+//
+// Inputs       : blocks - device blocks per cluster (1 to LC_MAX_CLUSTER_BLOCKS)
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcsetclustersize( int blocks ) {
+    if (file_handle != 0) {                                                 // Devices are already laid out in clusters
+        logMessage(LOG_ERROR_LEVEL, "LC failure setting cluster size, filesystem already in use");
+        return( -1 );
+    }
+    if ((blocks < 1) || (blocks > LC_MAX_CLUSTER_BLOCKS)) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure cluster size out of range [%d]", blocks);
+        return( -1 );
+    }
+
+    cluster_blocks = blocks;
+    cluster_size = blocks * LC_DEVICE_BLOCK_SIZE;
+    logMessage(LOG_OUTPUT_LEVEL, "LC cluster size set to [%d] blocks (%d bytes)", cluster_blocks, cluster_size);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsetlogmode
+// Description  : Lay data out as a log: every cluster written, new or not, is
+//                appended at the log head in segments of the given size, and
+//                a cleaner copies the live data out of mostly dead segments.
+//                Must be called before the first open.
+//
+// Inputs       : clusters - clusters per log segment, 0 to update in place
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcsetlogmode( int clusters ) {
+    if (file_handle != 0) {                                                 // Devices are already laid out
+        logMessage(LOG_ERROR_LEVEL, "LC failure setting log mode, filesystem already in use");
+        return( -1 );
+    }
+    if ( (clusters < 0) || (clusters == 1) ) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure log segment size out of range [%d]", clusters);
+        return( -1 );
+    }
+
+    log_clusters = clusters;
+    if (clusters > 0) {
+        logMessage(LOG_OUTPUT_LEVEL, "LC log-structured layout, segments of [%d] clusters", clusters);
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcopen
+// Description  : Open the file for for reading and writing
+//
+// Inputs       : path - the path/filename of the file to be read
+//                flags - open mode, LC_OPEN_DIRECT makes full-block reads and
+//                        writes bypass the cache
+// Outputs      : file handle if successful test, -1 if failure
+
+LcFHandle lcopen( const char *path, int flags ) {
+    if(file_handle == 0) {                                                  // First open operation, power on devices
+        if(device_power_on() == -1) {                                       // Start by powering on device
+            return(-1);                                                     // Throw error if device_power_on fails
+        }
+        lcloud_mem_reclaimer(compact_blockmaps);                            // Under memory pressure, after the cache shrinks
+    }
+
+    // Check if the file already exists
+    LcFHandle fh;
+    for(fh = 0; fh < file_handle; fh++) {                                   // When no name matches the path, fh = file_handle and is unique
+        if(strcmp(files[fh].name, path) == 0) {                             // If a file with this path exists, check if it is already opened
+            if(files[fh].opened == 1) {
+                return( -1 );                                               // If the file is already opened, the function fails
+                logMessage( LOG_ERROR_LEVEL, "LC failure opening file, file already opened.");
+            } else {                                                        // Otherwise, open the file
+                files[fh].pos = 0;                                          // Set the read/write head to 0
+                files[fh].opened = 1;                                       // The file is opened
+                files[fh].flags = flags;
+                lcloud_stats_open(fh, path);
+                return( fh );                                               // Return the file handle       
+            }
+        }
+    }
+
+    lcloud_file file, *grown;                                               // The file does not exist, create it
+
+    if (fh == files_alloc) {                                                // Grow the files array in whole chunks
+        if (lcloud_mem_reserve(LC_MEM_FILES, LC_FILES_CHUNK * sizeof(lcloud_file)) == -1) {
+            logMessage( LOG_ERROR_LEVEL, "LC failure opening file, file table over memory budget");
+            return( -1 );
+        }
+        if ( (grown = realloc(files, (files_alloc + LC_FILES_CHUNK) * sizeof(lcloud_file))) == NULL ) {
+            lcloud_mem_release(LC_MEM_FILES, LC_FILES_CHUNK * sizeof(lcloud_file));
+            logMessage( LOG_ERROR_LEVEL, "LC failure growing file table");
+            return( -1 );
+        }
+        files = grown;
+        files_alloc += LC_FILES_CHUNK;
+    }
+
+    file_handle += 1;                                                       // Increment the file_handle tracker to maintain uniqueness
+    file.fh = file_handle;                                                  // Assign the file's handle to the unique file_handle tracker
+    
+    strncpy(file.name, path, 259);                                          // Assign 259 characters of path to file.name
+    file.name[259] = '\0';                                                  // Place null terminator at end of path in case path length > 260
+    
+    file.pos = 0;                                                           // Set the file's read/write head to 0
+    file.size = 0;                                                          // Initialize the file's size to 0
+    file.blkmap = NULL;                                                     // Every block starts out as a hole
+    file.map_blocks = 0;
+    
+                                                                            // Block addresses go unassigned until a flush occurs
+
+    file.opened = 1;                                                        // Set the file to opened
+    file.flags = flags;                                                     // Remember the open mode
+    file.reserve.dev_id = -1;                                               // Nothing reserved until the first allocation
+    file.reserve.cluster = -1;
+    file.reserve.len = file.reserve.used = 0;
+
+    files[fh] = file;                                                       // Add the current file to the files array
+    lcloud_stats_open(fh, path);
+    return(fh);                                                             // Returns the uniquely generated file header
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : read_file
+// Description  : Read data from the file 
+//
+// Inputs       : fh - file handle for the file to read from
+//                buf - place to put the data
+//                len - the length of the read
+// Outputs      : number of bytes read, -1 if failure
+
+int read_file( LcFHandle fh, char *buf, size_t len ) {
+    char temp[2][LC_CLUSTER_BUFSIZE];                                       // Partial first and last clusters, read whole then copied out
+    char *copy_to[2];
+    int copy_from[2], copy_len[2];
+    lcloud_cachekey keys[LC_BUS_BATCH_FRAMES];                              // Allocated clusters of the round, looked up together
+    char *dst[LC_BUS_BATCH_FRAMES];
+    int i = 0, k, pos_in_block, bytes, direct, nkeys, npartial;
+    int fblk, dev_id, sec, blk;
+    char *data;
+
+    lcloud_file *file;
+    if( (file = validate_fh(fh)) == NULL ) {                                // Validate the file handle and get the file from handle
+        return( - 1 );
+    }
+
+    if (file->pos >= file->size) {                                          // No data to read
+        return ( 0 );
+    }
+    if (file->pos + len > file->size) {                                     // If the length of the read goes over the file sieze
+        len = file->size - file->pos;                                       // Set the length of the read to rest of file
+    }
+
+    while(i < len) {                                                        // Rounds of up to a batch of clusters, i is incremented by bytes copied
+        nkeys = npartial = 0;
+        while ( (i < len) && (nkeys < LC_BUS_BATCH_FRAMES / cluster_blocks) ) {
+            fblk = file->pos / cluster_size;
+            pos_in_block = file->pos % cluster_size;                        // Get the position of the read head in the cluster
+            bytes = cluster_size - pos_in_block;                            // Read to the end of the cluster, or the end of the read
+            if (bytes > len - i) {
+                bytes = len - i;
+            }
+
+            data = &buf[i];                                                 // A full cluster is read straight into buf at i
+            if (bytes < cluster_size) {
+                data = temp[npartial];
+                copy_to[npartial] = &buf[i];
+                copy_from[npartial] = pos_in_block;
+                copy_len[npartial++] = bytes;
+            }
+            direct = (file->flags & LC_OPEN_DIRECT) && (bytes == cluster_size);
+            if ( ((dev_id = get_block(file, fblk, &sec, &blk)) >= 0) && !direct ) {
+                keys[nkeys].dev_id = dev_id;                                // On a device, looked up with the rest of the round
+                keys[nkeys].sec = sec;
+                keys[nkeys].blk = blk;
+                dst[nkeys++] = data;
+            } else if ( read_block(fh, file, fblk, data, direct) == -1 ) {  // Hole, delayed, or a direct read around the cache
+                return( -1 );
+            }
+            file->pos += bytes;                                             // Increment pos by bytes read
+            i += bytes;
+        }
+
+        if ( (nkeys > 0) && (read_clusters(keys, dst, nkeys) == -1) ) {
+            return( -1 );
+        }
+        for(k = 0; k < npartial; k++) {                                     // Copy the requested part of the partial clusters into buf
+            memcpy(copy_to[k], &temp[k][copy_from[k]], copy_len[k]);
+        }
+    }
+    logMessage(LOG_OUTPUT_LEVEL, "Driver read %d bytes from file %s (at %d)", len, file->name, file->pos);
+
+    return( len );                                                          // returns number of bytes read on sucessful test
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcread
+// Description  : Read data from the file, traced as one span. Under a token
+//                the read gives up once the deadline passes or it is
+//                cancelled, leaving buf and the file position undefined.
+//
+// Inputs       : fh - file handle for the file to read from
+//                buf - place to put the data
+//                len - the length of the read
+// Outputs      : number of bytes read, -1 if failure
+
+int lcread( LcFHandle fh, char *buf, size_t len ) {
+    uint64_t start = lcloud_trace_now();
+    int ret;
+
+    if ( op_abandoned("read") == -1 ) {
+        return( -1 );
+    }
+    log_enter(0);                                                           // A miss may evict, and flush, delayed clusters
+    ret = read_file(fh, buf, len);
+    log_leave();
+
+    if (ret > 0) {
+        lcloud_stats_io(fh, 0, ret);
+    }
+    lcloud_trace_span("lcread", "api", start, len);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : write_file
+// Description  : write data to the file. Blocks that already have a device 
+//                address are written through, new blocks are kept in the cache
+//                as delayed dirty buffers until the file is flushed. Writing 
+//                past the end of the file leaves the skipped blocks as holes.
+//                Whole clusters that are written through (every one, in a
+//                direct open) are sent in batches straight from buf, which is
+//                free to reuse once the write returns. In log mode nothing is
+//                written in place: partial clusters are delayed too, and go
+//                to the log head with the rest of the file's dirty range.
+//
+// Inputs       : fh - file handle for the file to write to
+//                buf - pointer to data to write
+//                len - the length of the write
+// Outputs      : number of bytes written if successful test, -1 if failure
+
+int write_file( LcFHandle fh, char *buf, size_t len ) {
+    char temp[LC_CLUSTER_BUFSIZE];                                              // Temporary buffer to perform write in cluster sized chunks
+    int i = 0, pos_in_block, bytes, fblk, sec, blk, dev_id;
+    lcloud_extent ext = { -1, -1, 0, 0 };                                       // Extent for direct writes into unallocated clusters
+    lcloud_busbatch batch;                                                      // Whole clusters sent from buf
+    int sent_pos = 0, sent_size = 0;                                            // File position and size before the batch's clusters
+    lcloud_blkaddr *addr;
+    char *data;
+
+    lcloud_file *file;
+    if ( (file = validate_fh(fh)) == NULL ) {                                   // Validate the file handle and get the file from handle
+        return( - 1 );                                                          // Invalid file handle
+    }
+    batch.count = 0;
+    batch.ncached = 0;
+
+    while (i < len) {                                                           // Loop to write in blocks, i is incremented by bytes copied
+        fblk = file->pos / cluster_size;
+        pos_in_block = file->pos % cluster_size;                                // Get the position of the write head in the cluster
+        bytes = cluster_size - pos_in_block;                                    // Write to the end of the cluster, or the end of the write
+        if (bytes > len - i) {
+            bytes = len - i;
+        }
+
+        if ( (bytes == cluster_size) &&                                         // Full cluster going to the device, send straight from buf at i
+             ((file->flags & LC_OPEN_DIRECT) || (get_block(file, fblk, &sec, &blk) >= 0)) ) {
+            if ( (batch.count + cluster_blocks > LC_BUS_BATCH_FRAMES) && (batch_submit(&batch) == -1) ) {
+                break;
+            }
+            if (batch.count == 0) {
+                sent_pos = file->pos;
+                sent_size = file->size;
+            }
+            if ( zerocopy_write_block(fh, file, fblk, &buf[i], (len - i) / cluster_size, &ext, &batch) == -1 ) {
+                break;
+            }
+            file->pos += bytes;
+            i += bytes;
+            if (file->pos > file->size) {
+                file->size = file->pos;
+            }
+            continue;
+        }
+
+        if ( (batch.count > 0) && (batch_submit(&batch) == -1) ) {              // Earlier clusters go out first
+            break;
+        }
+        data = &buf[i];                                                         // A full cluster is buffered from buf as it is
+        if (bytes < cluster_size) {                                             // Partial cluster, read the current cluster into temp
+            if ( read_block(fh, file, fblk, temp, 0) == -1 ) {
+                return( -1 );
+            }
+            memcpy(&temp[pos_in_block], &buf[i], bytes);                        // Copy the next part of buf into the block
+            data = temp;
+        }
+
+        if ( ((dev_id = get_block(file, fblk, &sec, &blk)) >= 0) && (log_clusters == 0) ) { // Block has a device address, write it through
+            if ( (device_write_block(dev_id, sec, blk, data) == -1) ||
+                 (lcloud_putcache(dev_id, sec, blk, data) == -1) ) {
+                return( -1 );
+            }
+        } else {                                                                // Hole or delayed block, delay allocation until flush
+            if ( (lcloud_putdelayed(fh, fblk, data) == -1) ||
+                 ((addr = map_block(file, fblk)) == NULL) ) {
+                return( -1 );
+            }
+            if (dev_id >= 0) {                                                  // Log mode, the old copy is superseded and the new one is appended at flush
+                lcloud_invalidcache(dev_id, sec, blk);
+                log_retire(dev_id, addr->cluster);
+            }
+            addr->dev_id = LC_BLOCK_DELAYED;
+            logMessage(LOG_OUTPUT_LEVEL, "LC success buffering delayed blkc [%d:%d]", fh, fblk);
+        }
+
+        file->pos += bytes;                                                     // Increment pos by bytes written
+        i += bytes;
+        if (file->pos > file->size) {                                           // When writing to the end of the file
+            file->size = file->pos;                                             // Update the file size to the write head
+        }
+    }
+    if ( (i < len) || ((batch.count > 0) && (batch_submit(&batch) == -1)) ) {   // Send the last whole clusters before buf is handed back
+        file->pos = sent_pos;                                                   // The file ends where the device copy does
+        file->size = sent_size;
+        return( -1 );
+    }
+
+    logMessage(LOG_OUTPUT_LEVEL, "Driver wrote %d bytes to file %s (now %d bytes)", len, file->name, file->size);
+    return( len );                                                              // returns number of bytes written on sucessful test
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcwrite
+// Description  : Write data to the file, traced as one span. Under a token
+//                only a write that has not started is abandoned; one that
+//                has runs to the end, so a deadline never tears a write.
+//
+// Inputs       : fh - file handle for the file to write to
+//                buf - pointer to data to write
+//                len - the length of the write
+// Outputs      : number of bytes written if successful test, -1 if failure
+
+int lcwrite( LcFHandle fh, char *buf, size_t len ) {
+    uint64_t start = lcloud_trace_now();
+    int ret;
+
+    if ( op_abandoned("write") == -1 ) {                                    // Once started, a write runs to the end
+        return( -1 );
+    }
+    log_enter(len / cluster_size + 2);                                      // Whole clusters, and a partial one at each end
+    ret = write_file(fh, buf, len);
+    log_leave();
+
+    if (ret > 0) {
+        lcloud_stats_io(fh, 1, ret);
+    }
+    lcloud_trace_span("lcwrite", "api", start, len);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcseek
+// Description  : Seek to a specific place in the file. Seeking past the end
+//                of the file is allowed, a later write leaves a hole behind.
+//
+// Inputs       : fh - the file handle of the file to seek in
+//                off - offset within the file to seek to
+// Outputs      : new position if successful test, -1 if failure
+
+int lcseek( LcFHandle fh, size_t off ) {
+
+    lcloud_file *file;
+    if( (file = validate_fh(fh)) == NULL ) {                                // Validate the file handle and get the file from handle
+        return( - 1 );                                                      // Invalid file handle
+    }
+
+    if (off > INT_MAX) {                                                    // Validity check: position must fit the file's size field
+        logMessage(LOG_ERROR_LEVEL, "LC failure seek bounds out of range [%d,%lu]", file->size, off);
+        return( -1 );                                                       // Failed seek
+    }
+
+    file->pos = off;                                                        // Set the file position to the seek offset
+    logMessage(LOG_OUTPUT_LEVEL, "LC successfully seeked file %s to [%d]", file->name, off);
+    return( file->pos );                                                    // Successful seek
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcseekdata
+// Description  : Seek to the first byte at or after off that is not in a hole
+//
+// Inputs       : fh - the file handle of the file to seek in
+//                off - offset within the file to start searching from
+// Outputs      : new position if successful test, -1 if no data follows or failure
+
+int lcseekdata( LcFHandle fh, size_t off ) {
+    int fblk, sec, blk;
+
+    lcloud_file *file;
+    if( (file = validate_fh(fh)) == NULL ) {                                // Validate the file handle and get the file from handle
+        return( - 1 );                                                      // Invalid file handle
+    }
+
+    for(fblk = off / cluster_size; (off < file->size) && (fblk < file->map_blocks); fblk++) {
+        if ( get_block(file, fblk, &sec, &blk) != LC_BLOCK_HOLE ) {         // Written block, data starts here (or at off)
+            file->pos = CMPSC311_MAXVAL(off, fblk * cluster_size);
+            return( file->pos );
+        }
+    }
+
+    logMessage(LOG_OUTPUT_LEVEL, "LC no data in file %s after [%lu]", file->name, off);
+    return( -1 );                                                           // Only holes up to the end of the file
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcseekhole
+// Description  : Seek to the first byte at or after off that is in a hole. The
+//                end of the file counts as a hole.
+//
+// Inputs       : fh - the file handle of the file to seek in
+//                off - offset within the file to start searching from
+// Outputs      : new position if successful test, -1 if off is past the end or failure
+
+int lcseekhole( LcFHandle fh, size_t off ) {
+    int fblk, sec, blk;
+
+    lcloud_file *file;
+    if( (file = validate_fh(fh)) == NULL ) {                                // Validate the file handle and get the file from handle
+        return( - 1 );                                                      // Invalid file handle
+    }
+    if (off >= file->size) {
+        logMessage(LOG_OUTPUT_LEVEL, "LC no hole in file %s after [%lu]", file->name, off);
+        return( -1 );
+    }
+
+    for(fblk = off / cluster_size; fblk * cluster_size < file->size; fblk++) {
+        if ( get_block(file, fblk, &sec, &blk) == LC_BLOCK_HOLE ) {         // Unwritten block, hole starts here (or at off)
+            break;
+        }
+    }
+
+    file->pos = CMPSC311_MINVAL(CMPSC311_MAXVAL(off, fblk * cluster_size), file->size);
+    return( file->pos );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_unassign
+// Description  : Takes back the device addresses a failed flush gave to delayed
+//                clusters, which stay dirty in the cache for the next flush
+//
+// Inputs       : file - A pointer to the file
+//                fblks - the clusters, in the order they were assigned
+//                count - the number of clusters
+// Outputs      : none
+
+void flush_unassign(lcloud_file *file, int *fblks, int count) {
+    lcloud_blkaddr *addr;
+    int i;
+
+    for(i = 0; i < count; i++) {
+        addr = &file->blkmap[fblks[i]];
+        if (log_clusters > 0) {
+            log_retire(addr->dev_id, addr->cluster);                        // Log mode, the appended copy is dead space for the cleaner
+        } else {
+            release_extent(addr->dev_id, addr->cluster, 1);
+        }
+        addr->dev_id = LC_BLOCK_DELAYED;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_batch
+// Description  : Sends a batch of delayed clusters, then binds their cache lines
+//                to their new addresses; until then the lines stay delayed
+//
+// Inputs       : fh - the file handle of the file being flushed
+//                file - A pointer to the file
+//                batch - the batch to send
+//                fblks - the clusters in the batch
+//                count - the number of clusters
+// Outputs      : 0 if successful test, -1 if failure
+
+int flush_batch(LcFHandle fh, lcloud_file *file, lcloud_busbatch *batch, int *fblks, int count) {
+    int dev_id, i, sec, blk;
+
+    if (batch_submit(batch) == -1) {
+        logMessage( LOG_ERROR_LEVEL, "LC failure flushing file [%d]", fh);
+        return( -1 );
+    }
+    for(i = 0; i < count; i++) {
+        dev_id = get_block(file, fblks[i], &sec, &blk);
+        lcloud_placedelayed(fh, fblks[i], dev_id, sec, blk);
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flush_file
+// Description  : Allocate and write out any delayed blocks of the file. The 
+//                allocator is asked for the whole dirty range at once, so the
+//                file's new blocks land in as few contiguous extents as possible,
+//                and the writes go to the server in large batches. A cluster's
+//                cache line stays delayed until its batch is on the device, so
+//                a failed flush leaves it to be written by the next one.
+//
+// Inputs       : fh - the file handle of the file to flush
+// Outputs      : 0 if successful test, -1 if failure
+
+int flush_file( LcFHandle fh ) {
+    int fblk, want = 0;
+    lcloud_extent ext = { -1, -1, 0, 0 };
+    lcloud_busbatch batch;
+    int fblks[LC_BUS_BATCH_FRAMES], pending = 0;
+    int sec, blk, placed = 0, ret = 0;
+    char *data;
+
+    lcloud_file *file;
+    if( (file = validate_fh(fh)) == NULL ) {                                // Validate the file handle and get the file from handle
+        return( - 1 );                                                      // Invalid file handle
+    }
+
+    for(fblk = 0; fblk < file->map_blocks; fblk++) {                        // Count the dirty range to size the request
+        if (file->blkmap[fblk].dev_id == LC_BLOCK_DELAYED) {
+            want++;
+        }
+    }
+    batch.count = 0;
+    batch.ncached = 0;
+
+    for(fblk = 0; (fblk < file->map_blocks) && (want > 0); fblk++) {       // Place the delayed blocks in file order, holes stay unallocated
+        if (file->blkmap[fblk].dev_id != LC_BLOCK_DELAYED) {
+            continue;
+        }
+
+        if (batch.count + cluster_blocks > LC_BUS_BATCH_FRAMES) {
+            if ( (ret = flush_batch(fh, file, &batch, fblks, pending)) == -1 ) {
+                break;
+            }
+            pending = 0;
+        }
+        if (assign_block(file, fblk, want, &ext) == NULL) {
+            ret = -1;
+            break;
+        }
+        fblks[pending++] = fblk;
+        if ( (get_block(file, fblk, &sec, &blk) < 0) ||
+             ((data = lcloud_peekdelayed(fh, fblk)) == NULL) ) {
+            ret = -1;
+            break;
+        }
+        batch_add_cluster(&batch, ext.dev_id, sec, blk, data, LC_XFER_WRITE);
+        placed++;
+        want--;
+    }
+
+    if ( (ret == 0) && (batch.count > 0) ) {                               // Write out the last batch
+        ret = flush_batch(fh, file, &batch, fblks, pending);
+    }
+    if (ret == -1) {                                                        // Failed, the unsent clusters go back to delayed
+        flush_unassign(file, fblks, pending);
+        if ( (log_clusters == 0) && (ext.used < ext.len) ) {
+            release_extent(ext.dev_id, ext.cluster + ext.used, ext.len - ext.used);
+        }
+        return( -1 );
+    }
+    if (placed > 0) {
+        logMessage(LOG_OUTPUT_LEVEL, "LC success flushing [%d] clusters of file [%d]", placed, fh);
+    }
+    return( 0 );                                                            // Successful flush
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcflush
+// Description  : Allocate and write out any delayed blocks of the file, traced as
+//                a background job span
+//
+// Inputs       : fh - the file handle of the file to flush
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcflush( LcFHandle fh ) {
+    uint64_t start = lcloud_trace_now();
+    int ret;
+
+    log_enter(0);
+    ret = flush_file(fh);
+    log_leave();
+
+    lcloud_trace_span("lcflush", "job", start, fh);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : log_defrag
+// Description  : Defragments a file in log mode by copying its clusters, in
+//                file order, to the log head (one run per segment they span)
+//
+// Inputs       : fh - file handle of the file to defragment
+//                file - A pointer to the file
+// Outputs      : number of clusters moved, -1 if failure
+
+int log_defrag(LcFHandle fh, lcloud_file *file) {
+    int fhs[LC_BUS_BATCH_FRAMES], fblks[LC_BUS_BATCH_FRAMES];
+    int fblk, count, want = 0, runs = 0, prev_dev = -1, prev_cluster = -1, moved = 0, ret = 0;
+    int chunk = LC_BUS_BATCH_FRAMES / cluster_blocks;
+
+    for(fblk = 0; fblk < file->map_blocks; fblk++) {                        // Count the clusters and the runs they form
+        if (file->blkmap[fblk].dev_id < 0) {
+            continue;
+        }
+        if ( (file->blkmap[fblk].dev_id != prev_dev) || (file->blkmap[fblk].cluster != prev_cluster + 1) ) {
+            runs++;
+        }
+        prev_dev = file->blkmap[fblk].dev_id;
+        prev_cluster = file->blkmap[fblk].cluster;
+        want++;
+    }
+    if (runs <= 1) {
+        return( 0 );                                                        // Already contiguous
+    }
+
+    log_enter(want);
+    for(fblk = 0; (fblk < file->map_blocks) && (ret == 0); ) {
+        for(count = 0; (fblk < file->map_blocks) && (count < chunk); fblk++) {
+            if (file->blkmap[fblk].dev_id >= 0) {
+                fhs[count] = fh;
+                fblks[count++] = fblk;
+            }
+        }
+        if ( (count > 0) && ((ret = log_move(count, fhs, fblks)) == 0) ) {
+            moved += count;
+        }
+    }
+    log_leave();
+    if (ret == -1) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure relocating clusters of file [%d]", fh);
+        return( -1 );
+    }
+
+    logMessage(LOG_OUTPUT_LEVEL, "LC defragmented file [%d], [%d] clusters in [%d] runs moved to the log head", fh, want, runs);
+    return( moved );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcdefrag
+// Description  : Moves the allocated clusters of a file into one contiguous
+//                run, in file order, so later reads of the file batch well.
+//                Delayed clusters are placed first; holes stay holes. If no
+//                run is long enough the file is left as it is. In log mode
+//                the file is rewritten at the log head instead.
+//
+// Inputs       : fh - file handle of the file to defragment
+// Outputs      : number of clusters moved, -1 if failure
+
+int lcdefrag( LcFHandle fh ) {
+    int src_dev[LC_BUS_BATCH_FRAMES], src_cluster[LC_BUS_BATCH_FRAMES], fblks[LC_BUS_BATCH_FRAMES];
+    int fblk, i, want = 0, runs = 0, prev_dev = -1, prev_cluster = -1, dev_id, cluster, len, moved = 0, count, sec, blk;
+    int chunk = LC_BUS_BATCH_FRAMES / cluster_blocks;
+    uint64_t start = lcloud_trace_now();
+    lcloud_file *file;
+
+    if ( (file = validate_fh(fh)) == NULL ) {
+        return( -1 );
+    }
+    if ( flush_file(fh) == -1 ) {                                           // Delayed clusters need an address to move
+        return( -1 );
+    }
+    if (log_clusters > 0) {
+        moved = log_defrag(fh, file);
+        lcloud_trace_span("lcdefrag", "job", start, moved);
+        return( moved );
+    }
+
+    for(fblk = 0; fblk < file->map_blocks; fblk++) {                        // Count the clusters and the runs they form
+        if (file->blkmap[fblk].dev_id < 0) {
+            continue;
+        }
+        if ( (file->blkmap[fblk].dev_id != prev_dev) || (file->blkmap[fblk].cluster != prev_cluster + 1) ) {
+            runs++;
+        }
+        prev_dev = file->blkmap[fblk].dev_id;
+        prev_cluster = file->blkmap[fblk].cluster;
+        want++;
+    }
+    if (runs <= 1) {
+        return( 0 );                                                        // Already contiguous
+    }
+
+    if ( (dev_id = allocate_extent(want, -1, -1, &cluster, &len)) == -1 ) {
+        return( -1 );
+    }
+    if (len < want) {                                                       // No run long enough, leave the file alone
+        release_extent(dev_id, cluster, len);
+        logMessage(LOG_OUTPUT_LEVEL, "LC no run of [%d] clusters to defragment file [%d] into", want, fh);
+        return( 0 );
+    }
+
+    for(fblk = 0; fblk < file->map_blocks; ) {                              // Move the clusters a batch at a time
+        for(count = 0; (fblk < file->map_blocks) && (count < chunk); fblk++) {
+            if (file->blkmap[fblk].dev_id >= 0) {
+                src_dev[count] = file->blkmap[fblk].dev_id;
+                src_cluster[count] = file->blkmap[fblk].cluster;
+                fblks[count++] = fblk;
+            }
+        }
+        if ( (count > 0) && (relocate_clusters(count, src_dev, src_cluster, dev_id, cluster + moved) == -1) ) {
+            release_extent(dev_id, cluster + moved, want - moved);
+            logMessage(LOG_ERROR_LEVEL, "LC failure relocating clusters of file [%d]", fh);
+            return( -1 );
+        }
+        for(i = 0; i < count; i++, moved++) {                               // Point the file at the copies, free the old clusters
+            get_block(file, fblks[i], &sec, &blk);
+            lcloud_invalidcache(src_dev[i], sec, blk);
+            release_extent(src_dev[i], src_cluster[i], 1);
+            file->blkmap[fblks[i]].dev_id = dev_id;
+            file->blkmap[fblks[i]].cluster = cluster + moved;
+        }
+    }
+
+    logMessage(LOG_OUTPUT_LEVEL, "LC defragmented file [%d], [%d] clusters in [%d] runs moved to [%d/%d]", fh, want, runs, dev_id, cluster);
+    lcloud_trace_span("lcdefrag", "job", start, moved);
+    return( moved );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclean
+// Description  : Cleans log segments, between operations. Asked for none, it
+//                takes one step of background cleaning: one segment, only
+//                while free space is low and one is mostly dead.
+//
+// Inputs       : segments - most segments to clean, 0 for a background step
+// Outputs      : number of segments cleaned, -1 if failure
+
+int lcclean( int segments ) {
+    int dev_id, seg, cleaned = 0;
+
+    if ( (log_clusters == 0) || (log_depth > 0) || (log_total == 0) ) {
+        return( 0 );
+    }
+    if (segments == 0) {
+        if ( (log_free * LC_LOG_CLEAN_SHARE >= log_total) || (log_victim(LC_LOG_CLEAN_LIVE, &dev_id, &seg) == -1) ) {
+            return( 0 );
+        }
+        return( (log_clean_segment(dev_id, seg) == -1) ? -1 : 1 );
+    }
+
+    while ( (cleaned < segments) && (log_victim(100, &dev_id, &seg) == 0) ) {
+        if ( log_clean_segment(dev_id, seg) == -1 ) {
+            return( -1 );
+        }
+        cleaned++;
+    }
+    return( cleaned );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcprobe
+// Description  : Probes the bus again and attaches any device not seen before.
+//                Its clusters go to the allocator (and its segments to the
+//                log) at once; the rebalancer then moves data onto it. Before
+//                the first open nothing is powered on, and the first open
+//                finds every device anyway.
+//
+// Inputs       : none
+// Outputs      : number of devices attached, -1 if failure
+
+int lcprobe( void ) {
+    int id, probe, attached = 0;
+
+    if (file_handle == 0) {
+        return( 0 );
+    }
+    if ( (probe = device_probe()) == -1 ) {
+        return( -1 );
+    }
+    for(id = 0; id < 16; id++) {
+        if ( ((probe >> id) & 1) && (devices[id].dev_id == -1) ) {
+            if ( device_attach(id) == -1 ) {
+                return( -1 );
+            }
+            lcloud_trace_instant("attach device", "balance", id);
+            attached++;
+        }
+    }
+    if (attached > 0) {
+        logMessage(LOG_OUTPUT_LEVEL, "LC attached [%d] new devices", attached);
+    }
+    return( attached );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : balance_pair
+// Description  : Finds the fullest and emptiest devices, by the share of their
+//                clusters allocated, and how many clusters would even them out
+//
+// Inputs       : slack - percent apart the two may be and still count as even
+//                *src, *dst - the addresses of the fullest and emptiest devices
+// Outputs      : clusters to move from src to dst, 0 if the devices are even
+
+int balance_pair(int slack, int *src, int *dst) {
+    int id, g, used[16];
+    int64_t ns, nd;
+
+    for(id = 0, *src = *dst = -1; id < 16; id++) {
+        if (devices[id].dev_id == -1) {
+            continue;
+        }
+        for(g = 0, used[id] = devices[id].nclusters; g < devices[id].ngroups; g++) {
+            used[id] -= devices[id].group_free[g];
+        }
+        if ( (*src == -1) || ((int64_t)used[id] * devices[*src].nclusters > (int64_t)used[*src] * devices[id].nclusters) ) {
+            *src = id;
+        }
+        if ( (*dst == -1) || ((int64_t)used[id] * devices[*dst].nclusters < (int64_t)used[*dst] * devices[id].nclusters) ) {
+            *dst = id;
+        }
+    }
+    if ( (*src == -1) || (*src == *dst) ) {
+        return( 0 );
+    }
+
+    ns = devices[*src].nclusters;
+    nd = devices[*dst].nclusters;
+    if ( (used[*src] * 100 / ns) - (used[*dst] * 100 / nd) <= slack ) {
+        return( 0 );
+    }
+    return( (int)((used[*src] * nd - used[*dst] * ns) / (ns + nd)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcrebalance
+// Description  : Moves clusters from the fullest device to the emptiest, a
+//                batch at a time, until their fill is even. Each batch is
+//                copied to a run on the emptiest device before the block maps
+//                are pointed at it and the old clusters freed, all between
+//                operations, so a read never sees a half moved cluster. Asked
+//                for none, it takes one background step: at most
+//                LC_BALANCE_STEP clusters, and only while the devices are
+//                more than LC_BALANCE_SLACK percent apart. Log mode needs no
+//                rebalancing, since appends rotate over every device.
+//
+// Inputs       : clusters - most clusters to move, 0 for a background step
+// Outputs      : number of clusters moved, -1 if failure
+
+int lcrebalance( int clusters ) {
+    int src_dev[LC_BUS_BATCH_FRAMES], src_cluster[LC_BUS_BATCH_FRAMES], fhs[LC_BUS_BATCH_FRAMES], fblks[LC_BUS_BATCH_FRAMES];
+    int limit = (clusters == 0) ? LC_BALANCE_STEP : clusters, chunk = LC_BUS_BATCH_FRAMES / cluster_blocks;
+    int src, dst, want, count, fh, fblk, dev_id, cluster, len, i, sec, blk, moved = 0;
+    uint64_t start = lcloud_trace_now();
+
+    if ( (log_clusters > 0) || (file_handle == 0) ) {
+        return( 0 );
+    }
+
+    while ( (moved < limit) && ((want = balance_pair((clusters == 0) ? LC_BALANCE_SLACK : 0, &src, &dst)) > 0) ) {
+        want = CMPSC311_MINVAL(CMPSC311_MINVAL(want, limit - moved), chunk);
+        for(fh = 0, count = 0; (fh < file_handle) && (count < want); fh++) {   // Take the first clusters found on the fullest device
+            for(fblk = 0; (fblk < files[fh].map_blocks) && (count < want); fblk++) {
+                if (files[fh].blkmap[fblk].dev_id == src) {
+                    src_dev[count] = src;
+                    src_cluster[count] = files[fh].blkmap[fblk].cluster;
+                    fhs[count] = fh;
+                    fblks[count++] = fblk;
+                }
+            }
+        }
+        if (count == 0) {
+            break;                                                          // Only reservations left there
+        }
+
+        if ( (dev_id = allocate_extent(count, dst, 0, &cluster, &len)) == -1 ) {
+            return( -1 );
+        }
+        if (dev_id != dst) {                                                // No room on the emptiest device after all
+            release_extent(dev_id, cluster, len);
+            break;
+        }
+        count = CMPSC311_MINVAL(count, len);
+        if ( relocate_clusters(count, src_dev, src_cluster, dst, cluster) == -1 ) {
+            release_extent(dst, cluster, len);
+            logMessage(LOG_ERROR_LEVEL, "LC failure rebalancing [%d] clusters from device [%d] to [%d]", count, src, dst);
+            return( -1 );
+        }
+        release_extent(dst, cluster + count, len - count);
+        for(i = 0; i < count; i++) {                                        // Point the files at the copies, free the old clusters
+            get_block(&files[fhs[i]], fblks[i], &sec, &blk);
+            lcloud_invalidcache(src, sec, blk);
+            release_extent(src, src_cluster[i], 1);
+            files[fhs[i]].blkmap[fblks[i]].dev_id = dst;
+            files[fhs[i]].blkmap[fblks[i]].cluster = cluster + i;
+        }
+        moved += count;
+        balance_moved += count;
+        logMessage(LOG_OUTPUT_LEVEL, "LC rebalanced [%d] clusters from device [%d] to [%d/%d]", count, src, dst, cluster);
+    }
+
+    if (moved > 0) {
+        lcloud_trace_span("lcrebalance", "job", start, moved);
+    }
+    return( moved );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : plan_submit
+// Description  : Sends the batch of an object plan and copies the staged
+//                partial cluster reads out to their objects
+//
+// Inputs       : plan - the plan to send
+// Outputs      : 0 for successful test, -1 otherwise
+
+int plan_submit(lcloud_objplan *plan) {
+    int i, copies = plan->copies;
+
+    plan->copies = 0;
+    if ( (plan->batch.count > 0) && (batch_submit(&plan->batch) == -1) ) {
+        return( -1 );
+    }
+    for(i = 0; i < copies; i++) {
+        memcpy(plan->copy_to[i], &plan->scratch[plan->copy_from[i] * LC_DEVICE_BLOCK_SIZE], plan->copy_len[i]);
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : plan_room
+// Description  : Makes room in an object plan for one more cluster, sending the
+//                batch if it is full
+//
+// Inputs       : plan - the plan
+// Outputs      : the scratch space of the next cluster, NULL if failure
+
+char *plan_room(lcloud_objplan *plan) {
+    if ( (plan->batch.count + cluster_blocks > LC_BUS_BATCH_FRAMES) && (plan_submit(plan) == -1) ) {
+        return( NULL );
+    }
+    return( &plan->scratch[plan->batch.count * LC_DEVICE_BLOCK_SIZE] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : plan_get
+// Description  : Plans the read of the start of a file into a buffer. Clusters
+//                on the devices and not cached go into the plan's batch, full
+//                ones straight into buf; holes, cached and delayed clusters are
+//                filled from memory right away. buf is only complete once the
+//                plan has been submitted.
+//
+// Inputs       : plan - the plan to add to
+//                fh - the file handle of the file
+//                file - A pointer to the file
+//                buf - where the data goes
+//                len - bytes wanted, at most the file size is read
+// Outputs      : number of bytes planned, -1 if failure
+
+int plan_get(lcloud_objplan *plan, LcFHandle fh, lcloud_file *file, char *buf, int len) {
+    char temp[LC_CLUSTER_BUFSIZE];
+    int fblk, off, bytes, dev_id, sec, blk;
+    char *slot;
+
+    len = CMPSC311_MINVAL(len, file->size);
+    for(fblk = 0, off = 0; off < len; fblk++, off += bytes) {
+        bytes = CMPSC311_MINVAL(cluster_size, len - off);
+        if ( ((dev_id = get_block(file, fblk, &sec, &blk)) >= 0) && (lcloud_peekcache(dev_id, sec, blk) == NULL) ) {
+            if ( (slot = plan_room(plan)) == NULL ) {
+                return( -1 );
+            }
+            if (bytes < cluster_size) {                                     // Stage the partial cluster, copied out after the batch
+                plan->copy_to[plan->copies] = &buf[off];
+                plan->copy_from[plan->copies] = plan->batch.count;
+                plan->copy_len[plan->copies++] = bytes;
+            }
+            batch_add_cluster(&plan->batch, dev_id, sec, blk, (bytes < cluster_size) ? slot : &buf[off], LC_XFER_READ);
+        } else if (bytes == cluster_size) {
+            if ( read_block(fh, file, fblk, &buf[off], 1) == -1 ) {
+                return( -1 );
+            }
+        } else {
+            if ( read_block(fh, file, fblk, temp, 1) == -1 ) {
+                return( -1 );
+            }
+            memcpy(&buf[off], temp, bytes);
+        }
+    }
+
+    return( len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : truncate_file
+// Description  : Cuts a file down to a size, giving back its clusters past the
+//                last one the size reaches, which become holes
+//
+// Inputs       : fh - the file handle of the file
+//                file - A pointer to the file
+//                size - the new size, at most the current one
+// Outputs      : none
+
+void truncate_file(LcFHandle fh, lcloud_file *file, int size) {
+    int fblk, dev_id, sec, blk;
+
+    for(fblk = (size + cluster_size - 1) / cluster_size; fblk < file->map_blocks; fblk++) {
+        if ( (dev_id = get_block(file, fblk, &sec, &blk)) >= 0 ) {
+            lcloud_invalidcache(dev_id, sec, blk);
+            if (log_clusters > 0) {
+                log_retire(dev_id, file->blkmap[fblk].cluster);
+            } else {
+                release_extent(dev_id, file->blkmap[fblk].cluster, 1);
+            }
+        } else if (dev_id == LC_BLOCK_DELAYED) {
+            lcloud_dropdelayed(fh, fblk);
+        }
+        file->blkmap[fblk].dev_id = LC_BLOCK_HOLE;
+        file->blkmap[fblk].cluster = -1;
+    }
+    file->size = size;
+    file->pos = CMPSC311_MINVAL(file->pos, size);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : plan_put
+// Description  : Plans the replacement of a file's contents by a buffer. The
+//                file is cut to the buffer's length, then every cluster goes
+//                into the plan's batch, full ones straight from buf and a
+//                partial last one zero filled in scratch space; unallocated
+//                clusters get one extent sized for all of them. buf must be
+//                left alone until the plan has been submitted.
+//
+// Inputs       : plan - the plan to add to
+//                fh - the file handle of the file
+//                file - A pointer to the file
+//                buf - the data to write
+//                len - bytes to write
+// Outputs      : number of bytes planned, -1 if failure
+
+int plan_put(lcloud_objplan *plan, LcFHandle fh, lcloud_file *file, char *buf, int len) {
+    lcloud_extent ext = { -1, -1, 0, 0 };
+    int fblk, full = len / cluster_size, tail = len % cluster_size, clusters;
+    char *slot;
+
+    if (file->size > len) {                                                 // Nothing of the file past the object is kept
+        truncate_file(fh, file, len);
+    }
+    clusters = full + (tail > 0);
+    for(fblk = 0; fblk < clusters; fblk++) {
+        if ( (slot = plan_room(plan)) == NULL ) {
+            return( -1 );
+        }
+        if (fblk == full) {
+            memcpy(slot, &buf[fblk * cluster_size], tail);
+            memset(&slot[tail], 0, cluster_size - tail);
+        } else {
+            slot = &buf[fblk * cluster_size];
+        }
+        if ( zerocopy_write_block(fh, file, fblk, slot, clusters - fblk, &ext, &plan->batch) == -1 ) {
+            return( -1 );
+        }
+    }
+
+    file->size = len;
+    file->pos = len;
+
+    return( len );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lookup_file
+// Description  : Finds a file by name, without creating it
+//
+// Inputs       : path - the path/filename of the file
+// Outputs      : file handle if found, -1 if not
+
+LcFHandle lookup_file( const char *path ) {
+    LcFHandle fh;
+
+    for(fh = 0; fh < file_handle; fh++) {
+        if (strcmp(files[fh].name, path) == 0) {
+            return( fh );
+        }
+    }
+    return( -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : object_transfer
+// Description  : Reads or writes whole objects with one plan. Every object is
+//                opened and its cluster transfers planned, so the transfers of
+//                all of them share bus batches; the objects are closed once the
+//                last batch is back. A get of an object that does not exist, or
+//                of one that is open, fails for that object only.
+//
+// Inputs       : objs - the objects, result is set for each
+//                count - number of objects
+//                put - 1 to write the objects, 0 to read them
+// Outputs      : number of objects transferred, -1 if a bus transfer failed
+//                (the result of every object is then -1)
+
+int object_transfer( lcloud_object *objs, int count, int put ) {
+    lcloud_objplan *plan;
+    lcloud_file *file;
+    LcFHandle *fhs;
+    int i, done = 0, ret = 0;
+    uint64_t start = lcloud_trace_now(), bytes = 0;
+    size_t need = 0;
+
+    if ( op_abandoned((put) ? "object put" : "object get") == -1 ) {
+        return( -1 );
+    }
+    for(i = 0; put && (i < count); i++) {                                   // Room in the log for every cluster put
+        need += CMPSC311_MINVAL(objs[i].len, INT_MAX) / cluster_size + 1;
+    }
+    log_enter(CMPSC311_MINVAL(need, INT_MAX));
+    lcloud_mem_charge(LC_MEM_BUFFERS, sizeof(lcloud_objplan) + count * sizeof(LcFHandle));   // Never refused
+    if ( ((plan = malloc(sizeof(lcloud_objplan))) == NULL) || ((fhs = malloc(count * sizeof(LcFHandle))) == NULL) ) {
+        free(plan);
+        lcloud_mem_release(LC_MEM_BUFFERS, sizeof(lcloud_objplan) + count * sizeof(LcFHandle));
+        logMessage(LOG_ERROR_LEVEL, "LC failure allocating plan for [%d] objects", count);
+        log_leave();
+        return( -1 );
+    }
+    plan->batch.count = 0;
+    plan->batch.ncached = 0;
+    plan->copies = 0;
+
+    for(i = 0; (i < count) && (ret == 0); i++) {
+        objs[i].result = -1;
+        fhs[i] = -1;
+        if (objs[i].len > INT_MAX) {
+            logMessage(LOG_ERROR_LEVEL, "LC failure object [%s] too large [%lu]", objs[i].path, (unsigned long)objs[i].len);
+            continue;
+        }
+        if ( (!put && (lookup_file(objs[i].path) == -1)) ||
+             ((fhs[i] = lcopen(objs[i].path, LC_OPEN_DEFAULT)) == -1) || ((file = validate_fh(fhs[i])) == NULL) ) {
+            logMessage(LOG_ERROR_LEVEL, "LC failure opening object [%s]", objs[i].path);
+            continue;
+        }
+        if ( (objs[i].result = (put) ? plan_put(plan, fhs[i], file, objs[i].buf, objs[i].len)
+                                     : plan_get(plan, fhs[i], file, objs[i].buf, objs[i].len)) == -1 ) {
+            ret = -1;                                                           // The plan is in an unknown state
+        }
+    }
+    if (ret == 0) {
+        ret = plan_submit(plan);
+    }
+
+    for(i--; i >= 0; i--) {                                                 // Close what was opened, last first
+        if ( (fhs[i] != -1) && (lcclose(fhs[i]) == -1) ) {
+            ret = -1;
+        }
+        if (ret == -1) {
+            objs[i].result = -1;
+        } else if (objs[i].result >= 0) {
+            lcloud_stats_io(fhs[i], put, objs[i].result);
+            bytes += objs[i].result;
+            done++;
+        }
+    }
+    free(fhs);
+    free(plan);
+    lcloud_mem_release(LC_MEM_BUFFERS, sizeof(lcloud_objplan) + count * sizeof(LcFHandle));
+    log_leave();
+    if (ret == -1) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure transferring [%d] objects", count);
+        return( -1 );
+    }
+
+    logMessage(LOG_OUTPUT_LEVEL, "LC %s [%d] of [%d] objects, [%lu] bytes", (put) ? "put" : "got", done, count, (unsigned long)bytes);
+    lcloud_trace_span((put) ? "lcput" : "lcget", "api", start, bytes);
+    return( done );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcget
+// Description  : Reads the whole of a file, opening and closing it
+//
+// Inputs       : path - the file to read
+//                buf - where the data goes
+//                len - size of buf
+// Outputs      : number of bytes read (at most len), -1 if failure
+
+int lcget( const char *path, char *buf, size_t len ) {
+    lcloud_object obj = { path, buf, len, -1 };
+
+    return( (object_transfer(&obj, 1, 0) == 1) ? obj.result : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcput
+// Description  : Replaces the contents of a file with a buffer, creating the
+//                file if need be, opening and closing it
+//
+// Inputs       : path - the file to write
+//                buf - the data
+//                len - bytes to write
+// Outputs      : number of bytes written, -1 if failure
+
+int lcput( const char *path, char *buf, size_t len ) {
+    lcloud_object obj = { path, buf, len, -1 };
+
+    return( (object_transfer(&obj, 1, 1) == 1) ? obj.result : -1 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcgetv
+// Description  : Reads many whole files, their transfers sharing bus batches
+//
+// Inputs       : objs - the files, each result is the bytes read or -1
+//                count - number of files
+// Outputs      : number of files read, -1 if failure
+
+int lcgetv( lcloud_object *objs, int count ) {
+    return( object_transfer(objs, count, 0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcputv
+// Description  : Replaces the contents of many files, their transfers sharing
+//                bus batches
+//
+// Inputs       : objs - the files, each result is the bytes written or -1
+//                count - number of files
+// Outputs      : number of files written, -1 if failure
+
+int lcputv( lcloud_object *objs, int count ) {
+    return( object_transfer(objs, count, 1) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcimport
+// Description  : Copies a local file into a LionCloud file, replacing its
+//                contents. The local file is mapped and put as one object,
+//                full clusters straight from the mapping.
+//
+// Inputs       : local_fd - descriptor of a regular local file, open for reading
+//                path - the LionCloud file to write (created if need be)
+// Outputs      : number of bytes imported, -1 if failure
+
+int lcimport( int local_fd, const char *path ) {
+    struct stat st;
+    char *map = NULL;
+    int ret;
+
+    if ( (fstat(local_fd, &st) == -1) || !S_ISREG(st.st_mode) || (st.st_size > INT_MAX) ) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure importing [%s], local descriptor [%d] is not a usable file", path, local_fd);
+        return( -1 );
+    }
+    if ( (st.st_size > 0) && ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, local_fd, 0)) == MAP_FAILED) ) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure mapping local descriptor [%d] to import [%s]", local_fd, path);
+        return( -1 );
+    }
+    if (map != NULL) {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+    }
+    ret = lcput(path, map, st.st_size);
+    if (map != NULL) {
+        munmap(map, st.st_size);
+    }
+    if (ret == -1) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure importing [%s] from local descriptor [%d]", path, local_fd);
+        return( -1 );
+    }
+
+    logMessage(LOG_OUTPUT_LEVEL, "LC imported [%ld] bytes into file %s", (long)st.st_size, path);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcexport
+// Description  : Copies a LionCloud file into a local file, which is sized to
+//                match and mapped, and read into as one object.
+//
+// Inputs       : path - the LionCloud file to read
+//                local_fd - descriptor of a regular local file, open for reading and writing
+// Outputs      : number of bytes exported, -1 if failure
+
+int lcexport( const char *path, int local_fd ) {
+    LcFHandle fh;
+    struct stat st;
+    char *map = NULL;
+    int size, ret = 0;
+
+    if ( (fstat(local_fd, &st) == -1) || !S_ISREG(st.st_mode) ) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure exporting [%s], local descriptor [%d] is not a usable file", path, local_fd);
+        return( -1 );
+    }
+    if ( (fh = lookup_file(path)) == -1 ) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure exporting [%s], no such file", path);
+        return( -1 );
+    }
+    size = files[fh].size;
+    if ( (ftruncate(local_fd, size) == -1) ||
+         ((size > 0) && ((map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, local_fd, 0)) == MAP_FAILED)) ) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure mapping local descriptor [%d] to export [%s]", local_fd, path);
+        return( -1 );
+    }
+    if (map != NULL) {
+        ret = lcget(path, map, size);
+        munmap(map, size);
+    }
+    if (ret == -1) {
+        logMessage(LOG_ERROR_LEVEL, "LC failure exporting [%s] to local descriptor [%d]", path, local_fd);
+        return( -1 );
+    }
+
+    logMessage(LOG_OUTPUT_LEVEL, "LC exported [%d] bytes of file %s", size, path);
+    return( size );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcclose
+// Description  : Close the file
+//
+// Inputs       : fh - the file handle of the file to close
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcclose( LcFHandle fh ) {
+    lcloud_file *file;
+    if( (file = validate_fh(fh)) == NULL ) {                                // Validate the file handle and get the file from handle
+        return( - 1 );                                                      // Invalid file handle
+    }
+    if( lcflush(fh) == -1 ) {                                               // Place any delayed blocks before the file goes away
+        logMessage( LOG_ERROR_LEVEL, "LC failure closing file [%d] flush failed", fh);
+        return( -1 );                                                       // Failed close
+    }
+    if (file->reserve.used < file->reserve.len) {                           // Give back what the file did not get to use
+        release_extent(file->reserve.dev_id, file->reserve.cluster + file->reserve.used, file->reserve.len - file->reserve.used);
+        file->reserve.used = file->reserve.len = 0;
+    }
+    file->opened = 0;                                                       // File no longer opened, set opened to 0
+    LC_STAT_ADD(closes, 1);
+    logMessage(LOG_OUTPUT_LEVEL, "Driver successfully closed file %s", file->name);
+    return( 0 );                                                            // Succesful close      
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcshutdown
+// Description  : Shut down the filesystem
+//
+// Inputs       : none
+// Outputs      : 0 if successful test, -1 if failure
+
+int lcshutdown( void ) {
+    int i;
+    if(lcdrain() == -1) {                                                   // Let queued asynchronous requests finish first
+        logMessage( LOG_ERROR_LEVEL, "LC failure shutting down system, asynchronous requests pending");
+        return( -1 );
+    }
+    for(i = 0; i < file_handle; i++) {                                      // Loop through all files
+        if(files[i].opened == 1) {                                          // If the file is opened
+            if(lcclose(i) == -1) {
                 logMessage( LOG_ERROR_LEVEL, "LC failure shutting down system, cannot close file [%d]", i);
                 return( - 1);                                               // Failed shutdown
             }
         }
     }
 
+    for(i = 0; i < file_handle; i++) {                                      // Release the block maps
+        free(files[i].blkmap);
+        lcloud_mem_release(LC_MEM_BLOCKMAP, files[i].map_blocks * sizeof(lcloud_blkaddr));
+        files[i].blkmap = NULL;
+        files[i].map_blocks = 0;
+    }
+
     for(i = 0; i < 16; i++) {                                               // Loop through all devices
         if(devices[i].dev_id != -1) {                                       // If the device was initialized
-            free(devices[i].sector_block);                                  // Free the memory allocated to memory sturcture
-            devices[i].sector_block = NULL;
+            free(devices[i].usemap);                                        // Free the memory allocated to memory sturcture
+            free(devices[i].group_free);
+            lcloud_mem_release(LC_MEM_DEVICES, (devices[i].nclusters + 7) / 8 + devices[i].ngroups * sizeof(int));
+            devices[i].usemap = NULL;
+            devices[i].group_free = NULL;
+            if (devices[i].segs != NULL) {                                  // And the log maps
+                free(devices[i].segs);
+                free(devices[i].owner_fh);
+                free(devices[i].owner_fblk);
+                lcloud_mem_release(LC_MEM_DEVICES, devices[i].nsegs * sizeof(lcloud_segment) + 2 * (size_t)devices[i].nclusters * sizeof(int));
+                devices[i].segs = NULL;
+            }
         }
     }
 
@@ -621,7 +2782,26 @@ int lcshutdown( void ) {
             return( -1 );                                                   // Failed shutdown operation
     }
 
+    logMessage(LOG_OUTPUT_LEVEL, "Allocator: [%d] requests for [%d] clusters of [%d] blocks", allocator_calls, allocator_blocks, cluster_blocks);
+    logMessage(LOG_OUTPUT_LEVEL, "Allocator: [%d] extents from file reservations, reservations taken back [%d] times", allocator_reserved, allocator_reclaimed);
+    if (balance_moved > 0) {
+        logMessage(LOG_OUTPUT_LEVEL, "Rebalancer: moved [%d] clusters between devices", balance_moved);
+    }
+    if (log_clusters > 0) {
+        logMessage(LOG_OUTPUT_LEVEL, "Log: appended [%lu] clusters, cleaner emptied [%d] segments moving [%lu] (write amplification %.2f), [%d] of [%d] segments free",
+                   (unsigned long)log_clock, log_cleaned, (unsigned long)log_moved,
+                   (log_clock > log_moved) ? (double)log_clock / (log_clock - log_moved) : 1.0, log_free, log_total);
+    }
     lcloud_closecache();                                                    // Print out cache statistics at the end
 
+    free(files);                                                            // Release the files array
+    lcloud_mem_release(LC_MEM_FILES, files_alloc * sizeof(lcloud_file));
+    files = NULL;
+    files_alloc = 0;
+    lcloud_mem_report();                                                    // Print out memory usage at the end
+    lcloud_lock_report();                                                   // And where threads waited
+    lcloud_trace_finish();                                                  // Write out the trace, if one was asked for
+    lcloud_stats_finish();                                                  // Take down the counter segment, if published
+
     return( 0 );                                                            // Successful shutdown operation
 }
@@ -16,13 +16,71 @@
 #include <stdint.h>
 
 // Defines 
+#define LC_OPEN_DEFAULT 0x0 // Cached reads and writes
+#define LC_OPEN_DIRECT  0x1 // Full-block transfers bypass the cache
+#define LC_MAX_CLUSTER_BLOCKS 64 // Largest cluster, in device blocks
+
+// Asynchronous operations (lcloud_aio.op)
+#define LC_AIO_OPEN  0      // lcopen(path, flags)
+#define LC_AIO_READ  1      // lcread(fh, buf, len)
+#define LC_AIO_WRITE 2      // lcwrite(fh, buf, len)
+#define LC_AIO_SEEK  3      // lcseek(fh, len)
+#define LC_AIO_FLUSH 4      // lcflush(fh)
+#define LC_AIO_CLOSE 5      // lcclose(fh)
+#define LC_AIO_PROBE 6      // lcprobe()
 
 // Type definitions
 typedef int32_t LcFHandle;
 
+//
+// Deadline and cancellation token, shared by a caller and the driver
+typedef struct lcloud_cancel {
+    uint64_t    deadline;                           // Monotonic clock (ns) the operation must finish by, 0 for none
+    int         cancelled;                          // Set by lccancel, from any thread
+} lcloud_cancel;
+
+//
+// Asynchronous request, owned by the caller until its completion runs
+typedef struct lcloud_aio {
+    int         op;                                 // LC_AIO_* operation to perform
+    LcFHandle   fh;                                 // File handle (all but open)
+    struct lcloud_aio *opened;                      // Open queued earlier whose result is the handle, or NULL
+    const char *path;                               // Path to open
+    int         flags;                              // Open flags
+    char       *buf;                                // Data to read into or write from
+    size_t      len;                                // Bytes to read or write, offset of a seek
+    int         result;                             // Return value of the operation
+    void      (*complete)( struct lcloud_aio *aio ); // Called on the driver thread when done
+    void       *context;                            // For use by the completion
+    struct lcloud_aio *next;                        // Driver queue link
+    uint64_t    queued;                             // When it was queued, if its wait is being timed
+    lcloud_cancel *cancel;                          // Deadline and cancellation of the request, or NULL
+} lcloud_aio;
+
+//
+// Whole object transfer (lcgetv, lcputv)
+typedef struct {
+    const char *path;                               // File holding the object
+    char       *buf;                                // Data to read into or write from
+    size_t      len;                                // Bytes to write, or room in buf to read into
+    int         result;                             // Bytes transferred, -1 if failure
+} lcloud_object;
+
 // File system interface definitions
 
-LcFHandle lcopen( const char *path );
+int lcsetclustersize( int blocks );
+    // Set the device blocks per cluster, before the first open
+
+int lcsetlogmode( int clusters );
+    // Append all writes to a log of segments of clusters, before the first open
+
+int lcsetmemlimit( size_t bytes );
+    // Set the memory budget of the driver, 0 for unlimited
+
+size_t lcmemusage( int consumer );
+    // Get the bytes in use by a consumer (LC_MEM_*), or by all of them
+
+LcFHandle lcopen( const char *path, int flags );
     // Open the file for for reading and writing
 
 int lcread( LcFHandle fh, char *buf, size_t len );
@@ -34,10 +92,70 @@ int lcwrite( LcFHandle fh, char *buf, size_t len );
 int lcseek( LcFHandle fh, size_t off );
     // Seek to a specific place in the file
 
+int lcseekdata( LcFHandle fh, size_t off );
+    // Seek to the next part of the file holding data
+
+int lcseekhole( LcFHandle fh, size_t off );
+    // Seek to the next hole (unwritten region) in the file
+
+int lcflush( LcFHandle fh );
+    // Allocate and write out any delayed blocks of the file
+
+int lcdefrag( LcFHandle fh );
+    // Move the file's clusters into one contiguous run
+
+int lcclean( int segments );
+    // Clean up to segments log segments, 0 for one background step
+
+int lcprobe( void );
+    // Probe the bus again and attach any new devices
+
+int lcrebalance( int clusters );
+    // Move up to clusters clusters to even out the devices, 0 for one background step
+
+int lcget( const char *path, char *buf, size_t len );
+    // Read a whole file into buf in one planned transfer
+
+int lcput( const char *path, char *buf, size_t len );
+    // Replace the contents of a file with buf in one planned transfer
+
+int lcgetv( lcloud_object *objs, int count );
+    // Read many whole files, their transfers sharing bus batches
+
+int lcputv( lcloud_object *objs, int count );
+    // Replace many whole files, their transfers sharing bus batches
+
+int lcimport( int local_fd, const char *path );
+    // Copy a local file into a LionCloud file, replacing its contents
+
+int lcexport( const char *path, int local_fd );
+    // Copy a LionCloud file into a local file
+
 int lcclose( LcFHandle fh );
     // Close the file
 
 int lcshutdown( void );
     // Shut down the filesystem
 
+void lcdeadline( lcloud_cancel *token, uint64_t usec );
+    // Arm a token to expire usec microseconds from now, 0 for no deadline
+
+void lccancel( lcloud_cancel *token );
+    // Cancel the operations a token governs, from any thread
+
+int lcexpired( const lcloud_cancel *token );
+    // Get why a token's operations are abandoned (ETIMEDOUT, ECANCELED), 0 if not
+
+lcloud_cancel *lcsetcancel( lcloud_cancel *token );
+    // Govern this thread's following calls by a token (NULL for none), the old one returned
+
+lcloud_cancel *lcgetcancel( void );
+    // Get the token governing this thread's calls, NULL if none
+
+int lcsubmit( lcloud_aio *aio );
+    // Queue an operation for the driver thread, completion is called when done
+
+int lcdrain( void );
+    // Wait for every queued operation to complete and stop the driver thread
+
 #endif
@@ -0,0 +1,695 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_loadgen.c
+//  Description    : This is the LionCloud load generator. It drives a device
+//                   server directly over the bus protocol, with no driver or
+//                   filesystem in the way: each connection powers on, probes
+//                   and initializes the devices, then keeps a fixed number of
+//                   random block reads and writes in flight until the run
+//                   ends. Connections are spread over threads, each of which
+//                   polls its own. The rates and round trips it reports are
+//                   the server's capacity, the ceiling for any driver.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Project Includes
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+#include <lcloud_controller.h>
+#include <lcloud_network.h>
+#include <lcloud_devices.h>
+
+// Defines
+#define LCLOUD_LOADGEN_ARGUMENTS "h1a:c:D:l:p:q:r:s:t:"
+#define USAGE                                                                   \
+    "USAGE: lcloud_loadgen [-h] [-1] [-a <address>] [-p <port>] [-c <connections>] [-t <threads>]\n" \
+    "                      [-q <depth>] [-r <percent>] [-D <device>[,<device>...]] [-s <seconds>] [-l <logfile>]\n" \
+    "\n"                                                                        \
+    "where:\n"                                                                  \
+    "    -h - help mode (display this message)\n"                               \
+    "    -1 - speak protocol v1 even to a server offering v2\n"                 \
+    "    -a - server address (default 127.0.0.1)\n"                             \
+    "    -p - server port\n"                                                    \
+    "    -c - open <connections> to the server (default 1)\n"                   \
+    "    -t - drive the connections from <threads> threads (default 1)\n"       \
+    "    -q - keep <depth> requests in flight on each connection (default 1)\n" \
+    "    -r - make <percent> of the requests reads, the rest writes (default 50)\n" \
+    "    -D - only address these devices (default, every device probed)\n"      \
+    "    -s - run for <seconds> seconds (default 5)\n"                          \
+    "    -l - write log messages to the filename <logfile>\n"                   \
+    "\n"
+#define LC_LG_SUBBUCKETS    16              // Latency histogram buckets per power of two
+#define LC_LG_BUCKETS       (64 * LC_LG_SUBBUCKETS)
+#define LC_LG_RESPONSE      (sizeof(LCloudRegisterFrame) + sizeof(LCloudTagHeader) + LC_DEVICE_BLOCK_SIZE)
+#define LC_LG_IOV_MAX       1024            // Most buffers handed to one writev
+
+//
+// Request slot, one per request a connection may have in flight
+typedef struct {
+    LCloudRegisterFrame nbo;                // Request frame, network byte order
+    LCloudTagHeader     hdr;                // Tag header (v2)
+    int                 read;               // 1 for a read, 0 for a write
+    uint64_t            sent;               // When the request went out (ns)
+} lcloud_lgslot;
+
+//
+// Connection to the server
+typedef struct {
+    int                 sock;               // Socket, -1 when closed
+    int                 proto;              // Protocol negotiated at power on
+    int                 depth;              // Requests kept in flight
+    int                 inflight;           // Requests sent and not answered
+    lcloud_lgslot      *slots;              // depth request slots
+    int                 head;               // Oldest slot in flight (v1, replies come in order)
+    int                *idle;               // Slots free to send from (v2, replies come in any order)
+    int                 nidle;
+    char               *rbuf;               // Responses received and not yet parsed
+    int                 rlen;
+} lcloud_lgconn;
+
+//
+// Load thread and its tallies
+typedef struct {
+    pthread_t           thread;
+    lcloud_lgconn      *conns;              // The thread's connections
+    int                 nconns;
+    unsigned short      seed[3];            // Request mix and addresses
+    uint64_t            reads, writes;      // Requests answered
+    uint64_t            errors;             // Requests the server failed
+    uint64_t            rtt_total, rtt_max; // Round trips (ns)
+    uint64_t            hist[LC_LG_BUCKETS];
+    int                 failed;             // Connection lost
+} lcloud_lgthread;
+
+//
+// Global Data
+const char     *server_addr = LCLOUD_DEFAULT_IP;
+unsigned short  server_port = LCLOUD_DEFAULT_PORT;
+int             want_proto = LCLOUD_PROTO_V2;
+int             depth = 1;
+int             read_percent = 50;
+int             device_mask = 0xffff;                   // Devices requests may address
+int             dev_sectors[LC_MAX_DEVICES];            // Geometry of the devices, 0 if not used
+int             dev_blocks[LC_MAX_DEVICES];
+uint64_t        total_blocks;                           // Blocks across the devices used
+volatile int    stopping;                               // Set when the run is over
+char            write_data[LC_DEVICE_BLOCK_SIZE];       // Contents of every block written
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_clock
+// Description  : Read the monotonic clock
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds
+
+uint64_t loadgen_clock( void ) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return( (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_bucket
+// Description  : Find the histogram bucket of a round trip, 16 to each power
+//                of two (so within about 6%)
+//
+// Inputs       : ns - the round trip
+// Outputs      : the bucket
+
+int loadgen_bucket( uint64_t ns ) {
+    int msb;
+
+    if ( ns < LC_LG_SUBBUCKETS ) {
+        return( (int)ns );
+    }
+    msb = 63 - __builtin_clzll(ns);
+    return( (msb - 3) * LC_LG_SUBBUCKETS + (int)((ns >> (msb - 4)) & (LC_LG_SUBBUCKETS - 1)) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_bucket_value
+// Description  : Get the smallest round trip that falls in a histogram bucket
+//
+// Inputs       : bucket - the bucket
+// Outputs      : the round trip (ns)
+
+uint64_t loadgen_bucket_value( int bucket ) {
+    int msb = bucket / LC_LG_SUBBUCKETS + 3;
+
+    if ( bucket < LC_LG_SUBBUCKETS ) {
+        return( bucket );
+    }
+    return( (uint64_t)(LC_LG_SUBBUCKETS + bucket % LC_LG_SUBBUCKETS) << (msb - 4) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_percentile
+// Description  : Read a percentile off a round trip histogram
+//
+// Inputs       : hist - the histogram
+//                count - number of round trips in it
+//                pct - the percentile
+// Outputs      : the round trip (ns)
+
+uint64_t loadgen_percentile( const uint64_t *hist, uint64_t count, double pct ) {
+    uint64_t rank = (uint64_t)(pct * count / 100.0), seen = 0;
+    int i;
+
+    for ( i = 0; i < LC_LG_BUCKETS; i++ ) {
+        if ( (seen += hist[i]) > rank ) {
+            return( loadgen_bucket_value(i) );
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_read_all
+// Description  : Read exactly len bytes from a socket
+//
+// Inputs       : sock - the socket
+//                buf - place to put the data
+//                len - number of bytes
+// Outputs      : 0 if successful, -1 if failure
+
+int loadgen_read_all( int sock, void *buf, size_t len ) {
+    ssize_t got;
+
+    while ( len > 0 ) {
+        if ( (got = read(sock, buf, len)) <= 0 ) {
+            if ( (got == -1) && (errno == EINTR) ) {
+                continue;
+            }
+            return( -1 );
+        }
+        buf = (char *)buf + got;
+        len -= got;
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_writev_all
+// Description  : Write every buffer of an iovec array to a socket, retrying
+//                short writes (the array is consumed)
+//
+// Inputs       : sock - the socket
+//                iov - the buffers
+//                iovcnt - number of buffers
+// Outputs      : 0 if successful, -1 if failure
+
+int loadgen_writev_all( int sock, struct iovec *iov, int iovcnt ) {
+    ssize_t sent;
+
+    while ( iovcnt > 0 ) {
+        if ( (sent = writev(sock, iov, CMPSC311_MINVAL(iovcnt, LC_LG_IOV_MAX))) == -1 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return( -1 );
+        }
+        while ( (iovcnt > 0) && (sent >= (ssize_t)iov->iov_len) ) {
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if ( iovcnt > 0 ) {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_control
+// Description  : Send a control request (power, probe, init) and wait for the
+//                reply, nothing else being in flight
+//
+// Inputs       : conn - the connection
+//                frm - the request
+// Outputs      : the reply, -1 if failure
+
+LCloudRegisterFrame loadgen_control( lcloud_lgconn *conn, LCloudRegisterFrame frm ) {
+    LCloudTagHeader hdr = { 0, 0, 0 };
+    struct iovec iov[2];
+
+    frm = htonll64(frm);
+    iov[0].iov_base = &frm;
+    iov[0].iov_len = sizeof(frm);
+    iov[1].iov_base = &hdr;
+    iov[1].iov_len = sizeof(hdr);
+    if ( (loadgen_writev_all(conn->sock, iov, (conn->proto == LCLOUD_PROTO_V2) ? 2 : 1) == -1) ||
+         (loadgen_read_all(conn->sock, &frm, sizeof(frm)) == -1) ||
+         ((conn->proto == LCLOUD_PROTO_V2) && (loadgen_read_all(conn->sock, &hdr, sizeof(hdr)) == -1)) ) {
+        return( (LCloudRegisterFrame)-1 );
+    }
+    return( ntohll64(frm) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_connect
+// Description  : Connect to the server, power on (asking for protocol v2 with
+//                depth credits unless told not to) and bring up the devices.
+//                The first connection records the device geometry.
+//
+// Inputs       : conn - the connection to set up
+//                first - 1 for the first connection
+// Outputs      : 0 if successful, -1 if failure
+
+int loadgen_connect( lcloud_lgconn *conn, int first ) {
+    int b0, b1, c0, c1, c2, d0, d1, id, probe, one = 1;
+    struct sockaddr_in addr;
+    LCloudRegisterFrame rsp;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(server_port);
+    conn->proto = LCLOUD_PROTO_V1;
+    if ( (inet_aton(server_addr, &addr.sin_addr) == 0) ||
+         ((conn->sock = socket(AF_INET, SOCK_STREAM, 0)) == -1) ||
+         (connect(conn->sock, (struct sockaddr *)&addr, sizeof(addr)) == -1) ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure connecting to server [%s/%d] : %s", server_addr, server_port, strerror(errno));
+        return( -1 );
+    }
+    setsockopt(conn->sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    rsp = loadgen_control(conn, lcloud_pack_registers(0, 0, LC_POWER_ON, 0, 0,
+                                    (want_proto == LCLOUD_PROTO_V2) ? LCLOUD_PROTO_V2 : 0, depth));
+    lcloud_unpack_registers(rsp, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+    if ( (rsp == (LCloudRegisterFrame)-1) || (b1 != LC_SUCCESS) || (c0 != LC_POWER_ON) ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure powering on");
+        return( -1 );
+    }
+    if ( (want_proto == LCLOUD_PROTO_V2) && (d0 == LCLOUD_PROTO_V2) && (d1 > 0) ) {
+        conn->proto = LCLOUD_PROTO_V2;
+        conn->depth = CMPSC311_MINVAL(depth, d1);                   // What the server granted
+    } else {
+        conn->depth = depth;                                        // v1 replies come in order, the depth is ours to pick
+    }
+
+    rsp = loadgen_control(conn, lcloud_pack_registers(0, 0, LC_DEVPROBE, 0, 0, 0, 0));
+    lcloud_unpack_registers(rsp, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+    if ( (rsp == (LCloudRegisterFrame)-1) || (b1 != LC_SUCCESS) || (c0 != LC_DEVPROBE) ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure probing devices");
+        return( -1 );
+    }
+    probe = d0 & device_mask;
+    for ( id = 0; id < LC_MAX_DEVICES; id++ ) {
+        if ( !(probe & (1 << id)) ) {
+            continue;
+        }
+        rsp = loadgen_control(conn, lcloud_pack_registers(0, 0, LC_DEVINIT, id, 0, 0, 0));
+        lcloud_unpack_registers(rsp, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        if ( (rsp == (LCloudRegisterFrame)-1) || (b1 != LC_SUCCESS) || (c0 != LC_DEVINIT) ) {
+            logMessage(LOG_ERROR_LEVEL, "Failure initializing device [%d]", id);
+            return( -1 );
+        }
+        if ( first ) {
+            dev_sectors[id] = d0;
+            dev_blocks[id] = d1;
+            total_blocks += (uint64_t)d0 * d1;
+        }
+    }
+    if ( total_blocks == 0 ) {
+        logMessage(LOG_ERROR_LEVEL, "No devices to address (probe mask [%x])", probe);
+        return( -1 );
+    }
+
+    conn->slots = calloc(conn->depth, sizeof(lcloud_lgslot));
+    conn->idle = malloc(conn->depth * sizeof(int));
+    conn->rbuf = malloc((conn->depth + 1) * LC_LG_RESPONSE);
+    if ( (conn->slots == NULL) || (conn->idle == NULL) || (conn->rbuf == NULL) ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure allocating connection of depth [%d]", conn->depth);
+        return( -1 );
+    }
+    for ( conn->nidle = 0; conn->nidle < conn->depth; conn->nidle++ ) {
+        conn->idle[conn->nidle] = conn->nidle;
+    }
+    conn->head = conn->inflight = conn->rlen = 0;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_fill
+// Description  : Send requests until the connection has its depth in flight,
+//                in one gathered write
+//
+// Inputs       : thr - the load thread
+//                conn - the connection
+//                iov - scratch space for 3 * depth iovecs
+// Outputs      : 0 if successful, -1 if failure
+
+int loadgen_fill( lcloud_lgthread *thr, lcloud_lgconn *conn, struct iovec *iov ) {
+    int iovcnt = 0, slot, id;
+    uint64_t block, now = loadgen_clock();
+    lcloud_lgslot *s;
+
+    while ( conn->inflight < conn->depth ) {
+        if ( conn->proto == LCLOUD_PROTO_V2 ) {
+            slot = conn->idle[--conn->nidle];
+        } else {
+            slot = (conn->head + conn->inflight) % conn->depth;
+        }
+        s = &conn->slots[slot];
+        block = (uint64_t)(erand48(thr->seed) * total_blocks);     // Uniform over every block of the devices used
+        for ( id = 0; block >= (uint64_t)dev_sectors[id] * dev_blocks[id]; id++ ) {
+            block -= (uint64_t)dev_sectors[id] * dev_blocks[id];
+        }
+        s->read = (erand48(thr->seed) * 100 < read_percent);
+        s->nbo = htonll64(lcloud_pack_registers(0, 0, LC_BLOCK_XFER, id, (s->read) ? LC_XFER_READ : LC_XFER_WRITE,
+                                                (int)(block / dev_blocks[id]), (int)(block % dev_blocks[id])));
+        s->hdr.tag = htonl(slot);
+        s->hdr.credits = 0;
+        s->hdr.flags = 0;
+        s->sent = now;
+
+        iov[iovcnt].iov_base = &s->nbo;
+        iov[iovcnt++].iov_len = sizeof(LCloudRegisterFrame);
+        if ( conn->proto == LCLOUD_PROTO_V2 ) {
+            iov[iovcnt].iov_base = &s->hdr;
+            iov[iovcnt++].iov_len = sizeof(LCloudTagHeader);
+        }
+        if ( !s->read ) {
+            iov[iovcnt].iov_base = write_data;
+            iov[iovcnt++].iov_len = LC_DEVICE_BLOCK_SIZE;
+        }
+        conn->inflight++;
+    }
+    if ( (iovcnt > 0) && (loadgen_writev_all(conn->sock, iov, iovcnt) == -1) ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure sending requests : %s", strerror(errno));
+        return( -1 );
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_drain
+// Description  : Take in what the server has sent on a connection and tally
+//                every whole response
+//
+// Inputs       : thr - the load thread
+//                conn - the connection
+// Outputs      : 0 if successful, -1 if failure
+
+int loadgen_drain( lcloud_lgthread *thr, lcloud_lgconn *conn ) {
+    int b0, b1, c0, c1, c2, d0, d1, slot, need, off = 0;
+    size_t head = sizeof(LCloudRegisterFrame) + ((conn->proto == LCLOUD_PROTO_V2) ? sizeof(LCloudTagHeader) : 0);
+    LCloudRegisterFrame frm;
+    LCloudTagHeader hdr;
+    ssize_t got;
+    uint64_t rtt, now;
+
+    if ( (got = recv(conn->sock, &conn->rbuf[conn->rlen], (conn->depth + 1) * LC_LG_RESPONSE - conn->rlen, MSG_DONTWAIT)) <= 0 ) {
+        if ( (got == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) ) {
+            return( 0 );
+        }
+        logMessage(LOG_ERROR_LEVEL, "Server closed the connection");
+        return( -1 );
+    }
+    conn->rlen += got;
+    now = loadgen_clock();
+
+    while ( (conn->inflight > 0) && (conn->rlen - off >= (int)head) ) {
+        memcpy(&frm, &conn->rbuf[off], sizeof(frm));
+        if ( conn->proto == LCLOUD_PROTO_V2 ) {
+            memcpy(&hdr, &conn->rbuf[off + sizeof(frm)], sizeof(hdr));
+            slot = ntohl(hdr.tag);
+        } else {
+            slot = conn->head;
+        }
+        if ( (slot < 0) || (slot >= conn->depth) ) {
+            logMessage(LOG_ERROR_LEVEL, "Unexpected response tag [%d]", slot);
+            return( -1 );
+        }
+        need = head + ((conn->slots[slot].read) ? LC_DEVICE_BLOCK_SIZE : 0);
+        if ( conn->rlen - off < need ) {
+            break;                                                  // The rest of the block is still coming
+        }
+        off += need;
+
+        lcloud_unpack_registers(ntohll64(frm), &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        if ( (b1 != LC_SUCCESS) || (c0 != LC_BLOCK_XFER) ) {
+            thr->errors++;
+        } else if ( conn->slots[slot].read ) {
+            thr->reads++;
+        } else {
+            thr->writes++;
+        }
+        rtt = now - conn->slots[slot].sent;
+        thr->rtt_total += rtt;
+        thr->rtt_max = CMPSC311_MAXVAL(thr->rtt_max, rtt);
+        thr->hist[loadgen_bucket(rtt)]++;
+
+        if ( conn->proto == LCLOUD_PROTO_V2 ) {
+            conn->idle[conn->nidle++] = slot;
+        } else {
+            conn->head = (conn->head + 1) % conn->depth;
+        }
+        conn->inflight--;
+    }
+    memmove(conn->rbuf, &conn->rbuf[off], conn->rlen - off);
+    conn->rlen -= off;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : loadgen_thread
+// Description  : Load thread, keeps each of its connections full until the
+//                run ends and then waits for the last replies
+//
+// Inputs       : arg - the lcloud_lgthread of the thread
+// Outputs      : NULL
+
+void *loadgen_thread( void *arg ) {
+    lcloud_lgthread *thr = arg;
+    struct pollfd *pfds = calloc(thr->nconns, sizeof(struct pollfd));
+    struct iovec *iov = malloc(3 * depth * sizeof(struct iovec));
+    int i, busy = 1;
+
+    if ( (pfds == NULL) || (iov == NULL) ) {
+        thr->failed = 1;
+    }
+    for ( i = 0; (i < thr->nconns) && !thr->failed; i++ ) {
+        pfds[i].fd = thr->conns[i].sock;
+        pfds[i].events = POLLIN;
+    }
+    while ( busy && !thr->failed ) {
+        busy = 0;
+        for ( i = 0; (i < thr->nconns) && !thr->failed; i++ ) {
+            if ( !stopping && (loadgen_fill(thr, &thr->conns[i], iov) == -1) ) {
+                thr->failed = 1;
+            }
+            busy |= (thr->conns[i].inflight > 0);
+        }
+        if ( !busy || thr->failed || (poll(pfds, thr->nconns, 100) <= 0) ) {
+            continue;
+        }
+        for ( i = 0; (i < thr->nconns) && !thr->failed; i++ ) {
+            if ( (pfds[i].revents != 0) && (loadgen_drain(thr, &thr->conns[i]) == -1) ) {
+                thr->failed = 1;
+            }
+        }
+    }
+
+    free(pfds);
+    free(iov);
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the LionCloud load generator
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    int ch, i, id, nconns = 1, nthreads = 1, seconds = 5, log_initialized = 0, failed = 0, v2 = 0;
+    lcloud_lgconn *conns;
+    lcloud_lgthread *thrs;
+    uint64_t start, elapsed, reads = 0, writes = 0, errors = 0, total = 0, max = 0, count;
+    uint64_t hist[LC_LG_BUCKETS];
+    char *dev, *end;
+    double secs;
+
+    while ( (ch = getopt(argc, argv, LCLOUD_LOADGEN_ARGUMENTS)) != -1 ) {
+        switch ( ch ) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return( -1 );
+
+        case '1': // Protocol v1 only
+            want_proto = LCLOUD_PROTO_V1;
+            break;
+
+        case 'a': // Server address
+            server_addr = optarg;
+            break;
+
+        case 'p': // Server port
+            server_port = (unsigned short)atoi(optarg);
+            break;
+
+        case 'c': // Connections
+            nconns = atoi(optarg);
+            break;
+
+        case 't': // Threads
+            nthreads = atoi(optarg);
+            break;
+
+        case 'q': // Pipeline depth
+            depth = atoi(optarg);
+            break;
+
+        case 'r': // Read mix
+            read_percent = atoi(optarg);
+            break;
+
+        case 'D': // Devices to address
+            device_mask = 0;
+            for ( dev = strtok(optarg, ","); dev != NULL; dev = strtok(NULL, ",") ) {
+                id = (int)strtol(dev, &end, 10);
+                if ( (*end != '\0') || (id < 0) || (id >= LC_MAX_DEVICES) ) {
+                    fprintf(stderr, "Bad device (%s), aborting.\n", dev);
+                    return( -1 );
+                }
+                device_mask |= (1 << id);
+            }
+            break;
+
+        case 's': // Run time
+            seconds = atoi(optarg);
+            break;
+
+        case 'l': // Set the log filename
+            initializeLogWithFilename(optarg);
+            log_initialized = 1;
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return( -1 );
+        }
+    }
+    if ( (nconns < 1) || (nthreads < 1) || (nthreads > nconns) || (depth < 1) || (depth > LCLOUD_MAX_CREDITS) ||
+         (read_percent < 0) || (read_percent > 100) || (seconds < 1) ) {
+        fprintf(stderr, "Bad load parameters, use -h to see usage, aborting.\n");
+        return( -1 );
+    }
+    if ( !log_initialized ) {
+        initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    }
+    memset(write_data, 0xa5, sizeof(write_data));
+
+    // Connect everything before the clock starts
+    conns = calloc(nconns, sizeof(lcloud_lgconn));
+    thrs = calloc(nthreads, sizeof(lcloud_lgthread));
+    if ( (conns == NULL) || (thrs == NULL) ) {
+        fprintf(stderr, "Failure allocating [%d] connections, aborting.\n", nconns);
+        return( -1 );
+    }
+    for ( i = 0; i < nconns; i++ ) {
+        if ( loadgen_connect(&conns[i], i == 0) == -1 ) {
+            fprintf(stderr, "Failure setting up connection [%d]%s, aborting.\n", i,
+                    (i > 0) ? " (a server serving one connection at a time will not answer a second, see lcloud_devsrv -c)" : "");
+            return( -1 );
+        }
+        v2 += (conns[i].proto == LCLOUD_PROTO_V2);
+    }
+
+    // Each thread drives a run of the connections
+    start = loadgen_clock();
+    for ( i = 0; i < nthreads; i++ ) {
+        thrs[i].conns = &conns[i * nconns / nthreads];
+        thrs[i].nconns = (i + 1) * nconns / nthreads - i * nconns / nthreads;
+        thrs[i].seed[0] = 0x330e;
+        thrs[i].seed[1] = i;
+        thrs[i].seed[2] = (unsigned short)start;
+        if ( pthread_create(&thrs[i].thread, NULL, loadgen_thread, &thrs[i]) != 0 ) {
+            fprintf(stderr, "Failure starting load thread [%d], aborting.\n", i);
+            return( -1 );
+        }
+    }
+    sleep(seconds);
+    stopping = 1;
+    memset(hist, 0, sizeof(hist));
+    for ( i = 0; i < nthreads; i++ ) {
+        pthread_join(thrs[i].thread, NULL);
+        reads += thrs[i].reads;
+        writes += thrs[i].writes;
+        errors += thrs[i].errors;
+        total += thrs[i].rtt_total;
+        max = CMPSC311_MAXVAL(max, thrs[i].rtt_max);
+        failed |= thrs[i].failed;
+        for ( id = 0; id < LC_LG_BUCKETS; id++ ) {
+            hist[id] += thrs[i].hist[id];
+        }
+    }
+    elapsed = loadgen_clock() - start;
+
+    // Power off politely, a v2 server answers once the connection is idle
+    for ( i = 0; i < nconns; i++ ) {
+        if ( !failed ) {
+            loadgen_control(&conns[i], lcloud_pack_registers(0, 0, LC_POWER_OFF, 0, 0, 0, 0));
+        }
+        close(conns[i].sock);
+        free(conns[i].slots);
+        free(conns[i].idle);
+        free(conns[i].rbuf);
+    }
+
+    // Report
+    secs = elapsed / 1e9;
+    count = reads + writes + errors;
+    printf("%d connections on %d threads, depth %d, protocol v%d%s, %d%% reads, %.1f s\n", nconns, nthreads, depth,
+           (v2 > 0) ? LCLOUD_PROTO_V2 : LCLOUD_PROTO_V1, ((v2 > 0) && (v2 < nconns)) ? " (some v1)" : "", read_percent, secs);
+    printf("requests/s  %10.0f  (reads %.0f/s, writes %.0f/s)\n", count / secs, reads / secs, writes / secs);
+    printf("MB/s        %10.2f  (read %.2f, write %.2f)\n", count * LC_DEVICE_BLOCK_SIZE / secs / 1e6,
+           reads * LC_DEVICE_BLOCK_SIZE / secs / 1e6, writes * LC_DEVICE_BLOCK_SIZE / secs / 1e6);
+    if ( count > 0 ) {
+        printf("rtt (us)    mean %.1f  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n", total / 1e3 / count,
+               loadgen_percentile(hist, count, 50) / 1e3, loadgen_percentile(hist, count, 90) / 1e3,
+               loadgen_percentile(hist, count, 99) / 1e3, loadgen_percentile(hist, count, 99.9) / 1e3, max / 1e3);
+    }
+    printf("errors      %10lu%s\n", (unsigned long)errors, (failed) ? "  (connection lost, run cut short)" : "");
+
+    free(conns);
+    free(thrs);
+    return( (failed || (errors > 0)) ? -1 : 0 );
+}
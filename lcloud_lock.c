@@ -0,0 +1,318 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_lock.c
+//  Description    : This is the LionCloud lock profiler. Counting costs a
+//                   trylock and two atomic adds; the clock is only read for
+//                   sampled acquisitions, and only the holder of a lock
+//                   touches its hold stamp, so the profile adds no locking of
+//                   its own outside of handing out slots.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <string.h>
+#include <errno.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+
+// Project Includes
+#include <lcloud_lock.h>
+#include <lcloud_stats.h>
+
+//
+// Global Variables
+int                 lock_sample_every = 0;                      // Time one in this many, 0 for none
+pthread_mutex_t     lock_slots = PTHREAD_MUTEX_INITIALIZER;     // Hands out profile slots
+int                 lock_nslots;                                // Slots handed out
+__thread uint64_t   lock_tick, queue_tick;                      // The calling thread's acquisitions and items queued
+
+// Profile updates from any thread
+#define LC_WAIT_ADD(w, field, n) __atomic_fetch_add(&(w)->field, (n), __ATOMIC_RELAXED)
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lock_slot
+// Description  : Get the profile entry of a lock or queue, giving it a slot on
+//                first use (all but the first LC_STATS_WAITS share the last)
+//
+// Inputs       : name - the lock or queue name
+//                slot - its slot, -1 if it has none yet
+//                queue - 1 for a queue, 0 for a lock
+// Outputs      : the profile entry
+
+lcloud_stats_wait *lock_slot( const char *name, int *slot, int queue ) {
+    lcloud_stats_wait *w;
+    int s;
+
+    if ( (s = __atomic_load_n(slot, __ATOMIC_ACQUIRE)) >= 0 ) {
+        return( &lcloud_statp->waits[s] );
+    }
+    pthread_mutex_lock(&lock_slots);
+    if ( (s = *slot) < 0 ) {
+        s = CMPSC311_MINVAL(lock_nslots, LC_STATS_WAITS - 1);
+        w = &lcloud_statp->waits[s];
+        if ( lock_nslots++ < LC_STATS_WAITS - 1 ) {
+            strncpy(w->name, name, LC_STATS_NAME - 1);
+            w->queue = queue;
+        } else {
+            strcpy(w->name, "(others)");
+        }
+        __atomic_store_n(slot, s, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&lock_slots);
+    return( &lcloud_statp->waits[s] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lock_sampled
+// Description  : Decide whether the calling thread times this acquisition or
+//                item (locks and queues tick apart, so a queue guarded by a
+//                lock is not sampled in step with it)
+//
+// Inputs       : tick - the calling thread's count of them
+// Outputs      : 1 to time it, 0 if not
+
+int lock_sampled( uint64_t *tick ) {
+    int every = __atomic_load_n(&lock_sample_every, __ATOMIC_RELAXED);
+
+    return( (every > 0) && ((++*tick % every) == 0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lock_timed_wait
+// Description  : Record a timed wait, and its site if it is the longest yet
+//                (the caller holds the lock, or the queue's lock, so sites
+//                are written one at a time)
+//
+// Inputs       : w - the profile entry
+//                ns - the wait
+//                site - the function that waited
+// Outputs      : none
+
+void lock_timed_wait( lcloud_stats_wait *w, uint64_t ns, const char *site ) {
+    int bucket = (ns == 0) ? 0 : 64 - __builtin_clzll(ns);
+
+    LC_WAIT_ADD(w, timed, 1);
+    LC_WAIT_ADD(w, wait_ns, ns);
+    LC_WAIT_ADD(w, hist[CMPSC311_MINVAL(bucket, LC_STATS_WAIT_BUCKETS - 1)], 1);
+    if ( ns > __atomic_load_n(&w->wait_max, __ATOMIC_RELAXED) ) {
+        __atomic_store_n(&w->wait_max, ns, __ATOMIC_RELAXED);
+        strncpy(w->site, site, LC_STATS_NAME - 1);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_lock_sample
+// Description  : Set how often acquisitions and queue waits are timed; can be
+//                changed while the driver runs
+//
+// Inputs       : every - time one in every, 0 to only count
+// Outputs      : none
+
+void lcloud_lock_sample( int every ) {
+    __atomic_store_n(&lock_sample_every, CMPSC311_MAXVAL(every, 0), __ATOMIC_RELAXED);
+    LC_STAT_SET(sample_every, CMPSC311_MAXVAL(every, 0));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_lock_acquire
+// Description  : Take a lock, counting whether it was held by another thread
+//                and timing the wait of sampled acquisitions
+//
+// Inputs       : lk - the lock
+//                site - the calling function
+// Outputs      : none
+
+void lcloud_lock_acquire( lcloud_lock *lk, const char *site ) {
+    lcloud_stats_wait *w = lock_slot(lk->name, &lk->slot, 0);
+    int sampled = lock_sampled(&lock_tick), contended = 0;
+    uint64_t start = 0;
+
+    if ( pthread_mutex_trylock(&lk->mutex) == EBUSY ) {
+        contended = 1;
+        if ( sampled ) {
+            start = lcloud_stats_clock();
+        }
+        pthread_mutex_lock(&lk->mutex);
+    }
+    LC_WAIT_ADD(w, count, 1);
+    if ( contended ) {
+        LC_WAIT_ADD(w, contended, 1);
+    }
+    lk->held_since = 0;
+    if ( sampled ) {
+        lk->held_since = lcloud_stats_clock();
+        lock_timed_wait(w, (contended) ? lk->held_since - start : 0, site);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_lock_release
+// Description  : Drop a lock, recording the hold of a timed acquisition
+//
+// Inputs       : lk - the lock
+// Outputs      : none
+
+void lcloud_lock_release( lcloud_lock *lk ) {
+    lcloud_stats_wait *w;
+    uint64_t held;
+
+    if ( lk->held_since != 0 ) {
+        w = &lcloud_statp->waits[lk->slot];
+        held = lcloud_stats_clock() - lk->held_since;
+        lk->held_since = 0;
+        LC_WAIT_ADD(w, hold_ns, held);
+        if ( held > __atomic_load_n(&w->hold_max, __ATOMIC_RELAXED) ) {
+            __atomic_store_n(&w->hold_max, held, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&lk->mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_lock_wait
+// Description  : Wait on a condition with the lock held. The hold so far is
+//                recorded and a new one starts on waking; waiting for work is
+//                not contention, so the sleep itself is not counted.
+//
+// Inputs       : lk - the lock
+//                cond - the condition
+// Outputs      : none
+
+void lcloud_lock_wait( lcloud_lock *lk, pthread_cond_t *cond ) {
+    lcloud_stats_wait *w;
+    int timed = (lk->held_since != 0);
+    uint64_t held;
+
+    if ( timed ) {
+        w = &lcloud_statp->waits[lk->slot];
+        held = lcloud_stats_clock() - lk->held_since;
+        LC_WAIT_ADD(w, hold_ns, held);
+        if ( held > __atomic_load_n(&w->hold_max, __ATOMIC_RELAXED) ) {
+            __atomic_store_n(&w->hold_max, held, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_cond_wait(cond, &lk->mutex);
+    lk->held_since = (timed) ? lcloud_stats_clock() : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_queue_add
+// Description  : Count items into a queue at once, as its consumer finds them;
+//                all but the first are behind others
+//
+// Inputs       : q - the queue
+//                n - the number of items
+// Outputs      : none
+
+void lcloud_queue_add( lcloud_queue *q, uint64_t n ) {
+    lcloud_stats_wait *w = lock_slot(q->name, &q->slot, 1);
+    uint64_t depth;
+
+    LC_WAIT_ADD(w, count, n);
+    depth = LC_WAIT_ADD(w, depth, n);
+    LC_WAIT_ADD(w, contended, (depth > 0) ? n : n - 1);
+    if ( depth + n > __atomic_load_n(&w->depth_max, __ATOMIC_RELAXED) ) {
+        __atomic_store_n(&w->depth_max, depth + n, __ATOMIC_RELAXED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_queue_stamp
+// Description  : Stamp an item for lcloud_queue_leave without counting it, for
+//                a queue whose consumer counts items in as it finds them.
+//                Only the calling thread's tick is touched.
+//
+// Inputs       : none
+// Outputs      : the item's stamp, 0 if it is not timed
+
+uint64_t lcloud_queue_stamp( void ) {
+    return( lock_sampled(&queue_tick) ? lcloud_stats_clock() : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_queue_enter
+// Description  : Count an item into a queue
+//
+// Inputs       : q - the queue
+// Outputs      : the item's stamp for lcloud_queue_leave, 0 if it is not timed
+
+uint64_t lcloud_queue_enter( lcloud_queue *q ) {
+    lcloud_queue_add(q, 1);
+    return( lcloud_queue_stamp() );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_queue_leave
+// Description  : Count an item out of a queue, recording how long a timed one
+//                waited
+//
+// Inputs       : q - the queue
+//                stamp - what lcloud_queue_enter returned for the item
+//                site - the function taking it off
+// Outputs      : none
+
+void lcloud_queue_leave( lcloud_queue *q, uint64_t stamp, const char *site ) {
+    lcloud_stats_wait *w = lock_slot(q->name, &q->slot, 1);
+
+    LC_WAIT_ADD(w, depth, -1);
+    if ( stamp != 0 ) {
+        lock_timed_wait(w, lcloud_stats_clock() - stamp, site);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_lock_report
+// Description  : Log the profile of every lock and queue used; the 99th
+//                percentile wait is the top of its power of two bucket
+//
+// Inputs       : none
+// Outputs      : none
+
+void lcloud_lock_report( void ) {
+    lcloud_stats_wait *w;
+    uint64_t seen, p99;
+    int i, b;
+
+    for ( i = 0; i < CMPSC311_MINVAL(lock_nslots, LC_STATS_WAITS); i++ ) {
+        w = &lcloud_statp->waits[i];
+        if ( w->queue ) {
+            logMessage(LOG_OUTPUT_LEVEL, "Queue [%s] items [%lu] queued behind others [%lu] (%.1f%%), deepest [%lu]", w->name,
+                       (unsigned long)w->count, (unsigned long)w->contended, (w->count) ? 100.0 * w->contended / w->count : 0.0,
+                       (unsigned long)w->depth_max);
+        } else {
+            logMessage(LOG_OUTPUT_LEVEL, "Lock [%s] acquisitions [%lu] contended [%lu] (%.1f%%)", w->name,
+                       (unsigned long)w->count, (unsigned long)w->contended, (w->count) ? 100.0 * w->contended / w->count : 0.0);
+        }
+        if ( w->timed == 0 ) {
+            continue;
+        }
+        for ( b = 0, seen = 0, p99 = 0; b < LC_STATS_WAIT_BUCKETS; b++ ) {
+            if ( (seen += w->hist[b]) * 100 >= w->timed * 99 ) {
+                p99 = (b == 0) ? 0 : CMPSC311_MINVAL(1ULL << b, w->wait_max);
+                break;
+            }
+        }
+        logMessage(LOG_OUTPUT_LEVEL, "    timed [%lu] wait mean [%.2f] p99 [%.2f] max [%.2f] us (longest in %s)",
+                   (unsigned long)w->timed, w->wait_ns / 1e3 / w->timed, p99 / 1e3, w->wait_max / 1e3,
+                   (w->site[0] != '\0') ? w->site : "-");
+        if ( !w->queue ) {
+            logMessage(LOG_OUTPUT_LEVEL, "    hold mean [%.2f] max [%.2f] us", w->hold_ns / 1e3 / w->timed, w->hold_max / 1e3);
+        }
+    }
+}
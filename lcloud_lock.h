@@ -0,0 +1,72 @@
+#ifndef LCLOUD_LOCK_INCLUDED
+#define LCLOUD_LOCK_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_lock.h
+//  Description    : This is the interface of the LionCloud lock profiler. The
+//                   driver's locks and queues are named and wrapped; every
+//                   acquisition is counted, and when sampling is on one in
+//                   every so many is timed for its wait and hold. The profile
+//                   lives with the live counters (lcloud_top shows it) and is
+//                   logged at shutdown.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdint.h>
+#include <pthread.h>
+
+//
+// Profiled lock
+typedef struct {
+    pthread_mutex_t     mutex;
+    const char         *name;                   // Name in the profile (string constant)
+    int                 slot;                   // Profile slot, -1 until first used
+    uint64_t            held_since;             // When a timed holder took it (ns), 0 if untimed
+} lcloud_lock;
+
+//
+// Profiled queue, the queue itself belongs to its user
+typedef struct {
+    const char         *name;                   // Name in the profile (string constant)
+    int                 slot;                   // Profile slot, -1 until first used
+} lcloud_queue;
+
+// Static initializers and the acquire call, naming the calling function as the site
+#define LC_LOCK_INITIALIZER(n)  { PTHREAD_MUTEX_INITIALIZER, (n), -1, 0 }
+#define LC_QUEUE_INITIALIZER(n) { (n), -1 }
+#define LC_LOCK(lk)             lcloud_lock_acquire((lk), __func__)
+
+//
+// Functional Prototypes
+
+void lcloud_lock_sample( int every );
+    // Time one in every acquisitions and queue waits, 0 to only count them
+
+void lcloud_lock_acquire( lcloud_lock *lk, const char *site );
+    // Take a lock, counting (and maybe timing) the wait
+
+void lcloud_lock_release( lcloud_lock *lk );
+    // Drop a lock, recording the hold of a timed acquisition
+
+void lcloud_lock_wait( lcloud_lock *lk, pthread_cond_t *cond );
+    // Wait on a condition; the time asleep is not counted as held
+
+uint64_t lcloud_queue_enter( lcloud_queue *q );
+    // Count an item into a queue, its stamp for lcloud_queue_leave (0 if untimed)
+
+void lcloud_queue_add( lcloud_queue *q, uint64_t n );
+    // Count items into a queue at once, as its consumer finds them
+
+uint64_t lcloud_queue_stamp( void );
+    // Stamp an item for lcloud_queue_leave without counting it (0 if untimed)
+
+void lcloud_queue_leave( lcloud_queue *q, uint64_t stamp, const char *site );
+    // Count an item out of a queue, recording its wait if it was timed
+
+void lcloud_lock_report( void );
+    // Log the profile of every lock and queue used
+
+#endif
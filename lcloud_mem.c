@@ -0,0 +1,230 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_mem.c
+//  Description    : This is the LionCloud memory governor. It only does the
+//                   accounting: consumers reserve before they allocate and
+//                   release after they free, so a reclaimer never pulls memory
+//                   out from under an allocation in progress.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <lcloud_filesys.h>
+#include <lcloud_mem.h>
+
+//
+// Global Variables
+size_t      mem_budget = 0;                             // Bytes the driver may use, 0 if unlimited
+size_t      mem_used[LC_MEM_MAX];                       // Bytes charged to each consumer
+size_t      mem_peak[LC_MEM_MAX];                       // Most bytes ever charged to each consumer
+size_t      mem_total, mem_total_peak;                  // Bytes charged to all consumers
+size_t      mem_reclaimed;                              // Bytes given back by the reclaimers
+int         mem_failures;                               // Reservations refused
+int         mem_reclaiming;                             // Non-zero while the reclaimers run
+size_t    (*mem_reclaimers[LC_MEM_MAX_RECLAIMERS])( size_t want );
+int         mem_nreclaimers;
+
+const char *mem_names[LC_MEM_MAX] = { "cache", "files", "blockmap", "devices", "buffers" };
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : mem_account
+// Description  : Add bytes to a consumer and track the peaks
+//
+// Inputs       : consumer - the consumer charged
+//                bytes - bytes to add
+// Outputs      : none
+
+void mem_account( LcMemConsumer consumer, size_t bytes ) {
+    mem_used[consumer] += bytes;
+    mem_total += bytes;
+    if ( mem_used[consumer] > mem_peak[consumer] ) {
+        mem_peak[consumer] = mem_used[consumer];
+    }
+    if ( mem_total > mem_total_peak ) {
+        mem_total_peak = mem_total;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_mem_reclaim
+// Description  : Ask the reclaimers, in order, to free want bytes. A reclaimer
+//                that reserves memory itself does not start another round.
+//
+// Inputs       : want - bytes wanted
+// Outputs      : bytes freed
+
+size_t lcloud_mem_reclaim( size_t want ) {
+    size_t freed = 0;
+    int i;
+
+    if ( mem_reclaiming ) {
+        return( 0 );
+    }
+    mem_reclaiming = 1;
+    for ( i = 0; (i < mem_nreclaimers) && (freed < want); i++ ) {
+        freed += mem_reclaimers[i](want - freed);
+    }
+    mem_reclaiming = 0;
+
+    mem_reclaimed += freed;
+    return( freed );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_mem_reserve
+// Description  : Charge bytes to a consumer, reclaiming first if they would
+//                not fit in the budget
+//
+// Inputs       : consumer - the consumer charged
+//                bytes - bytes about to be allocated
+// Outputs      : 0 if successful, -1 if the budget can not cover them
+
+int lcloud_mem_reserve( LcMemConsumer consumer, size_t bytes ) {
+    if ( mem_budget && (mem_total + bytes > mem_budget) ) {
+        lcloud_mem_reclaim(mem_total + bytes - mem_budget);
+        if ( mem_total + bytes > mem_budget ) {
+            mem_failures++;
+            return( -1 );
+        }
+    }
+    mem_account(consumer, bytes);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_mem_charge
+// Description  : Charge bytes that can not be refused, such as the buffers of a
+//                bus batch already under way. They count against the budget
+//                and push the other consumers to shrink on their next reserve.
+//
+// Inputs       : consumer - the consumer charged
+//                bytes - bytes allocated
+// Outputs      : none
+
+void lcloud_mem_charge( LcMemConsumer consumer, size_t bytes ) {
+    mem_account(consumer, bytes);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_mem_release
+// Description  : Return bytes charged to a consumer
+//
+// Inputs       : consumer - the consumer charged
+//                bytes - bytes freed
+// Outputs      : none
+
+void lcloud_mem_release( LcMemConsumer consumer, size_t bytes ) {
+    if ( bytes > mem_used[consumer] ) {
+        logMessage(LOG_ERROR_LEVEL, "Memory release of [%zu] bytes exceeds [%s] usage [%zu]",
+                   bytes, mem_names[consumer], mem_used[consumer]);
+        bytes = mem_used[consumer];
+    }
+    mem_used[consumer] -= bytes;
+    mem_total -= bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_mem_reclaimer
+// Description  : Register a reclaimer. Each is handed the bytes still wanted and
+//                returns the bytes it freed (after releasing them).
+//
+// Inputs       : reclaim - the reclaimer
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_mem_reclaimer( size_t (*reclaim)( size_t want ) ) {
+    int i;
+
+    for ( i = 0; i < mem_nreclaimers; i++ ) {
+        if ( mem_reclaimers[i] == reclaim ) {
+            return( 0 );                                // Already registered (driver powered on again)
+        }
+    }
+    if ( mem_nreclaimers == LC_MEM_MAX_RECLAIMERS ) {
+        logMessage(LOG_ERROR_LEVEL, "Memory failure, too many reclaimers");
+        return( -1 );
+    }
+    mem_reclaimers[mem_nreclaimers++] = reclaim;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcsetmemlimit
+// Description  : Set the memory budget of the driver. Lowering it below current
+//                usage reclaims right away.
+//
+// Inputs       : bytes - the budget, 0 for unlimited
+// Outputs      : 0 if usage fits the budget, -1 if it could not be brought down
+
+int lcsetmemlimit( size_t bytes ) {
+    mem_budget = bytes;
+    if ( mem_budget && (mem_total > mem_budget) ) {
+        lcloud_mem_reclaim(mem_total - mem_budget);
+        if ( mem_total > mem_budget ) {
+            logMessage(LOG_ERROR_LEVEL, "Memory usage [%zu] still over new budget [%zu]", mem_total, mem_budget);
+            return( -1 );
+        }
+    }
+    if ( mem_budget ) {
+        logMessage(LOG_OUTPUT_LEVEL, "LC memory budget set to [%zu] bytes", mem_budget);
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_mem_budget
+// Description  : Get the memory budget, for consumers that size themselves by it
+//
+// Inputs       : none
+// Outputs      : the budget in bytes, 0 if unlimited
+
+size_t lcloud_mem_budget( void ) {
+    return( mem_budget );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcmemusage
+// Description  : Get the bytes charged to a consumer
+//
+// Inputs       : consumer - the consumer, LC_MEM_MAX for all of them
+// Outputs      : bytes in use
+
+size_t lcmemusage( int consumer ) {
+    if ( (consumer < 0) || (consumer >= LC_MEM_MAX) ) {
+        return( mem_total );
+    }
+    return( mem_used[consumer] );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_mem_report
+// Description  : Log usage and peak usage per consumer
+//
+// Inputs       : none
+// Outputs      : none
+
+void lcloud_mem_report( void ) {
+    int i;
+
+    for ( i = 0; i < LC_MEM_MAX; i++ ) {
+        logMessage(LOG_OUTPUT_LEVEL, "LC memory [%-8s] in use [%zu] peak [%zu]", mem_names[i], mem_used[i], mem_peak[i]);
+    }
+    logMessage(LOG_OUTPUT_LEVEL, "LC memory total in use [%zu] peak [%zu] budget [%zu], reclaimed [%zu], refused [%d]",
+               mem_total, mem_total_peak, mem_budget, mem_reclaimed, mem_failures);
+}
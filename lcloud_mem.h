@@ -0,0 +1,57 @@
+#ifndef LCLOUD_MEM_INCLUDED
+#define LCLOUD_MEM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_mem.h
+//  Description    : This is the interface of the LionCloud memory governor. The
+//                   cache, the file table, the block maps, the device
+//                   allocation maps and the bus buffers all draw from one
+//                   budget; when a reservation does not fit, the registered
+//                   reclaimers are asked to give memory back first.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stddef.h>
+
+// Defines
+#define LC_MEM_MAX_RECLAIMERS 8        // Reclaimers that can be registered
+
+//
+// Memory consumers
+typedef enum {
+    LC_MEM_CACHE    = 0,               // Cache lines and their data
+    LC_MEM_FILES    = 1,               // The file table
+    LC_MEM_BLOCKMAP = 2,               // Per-file block maps
+    LC_MEM_DEVICES  = 3,               // Device allocation maps
+    LC_MEM_BUFFERS  = 4,               // Transient bus buffers
+    LC_MEM_MAX      = 5                // Number of consumers (or every consumer, for lcmemusage)
+} LcMemConsumer;
+
+//
+// Functional Prototypes
+
+int lcloud_mem_reserve( LcMemConsumer consumer, size_t bytes );
+    // Charge bytes to a consumer, reclaiming to stay in the budget
+
+void lcloud_mem_charge( LcMemConsumer consumer, size_t bytes );
+    // Charge bytes that can not be refused (transient buffers)
+
+void lcloud_mem_release( LcMemConsumer consumer, size_t bytes );
+    // Return bytes charged to a consumer
+
+int lcloud_mem_reclaimer( size_t (*reclaim)( size_t want ) );
+    // Register a reclaimer, they are asked in order of registration
+
+size_t lcloud_mem_budget( void );
+    // Get the memory budget, 0 if unlimited
+
+size_t lcloud_mem_reclaim( size_t want );
+    // Ask the reclaimers to free want bytes
+
+void lcloud_mem_report( void );
+    // Log usage and peak usage per consumer
+
+#endif
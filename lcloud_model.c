@@ -0,0 +1,522 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_model.c
+//  Description    : This is the LionCloud performance model. It runs the real
+//                   driver (filesystem, cache, allocator and block maps) over
+//                   an in-process bus, where the emulated devices of a hardware
+//                   manifest answer each request and a virtual clock advances
+//                   by the modeled bus and device times. A workload replays as
+//                   fast as the driver code runs, and the predicted throughput
+//                   and latency percentiles are printed at the end.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <cmpsc311_assocarr.h>
+#include <cmpsc311_log.h>
+#include <cmpsc311_util.h>
+#include <cmpsc311_workload.h>
+
+// Project Includes
+#include <lcloud_controller.h>
+#include <lcloud_filesys.h>
+#include <lcloud_network.h>
+#include <lcloud_devices.h>
+#include <lcloud_support.h>
+
+// Defines
+#define LCLOUD_MODEL_ARGUMENTS "hvdc:l:m:r:s:"
+#define USAGE                                                                   \
+    "USAGE: lcloud_model [-h] [-v] [-d] [-c <blocks>] [-m <kbytes>] [-l <logfile>]\n" \
+    "                    [-r <usec>] [-s <usec>] <hardware-manifest> <workload-file>\n" \
+    "\n"                                                                        \
+    "where:\n"                                                                  \
+    "    -h - help mode (display this message)\n"                               \
+    "    -v - verbose output\n"                                                 \
+    "    -d - open files for direct (uncached) I/O\n"                           \
+    "    -c - allocate and cache in clusters of <blocks> device blocks\n"       \
+    "    -m - limit driver memory to <kbytes> kilobytes\n"                      \
+    "    -l - write log messages to the filename <logfile>\n"                   \
+    "    -r - bus round trip time in microseconds (default 100)\n"              \
+    "    -s - block service time of devices the manifest gives no latency\n"    \
+    "         for, in microseconds (default 100)\n"                             \
+    "\n"                                                                        \
+    "    <hardware-manifest> - the device topology, one device per line as\n"   \
+    "                          <device> <sectors> <blocks> [latency-usec [MBps [qdepth]]]\n" \
+    "    <workload-file> - file contain the workload to replay\n"               \
+    "\n"
+#define LC_MODEL_RTT_DEFAULT        100     // Bus round trip (microseconds)
+#define LC_MODEL_SERVICE_DEFAULT    100     // Block service time of devices without a latency (microseconds)
+#define LC_MODEL_MAX_QDEPTH         64      // Most transfers a modeled device serves at once
+
+//
+// Latency sample structure, one per kind of operation
+typedef struct {
+    const char     *name;           // Operation name in the report
+    uint64_t       *samples;        // Virtual latency of each operation (nanoseconds)
+    int             count;          // Samples recorded
+    int             alloc;          // Samples allocated
+} lcloud_modelstat;
+
+//
+// Global Variables
+uint64_t            model_clock;                                    // Virtual time (nanoseconds)
+uint64_t            model_rtt = LC_MODEL_RTT_DEFAULT * 1000ULL;     // Bus round trip (nanoseconds)
+uint64_t            model_service = LC_MODEL_SERVICE_DEFAULT * 1000ULL; // Service time of devices without a latency
+uint64_t            model_slots[LC_MAX_DEVICES][LC_MODEL_MAX_QDEPTH];   // When each queue slot of a device frees up
+uint64_t            model_busy[LC_MAX_DEVICES];                     // Virtual time each device spent serving
+uint64_t            model_window[LCLOUD_DEFAULT_CREDITS];           // Completions of the last batch frames, by credit
+int                 model_transfers[LC_MAX_DEVICES];                // Block transfers served by each device
+int                 model_requests, model_batches;                  // Bus trips taken
+int                 open_flags = LC_OPEN_DEFAULT;                   // Open mode of the replayed files
+lcloud_modelstat    model_stats[] = { { "open" }, { "read" }, { "write" }, { "close" }, { "all" } };
+
+//
+// Functional Prototypes
+
+int replay_workload( char *wload );         // Replay a workload against the driver
+void model_report( const char *manifest, const char *wload, double real );   // Print the predictions
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the LionCloud performance model
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    int ch, verbose = 0, log_initialized = 0, cluster = 1;
+    long mem_limit = 0;
+    struct timespec start, end;
+    double real;
+
+    // Process the command line parameters
+    while ( (ch = getopt(argc, argv, LCLOUD_MODEL_ARGUMENTS)) != -1 ) {
+        switch ( ch ) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return( -1 );
+
+        case 'v': // Verbose Flag
+            verbose = 1;
+            break;
+
+        case 'd': // Direct I/O Flag
+            open_flags = LC_OPEN_DIRECT;
+            break;
+
+        case 'c': // Cluster size
+            cluster = atoi(optarg);
+            break;
+
+        case 'm': // Memory budget
+            mem_limit = atol(optarg);
+            break;
+
+        case 'l': // Set the log filename
+            initializeLogWithFilename(optarg);
+            log_initialized = 1;
+            break;
+
+        case 'r': // Bus round trip
+            model_rtt = atol(optarg) * 1000ULL;
+            break;
+
+        case 's': // Default device service time
+            model_service = atol(optarg) * 1000ULL;
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return( -1 );
+        }
+    }
+    if ( (optind + 2 != argc) ) {
+        fprintf(stderr, "Missing command line parameters, use -h to see usage, aborting.\n");
+        return( -1 );
+    }
+
+    // Setup the log as needed
+    if ( !log_initialized ) {
+        initializeLogWithFilehandle(CMPSC311_LOG_STDERR);
+    }
+    LcControllerLLevel = registerLogLevel("LCLOUD_CONTROLLER", 0);
+    LcDriverLLevel = registerLogLevel("LCLOUD_DRIVER", 0);
+    LcSimulatorLLevel = registerLogLevel("LCLOUD_SIMULATOR", 0);
+    if ( verbose ) {
+        enableLogLevels(LOG_INFO_LEVEL);
+        enableLogLevels(LcControllerLLevel | LcDriverLLevel | LcSimulatorLLevel);
+    } else {
+        disableLogLevels(LOG_OUTPUT_LEVEL);                 // Per-transfer driver chatter would dominate the replay
+    }
+
+    // Configure the driver and create the devices
+    if ( lcsetclustersize(cluster) == -1 ) {
+        fprintf(stderr, "Bad cluster size (%d), must be 1 to %d blocks, aborting.\n", cluster, LC_MAX_CLUSTER_BLOCKS);
+        return( -1 );
+    }
+    if ( (mem_limit < 0) || (lcsetmemlimit((size_t)mem_limit * 1024) == -1) ) {
+        fprintf(stderr, "Bad memory limit (%ld kilobytes), aborting.\n", mem_limit);
+        return( -1 );
+    }
+    if ( lcloud_devices_load(argv[optind]) == -1 ) {
+        fprintf(stderr, "Bad hardware manifest [%s], aborting.\n", argv[optind]);
+        return( -1 );
+    }
+
+    // Replay the workload, then print the predictions
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if ( replay_workload(argv[optind + 1]) == -1 ) {
+        fprintf(stderr, "Workload replay failed, see the log.\n");
+        lcloud_devices_release();
+        return( -1 );
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    real = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    model_report(argv[optind], argv[optind + 1], real);
+
+    lcloud_devices_release();
+    freeLogRegistrations();
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : model_transfer
+// Description  : Model one request on the devices. A block transfer (or one
+//                side of a block copy) takes the device queue slot that frees
+//                up first and holds it for the device's service time; other
+//                requests are served on arrival.
+//
+// Inputs       : frm - the request register frame
+//                arrive - virtual time the request reaches the devices
+// Outputs      : virtual time the request completes
+
+uint64_t model_transfer( LCloudRegisterFrame frm, uint64_t arrive ) {
+    int b0, b1, c0, c1, c2, d0, d1, slot, i, depth;
+    uint64_t service, begin;
+
+    lcloud_unpack_registers(frm, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+    if ( ((c0 != LC_BLOCK_XFER) && (c0 != LC_BLOCK_COPY)) || (c1 >= LC_MAX_DEVICES) ) {
+        return( arrive );
+    }
+
+    service = lcloud_devices_latency(c1) ? lcloud_devices_latency(c1) * 1000ULL : model_service;
+    if ( lcloud_devices_bandwidth(c1) > 0 ) {               // MB/s is bytes per microsecond
+        service += LC_DEVICE_BLOCK_SIZE * 1000ULL / lcloud_devices_bandwidth(c1);
+    }
+    depth = CMPSC311_MINVAL(lcloud_devices_qdepth(c1), LC_MODEL_MAX_QDEPTH);
+    for ( i = 1, slot = 0; i < depth; i++ ) {
+        if ( model_slots[c1][i] < model_slots[c1][slot] ) {
+            slot = i;
+        }
+    }
+
+    begin = CMPSC311_MAXVAL(arrive, model_slots[c1][slot]);
+    model_slots[c1][slot] = begin + service;
+    model_busy[c1] += service;
+    model_transfers[c1]++;
+    return( begin + service );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_request
+// Description  : The model's bus, carries out one request on the emulated
+//                devices and advances the clock by a round trip plus the
+//                time the request waited and was served
+//
+// Inputs       : reg - the request register frame
+//                buf - block buffer of a transfer
+// Outputs      : the response register frame
+
+LCloudRegisterFrame client_lcloud_bus_request( LCloudRegisterFrame reg, void *buf ) {
+    LCloudRegisterFrame rfrm;
+
+    rfrm = lcloud_devices_execute(reg, buf);
+    model_clock = model_transfer(reg, model_clock + model_rtt / 2) + model_rtt / 2;
+    model_requests++;
+    return( rfrm );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_batch
+// Description  : The model's batched bus. Every frame leaves in one trip, but
+//                as with protocol v2 only LCLOUD_DEFAULT_CREDITS may be in
+//                flight, so later frames wait for the credit of an earlier one.
+//                A block copy reads its source block before the destination
+//                is written. The trip ends when the last response is back.
+//
+// Inputs       : regs - the request frames, replaced by the responses
+//                bufs - block buffer of each transfer, or source frame of a copy
+//                count - number of frames
+// Outputs      : 0 if successful, -1 if failure
+
+int client_lcloud_bus_batch( LCloudRegisterFrame *regs, void **bufs, int count ) {
+    uint64_t arrive = model_clock + model_rtt / 2, issue, last = arrive;
+    LCloudRegisterFrame req;
+    int i, b0, b1, c0, c1, c2, d0, d1;
+
+    for ( i = 0; i < count; i++ ) {
+        issue = (i < LCLOUD_DEFAULT_CREDITS) ? arrive : CMPSC311_MAXVAL(arrive, model_window[i % LCLOUD_DEFAULT_CREDITS]);
+        req = regs[i];
+        lcloud_unpack_registers(req, &b0, &b1, &c0, &c1, &c2, &d0, &d1);
+        if ( c0 == LC_BLOCK_COPY ) {
+            regs[i] = lcloud_devices_copy(req, *(LCloudRegisterFrame *)bufs[i]);
+            issue = model_transfer(*(LCloudRegisterFrame *)bufs[i], issue);
+        } else {
+            regs[i] = lcloud_devices_execute(req, bufs[i]);
+        }
+        model_window[i % LCLOUD_DEFAULT_CREDITS] = model_transfer(req, issue);
+        last = CMPSC311_MAXVAL(last, model_window[i % LCLOUD_DEFAULT_CREDITS]);
+    }
+
+    model_clock = last + model_rtt / 2;
+    model_batches++;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_protocol
+// Description  : Get the bus protocol the model stands in for
+//
+// Inputs       : none
+// Outputs      : LCLOUD_PROTO_V2
+
+int client_lcloud_bus_protocol( void ) {
+    return( LCLOUD_PROTO_V2 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : client_lcloud_bus_features
+// Description  : Get the protocol v2 features the model stands in for
+//
+// Inputs       : none
+// Outputs      : LCLOUD_FEATURE_COPY
+
+int client_lcloud_bus_features( void ) {
+    return( LCLOUD_FEATURE_COPY );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : model_record
+// Description  : Record the virtual latency of an operation
+//
+// Inputs       : stat - the kind of operation
+//                latency - virtual time it took (nanoseconds)
+// Outputs      : 0 if successful, -1 if failure
+
+int model_record( lcloud_modelstat *stat, uint64_t latency ) {
+    uint64_t *grown;
+
+    if ( stat->count == stat->alloc ) {
+        stat->alloc = (stat->alloc == 0) ? 1024 : stat->alloc * 2;
+        if ( (grown = realloc(stat->samples, stat->alloc * sizeof(uint64_t))) == NULL ) {
+            logMessage(LOG_ERROR_LEVEL, "Model failure recording [%s] latency", stat->name);
+            return( -1 );
+        }
+        stat->samples = grown;
+    }
+    stat->samples[stat->count++] = latency;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : replay_workload
+// Description  : Replay a workload against the driver, timing each operation
+//                on the virtual clock. Reads are checked against the workload
+//                so a replay that goes wrong does not produce numbers.
+//
+// Inputs       : wload - the name of the workload file
+// Outputs      : 0 if successful, -1 if failure
+
+int replay_workload( char *wload ) {
+    typedef struct {
+        char       *filename;
+        LcFHandle   fhandle;
+        int         pos;
+    } fsysdata;
+
+    workload_state state;
+    workload_operation operation;
+    AssocArray fhTable;
+    fsysdata *fdata = NULL;
+    char buf[LC_MAX_OPERATION_SIZE];
+    uint64_t start;
+    int kind, ret;
+
+    init_assoc(&fhTable, stringCompareCallback, pointerCompareCallback);
+    if ( openCmpsc311Workload(&state, wload) ) {
+        logMessage(LOG_ERROR_LEVEL, "Model failure opening workload [%s]", wload);
+        return( -1 );
+    }
+
+    do {
+        if ( readCmpsc311Workload(&state, &operation) ) {
+            logMessage(LOG_ERROR_LEVEL, "Model failure reading workload at line %d", state.lineno);
+            return( -1 );
+        }
+        if ( (operation.op != WL_OPEN) && (operation.op != WL_EOF) &&
+             ((fdata = find_assoc(&fhTable, operation.objname)) == NULL) ) {
+            logMessage(LOG_ERROR_LEVEL, "Model failure, operation on unknown file [%s]", operation.objname);
+            return( -1 );
+        }
+
+        start = model_clock;
+        switch ( operation.op ) {
+        case WL_OPEN:
+            kind = 0;
+            fdata = malloc(sizeof(fsysdata));
+            fdata->filename = strdup(operation.objname);
+            fdata->pos = 0;
+            if ( (ret = fdata->fhandle = lcopen(operation.objname, open_flags)) != -1 ) {
+                insert_assoc(&fhTable, fdata->filename, fdata);
+            } else {
+                free(fdata->filename);
+                free(fdata);
+            }
+            break;
+
+        case WL_READ:
+        case WL_WRITE:
+            kind = (operation.op == WL_READ) ? 1 : 2;
+            if ( (fdata->pos != operation.pos) && (lcseek(fdata->fhandle, operation.pos) != operation.pos) ) {
+                ret = -1;
+                break;
+            }
+            fdata->pos = operation.pos;
+            if ( operation.op == WL_READ ) {
+                ret = ( (lcread(fdata->fhandle, buf, operation.size) == operation.size) &&
+                        (strncmp(buf, operation.data, operation.size) == 0) ) ? 0 : -1;
+            } else {
+                ret = (lcwrite(fdata->fhandle, operation.data, operation.size) == operation.size) ? 0 : -1;
+            }
+            fdata->pos += operation.size;
+            break;
+
+        case WL_CLOSE:
+            kind = 3;
+            ret = lcclose(fdata->fhandle);
+            delete_assoc(&fhTable, fdata->filename);
+            free(fdata->filename);
+            free(fdata);
+            break;
+
+        case WL_EOF:
+            kind = -1;
+            ret = lcshutdown();
+            break;
+
+        default:
+            logMessage(LOG_ERROR_LEVEL, "Model failure, bad operation type [%d]", operation.op);
+            return( -1 );
+        }
+
+        if ( ret == -1 ) {
+            logMessage(LOG_ERROR_LEVEL, "Model failure replaying %s of [%s] at line %d",
+                       workload_operations_strings[operation.op], operation.objname, state.lineno);
+            return( -1 );
+        }
+        if ( (kind != -1) && ((model_record(&model_stats[kind], model_clock - start) == -1) ||
+                              (model_record(&model_stats[4], model_clock - start) == -1)) ) {
+            return( -1 );
+        }
+    } while ( operation.op < WL_EOF );
+
+    closeCmpsc311Workload(&state);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : model_compare
+// Description  : Order latency samples for qsort
+//
+// Inputs       : a, b - the samples
+// Outputs      : negative, zero or positive as a is below, equal or above b
+
+int model_compare( const void *a, const void *b ) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return( (x > y) - (x < y) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : model_percentile
+// Description  : Get a percentile of sorted samples (nearest rank)
+//
+// Inputs       : stat - the sorted samples
+//                pct - the percentile, 0 to 100
+// Outputs      : the sample in microseconds
+
+double model_percentile( lcloud_modelstat *stat, double pct ) {
+    int rank = (int)((pct / 100.0) * stat->count + 0.999999);
+
+    rank = CMPSC311_MAXVAL(CMPSC311_MINVAL(rank, stat->count), 1);
+    return( stat->samples[rank - 1] / 1000.0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : model_report
+// Description  : Print the predicted throughput, latency percentiles and
+//                device utilization
+//
+// Inputs       : manifest - the hardware manifest
+//                wload - the workload replayed
+//                real - wall clock seconds the replay took
+// Outputs      : none
+
+void model_report( const char *manifest, const char *wload, double real ) {
+    double elapsed = model_clock / 1e9, sum;
+    lcloud_modelstat *stat;
+    int i, k;
+
+    printf("LionCloud model of [%s] on [%s]\n", wload, manifest);
+    printf("  virtual time %.6f s, replayed in %.6f s (%.0fx real time)\n",
+           elapsed, real, (real > 0) ? elapsed / real : 0.0);
+    printf("  %d bus requests, %d batches\n", model_requests, model_batches);
+    printf("  throughput %.1f ops/s\n\n", (elapsed > 0) ? model_stats[4].count / elapsed : 0.0);
+
+    printf("  %-6s %8s %10s %10s %10s %10s %10s %10s   (usec)\n", "op", "count", "mean", "p50", "p90", "p99", "p99.9", "max");
+    for ( k = 0; k < 5; k++ ) {
+        stat = &model_stats[k];
+        if ( stat->count == 0 ) {
+            continue;
+        }
+        qsort(stat->samples, stat->count, sizeof(uint64_t), model_compare);
+        for ( i = 0, sum = 0; i < stat->count; i++ ) {
+            sum += stat->samples[i];
+        }
+        printf("  %-6s %8d %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", stat->name, stat->count,
+               sum / stat->count / 1000.0, model_percentile(stat, 50), model_percentile(stat, 90),
+               model_percentile(stat, 99), model_percentile(stat, 99.9), model_percentile(stat, 100));
+        free(stat->samples);
+        stat->samples = NULL;
+        stat->count = stat->alloc = 0;
+    }
+
+    printf("\n  %-6s %10s %12s\n", "device", "transfers", "utilization");
+    for ( i = 0; i < LC_MAX_DEVICES; i++ ) {
+        if ( model_transfers[i] > 0 ) {
+            printf("  %-6d %10d %11.1f%%\n", i, model_transfers[i],
+                   (elapsed > 0) ? 100.0 * model_busy[i] / 1e9 / elapsed / CMPSC311_MINVAL(lcloud_devices_qdepth(i), LC_MODEL_MAX_QDEPTH) : 0.0);
+        }
+    }
+}
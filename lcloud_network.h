@@ -12,6 +12,7 @@
 //
 
 // Include Files
+#include <stdint.h>
 
 // Project Include Files
 #include <lcloud_controller.h>
@@ -22,6 +23,33 @@
 #define LCLOUD_DEFAULT_IP "127.0.0.1"
 #define LCLOUD_DEFAULT_PORT 24567
 
+// Protocol versions, asked for in D0 of LC_POWER_ON (stock servers answer 0)
+#define LCLOUD_PROTO_V1 1           // One request at a time, replies in order
+#define LCLOUD_PROTO_V2 2           // Tagged requests, credit flow control, replies in any order
+#define LCLOUD_DEFAULT_CREDITS 64   // Requests in flight the client asks for (D1 of LC_POWER_ON)
+#define LCLOUD_MAX_CREDITS 1024     // Most requests in flight a server will grant
+
+// Protocol v2 features, announced by the server in C1 of the LC_POWER_ON reply
+#define LCLOUD_FEATURE_COPY 0x01    // Server copies blocks itself (LC_BLOCK_COPY)
+
+// Server-side block copy (LC_BLOCK_COPY features only): C1, D0 and D1 hold the
+// destination device, sector and block, and the frame is followed by a
+// source frame (same opcode, source device/sector/block) in place of data.
+#define LC_BLOCK_COPY LC_MAX_OPERATION
+
+// Type definitions
+
+//
+// Tag header, follows the register frame of every v2 request and response
+// (fields in network byte order)
+typedef struct {
+    uint32_t tag;                   // Request tag, echoed in the response
+    uint16_t credits;               // Credits handed back with a response
+    uint16_t flags;                 // Reserved, zero
+} LCloudTagHeader;
+
+#define LCLOUD_NET_TAG_SIZE sizeof(LCloudTagHeader)
+
 // Global data
 
 //
@@ -31,5 +59,15 @@ LCloudRegisterFrame client_lcloud_bus_request(LCloudRegisterFrame reg, void *buf
 	// This is the implementation of the client operation, as implemented 
 	//  by the 311 student code.
 
+int client_lcloud_bus_batch(LCloudRegisterFrame *regs, void **bufs, int count);
+	// Send a batch of block transfers back to back, then collect the
+	//  responses (regs is overwritten with the responses).
+
+int client_lcloud_bus_protocol(void);
+	// Get the protocol version negotiated with the server at power on.
+
+int client_lcloud_bus_features(void);
+	// Get the protocol features the server announced (LCLOUD_FEATURE_*).
+
 
 #endif
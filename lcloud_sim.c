@@ -17,7 +17,11 @@
 #include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -26,28 +30,105 @@
 #include <lcloud_controller.h>
 #include <lcloud_filesys.h>
 #include <lcloud_support.h>
+#include <lcloud_trace.h>
+#include <lcloud_stats.h>
+#include <lcloud_lock.h>
 
 // Defines
-#define LCLOUD_ARGUMENTS "hvl:x:"
-#define USAGE                                                       \
-    "USAGE: lcloud_sim [-h] [-v] [-l <logfile>] <workload-file>\n"  \
-    "\n"                                                            \
-    "where:\n"                                                      \
-    "    -h - help mode (display this message)\n"                   \
-    "    -v - verbose output\n"                                     \
-    "    -l - write log messages to the filename <logfile>\n"       \
-    "\n"                                                            \
-    "    <workload-file> - file contain the workload to simulate\n" \
+#define LCLOUD_ARGUMENTS "hvdgpa:c:e:k:l:m:r:s:t:w:x:L:"
+#define LC_SIM_MAX_RATES 64 // Most offered rates in one sweep
+#define LC_SIM_MAX_WORKERS 64 // Most open loop load streams
+#define USAGE                                                           \
+    "USAGE: lcloud_sim [-h] [-v] [-d] [-g] [-a <ops>] [-c <blocks>] [-L <clusters>] [-m <kbytes>] [-l <logfile>] [-s <segment>] [-t <tracefile>]\n" \
+    "                  [-k <every>] [-r <rate>[,<rate>...]] [-p] [-w <workers>] [-e <usec>] <workload-file>\n" \
+    "\n"                                                                \
+    "where:\n"                                                          \
+    "    -h - help mode (display this message)\n"                       \
+    "    -v - verbose output\n"                                         \
+    "    -d - open files for direct (uncached) I/O\n"                   \
+    "    -g - defragment each file before it is closed\n"              \
+    "    -a - probe for new devices every <ops> operations, and rebalance\n" \
+    "         the devices a step between operations (open loop streams\n" \
+    "         queue the probe to the driver instead)\n"               \
+    "    -c - allocate and cache in clusters of <blocks> device blocks\n" \
+    "    -L - lay data out as a log of segments of <clusters> clusters\n" \
+    "         (default, update in place)\n"                            \
+    "    -m - limit driver memory to <kbytes> kilobytes\n"              \
+    "    -l - write log messages to the filename <logfile>\n"           \
+    "    -s - publish live counters in shared memory <segment> (e.g. /lcloud)\n" \
+    "    -t - write a Chrome trace-event timeline to <tracefile>\n"     \
+    "    -k - time one in <every> lock acquisitions and queue waits\n"  \
+    "         (default, only count them)\n"                             \
+    "    -r - open loop, replay the workload once at each offered <rate> (ops/s)\n" \
+    "         and report latency from each operation's intended start\n" \
+    "    -p - open loop arrivals are Poisson (default, evenly spaced)\n" \
+    "    -w - open loop load comes from <workers> streams, each with its own\n" \
+    "         objects (default 1)\n"                                  \
+    "    -e - open loop reads are abandoned <usec> microseconds after their\n" \
+    "         intended start, and counted as expired (default, no deadline)\n" \
+    "\n"                                                                \
+    "    <workload-file> - file contain the workload to simulate\n"     \
     "\n"
 
 //
 // Global Data
 int verbose;
+int open_flags = LC_OPEN_DEFAULT;
+int defrag;
+int probe_every; // Operations between device probes, 0 for none
+double sweep_rates[LC_SIM_MAX_RATES]; // Offered loads of an open loop run, ops/s
+int sweep_count;
+int poisson;
+int workers = 1;
+int openloop_errors;
+int openloop_expired;
+int probes_queued; // Open loop device probes queued
+int probes_done; // Open loop device probes completed
+uint64_t read_deadline; // Open loop read deadline (us), 0 for none
+
+//
+// Open loop object, its state as of the operations issued so far
+typedef struct {
+    char* name; // Object (file) name
+    int worker; // Stream issuing the object's operations
+    lcloud_aio* opened; // Latest open of the object
+    size_t pos; // File position after the issued operations
+} lcloud_simobj;
+
+//
+// Open loop operation, one workload line
+typedef struct {
+    lcloud_aio aio; // The request for the operation
+    lcloud_aio seek; // Seek queued ahead of it, when the position moves
+    lcloud_simobj* obj; // The object operated on
+    int op; // WL_* operation
+    size_t pos, size; // Where and how much to read or write
+    char* data; // Data to write, or expected back from a read
+    char* buf; // Read buffer
+    uint64_t intended; // When the operation was due to start (ns)
+    uint64_t done; // When it completed (ns)
+    lcloud_cancel cancel; // Deadline of a read
+} lcloud_simop;
+
+//
+// Open loop load stream
+typedef struct {
+    lcloud_simop** ops; // Operations of the stream's objects, in workload order
+    int count; // Number of operations
+    double rate; // Arrivals per second
+    uint64_t start; // Time of the first arrival (ns)
+    unsigned short seed[3]; // Poisson arrival generator
+    lcloud_aio probe; // Device probe queued by the stream
+    int probing; // The probe is still with the driver
+    int issued; // Operations issued since the last probe
+    pthread_t thread;
+} lcloud_simworker;
 
 //
 // Functional Prototypes
 
 int simulateLionCloud(char* wload); // LionCloud simulation
+int simulateOpenLoop(char* wload); // Open loop LionCloud simulation
 
 //
 // Functions
@@ -65,7 +146,10 @@ int main(int argc, char* argv[])
 {
 
     // Local variables
-    int ch, verbose = 0, log_initialized = 0;
+    int ch, verbose = 0, log_initialized = 0, cluster = 1, ret;
+    long mem_limit = 0;
+    int sample_every = 0, log_segment = 0;
+    char *trace_file = NULL, *segment = NULL, *rate, *end;
 
     // Process the command line parameters
     while ((ch = getopt(argc, argv, LCLOUD_ARGUMENTS)) != -1) {
@@ -79,6 +163,67 @@ int main(int argc, char* argv[])
             verbose = 1;
             break;
 
+        case 'd': // Direct I/O Flag
+            open_flags = LC_OPEN_DIRECT;
+            break;
+
+        case 'g': // Defragment Flag
+            defrag = 1;
+            break;
+
+        case 'a': // Device probes
+            probe_every = atoi(optarg);
+            break;
+
+        case 'c': // Cluster size
+            cluster = atoi(optarg);
+            break;
+
+        case 'L': // Log segment size
+            log_segment = atoi(optarg);
+            break;
+
+        case 'm': // Memory budget
+            mem_limit = atol(optarg);
+            break;
+
+        case 'p': // Poisson arrivals
+            poisson = 1;
+            break;
+
+        case 'r': // Offered rates, open loop
+            for (rate = strtok(optarg, ","); rate != NULL; rate = strtok(NULL, ",")) {
+                if ((sweep_count == LC_SIM_MAX_RATES) || ((sweep_rates[sweep_count++] = strtod(rate, &end)) <= 0) || (*end != '\0')) {
+                    fprintf(stderr, "Bad offered rate (%s), aborting.\n", rate);
+                    return (-1);
+                }
+            }
+            break;
+
+        case 'w': // Load streams
+            workers = atoi(optarg);
+            if ((workers < 1) || (workers > LC_SIM_MAX_WORKERS)) {
+                fprintf(stderr, "Bad worker count (%s), must be 1 to %d, aborting.\n", optarg, LC_SIM_MAX_WORKERS);
+                return (-1);
+            }
+            break;
+
+        case 'e': // Open loop read deadline
+            read_deadline = strtoull(optarg, NULL, 10);
+            break;
+
+        case 'k': // Lock profile sampling
+            sample_every = atoi(optarg);
+            break;
+
+        case 's': // Counter segment
+            segment = optarg;
+            break;
+
+        case 't': // Trace file
+            trace_file = optarg;
+            break;
+
         case 'l': // Set the log filename
             initializeLogWithFilename(optarg);
             log_initialized = 1;
@@ -102,6 +247,38 @@ int main(int argc, char* argv[])
         enableLogLevels(LcControllerLLevel | LcDriverLLevel | LcSimulatorLLevel);
     }
 
+    // Set the cluster size before any file is opened
+    if (lcsetclustersize(cluster) == -1) {
+        fprintf(stderr, "Bad cluster size (%d), must be 1 to %d blocks, aborting.\n", cluster, LC_MAX_CLUSTER_BLOCKS);
+        return (-1);
+    }
+
+    // Choose the layout, also before any file is opened
+    if (lcsetlogmode(log_segment) == -1) {
+        fprintf(stderr, "Bad log segment size (%d), must be 0 or at least 2 clusters, aborting.\n", log_segment);
+        return (-1);
+    }
+
+    // Set the memory budget, 0 leaves the driver unlimited
+    if ((mem_limit < 0) || (lcsetmemlimit((size_t)mem_limit * 1024) == -1)) {
+        fprintf(stderr, "Bad memory limit (%ld kilobytes), aborting.\n", mem_limit);
+        return (-1);
+    }
+
+    // Start tracing, the trace is written when the driver shuts down
+    if ((trace_file != NULL) && (lcloud_trace_start(trace_file) == -1)) {
+        return (-1);
+    }
+    lcloud_trace_thread("lcloud_sim");
+
+    // Publish the counters for lcloud_top, the segment goes away at shutdown
+    if ((segment != NULL) && (lcloud_stats_publish(segment) == -1)) {
+        return (-1);
+    }
+
+    // Time a sample of lock and queue waits, reported at shutdown
+    lcloud_lock_sample(sample_every);
+
     // The filename should be the next option
     if (argv[optind] == NULL) {
         fprintf(stderr, "Missing command line parameters, use -h to see usage, aborting.\n");
@@ -109,7 +286,8 @@ int main(int argc, char* argv[])
     }
 
     // Run the simulation
-    if (simulateLionCloud(argv[optind]) == 0) {
+    ret = (sweep_count > 0) ? simulateOpenLoop(argv[optind]) : simulateLionCloud(argv[optind]);
+    if (ret == 0) {
         logMessage(LOG_INFO_LEVEL, "LionCloud simulation completed successfully!!!\n\n");
     } else {
         logMessage(LOG_INFO_LEVEL, "LionCloud simulation failed.\n\n");
@@ -147,7 +325,7 @@ int simulateLionCloud(char* wload)
     LcFHandle fh;
     AssocArray fhTable;
     char buf[LC_MAX_OPERATION_SIZE];
-    int opens, reads, writes, seeks, closes;
+    int opens, reads, writes, seeks, closes, ops = 0;
     fsysdata* fdata;
 
     /* Init fh table, open the workload for processing */
@@ -182,7 +360,7 @@ int simulateLionCloud(char* wload)
         case WL_OPEN: /* Open the file for reading/writing, check error */
 
             /* Open the file for reading */
-            if ((fh = lcopen(operation.objname)) == -1) {
+            if ((fh = lcopen(operation.objname, open_flags)) == -1) {
                 logMessage(LOG_ERROR_LEVEL, "CMPSC311 error opening file [%s], aborting", operation.objname);
                 return (-1);
             }
@@ -284,6 +462,13 @@ int simulateLionCloud(char* wload)
                 return (-1);
             }
 
+            /* Move the file into one run first if asked to */
+            if (defrag && (lcdefrag(fdata->fhandle) == -1)) {
+                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error defragment failed [%s], aborting",
+                    operation.objname);
+                return (-1);
+            }
+
             /* Now close the file */
             if (lcclose(fdata->fhandle) != 0) {
                 logMessage(LOG_ERROR_LEVEL, "CMPSC311 error write failed [%s, pos=%d, size=%d], aborting",
@@ -315,9 +500,420 @@ int simulateLionCloud(char* wload)
             return (-1);
         }
 
+        /* Attach devices that came online, and move data onto them a step at a time */
+        if ((probe_every > 0) && (operation.op < WL_EOF)) {
+            if ((++ops % probe_every == 0) && (lcprobe() == -1)) {
+                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error probing devices at line %d, aborting", state.lineno);
+                return (-1);
+            }
+            if (lcrebalance(0) == -1) {
+                logMessage(LOG_ERROR_LEVEL, "CMPSC311 error rebalancing devices at line %d, aborting", state.lineno);
+                return (-1);
+            }
+        }
+
     } while (operation.op < WL_EOF);
 
     /* Log, close workload and delete the local file, return successfully  */
     closeCmpsc311Workload(&state);
     return (0);
 }
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openloop_complete
+// Description  : Completion of an open loop operation (on the driver thread),
+//                stamps the completion time and checks the result
+//
+// Inputs       : aio - the completed request
+// Outputs      : none
+
+void openloop_complete(lcloud_aio* aio)
+{
+    lcloud_simop* sop = aio->context;
+    int ok;
+
+    sop->done = lcloud_stats_clock();
+    switch (sop->op) {
+    case WL_OPEN:
+        ok = (aio->result != -1);
+        break;
+    case WL_READ:
+        ok = (aio->result == sop->size) && (strncmp(sop->buf, sop->data, sop->size) == 0);
+        if (!ok && (aio->result == -1) && lcexpired(&sop->cancel)) { /* Gave up at its deadline */
+            __atomic_add_fetch(&openloop_expired, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        break;
+    case WL_WRITE:
+        ok = (aio->result == sop->size);
+        break;
+    default:
+        ok = (aio->result == 0);
+        break;
+    }
+    if (!ok) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 open loop %s of [%s] failed (pos=%d, size=%d, result=%d)",
+            workload_operations_strings[sop->op], sop->obj->name, (int)sop->pos, (int)sop->size, aio->result);
+        __atomic_add_fetch(&openloop_errors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openloop_seeked
+// Description  : Completion of the seek ahead of an open loop operation
+//
+// Inputs       : aio - the completed request
+// Outputs      : none
+
+void openloop_seeked(lcloud_aio* aio)
+{
+    lcloud_simop* sop = aio->context;
+
+    if (aio->result != sop->pos) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 open loop seek of [%s] to [%d] failed", sop->obj->name, (int)sop->pos);
+        __atomic_add_fetch(&openloop_errors, 1, __ATOMIC_RELAXED);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openloop_probed
+// Description  : Completion of a device probe queued by a load stream
+//
+// Inputs       : aio - the completed request
+// Outputs      : none
+
+void openloop_probed(lcloud_aio* aio)
+{
+    lcloud_simworker* wrk = aio->context;
+
+    if (aio->result == -1) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 open loop device probe failed");
+        __atomic_add_fetch(&openloop_errors, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_add_fetch(&probes_done, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&wrk->probing, 0, __ATOMIC_RELEASE);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openloop_probe
+// Description  : Queue a device probe for the driver behind a stream's
+//                operations, unless the stream's last one is still queued
+//
+// Inputs       : wrk - the load stream
+// Outputs      : 0 if successful test, -1 if failure
+
+int openloop_probe(lcloud_simworker* wrk)
+{
+    if (__atomic_load_n(&wrk->probing, __ATOMIC_ACQUIRE)) {
+        return (0);
+    }
+    memset(&wrk->probe, 0, sizeof(lcloud_aio));
+    wrk->probe.op = LC_AIO_PROBE;
+    wrk->probe.fh = -1;
+    wrk->probe.complete = openloop_probed;
+    wrk->probe.context = wrk;
+    wrk->probing = 1;
+    wrk->issued = 0;
+    __atomic_add_fetch(&probes_queued, 1, __ATOMIC_RELAXED);
+    if (lcsubmit(&wrk->probe) == -1) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 open loop failed queueing a device probe");
+        wrk->probing = 0;
+        return (-1);
+    }
+    return (0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openloop_issue
+// Description  : Queue one operation for the driver, without waiting for it.
+//                Operations on a file that is still being opened name the
+//                open, the driver runs requests in the order queued.
+//
+// Inputs       : sop - the operation
+// Outputs      : 0 if successful test, -1 if failure
+
+int openloop_issue(lcloud_simop* sop)
+{
+    lcloud_simobj* obj = sop->obj;
+
+    memset(&sop->aio, 0, sizeof(lcloud_aio));
+    sop->aio.fh = -1;
+    sop->aio.opened = obj->opened;
+    sop->aio.complete = openloop_complete;
+    sop->aio.context = sop;
+
+    switch (sop->op) {
+    case WL_OPEN:
+        sop->aio.op = LC_AIO_OPEN;
+        sop->aio.path = obj->name;
+        sop->aio.flags = open_flags;
+        sop->aio.opened = NULL;
+        obj->opened = &sop->aio;
+        obj->pos = 0;
+        break;
+
+    case WL_READ:
+    case WL_WRITE:
+        if ((obj->pos != sop->pos) || (read_deadline > 0)) { /* Move the file position first, an abandoned read leaves it anywhere */
+            memset(&sop->seek, 0, sizeof(lcloud_aio));
+            sop->seek.op = LC_AIO_SEEK;
+            sop->seek.fh = -1;
+            sop->seek.opened = obj->opened;
+            sop->seek.len = sop->pos;
+            sop->seek.complete = openloop_seeked;
+            sop->seek.context = sop;
+            if (lcsubmit(&sop->seek) == -1) {
+                return (-1);
+            }
+        }
+        sop->aio.op = (sop->op == WL_READ) ? LC_AIO_READ : LC_AIO_WRITE;
+        sop->aio.buf = (sop->op == WL_READ) ? sop->buf : sop->data;
+        sop->aio.len = sop->size;
+        if ((sop->op == WL_READ) && (read_deadline > 0)) { /* Due by a fixed time after its intended start */
+            sop->cancel.deadline = sop->intended + read_deadline * 1000;
+            sop->cancel.cancelled = 0;
+            sop->aio.cancel = &sop->cancel;
+        }
+        obj->pos = sop->pos + sop->size;
+        break;
+
+    default:
+        sop->aio.op = LC_AIO_CLOSE;
+        break;
+    }
+
+    return (lcsubmit(&sop->aio));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openloop_worker
+// Description  : Load stream thread, issues its operations at their arrival
+//                times whether or not earlier ones have finished. Each
+//                operation is stamped with the time it was due, not the time
+//                it went out, so a stream that falls behind still charges the
+//                wait to the operations.
+//
+// Inputs       : arg - the lcloud_simworker of the thread
+// Outputs      : NULL
+
+void* openloop_worker(void* arg)
+{
+    lcloud_simworker* wrk = arg;
+    struct timespec due;
+    uint64_t when = wrk->start;
+    int i;
+
+    for (i = 0; i < wrk->count; i++) {
+        if (i > 0) { /* Gap to the next arrival */
+            when += (uint64_t)(((poisson) ? -log(1.0 - erand48(wrk->seed)) : 1.0) * 1e9 / wrk->rate);
+        }
+        due.tv_sec = when / 1000000000ULL;
+        due.tv_nsec = when % 1000000000ULL;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+            ;
+        wrk->ops[i]->intended = when;
+        if (openloop_issue(wrk->ops[i]) == -1) {
+            __atomic_add_fetch(&openloop_errors, 1, __ATOMIC_RELAXED);
+        }
+        if ((probe_every > 0) && (++wrk->issued >= probe_every) && (openloop_probe(wrk) == -1)) {
+            __atomic_add_fetch(&openloop_errors, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    return (NULL);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openloop_compare
+// Description  : Order latencies for qsort
+//
+// Inputs       : a, b - the latencies
+// Outputs      : <0, 0, >0 as for qsort
+
+int openloop_compare(const void* a, const void* b)
+{
+    uint64_t la = *(const uint64_t*)a, lb = *(const uint64_t*)b;
+
+    return ((la > lb) - (la < lb));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openloop_run
+// Description  : Replay the workload once at an offered rate, split across
+//                the load streams, and print the throughput and latencies
+//
+// Inputs       : ops - the workload operations
+//                count - number of operations
+//                wrks - the load streams, with their operations
+//                rate - offered load, ops/s
+//                lat - space for count latencies
+// Outputs      : 0 if successful test, -1 if failure
+
+int openloop_run(lcloud_simop* ops, int count, lcloud_simworker* wrks, double rate, uint64_t* lat)
+{
+    uint64_t start, last = 0, total = 0;
+    int i, errors;
+
+    openloop_errors = 0;
+    openloop_expired = 0;
+    probes_queued = probes_done = 0;
+    start = lcloud_stats_clock() + 10000000ULL; /* Give every stream time to start */
+    for (i = 0; i < workers; i++) {
+        wrks[i].probing = wrks[i].issued = 0;
+        wrks[i].rate = rate * wrks[i].count / count; /* Streams share the load as they share the operations */
+        wrks[i].start = start;
+        if (pthread_create(&wrks[i].thread, NULL, openloop_worker, &wrks[i]) != 0) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 open loop failed starting load stream [%d]", i);
+            return (-1);
+        }
+    }
+    for (i = 0; i < workers; i++) {
+        pthread_join(wrks[i].thread, NULL);
+    }
+    if (lcdrain() == -1) { /* Every issued operation has completed */
+        return (-1);
+    }
+    if (probes_done != probes_queued) { /* Every queued probe came back */
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 open loop queued [%d] device probes, [%d] completed", probes_queued, probes_done);
+        __atomic_add_fetch(&openloop_errors, 1, __ATOMIC_RELAXED);
+    } else if (probes_queued > 0) {
+        logMessage(LcSimulatorLLevel, "CMPSC311 open loop: [%d] device probes completed", probes_done);
+    }
+    errors = __atomic_load_n(&openloop_errors, __ATOMIC_RELAXED);
+
+    for (i = 0; i < count; i++) {
+        lat[i] = ops[i].done - ops[i].intended;
+        last = CMPSC311_MAXVAL(last, ops[i].done);
+        total += lat[i];
+    }
+    qsort(lat, count, sizeof(uint64_t), openloop_compare);
+
+#define LC_SIM_PCT(p) (lat[CMPSC311_MINVAL((int)((p) * count / 100.0), count - 1)] / 1000.0)
+    printf("%10.0f %11.0f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %7d", rate, count * 1e9 / (last - start),
+        total / 1000.0 / count, LC_SIM_PCT(50), LC_SIM_PCT(90), LC_SIM_PCT(99), LC_SIM_PCT(99.9), lat[count - 1] / 1000.0, errors);
+    if (read_deadline > 0) {
+        printf(" %8d", __atomic_load_n(&openloop_expired, __ATOMIC_RELAXED));
+    }
+    printf("\n");
+#undef LC_SIM_PCT
+    fflush(stdout);
+
+    return ((errors > 0) ? -1 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulateOpenLoop
+// Description  : Open loop simulation. The workload is loaded into memory and
+//                replayed once per offered rate: operations arrive on a fixed
+//                (or Poisson) schedule and are queued to the driver without
+//                waiting for earlier ones, so queueing delay shows up in the
+//                latencies instead of slowing the arrivals. Each object
+//                belongs to one load stream, which keeps its operations in
+//                workload order.
+//
+// Inputs       : wload - the name of the workload file
+// Outputs      : 0 if successful test, -1 if failure
+
+int simulateOpenLoop(char* wload)
+{
+    /* Local variables */
+    workload_state state;
+    workload_operation* operation;
+    AssocArray objTable;
+    lcloud_simobj* obj;
+    lcloud_simop* ops = NULL;
+    lcloud_simworker wrks[LC_SIM_MAX_WORKERS];
+    uint64_t* lat;
+    int i, count = 0, alloc = 0, nobjs = 0, ret = 0;
+
+    /* Load the workload */
+    init_assoc(&objTable, stringCompareCallback, pointerCompareCallback);
+    if (((operation = malloc(sizeof(workload_operation))) == NULL) || openCmpsc311Workload(&state, wload)) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 lcloud workload: failed opening workload [%s]", wload);
+        return (-1);
+    }
+    while (1) {
+        if (readCmpsc311Workload(&state, operation)) {
+            logMessage(LOG_ERROR_LEVEL, "CMPSC311 workload unit test failed at line %d, get op", state.lineno);
+            return (-1);
+        }
+        if (operation->op >= WL_EOF) {
+            break;
+        }
+        if (count == alloc) {
+            alloc = (alloc == 0) ? 1024 : alloc * 2;
+            if ((ops = realloc(ops, alloc * sizeof(lcloud_simop))) == NULL) {
+                logMessage(LOG_ERROR_LEVEL, "CMPSC311 open loop failed loading workload [%s]", wload);
+                return (-1);
+            }
+        }
+        if ((obj = find_assoc(&objTable, operation->objname)) == NULL) { /* Objects go round robin to the streams */
+            obj = calloc(1, sizeof(lcloud_simobj));
+            obj->name = strdup(operation->objname);
+            obj->worker = nobjs++ % workers;
+            insert_assoc(&objTable, obj->name, obj);
+        }
+        memset(&ops[count], 0, sizeof(lcloud_simop));
+        ops[count].obj = obj;
+        ops[count].op = operation->op;
+        ops[count].pos = operation->pos;
+        ops[count].size = operation->size;
+        if ((operation->op == WL_READ) || (operation->op == WL_WRITE)) {
+            ops[count].data = malloc(operation->size + 1);
+            ops[count].buf = malloc(operation->size + 1);
+            memcpy(ops[count].data, operation->data, operation->size);
+        }
+        count++;
+    }
+    closeCmpsc311Workload(&state);
+    free(operation);
+    if (count == 0) {
+        logMessage(LOG_ERROR_LEVEL, "CMPSC311 open loop workload [%s] is empty", wload);
+        return (-1);
+    }
+
+    /* Hand each stream the operations of its objects */
+    lat = malloc(count * sizeof(uint64_t));
+    for (i = 0; i < workers; i++) {
+        wrks[i].ops = malloc(count * sizeof(lcloud_simop*));
+        wrks[i].count = 0;
+        wrks[i].seed[0] = 0x330e;
+        wrks[i].seed[1] = i;
+        wrks[i].seed[2] = 311;
+    }
+    for (i = 0; i < count; i++) {
+        lcloud_simworker* wrk = &wrks[ops[i].obj->worker];
+        wrk->ops[wrk->count++] = &ops[i];
+    }
+    logMessage(LcSimulatorLLevel, "CMPSC311 open loop: [%d] operations on [%d] objects, [%d] streams, %s arrivals",
+        count, nobjs, workers, (poisson) ? "Poisson" : "constant");
+
+    /* Replay once per offered rate */
+    printf("%10s %11s %10s %10s %10s %10s %10s %10s %7s%s\n", "offered/s", "achieved/s", "mean(us)", "p50(us)",
+        "p90(us)", "p99(us)", "p99.9(us)", "max(us)", "errors", (read_deadline > 0) ? "  expired" : "");
+    for (i = 0; (i < sweep_count) && (ret == 0); i++) {
+        ret = openloop_run(ops, count, wrks, sweep_rates[i], lat);
+    }
+    lcshutdown();
+
+    /* Clean up */
+    for (i = 0; i < workers; i++) {
+        free(wrks[i].ops);
+    }
+    for (i = 0; i < count; i++) {
+        free(ops[i].data);
+        free(ops[i].buf);
+    }
+    free(ops);
+    free(lat);
+    return (ret);
+}
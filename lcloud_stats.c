@@ -0,0 +1,166 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_stats.c
+//  Description    : This is the LionCloud live counters. Until they are
+//                   published the counters live in private memory; publishing
+//                   copies them into a shared-memory segment and points the
+//                   driver at it, so updates cost the same either way.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <lcloud_stats.h>
+
+//
+// Global Variables
+lcloud_stats    stats_private = { .files = { [0 ... LC_STATS_FILES - 1] = { .fh = -1 } } };  // Counters before (and after) publishing
+lcloud_stats   *lcloud_statp = &stats_private;              // The live counters
+char            stats_name[256];                            // Name of the published segment, empty if none
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_stats_clock
+// Description  : Read the monotonic clock, the one clock of the driver's
+//                counters, lock profile, cache costs and trace
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds
+
+uint64_t lcloud_stats_clock( void ) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return( (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_stats_publish
+// Description  : Create the shared-memory segment, copy the counters into it
+//                and make it the live copy
+//
+// Inputs       : name - segment name, starting with a slash
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_stats_publish( const char *name ) {
+    lcloud_stats *seg;
+    int fd;
+
+    if ( (name[0] != '/') || (strlen(name) >= sizeof(stats_name)) || (stats_name[0] != '\0') ) {
+        logMessage(LOG_ERROR_LEVEL, "Bad or second counter segment name [%s]", name);
+        return( -1 );
+    }
+    if ( (fd = shm_open(name, O_CREAT | O_RDWR | O_TRUNC, 0644)) == -1 ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure creating counter segment [%s]", name);
+        return( -1 );
+    }
+    if ( (ftruncate(fd, sizeof(lcloud_stats)) == -1) ||
+         ((seg = mmap(NULL, sizeof(lcloud_stats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure mapping counter segment [%s]", name);
+        close(fd);
+        shm_unlink(name);
+        return( -1 );
+    }
+    close(fd);
+
+    memcpy(seg, lcloud_statp, sizeof(lcloud_stats));
+    seg->pid = getpid();
+    __atomic_store_n(&seg->magic, LC_STATS_MAGIC, __ATOMIC_RELEASE); // Readers wait for the magic
+    lcloud_statp = seg;
+    strcpy(stats_name, name);
+
+    logMessage(LOG_OUTPUT_LEVEL, "Publishing driver counters in [%s]", name);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_stats_open
+// Description  : Give a file handle its counter slot, taking it over from any
+//                earlier file with the same slot
+//
+// Inputs       : fh - the file handle
+//                name - the file's name
+// Outputs      : none
+
+void lcloud_stats_open( int fh, const char *name ) {
+    lcloud_stats_file *slot = &lcloud_statp->files[fh % LC_STATS_FILES];
+
+    LC_STAT_ADD(opens, 1);
+    LC_STAT_SET(updated, lcloud_stats_clock());
+    if ( slot->fh != fh ) {
+        __atomic_store_n(&slot->fh, -1, __ATOMIC_RELAXED);          // Retire the old file before the slot changes
+        strncpy(slot->name, name, LC_STATS_NAME - 1);
+        slot->name[LC_STATS_NAME - 1] = '\0';
+        slot->reads = slot->read_bytes = slot->writes = slot->write_bytes = 0;
+        __atomic_store_n(&slot->fh, fh, __ATOMIC_RELEASE);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_stats_io
+// Description  : Count an lcread or lcwrite, for the driver and for the file
+//
+// Inputs       : fh - the file handle
+//                write - 1 for a write, 0 for a read
+//                bytes - bytes moved
+// Outputs      : none
+
+void lcloud_stats_io( int fh, int write, uint64_t bytes ) {
+    lcloud_stats_file *slot;
+
+    if ( write ) {
+        LC_STAT_ADD(writes, 1);
+        LC_STAT_ADD(write_bytes, bytes);
+    } else {
+        LC_STAT_ADD(reads, 1);
+        LC_STAT_ADD(read_bytes, bytes);
+    }
+    LC_STAT_SET(updated, lcloud_stats_clock());
+
+    if ( (fh >= 0) && ((slot = &lcloud_statp->files[fh % LC_STATS_FILES])->fh == fh) ) {
+        if ( write ) {
+            __atomic_store_n(&slot->writes, slot->writes + 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->write_bytes, slot->write_bytes + bytes, __ATOMIC_RELAXED);
+        } else {
+            __atomic_store_n(&slot->reads, slot->reads + 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&slot->read_bytes, slot->read_bytes + bytes, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_stats_finish
+// Description  : Remove the published segment; the counters are copied back to
+//                private memory so the driver can keep counting
+//
+// Inputs       : none
+// Outputs      : none
+
+void lcloud_stats_finish( void ) {
+    lcloud_stats *seg = lcloud_statp;
+
+    if ( stats_name[0] == '\0' ) {
+        return;
+    }
+    memcpy(&stats_private, seg, sizeof(lcloud_stats));
+    lcloud_statp = &stats_private;
+    munmap(seg, sizeof(lcloud_stats));
+    shm_unlink(stats_name);
+    stats_name[0] = '\0';
+}
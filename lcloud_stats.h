@@ -0,0 +1,112 @@
+#ifndef LCLOUD_STATS_INCLUDED
+#define LCLOUD_STATS_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_stats.h
+//  Description    : This is the interface of the LionCloud live counters. The
+//                   driver keeps its counters in one structure which can be
+//                   published as a POSIX shared-memory segment, so lcloud_top
+//                   (or anything else) can map it read-only and watch a running
+//                   node. The driver is the only writer and stores each counter
+//                   whole, so readers need no locks; a reader may see one
+//                   counter a moment ahead of another.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdint.h>
+
+// Defines
+#define LC_STATS_MAGIC      0x4c43535441545332ULL  // "LCSTATS2", set last when a segment is ready
+#define LC_STATS_DEVICES    16                      // Devices counted (bits of the probe mask)
+#define LC_STATS_FILES      64                      // File slots, by file handle modulo the slot count
+#define LC_STATS_NAME       32                      // Bytes of a file name kept in its slot
+#define LC_STATS_WAITS      16                      // Locks and queues profiled
+#define LC_STATS_WAIT_BUCKETS 40                    // Timed waits, bucket i holds waits under 2^i ns
+
+//
+// Per-device counters
+typedef struct {
+    uint64_t    reads;                              // Block reads sent to the device
+    uint64_t    writes;                             // Block writes (and copies) sent to the device
+    uint64_t    inflight;                           // Requests on the bus waiting for a reply
+    uint64_t    clusters;                           // Clusters on the device, 0 if not present
+    uint64_t    free;                               // Clusters not allocated
+} lcloud_stats_device;
+
+//
+// Per-file counters
+typedef struct {
+    int64_t     fh;                                 // File handle using the slot, -1 if none
+    char        name[LC_STATS_NAME];                // Start of the file's name
+    uint64_t    reads, read_bytes;                  // lcread calls and bytes returned
+    uint64_t    writes, write_bytes;                // lcwrite calls and bytes written
+} lcloud_stats_file;
+
+//
+// Lock and queue profile
+typedef struct {
+    char        name[LC_STATS_NAME];                // Lock or queue, empty if the slot is unused
+    char        site[LC_STATS_NAME];                // Function that saw the longest timed wait
+    uint64_t    queue;                              // 1 for a queue, 0 for a lock
+    uint64_t    count;                              // Acquisitions, or items queued
+    uint64_t    contended;                          // Acquisitions that found it held, or items queued behind others
+    uint64_t    timed;                              // Acquisitions or items sampled for timing
+    uint64_t    wait_ns, wait_max;                  // Waits of the timed ones
+    uint64_t    hold_ns, hold_max;                  // Holds of the timed ones (locks)
+    uint64_t    depth, depth_max;                   // Items in the queue (queues)
+    uint64_t    hist[LC_STATS_WAIT_BUCKETS];        // Timed waits by power of two
+} lcloud_stats_wait;
+
+//
+// The counters, as laid out in the segment
+typedef struct {
+    uint64_t    magic;                              // LC_STATS_MAGIC once the segment is ready
+    int64_t     pid;                                // Process publishing the counters
+    uint64_t    updated;                            // Monotonic clock of the last operation (ns)
+    uint64_t    opens, closes;                      // File operations
+    uint64_t    reads, read_bytes;
+    uint64_t    writes, write_bytes;
+    uint64_t    cache_hits, cache_misses;           // Cache lookups
+    uint64_t    dirty;                              // Delayed (dirty, unallocated) clusters in the cache
+    uint64_t    bus_requests, bus_batches;          // Single requests and batches on the bus
+    uint64_t    bus_frames;                         // Frames carried by batches
+    uint64_t    bus_inflight;                       // Frames waiting for a reply
+    uint64_t    bus_rtt;                            // Shortest round trip seen (ns)
+    uint64_t    bus_gap;                            // Moving average of the gap between replies (ns)
+    lcloud_stats_device devices[LC_STATS_DEVICES];
+    lcloud_stats_file   files[LC_STATS_FILES];
+    uint64_t    sample_every;                       // One in this many lock acquisitions is timed, 0 if none
+    lcloud_stats_wait   waits[LC_STATS_WAITS];
+} lcloud_stats;
+
+//
+// Global data
+extern lcloud_stats *lcloud_statp;                  // The live counters, in the segment once published
+
+// Counter updates, a plain load and a whole store from the one writer (the
+// lock profile has many writers, and adds atomically)
+#define LC_STAT_ADD(field, n) __atomic_store_n(&lcloud_statp->field, lcloud_statp->field + (n), __ATOMIC_RELAXED)
+#define LC_STAT_SET(field, v) __atomic_store_n(&lcloud_statp->field, (v), __ATOMIC_RELAXED)
+
+//
+// Functional Prototypes
+
+int lcloud_stats_publish( const char *name );
+    // Move the counters into the shared-memory segment name (e.g. "/lcloud")
+
+uint64_t lcloud_stats_clock( void );
+    // Read the monotonic clock the counters, profile and trace are stamped with (ns)
+
+void lcloud_stats_open( int fh, const char *name );
+    // Give a file handle its counter slot
+
+void lcloud_stats_io( int fh, int write, uint64_t bytes );
+    // Count an lcread or lcwrite of a file
+
+void lcloud_stats_finish( void );
+    // Remove the segment, the counters go back to private memory
+
+#endif
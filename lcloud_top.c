@@ -0,0 +1,286 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_top.c
+//  Description    : This is the LionCloud monitor. It maps the counter segment
+//                   a driver publishes (lcloud_client -s) read-only, and every
+//                   interval prints the rates since the last look: operations,
+//                   cache hit ratio, bus traffic and round trip, and the
+//                   transfers, queue depth and free space of each device and
+//                   the busiest files, and where threads waited on the
+//                   driver's locks and queues. The driver is never stopped or
+//                   signalled.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Project Includes
+#include <cmpsc311_util.h>
+#include <lcloud_stats.h>
+
+// Defines
+#define LCLOUD_TOP_ARGUMENTS "hi:n:f:"
+#define USAGE                                                                   \
+    "USAGE: lcloud_top [-h] [-i <msec>] [-n <count>] [-f <files>] <segment>\n"  \
+    "\n"                                                                        \
+    "where:\n"                                                                  \
+    "    -h - help mode (display this message)\n"                               \
+    "    -i - refresh every <msec> milliseconds (default 1000)\n"               \
+    "    -n - stop after <count> refreshes (default, until the driver exits)\n" \
+    "    -f - show the <files> busiest files (default 10)\n"                    \
+    "\n"                                                                        \
+    "    <segment> - the counter segment the driver publishes (e.g. /lcloud)\n" \
+    "\n"
+#define LC_TOP_ATTACH_WAIT 50           // Tenths of a second to wait for the segment to appear
+
+//
+// File activity in one interval, for sorting
+typedef struct {
+    int                 slot;           // Slot in the segment
+    uint64_t            bytes;          // Bytes read and written in the interval
+} lcloud_topfile;
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : top_attach
+// Description  : Map a counter segment read-only, waiting a while for a driver
+//                that is still starting to create it
+//
+// Inputs       : name - the segment name
+// Outputs      : the mapped counters, NULL if failure
+
+const lcloud_stats *top_attach( const char *name ) {
+    const lcloud_stats *seg;
+    int fd = -1, tries;
+
+    for ( tries = 0; tries < LC_TOP_ATTACH_WAIT; tries++ ) {
+        if ( (fd = shm_open(name, O_RDONLY, 0)) != -1 ) {
+            break;
+        }
+        usleep(100000);
+    }
+    if ( fd == -1 ) {
+        fprintf(stderr, "No counter segment [%s], is the driver running with -s?\n", name);
+        return( NULL );
+    }
+    seg = mmap(NULL, sizeof(lcloud_stats), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( seg == MAP_FAILED ) {
+        fprintf(stderr, "Failure mapping counter segment [%s]\n", name);
+        return( NULL );
+    }
+    for ( tries = 0; (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != LC_STATS_MAGIC) && (tries < LC_TOP_ATTACH_WAIT); tries++ ) {
+        usleep(100000);
+    }
+    if ( seg->magic != LC_STATS_MAGIC ) {
+        fprintf(stderr, "Segment [%s] does not hold LionCloud counters\n", name);
+        munmap((void *)seg, sizeof(lcloud_stats));
+        return( NULL );
+    }
+    return( seg );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : top_compare
+// Description  : Order files by activity, busiest first
+//
+// Inputs       : a, b - the files to compare
+// Outputs      : <0, 0, >0 as for qsort
+
+int top_compare( const void *a, const void *b ) {
+    const lcloud_topfile *fa = a, *fb = b;
+
+    return( (fa->bytes < fb->bytes) - (fa->bytes > fb->bytes) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : top_print
+// Description  : Print the rates between two snapshots of the counters
+//
+// Inputs       : name - the segment name
+//                prev, cur - the snapshots
+//                secs - seconds between them
+//                nfiles - number of files to show
+//                tty - 1 to redraw the screen, 0 to append
+// Outputs      : none
+
+void top_print( const char *name, const lcloud_stats *prev, const lcloud_stats *cur, double secs, int nfiles, int tty ) {
+    lcloud_topfile active[LC_STATS_FILES];
+    const lcloud_stats_device *dp, *dc;
+    const lcloud_stats_file *fp, *fc;
+    const lcloud_stats_wait *wp, *wc;
+    uint64_t hits, lookups, bytes, timed, seen, p99;
+    char hold[16];
+    int i, b, count = 0;
+
+    if ( tty ) {
+        printf("\033[H\033[2J");
+    }
+    hits = cur->cache_hits - prev->cache_hits;
+    lookups = hits + cur->cache_misses - prev->cache_misses;
+    printf("lcloud_top - [%s] pid %ld\n\n", name, (long)cur->pid);
+    printf("ops/s    open %8.0f  close %8.0f  read %8.0f (%8.1f KB/s)  write %8.0f (%8.1f KB/s)\n",
+           (cur->opens - prev->opens) / secs, (cur->closes - prev->closes) / secs,
+           (cur->reads - prev->reads) / secs, (cur->read_bytes - prev->read_bytes) / secs / 1024,
+           (cur->writes - prev->writes) / secs, (cur->write_bytes - prev->write_bytes) / secs / 1024);
+    printf("cache    hit ratio %5.1f%% (%5.1f%% overall)  dirty clusters %lu\n",
+           lookups ? 100.0 * hits / lookups : 0.0,
+           (cur->cache_hits + cur->cache_misses) ? 100.0 * cur->cache_hits / (cur->cache_hits + cur->cache_misses) : 0.0,
+           (unsigned long)cur->dirty);
+    printf("bus      requests/s %8.0f  batches/s %8.0f  frames/s %8.0f  in flight %4lu  rtt %6.1f us  reply gap %6.0f ns\n\n",
+           (cur->bus_requests - prev->bus_requests) / secs, (cur->bus_batches - prev->bus_batches) / secs,
+           (cur->bus_frames - prev->bus_frames) / secs, (unsigned long)cur->bus_inflight,
+           cur->bus_rtt / 1000.0, (double)cur->bus_gap);
+
+    printf("DEV   reads/s   writes/s  queue     free/clusters\n");
+    for ( i = 0; i < LC_STATS_DEVICES; i++ ) {
+        dp = &prev->devices[i];
+        dc = &cur->devices[i];
+        if ( dc->clusters == 0 ) {
+            continue;
+        }
+        printf("%3d  %8.0f  %9.0f  %5lu  %8lu/%-8lu (%5.1f%% free)\n", i,
+               (dc->reads - dp->reads) / secs, (dc->writes - dp->writes) / secs, (unsigned long)dc->inflight,
+               (unsigned long)dc->free, (unsigned long)dc->clusters, 100.0 * dc->free / dc->clusters);
+    }
+
+    for ( i = 0; i < LC_STATS_FILES; i++ ) {                    // Activity of files that kept their slot
+        fp = &prev->files[i];
+        fc = &cur->files[i];
+        if ( fc->fh < 0 ) {
+            continue;
+        }
+        bytes = fc->read_bytes + fc->write_bytes;
+        if ( fp->fh == fc->fh ) {
+            bytes -= fp->read_bytes + fp->write_bytes;
+        }
+        if ( bytes > 0 ) {
+            active[count].slot = i;
+            active[count++].bytes = bytes;
+        }
+    }
+    qsort(active, count, sizeof(lcloud_topfile), top_compare);
+    printf("\nFH    FILE                              reads/s  writes/s   KB/s\n");
+    for ( i = 0; (i < count) && (i < nfiles); i++ ) {
+        fc = &cur->files[active[i].slot];
+        fp = &prev->files[active[i].slot];
+        if ( fp->fh != fc->fh ) {
+            fp = NULL;                                          // Opened during the interval
+        }
+        printf("%-5ld %-32s %8.0f  %8.0f  %7.1f\n", (long)fc->fh, fc->name,
+               (fc->reads - (fp ? fp->reads : 0)) / secs, (fc->writes - (fp ? fp->writes : 0)) / secs,
+               active[i].bytes / secs / 1024);
+    }
+
+    printf("\nWAIT                 kind   count/s  contended   timed  mean us   p99 us  hold us  longest in\n");
+    for ( i = 0; (i < LC_STATS_WAITS) && (cur->waits[i].name[0] != '\0'); i++ ) {
+        wp = &prev->waits[i];
+        wc = &cur->waits[i];
+        timed = wc->timed - wp->timed;
+        for ( b = 0, seen = 0, p99 = 0; (timed > 0) && (b < LC_STATS_WAIT_BUCKETS); b++ ) {
+            if ( (seen += wc->hist[b] - wp->hist[b]) * 100 >= timed * 99 ) {
+                p99 = (b == 0) ? 0 : CMPSC311_MINVAL(1ULL << b, wc->wait_max);
+                break;
+            }
+        }
+        snprintf(hold, sizeof(hold), "%.2f", (timed) ? (wc->hold_ns - wp->hold_ns) / 1e3 / timed : 0.0);
+        printf("%-20s %-5s %8.0f  %8.1f%%  %6lu  %7.2f  %7.2f  %7s  %s\n", wc->name, (wc->queue) ? "queue" : "lock",
+               (wc->count - wp->count) / secs,
+               (wc->count > wp->count) ? 100.0 * (wc->contended - wp->contended) / (wc->count - wp->count) : 0.0,
+               (unsigned long)timed, (timed) ? (wc->wait_ns - wp->wait_ns) / 1e3 / timed : 0.0, p99 / 1e3,
+               (wc->queue) ? "-" : hold, (wc->site[0] != '\0') ? wc->site : "-");
+    }
+    if ( cur->sample_every == 0 ) {
+        printf("(waits are not being timed, see lcloud_sim -k)\n");
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : main
+// Description  : The main function for the LionCloud monitor
+//
+// Inputs       : argc - the number of command line parameters
+//                argv - the parameters
+// Outputs      : 0 if successful, -1 if failure
+
+int main( int argc, char *argv[] ) {
+    int ch, interval = 1000, refreshes = -1, nfiles = 10, tty = isatty(STDOUT_FILENO);
+    lcloud_stats prev, cur;
+    const lcloud_stats *seg;
+    struct timespec then, now, nap;
+    double secs;
+
+    while ( (ch = getopt(argc, argv, LCLOUD_TOP_ARGUMENTS)) != -1 ) {
+        switch ( ch ) {
+        case 'h': // Help, print usage
+            fprintf(stderr, USAGE);
+            return( -1 );
+
+        case 'i': // Refresh interval
+            interval = atoi(optarg);
+            break;
+
+        case 'n': // Refresh count
+            refreshes = atoi(optarg);
+            break;
+
+        case 'f': // Files shown
+            nfiles = atoi(optarg);
+            break;
+
+        default: // Default (unknown)
+            fprintf(stderr, "Unknown command line option (%c), aborting.\n", ch);
+            return( -1 );
+        }
+    }
+    if ( (argv[optind] == NULL) || (interval <= 0) ) {
+        fprintf(stderr, "Missing segment or bad interval, use -h to see usage, aborting.\n");
+        return( -1 );
+    }
+    if ( (seg = top_attach(argv[optind])) == NULL ) {
+        return( -1 );
+    }
+
+    memcpy(&prev, seg, sizeof(lcloud_stats));
+    clock_gettime(CLOCK_MONOTONIC, &then);
+    nap.tv_sec = interval / 1000;
+    nap.tv_nsec = (interval % 1000) * 1000000L;
+    while ( refreshes != 0 ) {
+        nanosleep(&nap, NULL);
+        memcpy(&cur, seg, sizeof(lcloud_stats));                // Counters keep moving, work from a snapshot
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        secs = (now.tv_sec - then.tv_sec) + (now.tv_nsec - then.tv_nsec) / 1e9;
+        top_print(argv[optind], &prev, &cur, secs, nfiles, tty);
+
+        if ( (kill((pid_t)cur.pid, 0) == -1) && (errno == ESRCH) ) {
+            printf("Driver [%ld] has exited.\n", (long)cur.pid);
+            break;
+        }
+        prev = cur;
+        then = now;
+        if ( refreshes > 0 ) {
+            refreshes--;
+        }
+    }
+
+    munmap((void *)seg, sizeof(lcloud_stats));
+    return( 0 );
+}
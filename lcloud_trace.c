@@ -0,0 +1,270 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_trace.c
+//  Description    : This is the LionCloud driver tracer. Every thread appends
+//                   to its own event buffer, so recording takes no locks; the
+//                   buffers are linked onto a global list with an atomic push
+//                   the first time a thread records, and are written out as
+//                   Chrome trace-event JSON once the driver is quiet.
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <lcloud_trace.h>
+#include <lcloud_stats.h>
+
+//
+// Event structure
+typedef struct {
+    const char         *name;           // Event name (string constant)
+    const char         *cat;            // Event category (string constant)
+    uint64_t            ts;             // Start time, nanoseconds since the trace started
+    uint64_t            dur;            // Duration of a span (nanoseconds)
+    int64_t             arg;            // Argument, or the value of a counter
+    char                ph;             // Trace-event phase: 'X' span, 'i' instant, 'C' counter
+} lcloud_trace_event;
+
+//
+// Per-thread buffer structure
+typedef struct lcloud_trace_buffer {
+    lcloud_trace_event         *events;         // The recorded events
+    int                         count;          // Events recorded
+    int                         dropped;        // Events lost to a full buffer
+    int                         tid;            // Thread id used in the trace
+    const char                 *thread_name;    // Name given with lcloud_trace_thread
+    struct lcloud_trace_buffer *next;           // Next buffer on the global list
+} lcloud_trace_buffer;
+
+//
+// Global Variables
+int                             lcloud_tracing = 0;             // Non-zero while tracing is enabled
+char                            trace_path[256];                // Where the trace is written
+uint64_t                        trace_epoch;                    // Clock at the start of the trace
+lcloud_trace_buffer            *trace_buffers = NULL;           // Every thread's buffer
+int                             trace_next_tid = 1;             // Next thread id to hand out
+__thread lcloud_trace_buffer   *trace_local = NULL;             // The calling thread's buffer
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_buffer
+// Description  : Get the calling thread's buffer, creating it and pushing it on
+//                the global list (lock free) on first use
+//
+// Inputs       : none
+// Outputs      : the buffer, NULL if it can not be allocated
+
+lcloud_trace_buffer *trace_buffer( void ) {
+    lcloud_trace_buffer *buf;
+
+    if ( trace_local != NULL ) {
+        return( trace_local );
+    }
+    if ( (buf = calloc(1, sizeof(lcloud_trace_buffer))) == NULL ) {
+        return( NULL );
+    }
+    if ( (buf->events = malloc(LC_TRACE_EVENTS_PER_THREAD * sizeof(lcloud_trace_event))) == NULL ) {
+        free(buf);
+        return( NULL );
+    }
+    buf->tid = __atomic_fetch_add(&trace_next_tid, 1, __ATOMIC_RELAXED);
+    buf->next = __atomic_load_n(&trace_buffers, __ATOMIC_RELAXED);
+    while ( !__atomic_compare_exchange_n(&trace_buffers, &buf->next, buf, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED) );
+
+    trace_local = buf;
+    return( buf );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : trace_record
+// Description  : Append an event to the calling thread's buffer
+//
+// Inputs       : ph - event phase
+//                name, cat - event name and category
+//                ts, dur - start and duration (absolute clock)
+//                arg - argument or counter value
+// Outputs      : none
+
+void trace_record( char ph, const char *name, const char *cat, uint64_t ts, uint64_t dur, int64_t arg ) {
+    lcloud_trace_buffer *buf;
+    lcloud_trace_event *ev;
+
+    if ( (buf = trace_buffer()) == NULL ) {
+        return;
+    }
+    if ( buf->count == LC_TRACE_EVENTS_PER_THREAD ) {
+        buf->dropped++;
+        return;
+    }
+    ev = &buf->events[buf->count++];
+    ev->ph = ph;
+    ev->name = name;
+    ev->cat = cat;
+    ev->ts = ts - trace_epoch;
+    ev->dur = dur;
+    ev->arg = arg;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_start
+// Description  : Enable tracing, the trace is written to path at shutdown
+//
+// Inputs       : path - file to write the trace to
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_trace_start( const char *path ) {
+    if ( strlen(path) >= sizeof(trace_path) ) {
+        logMessage(LOG_ERROR_LEVEL, "Trace path too long [%s]", path);
+        return( -1 );
+    }
+    strcpy(trace_path, path);
+    trace_epoch = lcloud_stats_clock();
+    lcloud_tracing = 1;
+    logMessage(LOG_OUTPUT_LEVEL, "Tracing driver activity to [%s]", trace_path);
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_now
+// Description  : Get the trace clock, for the start of a span
+//
+// Inputs       : none
+// Outputs      : the time in nanoseconds, 0 when tracing is off
+
+uint64_t lcloud_trace_now( void ) {
+    return( lcloud_tracing ? lcloud_stats_clock() : 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_span
+// Description  : Record a span from start until now
+//
+// Inputs       : name, cat - event name and category
+//                start - lcloud_trace_now at the start of the span
+//                arg - argument shown with the span
+// Outputs      : none
+
+void lcloud_trace_span( const char *name, const char *cat, uint64_t start, int64_t arg ) {
+    if ( lcloud_tracing && (start != 0) ) {                 // Spans begun before tracing started are skipped
+        trace_record('X', name, cat, start, lcloud_stats_clock() - start, arg);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_instant
+// Description  : Record an instant event
+//
+// Inputs       : name, cat - event name and category
+//                arg - argument shown with the event
+// Outputs      : none
+
+void lcloud_trace_instant( const char *name, const char *cat, int64_t arg ) {
+    if ( lcloud_tracing ) {
+        trace_record('i', name, cat, lcloud_stats_clock(), 0, arg);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_counter
+// Description  : Record the new value of a counter
+//
+// Inputs       : name - counter name
+//                value - the value from now on
+// Outputs      : none
+
+void lcloud_trace_counter( const char *name, int64_t value ) {
+    if ( lcloud_tracing ) {
+        trace_record('C', name, "counter", lcloud_stats_clock(), 0, value);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_thread
+// Description  : Name the calling thread in the trace
+//
+// Inputs       : name - the thread name (string constant)
+// Outputs      : none
+
+void lcloud_trace_thread( const char *name ) {
+    lcloud_trace_buffer *buf;
+
+    if ( lcloud_tracing && ((buf = trace_buffer()) != NULL) ) {
+        buf->thread_name = name;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : lcloud_trace_finish
+// Description  : Write the trace out and stop tracing. Must only be called once
+//                no other thread is recording.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int lcloud_trace_finish( void ) {
+    lcloud_trace_buffer *buf;
+    lcloud_trace_event *ev;
+    int i, events = 0, dropped = 0;
+    const char *sep = "";
+    FILE *fp;
+
+    if ( !lcloud_tracing ) {
+        return( 0 );
+    }
+    lcloud_tracing = 0;
+
+    if ( (fp = fopen(trace_path, "w")) == NULL ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure opening trace file [%s]", trace_path);
+        return( -1 );
+    }
+    fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for ( buf = __atomic_load_n(&trace_buffers, __ATOMIC_ACQUIRE); buf != NULL; buf = buf->next ) {
+        if ( buf->thread_name != NULL ) {
+            fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    sep, buf->tid, buf->thread_name);
+            sep = ",\n";
+        }
+        for ( i = 0; i < buf->count; i++ ) {
+            ev = &buf->events[i];
+            fprintf(fp, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+                    sep, ev->name, ev->cat, ev->ph, ev->ts / 1000.0, buf->tid);
+            if ( ev->ph == 'X' ) {
+                fprintf(fp, ",\"dur\":%.3f,\"args\":{\"n\":%lld}}", ev->dur / 1000.0, (long long)ev->arg);
+            } else if ( ev->ph == 'C' ) {
+                fprintf(fp, ",\"args\":{\"value\":%lld}}", (long long)ev->arg);
+            } else {
+                fprintf(fp, ",\"s\":\"t\",\"args\":{\"n\":%lld}}", (long long)ev->arg);
+            }
+            sep = ",\n";
+        }
+        events += buf->count;
+        dropped += buf->dropped;
+        buf->count = 0;                                     // Buffers are kept for a later trace
+        buf->dropped = 0;
+    }
+    fprintf(fp, "\n]}\n");
+
+    if ( fclose(fp) != 0 ) {
+        logMessage(LOG_ERROR_LEVEL, "Failure writing trace file [%s]", trace_path);
+        return( -1 );
+    }
+    logMessage(LOG_OUTPUT_LEVEL, "Wrote trace of [%d] events to [%s] ([%d] dropped)", events, trace_path, dropped);
+    return( 0 );
+}
@@ -0,0 +1,52 @@
+#ifndef LCLOUD_TRACE_INCLUDED
+#define LCLOUD_TRACE_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : lcloud_trace.h
+//  Description    : This is the interface of the LionCloud driver tracer. When
+//                   enabled it records spans, instants and counters into
+//                   per-thread buffers and writes them out as Chrome
+//                   trace-event JSON (loadable in Perfetto or chrome://tracing).
+//
+//   Last Modified : 18 Oct 2026
+//
+
+// Includes
+#include <stdint.h>
+
+// Defines
+#define LC_TRACE_EVENTS_PER_THREAD (1 << 18)   // Events kept per thread, later ones are counted as dropped
+
+//
+// Global data
+extern int lcloud_tracing;                      // Non-zero while tracing is enabled
+
+//
+// Functional Prototypes
+//
+// Event names and categories must be string constants, they are kept by
+// pointer until the trace is written.
+
+int lcloud_trace_start( const char *path );
+    // Enable tracing, the trace is written to path at shutdown
+
+uint64_t lcloud_trace_now( void );
+    // Get the trace clock (nanoseconds), 0 when tracing is off
+
+void lcloud_trace_span( const char *name, const char *cat, uint64_t start, int64_t arg );
+    // Record a span from start (lcloud_trace_now) until now
+
+void lcloud_trace_instant( const char *name, const char *cat, int64_t arg );
+    // Record an instant event
+
+void lcloud_trace_counter( const char *name, int64_t value );
+    // Record the new value of a counter
+
+void lcloud_trace_thread( const char *name );
+    // Name the calling thread in the trace
+
+int lcloud_trace_finish( void );
+    // Write the trace out and stop tracing
+
+#endif
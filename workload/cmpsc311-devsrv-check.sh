@@ -0,0 +1,134 @@
+#!/bin/bash
+#
+# CMPSC311 - LionCloud Device - Assignment #4
+# cmpsc311-devsrv-check.sh - regression run against the device server
+#
+# Replays the workloads through the driver against lcloud_devsrv, which
+# negotiates protocol v2 (tagged requests, out of order replies and the credit
+# window), in closed and open loop; then drives the server raw with
+# lcloud_loadgen, through the coroutine layer with lcloud_coro_test, and
+# through the paths the workloads miss with lcloud_check; and replays the
+# workloads through lcloud_model. Each run must report no errors.
+# Run from the top of the tree once it is built (make check).
+#
+# usage: workload/cmpsc311-devsrv-check.sh [-k]   (-k keeps the logs)
+#
+
+WORKLOADS="assign4a assign4b assign4c assign4d assign4e"
+LOGS=$(mktemp -d /tmp/lcloud-check.XXXXXX)
+FAILURES=0
+SERVER=
+
+# Start a server on the default port for a manifest, and wait for it to listen
+start_server() {
+    ./lcloud_devsrv -c -l "$LOGS/devsrv-$1.log" "workload/cmpsc311-$2-manifest.txt" &
+    SERVER=$!
+    for i in $(seq 50); do
+        grep -q "listening" "$LOGS/devsrv-$1.log" 2>/dev/null && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+# Stop the server started last
+stop_server() {
+    if [ -n "$SERVER" ]; then
+        kill "$SERVER" 2>/dev/null
+        wait "$SERVER" 2>/dev/null
+        SERVER=
+    fi
+}
+
+# Record the outcome of a run: name, exit status, log to search for errors
+result() {
+    local errors=0
+
+    [ -f "$3" ] && errors=$(grep -c "\[ERROR\]" "$3")
+    if [ "$2" -ne 0 ] || [ "$errors" -ne 0 ]; then
+        echo "FAIL $1 (exit $2, $errors errors, see $3)"
+        FAILURES=$((FAILURES + 1))
+    else
+        echo "pass $1"
+    fi
+}
+
+# Run the driver over a workload against a fresh server: name, workload, client options
+run_client() {
+    local log="$LOGS/client-$1.log" rc
+
+    if ! start_server "$1" "$2"; then
+        result "$1" 1 "$LOGS/devsrv-$1.log"
+        stop_server
+        return
+    fi
+    timeout 300 ./lcloud_client $3 -l "$log" "workload/cmpsc311-$2-workload.txt" > "$LOGS/client-$1.out"
+    rc=$?
+    stop_server
+    if [ $rc -eq 0 ] && ! grep -q "bus protocol v2" "$log"; then
+        echo "    $1: the driver did not negotiate protocol v2"
+        rc=1
+    fi
+    result "$1" $rc "$log"
+}
+
+[ -x ./lcloud_devsrv ] && [ -x ./lcloud_client ] && [ -x ./lcloud_check ] || { echo "Build the tree first (make)."; exit 1; }
+if (exec 3<>/dev/tcp/127.0.0.1/24567) 2>/dev/null; then
+    echo "A server is already listening on the default port, aborting."
+    exit 1
+fi
+
+# Closed loop, every workload, then clustered transfers
+for w in $WORKLOADS; do
+    run_client "$w" "$w" ""
+done
+run_client "assign4e-clusters" "assign4e" "-c 4"
+
+# Open loop, streams keep many tagged requests in flight and queue device probes
+run_client "assign4e-openloop" "assign4e" "-r 2000 -w 4 -a 100"
+
+# Raw protocol load, several connections deep in their credit windows
+if start_server "loadgen" "assign4b"; then
+    ./lcloud_loadgen -c 2 -t 2 -q 16 -s 1 -l "$LOGS/loadgen.log" > "$LOGS/loadgen.out"
+    rc=$?
+    if [ $rc -eq 0 ] && ! grep -q "protocol v2" "$LOGS/loadgen.out"; then
+        echo "    loadgen: the server did not offer protocol v2"
+        rc=1
+    fi
+    result "loadgen" $rc "$LOGS/loadgen.log"
+else
+    result "loadgen" 1 "$LOGS/devsrv-loadgen.log"
+fi
+stop_server
+
+# The coroutine layer, many files at once through lcsubmit
+if start_server "coro" "assign4e"; then
+    ./lcloud_coro_test -n 16 -l "$LOGS/coro.log" > "$LOGS/coro.out"
+    result "coro" $? "$LOGS/coro.log"
+else
+    result "coro" 1 "$LOGS/devsrv-coro.log"
+fi
+stop_server
+
+# Driver paths the workloads miss, with batches failed on demand (the driver
+# logs those failures as errors, so only the exit status counts)
+if start_server "check" "assign4e"; then
+    ./lcloud_check -l "$LOGS/check.log" > "$LOGS/check.out"
+    result "check" $? "$LOGS/check.out"
+else
+    result "check" 1 "$LOGS/devsrv-check.log"
+fi
+stop_server
+
+# The performance model, which needs no server
+for w in assign4b assign4e; do
+    ./lcloud_model -l "$LOGS/model-$w.log" "workload/cmpsc311-$w-manifest.txt" "workload/cmpsc311-$w-workload.txt" > "$LOGS/model-$w.out"
+    result "model-$w" $? "$LOGS/model-$w.log"
+done
+
+echo "$FAILURES failed"
+if [ "$1" != "-k" ] && [ $FAILURES -eq 0 ]; then
+    rm -rf "$LOGS"
+else
+    echo "logs in $LOGS"
+fi
+[ $FAILURES -eq 0 ]